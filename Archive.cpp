@@ -0,0 +1,395 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+// MRPODS -- Machine-Readable Printed Optical Data Sheets                     //
+// https://github.com/sheafdynamics/mrpods                                    //
+//                                                                            //
+// Copyright (c) 2024 Ray Doll                                                //
+// Copyright (c) 2007 Oleh Yuschuk                                            //
+//                                                                            //
+// This file is part of MRPODS, which is built off                            //
+// Oleh Yuschuk's PaperBack https://ollydbg.de/Paperbak/                      //
+// MRPODS is cumulative work of passionate programmers,                       //
+// both named and unnamed, including freelancers and private contractors.     //
+// Without them, this would not be possible.                                  //
+// This software contains Oleh Yuschuk's original comments and                //
+// comments from other maintainers.                                           //
+//                                                                            //
+// MRPODS is free software; you can redistribute it and/or modify it under    //
+// the terms of the GNU General Public License as published by the Free       //
+// Software Foundation; either version 3 of the License, or (at your option)  //
+// any later version.                                                         //
+//                                                                            //
+// MRPODS is distributed in the hope that it will be useful, but WITHOUT      //
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or      //
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for   //
+// more details.                                                              //
+//                                                                            //
+// You should have received a copy of the GNU General Public License along    //
+// with this program. If not, see <http://www.gnu.org/licenses/>.             //
+//                                                                            //
+//                              bzip2 license                                 //
+// -------------------------------------------------------------------------- //
+// "bzip2", the associated library "libbzip2" copyright(C) 1996 - 2010        //
+// Julian R Seward. All rights reserved.                                      //
+// Julian Seward, jseward@acm.org                                             //
+// bzip2 / libbzip2 version 1.0.6 of 6 September 2010                         //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include <windows.h>
+#include <commctrl.h>
+#include <stdio.h>
+#include <direct.h>
+#include <math.h>
+#include "twain.h"
+#pragma hdrstop
+
+#include "mrpods.h"
+#include "resource.h"
+
+// Folder is printed as a single archive: all its files and subfolders are
+// packed into one payload, which is then compressed and printed exactly like
+// an ordinary file, with PBM_ARCHIVE set in the mode. Payload starts with the
+// table of contents, so that it comes onto the first blocks of the first
+// page: header t_archead, followed by nfile entries t_arcentry, each followed
+// by the path relative to the folder (namelen chars, not null-terminated).
+// Data of the files follows the table, in the order of entries. Subfolders
+// have their own entries with FILE_ATTRIBUTE_DIRECTORY and no data, so that
+// empty folders are restored too.
+
+typedef struct t_arcitem {             // File found in the folder
+  char           name[MAX_PATH];       // Path relative to the folder
+  ulong          size;                 // Size of file, bytes
+  FILETIME       modified;             // Time of last file modification
+  ulong          attributes;           // File attributes
+} t_arcitem;
+
+static t_arcitem *item;                // Files found in the folder
+static int       nitem;                // Actual number of found files
+static int       nitemmax;             // Allocated number of items
+
+// Frees list of files found in the folder.
+static void Freeitems(void) {
+  if (item!=NULL)
+    GlobalFree((HGLOBAL)item);
+  item=NULL;
+  nitem=nitemmax=0;
+};
+
+// Adds file or folder to the list, growing the list if necessary. Returns 0
+// on success and -1 on error.
+static int Additem(char *name,WIN32_FIND_DATA *fd) {
+  int n;
+  t_arcitem *pnew;
+  if (nitem>=NARCFILE) {
+    Reporterror("Too many files in the folder");
+    return -1; };
+  if (nitem>=nitemmax) {
+    n=max(256,nitemmax*2);
+    pnew=(t_arcitem *)GlobalAlloc(GMEM_FIXED,n*sizeof(t_arcitem));
+    if (pnew==NULL) {
+      Reporterror("Low memory");
+      return -1; };
+    if (item!=NULL) {
+      memcpy(pnew,item,nitem*sizeof(t_arcitem));
+      GlobalFree((HGLOBAL)item); };
+    item=pnew;
+    nitemmax=n; };
+  strcpy(item[nitem].name,name);
+  if (fd->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+    item[nitem].size=0;
+  else
+    item[nitem].size=fd->nFileSizeLow;
+  item[nitem].modified=fd->ftLastWriteTime;
+  item[nitem].attributes=fd->dwFileAttributes;
+  nitem++;
+  return 0;
+};
+
+// Adds all files in the subfolder rel of the folder, recursively, to the
+// list. Returns 0 on success and -1 on error.
+static int Scanfolder(char *folder,char *rel) {
+  int result;
+  char mask[MAX_PATH],name[MAX_PATH];
+  HANDLE hfind;
+  WIN32_FIND_DATA fd;
+  if (strlen(folder)+strlen(rel)+3>=MAX_PATH) {
+    Reporterror("Path is too long");
+    return -1; };
+  if (rel[0]=='\0')
+    sprintf(mask,"%s\\*",folder);
+  else
+    sprintf(mask,"%s\\%s\\*",folder,rel);
+  hfind=FindFirstFile(mask,&fd);
+  if (hfind==INVALID_HANDLE_VALUE)
+    return 0;                          // Empty folder
+  result=0;
+  do {
+    if (strcmp(fd.cFileName,".")==0 || strcmp(fd.cFileName,"..")==0)
+      continue;
+    if (strlen(folder)+strlen(rel)+strlen(fd.cFileName)+3>=MAX_PATH) {
+      Reporterror("Path is too long");
+      result=-1;
+      break; };
+    if (rel[0]=='\0')
+      strcpy(name,fd.cFileName);
+    else
+      sprintf(name,"%s\\%s",rel,fd.cFileName);
+    if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+      if (Additem(name,&fd)!=0 || Scanfolder(folder,name)!=0) {
+        result=-1;
+        break;
+      }; }
+    else if (fd.nFileSizeHigh!=0) {
+      Reporterror("File in the folder is too big");
+      result=-1;
+      break; }
+    else if (Additem(name,&fd)!=0) {
+      result=-1;
+      break;
+    };
+  } while (FindNextFile(hfind,&fd));
+  FindClose(hfind);
+  return result;
+};
+
+// Packs all files in the folder into the archive. On success, returns 0,
+// allocated buffer (aligned to 16 bytes) with the archive, its size and the
+// time of the newest file. Returns -1 on error.
+int Buildarchive(char *folder,uchar **pbuf,ulong *psize,FILETIME *modified) {
+  int i,n,success;
+  ulong tocsize,offset,l;
+  double total;
+  uchar *buf,*p;
+  char path[MAX_PATH];
+  t_archead head;
+  t_arcentry entry;
+  HANDLE hfile;
+  // Find all files. As files are read later, some of them may change in
+  // between, but the size must remain the same.
+  Freeitems();
+  Message("Searching files",0);
+  if (Scanfolder(folder,"")!=0) {
+    Freeitems();
+    return -1; };
+  if (nitem==0) {
+    Reporterror("Folder is empty");
+    return -1; };
+  // Calculate size of the table of contents and of the whole archive.
+  tocsize=sizeof(t_archead);
+  total=0.0;
+  for (i=0; i<nitem; i++) {
+    tocsize+=sizeof(t_arcentry)+strlen(item[i].name);
+    total+=item[i].size; };
+  total+=tocsize;
+  if (total>MAXSIZE) {
+    Reporterror("Folder is too big");
+    Freeitems();
+    return -1; };
+  buf=(uchar *)GlobalAlloc(GMEM_FIXED,((ulong)total+15) & 0xFFFFFFF0);
+  if (buf==NULL) {
+    Reporterror("Low memory");
+    Freeitems();
+    return -1; };
+  // Fill table of contents and read files.
+  memset(&head,0,sizeof(head));
+  head.magic=ARCMAGIC;
+  head.nfile=nitem;
+  head.tocsize=tocsize;
+  memcpy(buf,&head,sizeof(head));
+  p=buf+sizeof(head);
+  offset=tocsize;
+  memset(modified,0,sizeof(FILETIME));
+  success=1;
+  for (i=0; i<nitem && success; i++) {
+    memset(&entry,0,sizeof(entry));
+    entry.offset=offset;
+    entry.size=item[i].size;
+    entry.modified=item[i].modified;
+    entry.attributes=item[i].attributes;
+    n=strlen(item[i].name);
+    entry.namelen=(ushort)n;
+    if (item[i].size>0) {
+      sprintf(path,"%s\\%s",folder,item[i].name);
+      hfile=CreateFile(path,GENERIC_READ,FILE_SHARE_READ,
+        NULL,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,NULL);
+      if (hfile==INVALID_HANDLE_VALUE)
+        success=0;
+      else {
+        if (ReadFile(hfile,buf+offset,item[i].size,&l,NULL)==0 ||
+          l!=item[i].size)
+          success=0;
+        CloseHandle(hfile);
+      };
+      if (success==0) {
+        Reporterror("Unable to read file in the folder");
+        break; };
+      entry.crc=Crc16(buf+offset,item[i].size);
+    };
+    memcpy(p,&entry,sizeof(entry));
+    p+=sizeof(entry);
+    memcpy(p,item[i].name,n);
+    p+=n;
+    offset+=item[i].size;
+    // Archive gets the time of the newest file.
+    if (item[i].modified.dwHighDateTime>modified->dwHighDateTime ||
+      (item[i].modified.dwHighDateTime==modified->dwHighDateTime &&
+      item[i].modified.dwLowDateTime>modified->dwLowDateTime))
+      *modified=item[i].modified;
+    Message("Reading files",(int)((i+1)*100.0/nitem));
+  };
+  Freeitems();
+  if (success==0) {
+    GlobalFree((HGLOBAL)buf);
+    return -1; };
+  *pbuf=buf;
+  *psize=offset;
+  return 0;
+};
+
+// Checks that path from the archive is relative and doesn't leave the folder
+// where archive is extracted. Returns 0 if path is safe and -1 otherwise.
+static int Checkpath(char *name) {
+  char *pc,*pe;
+  if (name[0]=='\0' || strchr(name,':')!=NULL)
+    return -1;
+  pc=name;
+  while (1) {
+    pe=pc;
+    while (*pe!='\0' && *pe!='\\' && *pe!='/')
+      pe++;
+    if (pe==pc)
+      return -1;                       // Absolute path or empty component
+    if (pe-pc<=2 && pc[0]=='.' && (pe-pc==1 || pc[1]=='.'))
+      return -1;                       // Component "." or ".."
+    if (*pe=='\0')
+      break;
+    pc=pe+1; };
+  return 0;
+};
+
+// Gets entry of the table of contents at offset pos and its relative path
+// (MAX_PATH bytes) and advances pos to the next entry. Table toc of tocsize
+// bytes starts with t_archead. Returns 0 on success and -1 if entry is
+// corrupt.
+int Nextarcentry(uchar *toc,ulong tocsize,ulong *pos,t_arcentry *entry,
+  char *name) {
+  int n;
+  if (*pos+sizeof(t_arcentry)>tocsize)
+    return -1;
+  memcpy(entry,toc+*pos,sizeof(t_arcentry));
+  *pos+=sizeof(t_arcentry);
+  n=entry->namelen;
+  if (n>=MAX_PATH || *pos+n>tocsize)
+    return -1;
+  memcpy(name,toc+*pos,n);
+  name[n]='\0';
+  *pos+=n;
+  return Checkpath(name);
+};
+
+// Creates all folders on the path to the file, starting after the first skip
+// characters. Errors are ignored, they manifest themselves when file is
+// created.
+static void Makefolders(char *path,int skip) {
+  char *pc;
+  for (pc=path+skip; *pc!='\0'; pc++) {
+    if (*pc!='\\' && *pc!='/')
+      continue;
+    *pc='\0';
+    CreateDirectory(path,NULL);
+    *pc='\\';
+  };
+};
+
+// Extracts all files from the archive saved in the file path into the folder,
+// which is created if necessary. Returns number of extracted files or -1 on
+// error.
+int Extractarchive(char *path,char *folder) {
+  int i,n,nsaved,skip,success;
+  ulong size,pos,l;
+  uchar *view;
+  char name[MAX_PATH],out[MAX_PATH];
+  t_archead head;
+  t_arcentry entry;
+  HANDLE hfile,hmap,hout;
+  // Map restored archive into memory.
+  hfile=CreateFile(path,GENERIC_READ,FILE_SHARE_READ,
+    NULL,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,NULL);
+  if (hfile==INVALID_HANDLE_VALUE) {
+    Reporterror("Unable to open restored archive");
+    return -1; };
+  size=GetFileSize(hfile,NULL);
+  view=NULL;
+  if (size>=sizeof(t_archead)) {
+    hmap=CreateFileMapping(hfile,NULL,PAGE_READONLY,0,0,NULL);
+    if (hmap!=NULL) {
+      view=(uchar *)MapViewOfFile(hmap,FILE_MAP_READ,0,0,0);
+      CloseHandle(hmap);
+    };
+  };
+  CloseHandle(hfile);
+  if (view==NULL) {
+    Reporterror("Unable to open restored archive");
+    return -1; };
+  // Verify header.
+  memcpy(&head,view,sizeof(head));
+  if (head.magic!=ARCMAGIC || head.tocsize>size ||
+    head.nfile==0 || head.nfile>NARCFILE) {
+    UnmapViewOfFile(view);
+    Reporterror("Invalid archive");
+    return -1; };
+  // Create folder and extract files one by one.
+  CreateDirectory(folder,NULL);
+  skip=strlen(folder)+1;
+  pos=sizeof(head);
+  nsaved=0;
+  success=1;
+  for (i=0; i<(int)head.nfile; i++) {
+    // Get entry and verify it.
+    if (Nextarcentry(view,head.tocsize,&pos,&entry,name)!=0) {
+      success=0; break; };
+    n=entry.namelen;
+    if (skip+n>=MAX_PATH) {
+      Reporterror("Path is too long");
+      success=-1; break; };
+    sprintf(out,"%s\\%s",folder,name);
+    Makefolders(out,skip);
+    if (entry.attributes & FILE_ATTRIBUTE_DIRECTORY) {
+      CreateDirectory(out,NULL);
+      continue; };
+    if (entry.offset<head.tocsize || entry.offset>size ||
+      entry.size>size-entry.offset ||
+      (entry.size>0 && Crc16(view+entry.offset,entry.size)!=entry.crc)) {
+      success=0; break; };
+    // Write file and restore its time and basic attributes.
+    hout=CreateFile(out,GENERIC_WRITE,0,NULL,
+      CREATE_ALWAYS,FILE_ATTRIBUTE_NORMAL,NULL);
+    if (hout==INVALID_HANDLE_VALUE) {
+      Reporterror("Unable to create file");
+      success=-1; break; };
+    if (entry.size>0 &&
+      (WriteFile(hout,view+entry.offset,entry.size,&l,NULL)==0 ||
+      l!=entry.size)) {
+      CloseHandle(hout);
+      DeleteFile(out);
+      Reporterror("I/O error");
+      success=-1; break; };
+    SetFileTime(hout,&entry.modified,&entry.modified,&entry.modified);
+    CloseHandle(hout);
+    SetFileAttributes(out,entry.attributes &
+      (FILE_ATTRIBUTE_READONLY|FILE_ATTRIBUTE_HIDDEN|
+      FILE_ATTRIBUTE_SYSTEM|FILE_ATTRIBUTE_ARCHIVE|
+      FILE_ATTRIBUTE_NORMAL));
+    nsaved++;
+    Message("Extracting files",(int)((i+1)*100.0/head.nfile));
+  };
+  UnmapViewOfFile(view);
+  if (success==0)
+    Reporterror("Archive is corrupt");
+  if (success<=0)
+    return -1;
+  return nsaved;
+};
@@ -96,7 +96,7 @@ LRESULT CALLBACK Buttonframewp(HWND hw,UINT msg,WPARAM wp,LPARAM lp) {
             Printfile(infile,NULL);
           break;
         case BTN_SCAN:                 // Scan button pressed
-          OpenTWAINinterface();
+          Acquirepages();
           Updatebuttons();
           break;
         case BTN_READ:                 // Open bitmap button pressed
@@ -105,6 +105,8 @@ LRESULT CALLBACK Buttonframewp(HWND hw,UINT msg,WPARAM wp,LPARAM lp) {
         case BTN_STOP:                 // Stop button pressed
           Stopbitmapdecoding(&procdata);
           Stopprinting(&printdata);
+          CancelTWAINtransfers();
+          Closepagestream();
           Clearqueue();
           Updatebuttons();
           Message("Processing interrupted",0);
@@ -128,7 +130,7 @@ LRESULT CALLBACK Buttonframewp(HWND hw,UINT msg,WPARAM wp,LPARAM lp) {
 // Enables or disables buttons according to the processing mode. Button "Close"
 // is always enabled.
 void Updatebuttons(void) {
-  if (procdata.step!=0 || printdata.step!=0) {
+  if (procdata.step!=0 || printdata.step!=0 || Pagestreamactive()) {
     EnableWindow(hprint,0);
     EnableWindow(hscan,0);
     EnableWindow(hopen,0);
@@ -138,7 +140,7 @@ void Updatebuttons(void) {
   else {
     EnableWindow(hprint,1);
     if (twainstate<=1) {
-      EnableWindow(hscan,0);
+      EnableWindow(hscan,replaysource[0]!='\0');
       EnableWindow(hopen,1); }
     else if (twainstate<=3) {
       EnableWindow(hscan,1);
@@ -1023,6 +1025,7 @@ void Destroydisplay(void) {
 
 #define INFO_DISCARD   1000            // Identifier of Discard button
 #define INFO_SAVE      1001            // Identifier of Save button
+#define INFO_PART      1002            // Identifier of Part button
 
 static HWND      hinfoframe;           // Frame that owns the info tab
 static HWND      hinfotab;             // Info tab control
@@ -1036,8 +1039,39 @@ static HWND      hcorrcount;           // Number of corrected bytes
 static HWND      hpagelist;            // List of pages to scan
 static HWND      hinfobtns;            // Parent for Save/Discard buttons
 static HWND      hdiscard;             // Discard button
+static HWND      hpart;                // Part button
 static HWND      hsavedata;            // Save button
 
+// Finds tab that shows processed file with given index (-1: placeholder tab
+// shown when there are no files). Returns index of tab or -1 if not found.
+static int Findfiletab(int slot) {
+  int i,n;
+  TCITEM titem;
+  n=SendMessage(hinfotab,TCM_GETITEMCOUNT,0,0);
+  for (i=0; i<n; i++) {
+    titem.mask=TCIF_PARAM;
+    if (SendMessage(hinfotab,TCM_GETITEM,i,(LPARAM)&titem)==0)
+      continue;
+    if (titem.lParam==slot)
+      return i;
+    ;
+  };
+  return -1;
+};
+
+// Returns index of processed file shown in the selected tab or -1 if none.
+static int Selectedfile(void) {
+  int i;
+  TCITEM titem;
+  i=SendMessage(hinfotab,TCM_GETCURSEL,0,0);
+  if (i<0)
+    return -1;
+  titem.mask=TCIF_PARAM;
+  if (SendMessage(hinfotab,TCM_GETITEM,i,(LPARAM)&titem)==0)
+    return -1;
+  return titem.lParam;
+};
+
 // Windows function of info frame window. This window is fully covered by the
 // info tab, so drawing is not necessary.
 LRESULT CALLBACK Infoframewp(HWND hw,UINT msg,WPARAM wp,LPARAM lp) {
@@ -1047,8 +1081,8 @@ LRESULT CALLBACK Infoframewp(HWND hw,UINT msg,WPARAM wp,LPARAM lp) {
       if (((NMHDR *)lp)->hwndFrom==hinfotab &&
         ((NMHDR *)lp)->code==TCN_SELCHANGE
       ) {
-        slot=SendMessage(hinfotab,TCM_GETCURSEL,0,0);
-        Updatefileinfo(slot,fproc+slot);
+        slot=Selectedfile();
+        if (slot>=0) Showfileinfo(slot);
       };
       break;
     default: return DefWindowProc(hw,msg,wp,lp);
@@ -1074,12 +1108,17 @@ LRESULT CALLBACK Infobtnwp(HWND hw,UINT msg,WPARAM wp,LPARAM lp) {
     case WM_COMMAND:
       if (HIWORD(wp)!=BN_CLICKED)
         break;
-      slot=SendMessage(hinfotab,TCM_GETCURSEL,0,0);
+      slot=Selectedfile();
+      if (slot<0)
+        break;                         // No file in selected tab
       switch (LOWORD(wp)) {
         case INFO_DISCARD:             // Discard button pressed
           Closefproc(slot);
           Message("",0);
           break;
+        case INFO_PART:                // Part button pressed
+          Selectpart(slot);
+          break;
         case INFO_SAVE:                // Save button pressed
           Saverestoredfile(slot,0);
         break;
@@ -1092,8 +1131,7 @@ LRESULT CALLBACK Infobtnwp(HWND hw,UINT msg,WPARAM wp,LPARAM lp) {
 
 // Creates tab with info window and places it in the specified rectangle.
 HWND Createinfo(RECT *rc) {
-  int i,x,y;
-  char s[TEXTLEN];
+  int x,y;
   RECT rci;
   WNDCLASS wc;
   TCITEM titem;
@@ -1138,13 +1176,13 @@ HWND Createinfo(RECT *rc) {
     DestroyWindow(hinfoframe); hinfoframe=NULL;
     return NULL; };
   SendMessage(hinfotab,WM_SETFONT,(WPARAM)GetStockObject(ANSI_VAR_FONT),0);
-  // Add tabs for processed files. Initially they are anonymous.
+  // Tabs are added for processed files as they appear. Until then, there is
+  // a single placeholder tab.
   memset(&titem,0,sizeof(titem));
-  titem.mask=TCIF_TEXT;
-  for (i=0; i<NFILE; i++) {
-    sprintf(s,"File %i",i+1);
-    titem.pszText=s;
-    SendMessage(hinfotab,TCM_INSERTITEM,i,(LPARAM)&titem); };
+  titem.mask=TCIF_TEXT|TCIF_PARAM;
+  titem.pszText="No file";
+  titem.lParam=-1;
+  SendMessage(hinfotab,TCM_INSERTITEM,0,(LPARAM)&titem);
   // Get working rectangle of info tab window.
   GetClientRect(hinfotab,&rci);
   SendMessage(hinfotab,TCM_ADJUSTRECT,0,(LPARAM)&rci);
@@ -1262,27 +1300,65 @@ HWND Createinfo(RECT *rc) {
     WS_CHILD|WS_VISIBLE|WS_CLIPCHILDREN,
     x,y,rci.right-x-10,BUTTONDY,
     hinfotab,NULL,hinst,NULL);
-  // Create Discard and Save button.
+  // Create Discard, Part and Save button.
   hdiscard=CreateWindow("BUTTON","Discard",
     WS_VISIBLE|WS_CHILD|BS_PUSHBUTTON,
-    0,0,(rci.right-x-20)/2,BUTTONDY,
+    0,0,(rci.right-x-30)/3,BUTTONDY,
     hinfobtns,(HMENU)INFO_DISCARD,hinst,NULL);
   SendMessage(hdiscard,WM_SETFONT,(WPARAM)GetStockObject(ANSI_VAR_FONT),0);
   EnableWindow(hdiscard,0);
+  hpart=CreateWindow("BUTTON","Part...",
+    WS_VISIBLE|WS_CHILD|BS_PUSHBUTTON,
+    (rci.right-x-30)/3+10,0,(rci.right-x-30)/3,BUTTONDY,
+    hinfobtns,(HMENU)INFO_PART,hinst,NULL);
+  SendMessage(hpart,WM_SETFONT,(WPARAM)GetStockObject(ANSI_VAR_FONT),0);
+  EnableWindow(hpart,0);
   hsavedata=CreateWindow("BUTTON","Save",
     WS_VISIBLE|WS_CHILD|BS_PUSHBUTTON,
-    (rci.right-x-20)/2+10,0,(rci.right-x-20)/2,BUTTONDY,
+    2*((rci.right-x-30)/3+10),0,(rci.right-x-30)/3,BUTTONDY,
     hinfobtns,(HMENU)INFO_SAVE,hinst,NULL);
   SendMessage(hsavedata,WM_SETFONT,(WPARAM)GetStockObject(ANSI_VAR_FONT),0);
   EnableWindow(hsavedata,0);
   return hinfotab;
 };
 
+// Shows information about processed file with given index, adding or removing
+// its tab as necessary. Table of processed files must be locked.
 void Updatefileinfo(int slot,t_fproc *fproc) {
-  int i,n;
+  int i,n,tab;
   char s[TEXTLEN];
-  // Select specified tab.
-  SendMessage(hinfotab,TCM_SETCURSEL,slot,0);
+  TCITEM titem;
+  tab=Findfiletab(slot);
+  titem.mask=TCIF_TEXT|TCIF_PARAM;
+  if (fproc->busy==0) {
+    // File closed, remove its tab but keep at least the placeholder.
+    if (tab>=0) {
+      if (SendMessage(hinfotab,TCM_GETITEMCOUNT,0,0)>1)
+        SendMessage(hinfotab,TCM_DELETEITEM,tab,0);
+      else {
+        titem.pszText="No file";
+        titem.lParam=-1;
+        SendMessage(hinfotab,TCM_SETITEM,tab,(LPARAM)&titem);
+      };
+    };
+    SendMessage(hinfotab,TCM_SETCURSEL,0,0);
+    // Show the file in the first tab instead. Critical section is recursive.
+    i=Selectedfile();
+    if (i>=0 && i!=slot) {
+      Showfileinfo(i);
+      return; }; }
+  else {
+    // Name tab after the file, reusing placeholder if it is still there.
+    memcpy(s,fproc->name,32); s[32]='\0';
+    titem.pszText=s;
+    titem.lParam=slot;
+    if (tab<0 && (tab=Findfiletab(-1))>=0)
+      SendMessage(hinfotab,TCM_SETITEM,tab,(LPARAM)&titem);
+    else if (tab<0) {
+      tab=SendMessage(hinfotab,TCM_GETITEMCOUNT,0,0);
+      SendMessage(hinfotab,TCM_INSERTITEM,tab,(LPARAM)&titem); };
+    SendMessage(hinfotab,TCM_SETCURSEL,tab,0);
+  };
   if (fproc->name[0]=='\0') {
     // Special case: empty descriptor.
     SetWindowText(hdataname," (None)");
@@ -1294,6 +1370,7 @@ void Updatefileinfo(int slot,t_fproc *fproc) {
     SetWindowText(hcorrcount,"");
     SetWindowText(hpagelist,"");
     EnableWindow(hdiscard,0);
+    EnableWindow(hpart,0);
     EnableWindow(hsavedata,0); }
   else {
     // File name.
@@ -1325,12 +1402,15 @@ void Updatefileinfo(int slot,t_fproc *fproc) {
       n+=sprintf(s+n," %i",fproc->rempages[i]); };
     if (i==7 && fproc->rempages[i]!=0)
       sprintf(s+n,"...");
-    else if (i==0 && fproc->ndata==fproc->nblock)
+    else if (i==0 && (fproc->ndata==fproc->nblock || fproc->partready))
       sprintf(s," Finished, press \"Save\"");
     SetWindowText(hpagelist,s);
-    // Enable or disable buttons.
+    // Enable or disable buttons. Part of compressed data can be restored only
+    // if data has frame index, elided data is restored only as a whole.
     EnableWindow(hdiscard,1);
-    EnableWindow(hsavedata,fproc->ndata==fproc->nblock);
+    EnableWindow(hpart,(fproc->mode & PBM_ELIDED)==0 &&
+      ((fproc->mode & PBM_COMPRESSED)==0 || (fproc->mode & PBM_FRAMED)!=0));
+    EnableWindow(hsavedata,fproc->ndata==fproc->nblock || fproc->partready);
   };
 };
 
@@ -54,6 +54,33 @@
 #define SUBDX          8               // X size of subblock, pixels
 #define SUBDY          8               // Y size of subblock, pixels
 
+// Intensity (0 or 255) of pixel x in the packed 1-bit row. Set bits are black.
+#define BITPIXEL(row,x) (((row)[(x)>>3] & (0x80>>((x) & 7)))?0:255)
+
+static uchar     bitcount[256];        // Number of set bits in the byte
+
+// Reports decoding error. In silent mode decoder runs in the background thread
+// and must not touch UI, so error is saved and reported later by the main
+// thread.
+static void Decodingerror(t_procdata *pdata,char *text) {
+  if (pdata->mode & M_SILENT) {
+    strncpy(pdata->error,text,TEXTLEN-1);
+    pdata->error[TEXTLEN-1]='\0'; }
+  else
+    Reporterror(text);
+  ;
+};
+
+// Returns 8 pixels of the packed 1-bit row starting with pixel x, leftmost in
+// the most significant bit. May read one byte beyond the end of the row.
+static uchar Getpackedbyte(uchar *row,int x) {
+  int k;
+  k=x & 7;
+  row+=x>>3;
+  if (k==0) return row[0];
+  return (uchar)((row[0]<<k)|(row[1]>>(8-k)));
+};
+
 // Given hystogramm h of length n points, locates black peaks and determines
 // phase and step of the grid.
 static float Findpeaks(int *h,int n,float *bestpeak,float *beststep) {
@@ -170,7 +197,6 @@ static int Recognizebits(t_data *result,uchar grid[NDOT][NDOT],
   t_procdata *pdata) {
   int i,j,k,q,r,factor,lcorr,c,cmin,cmax,limit;
   int grid1[NDOT][NDOT],answer,bestanswer;
-  static int lastgood;
   ushort crc;
   t_data uncorrected = {}, bestresult = {};
   cmin=pdata->cmin;
@@ -183,7 +209,7 @@ static int Recognizebits(t_data *result,uchar grid[NDOT][NDOT],
     // thresholds. Usually all cells are alike, so I remember the last known
     // good combination and start with it.
     for (k=0; k<9; k++) {
-      q=(k+lastgood)%9;
+      q=(k+pdata->lastgood)%9;
       switch (q) {
         case 0: factor=1000; lcorr=0; break;
         case 1: factor=32; lcorr=0; break;
@@ -194,7 +220,7 @@ static int Recognizebits(t_data *result,uchar grid[NDOT][NDOT],
         case 6: factor=1000; lcorr=(cmax-cmin)/16; break;
         case 7: factor=32; lcorr=(cmax-cmin)/16; break;
         case 8: factor=16; lcorr=(cmax-cmin)/16; break;
-        default: factor=1000; lcorr=0; lastgood=0; break; };
+        default: factor=1000; lcorr=0; pdata->lastgood=0; break; };
       // Correct grid for overlapping dots and calculate limit between black
       // and white. I take into account only adjacent dots; the influence of
       // diagonals is significantly lower.
@@ -233,6 +259,10 @@ static int Recognizebits(t_data *result,uchar grid[NDOT][NDOT],
       // XOR with grid that corrects mean brightness.
       for (j=0; j<NDOT; j++) {
         ((ulong *)result)[j]^=(j & 1?0xAAAAAAAA:0x55555555); };
+      // If address of the block is known from the layout of the page, these
+      // 4 bytes need no correction.
+      if (pdata->predict)
+        result->addr=pdata->expectaddr;
       // Apply ECC to restore invalid data.
       if (pdata->mode & M_BEST)
         memcpy(&uncorrected,result,sizeof(t_data));
@@ -240,6 +270,8 @@ static int Recognizebits(t_data *result,uchar grid[NDOT][NDOT],
         memcpy(&pdata->uncorrected,result,sizeof(t_data));
       answer=Decode8((uchar *)result,NULL,0,127);
       if (answer<0) answer=17;
+      // Block that is corrected to a different address is a false positive.
+      if (pdata->predict && result->addr!=pdata->expectaddr) answer=17;
       // Verify data for correctness by calculating CRC.
       if (answer<=16) {
         crc=(ushort)(Crc16((uchar *)result,NDATA+4)^0x55AA);
@@ -249,7 +281,7 @@ static int Recognizebits(t_data *result,uchar grid[NDOT][NDOT],
           pdata->orientation=r;
           // Report success.
           if ((pdata->mode & M_BEST)==0) {
-            lastgood=q;
+            pdata->lastgood=q;
             return answer; }
           else if (answer<bestanswer) {
             bestanswer=answer;
@@ -265,18 +297,76 @@ static int Recognizebits(t_data *result,uchar grid[NDOT][NDOT],
   return bestanswer;
 };
 
+// Calculates soft values of the grid of dots that was not recognized: for
+// each bit of the block, signed confidence that the bit is set. I correct
+// overlapping and select threshold exactly as Recognizebits() does with the
+// last good combination, so the signs are the bits it got. Returns 0 on
+// success and -1 if orientation of the page is not yet known.
+static int Getsoftvalues(t_procdata *pdata,uchar grid[NDOT][NDOT],
+  signed char *soft) {
+  int i,j,q,r,c,v,factor,lcorr,limit,swing,cmin,cmax;
+  int grid1[NDOT][NDOT];
+  cmin=pdata->cmin;
+  cmax=pdata->cmax;
+  r=pdata->orientation;
+  if (r<0 || cmax<=cmin)
+    return -1;
+  q=pdata->lastgood%9;
+  factor=(q%3==0?1000:(q%3==1?32:16));
+  if (q<3) lcorr=0;
+  else if (q<6) lcorr=(cmin-cmax)/16;
+  else lcorr=(cmax-cmin)/16;
+  limit=0;
+  for (j=0; j<NDOT; j++) {
+    for (i=0; i<NDOT; i++) {
+      c=grid[i][j]*factor;
+      if (i>0) c-=grid[j][i-1]; else c-=cmax;
+      if (i<31) c-=grid[j][i+1]; else c-=cmax;
+      if (j>0) c-=grid[j-1][i]; else c-=cmax;
+      if (j<31) c-=grid[j+1][i]; else c-=cmax;
+      grid1[j][i]=c;
+      limit+=c;
+    };
+  };
+  limit=limit/1024+lcorr*factor;
+  // Distance to the limit, scaled so that half of the difference between
+  // black and white dot gives full confidence.
+  swing=factor*(cmax-cmin);
+  for (j=0; j<NDOT; j++) {
+    for (i=0; i<NDOT; i++) {
+      switch (r) {
+        case 0: c=grid1[j][i]; break;
+        case 1: c=grid1[i][NDOT-1-j]; break;
+        case 2: c=grid1[NDOT-1-j][NDOT-1-i]; break;
+        case 3: c=grid1[NDOT-1-i][j]; break;
+        case 4: c=grid1[i][j]; break;
+        case 5: c=grid1[j][NDOT-1-i]; break;
+        case 6: c=grid1[NDOT-1-i][NDOT-1-j]; break;
+        default: c=grid1[NDOT-1-j][i]; break; };
+      v=(limit-c)*254/swing;
+      if (v>127) v=127;
+      else if (v<-127) v=-127;
+      // Account for the grid that corrects mean brightness.
+      if (((i^j) & 1)==0) v=-v;
+      soft[j*NDOT+i]=(signed char)v;
+    };
+  };
+  return 0;
+};
+
 // Determines rough grid position.
 static void Getgridposition(t_procdata *pdata) {
-  int i,j,nx,ny,stepx,stepy,sizex,sizey;
+  int i,j,x,nx,ny,stepx,stepy,sizex,sizey,rowbytes;
   int c,cmin,cmax,distrx[256],distry[256],limit;
   uchar *data,*pd;
   // Get frequently used variables.
   sizex=pdata->sizex;
   sizey=pdata->sizey;
+  rowbytes=pdata->rowbytes;
   data=pdata->data;
   // Check overall bitmap size.
   if (sizex<=3*NDOT || sizey<=3*NDOT) {
-    Reporterror("Bitmap is too small to process");
+    Decodingerror(pdata,"Bitmap is too small to process");
     pdata->step=0; return; };
   // Select horizontal and vertical lines (at most 256 in each direction) to
   // check for grid location.
@@ -290,6 +380,18 @@ static void Getgridposition(t_procdata *pdata) {
   memset(distrx,0,nx*sizeof(int));
   memset(distry,0,ny*sizeof(int));
   for (j=0; j<ny; j++) {
+    if (pdata->bpp==1) {
+      // Packed bilevel bitmap, amplitude is either 0 or 255.
+      pd=data+j*stepy*rowbytes;
+      for (i=0,x=0; i<nx; i++,x+=stepx) {
+        c=BITPIXEL(pd,x)+BITPIXEL(pd,x+2)+BITPIXEL(pd+rowbytes,x+1)+
+          BITPIXEL(pd+2*rowbytes,x)+BITPIXEL(pd+2*rowbytes,x+2);
+        if (c!=0 && c!=5*255) {
+          distrx[i]+=255;
+          distry[j]+=255;
+        };
+      };
+      continue; };
     pd=data+j*stepy*sizex;
     for (i=0; i<nx; i++,pd+=stepx) {
       c=pd[0];         cmin=c;           cmax=c;
@@ -330,13 +432,14 @@ static void Getgridposition(t_procdata *pdata) {
 
 // Selects search range, determines grid intensity and estimates sharpness.
 static void Getgridintensity(t_procdata *pdata) {
-  int i,j,sizex,sizey,centerx,centery,dx,dy,n;
+  int i,j,k,sizex,sizey,rowbytes,centerx,centery,dx,dy,n,nblack,ndiff;
   int searchx0,searchy0,searchx1,searchy1;
   int distrc[256],distrd[256],cmean,cmin,cmax,limit,sum,contrast;
-  uchar *data,*pd;
+  uchar *data,*pd,b,mask;
   // Get frequently used variables.
   sizex=pdata->sizex;
   sizey=pdata->sizey;
+  rowbytes=pdata->rowbytes;
   data=pdata->data;
   // Select X and Y ranges to search for the grid. As I use affine transforms
   // instead of more CPU-intensive rotations, these ranges are determined for
@@ -355,12 +458,33 @@ static void Getgridintensity(t_procdata *pdata) {
   memset(distrc,0,sizeof(distrc));
   memset(distrd,0,sizeof(distrd));
   cmean=0; n=0;
-  for (j=0; j<dy-1; j++) {
-    pd=data+(searchy0+j)*sizex+searchx0;
-    for (i=0; i<dx-1; i++,pd++) {
-      distrc[*pd]++; cmean+=*pd; n++;
-      distrd[abs(pd[1]-pd[0])]++;
-      distrd[abs(pd[sizex]-pd[0])]++;
+  if (pdata->bpp==1) {
+    // Packed bilevel bitmap. Pixels are either 0 or 255, so it's enough to
+    // count black pixels and changes to the right and below, 8 pixels at once.
+    nblack=ndiff=0;
+    for (j=0; j<dy-1; j++) {
+      pd=data+(searchy0+j)*rowbytes;
+      for (i=0; i<dx-1; i+=8) {
+        k=min(dx-1-i,8);
+        mask=(uchar)(0xFF00>>k);
+        b=Getpackedbyte(pd,searchx0+i);
+        nblack+=bitcount[b & mask];
+        ndiff+=bitcount[(b^Getpackedbyte(pd,searchx0+i+1)) & mask];
+        ndiff+=bitcount[(b^Getpackedbyte(pd+rowbytes,searchx0+i)) & mask];
+        n+=k;
+      };
+    };
+    distrc[0]=nblack; distrc[255]=n-nblack;
+    distrd[0]=2*n-ndiff; distrd[255]=ndiff;
+    cmean=(n-nblack)*255; }
+  else {
+    for (j=0; j<dy-1; j++) {
+      pd=data+(searchy0+j)*sizex+searchx0;
+      for (i=0; i<dx-1; i++,pd++) {
+        distrc[*pd]++; cmean+=*pd; n++;
+        distrd[abs(pd[1]-pd[0])]++;
+        distrd[abs(pd[sizex]-pd[0])]++;
+      };
     };
   };
   // Calculate mean, minimal and maximal image intensity.
@@ -373,7 +497,7 @@ static void Getgridintensity(t_procdata *pdata) {
     sum+=distrc[cmax];
     if (sum>=limit) break; };
   if (cmax-cmin<1) {
-    Reporterror("No image");
+    Decodingerror(pdata,"No image");
     pdata->step=0;
     return; };
   // Estimate image sharpness. The factor is rather empirical. Later, when
@@ -397,13 +521,14 @@ static void Getgridintensity(t_procdata *pdata) {
 
 // Find angle and step of vertical grid lines.
 static void Getxangle(t_procdata *pdata) {
-  int i,j,a,x,y,x0,y0,dx,dy,sizex;
-  int h[NHYST],nh[NHYST],ystep;
-  uchar *data,*pd;
+  int i,j,k,n,a,x,y,x0,y0,i0,i1,dx,dy,sizex,rowbytes;
+  int h[NHYST],nh[NHYST+1],ystep;
+  uchar *data,*pd,b;
   float weight,xpeak,xstep;
   float maxweight,bestxpeak,bestxangle,bestxstep;
   // Get frequently used variables.
   sizex=pdata->sizex;
+  rowbytes=pdata->rowbytes;
   data=pdata->data;
   x0=pdata->searchx0;
   y0=pdata->searchy0;
@@ -420,16 +545,44 @@ static void Getxangle(t_procdata *pdata) {
   for (a=-(NHYST/20)*2; a<=(NHYST/20)*2; a+=2) {
     // Clear histogramm.
     memset(h,0,dx*sizeof(int));
-    memset(nh,0,dx*sizeof(int));
+    memset(nh,0,(dx+1)*sizeof(int));
     // Gather histogramm.
-    for (j=0; j<dy; j+=ystep) {
-      y=y0+j;
-      x=x0+(y0+j)*a/NHYST;             // Affine transformation
-      pd=data+y*sizex+x;
-      for (i=0; i<dx; i++,x++,pd++) {
-        if (x<0) continue;
-        if (x>=sizex) break;
-        h[i]+=*pd; nh[i]++;
+    if (pdata->bpp==1) {
+      // Packed bilevel bitmap. I count black pixels in h, skipping white
+      // bytes, and mark limits of the valid range in nh. Conversion to the
+      // sum of intensities follows.
+      for (j=0; j<dy; j+=ystep) {
+        y=y0+j;
+        x=x0+(y0+j)*a/NHYST;           // Affine transformation
+        i0=max(0,-x);
+        i1=min(dx,sizex-x);
+        if (i0>=i1) continue;
+        nh[i0]++; nh[i1]--;
+        pd=data+y*rowbytes;
+        for (i=i0; i<i1; i+=8) {
+          b=Getpackedbyte(pd,x+i);
+          if (i1-i<8) b&=(uchar)(0xFF00>>(i1-i));
+          if (b==0) continue;
+          for (k=0; k<8; k++) {
+            if (b & (0x80>>k)) h[i+k]++; };
+          ;
+        };
+      };
+      for (i=0,n=0; i<dx; i++) {
+        n+=nh[i];
+        nh[i]=n;
+        h[i]=(n-h[i])*255;
+      }; }
+    else {
+      for (j=0; j<dy; j+=ystep) {
+        y=y0+j;
+        x=x0+(y0+j)*a/NHYST;           // Affine transformation
+        pd=data+y*sizex+x;
+        for (i=0; i<dx; i++,x++,pd++) {
+          if (x<0) continue;
+          if (x>=sizex) break;
+          h[i]+=*pd; nh[i]++;
+        };
       };
     };
     // Normalize histogramm.
@@ -449,7 +602,7 @@ static void Getxangle(t_procdata *pdata) {
   };
   // Analyse and save results.
   if (maxweight==0.0 || bestxstep<NDOT) {
-    Reporterror("No grid");
+    Decodingerror(pdata,"No grid");
     pdata->step=0;
     return; };
   pdata->xpeak=bestxpeak;
@@ -461,7 +614,7 @@ static void Getxangle(t_procdata *pdata) {
 
 // Find angle and step of horizontal grid lines. Very similar to Getxangle().
 static void Getyangle(t_procdata *pdata) {
-  int i,j,a,x,y,x0,y0,dx,dy,sizex,sizey;
+  int i,j,a,x,y,x0,y0,dx,dy,sizex,sizey,rowbytes;
   int h[NHYST],nh[NHYST],xstep;
   uchar *data,*pd;
   float weight,ypeak,ystep;
@@ -469,6 +622,7 @@ static void Getyangle(t_procdata *pdata) {
   // Get frequently used variables.
   sizex=pdata->sizex;
   sizey=pdata->sizey;
+  rowbytes=pdata->rowbytes;
   data=pdata->data;
   x0=pdata->searchx0;
   y0=pdata->searchy0;
@@ -488,6 +642,15 @@ static void Getyangle(t_procdata *pdata) {
     for (i=0; i<dx; i+=xstep) {
       x=x0+i;
       y=y0+(x0+i)*a/NHYST;             // Affine transformation
+      if (pdata->bpp==1) {
+        // Packed bilevel bitmap.
+        pd=data+y*rowbytes;
+        for (j=0; j<dy; j++,y++,pd+=rowbytes) {
+          if (y<0) continue;
+          if (y>=sizey) break;
+          h[j]+=BITPIXEL(pd,x); nh[j]++;
+        };
+        continue; };
       pd=data+y*sizex+x;
       for (j=0; j<dy; j++,y++,pd+=sizex) {
         if (y<0) continue;
@@ -512,7 +675,7 @@ static void Getyangle(t_procdata *pdata) {
     bestystep<pdata->xstep*0.40 ||
     bestystep>pdata->xstep*2.50
   ) {
-    Reporterror("No grid");
+    Decodingerror(pdata,"No grid");
     pdata->step=0;
     return; };
   pdata->ypeak=bestypeak;
@@ -524,7 +687,7 @@ static void Getyangle(t_procdata *pdata) {
 
 // Prepare data and allocate memory for data decoding.
 static void Preparefordecoding(t_procdata *pdata) {
-  int sizex,sizey,dx,dy;
+  int i,sizex,sizey,dx,dy;
   float xstep,ystep,border,sharpfactor,shift,maxxshift,maxyshift,dotsize;
   // Get frequently used variables.
   sizex=pdata->sizex;
@@ -565,7 +728,8 @@ static void Preparefordecoding(t_procdata *pdata) {
   pdata->nposy=(int)((sizey+maxyshift)/ystep);
   // Start new quality map. Note that this call doesn't force map to be
   // displayed.
-  Initqualitymap(pdata->nposx,pdata->nposy);
+  if ((pdata->mode & M_SILENT)==0)
+    Initqualitymap(pdata->nposx,pdata->nposy);
   // Allocate block buffers.
   dx= (int)(xstep*(2.0*border+1.0)+1.0);
   dy= (int)(ystep*(2.0*border+1.0)+1.0);
@@ -575,16 +739,27 @@ static void Preparefordecoding(t_procdata *pdata) {
   pdata->bufy=(int *)GlobalAlloc(GMEM_FIXED,dy*sizeof(int));
   pdata->blocklist=(t_block *)
     GlobalAlloc(GMEM_FIXED,pdata->nposx*pdata->nposy*sizeof(t_block));
+  pdata->softlist=(t_soft *)GlobalAlloc(GMEM_FIXED,NSOFT*sizeof(t_soft));
+  pdata->celladdr=(ulong *)
+    GlobalAlloc(GMEM_FIXED,pdata->nposx*pdata->nposy*sizeof(ulong));
   // Check that we have enough memory.
   if (pdata->buf1==NULL || pdata->buf2==NULL ||
-    pdata->bufx==NULL || pdata->bufy==NULL || pdata->blocklist==NULL
+    pdata->bufx==NULL || pdata->bufy==NULL || pdata->blocklist==NULL ||
+    pdata->softlist==NULL || pdata->celladdr==NULL
   ) {
     if (pdata->buf1!=NULL) GlobalFree((HGLOBAL)pdata->buf1);
     if (pdata->buf2!=NULL) GlobalFree((HGLOBAL)pdata->buf2);
     if (pdata->bufx!=NULL) GlobalFree((HGLOBAL)pdata->bufx);
     if (pdata->bufy!=NULL) GlobalFree((HGLOBAL)pdata->bufy);
     if (pdata->blocklist!=NULL) GlobalFree((HGLOBAL)pdata->blocklist);
-    Reporterror("Low memory");
+    if (pdata->softlist!=NULL) GlobalFree((HGLOBAL)pdata->softlist);
+    if (pdata->celladdr!=NULL) GlobalFree((HGLOBAL)pdata->celladdr);
+    pdata->buf1=pdata->buf2=NULL;
+    pdata->bufx=pdata->bufy=NULL;
+    pdata->blocklist=NULL;
+    pdata->softlist=NULL;
+    pdata->celladdr=NULL;
+    Decodingerror(pdata,"Low memory");
     pdata->step=0;
     return; };
   // Determine maximal size of the dot on the bitmap.
@@ -602,11 +777,18 @@ static void Preparefordecoding(t_procdata *pdata) {
   pdata->bufdx=dx;
   pdata->bufdy=dy;
   pdata->orientation=-1;               // As yet, unknown page orientation
+  pdata->lastdotsize=1;
   pdata->ngood=0;
   pdata->nbad=0;
   pdata->nsuper=0;
   pdata->nrestored=0;
+  pdata->nsoft=0;
   pdata->posx=pdata->posy=0;           // First block to scan
+  pdata->minposx=pdata->nposx;
+  pdata->minposy=pdata->nposy;
+  pdata->maxposx=pdata->maxposy=-1;
+  for (i=0; i<pdata->nposx*pdata->nposy; i++)
+    pdata->celladdr[i]=CELL_NONE;
   // Step finished.
   pdata->step++;
 };
@@ -615,16 +797,20 @@ static void Preparefordecoding(t_procdata *pdata) {
 // data decoder and by block display. Returns -1 if block cannot be located,
 // 0 to 16 if block is correctly decoded and 17 if block is unrecoverable.
 int Decodeblock(t_procdata *pdata,int posx,int posy,t_data *result) {
-  int i,j,x,y,x0,y0,dx,dy,sizex,sizey,*bufx,*bufy;
-  int c,cmin,cmax,dotsize,shift,shiftmax,sum,answer,bestanswer;
+  int i,j,x,y,x0,y0,dx,dy,sizex,sizey,rowbytes,*bufx,*bufy;
+  int c,c00,c01,c10,c11,cmin,cmax,dotsize,shift,shiftmax,sum,answer,bestanswer;
   float xangle,yangle,xbmp,ybmp,xres,yres,sharpfactor;
   float xpeak,xstep,ypeak,ystep,halfdot;
   float sy,syy,disp,dispmin,dispmax;
   uchar *psrc,*pdest,*data,g[9][NDOT][NDOT],grid[NDOT][NDOT];
+  uchar softgrid[NDOT][NDOT];
+  int softsize;
   t_data uncorrected = {}, bestresult = {};
+  pdata->softvalid=0;
   // Get frequently used variables.
   sizex=pdata->sizex;
   sizey=pdata->sizey;
+  rowbytes=pdata->rowbytes;
   xangle=pdata->xangle;
   yangle=pdata->yangle;
   data=pdata->data;
@@ -659,6 +845,13 @@ int Decodeblock(t_procdata *pdata,int posx,int posy,t_data *result) {
       yres=ybmp-y;
       if (x<0 || x>=sizex-1 || y<0 || y>=sizey-1)
         *pdest=(uchar)cmax;            // Fill areas outside the page white
+      else if (pdata->bpp==1) {
+        psrc=data+y*rowbytes;
+        c00=BITPIXEL(psrc,x); c01=BITPIXEL(psrc,x+1);
+        psrc+=rowbytes;
+        c10=BITPIXEL(psrc,x); c11=BITPIXEL(psrc,x+1);
+        *pdest=(uchar)((c00+(c01-c00)*xres)*(1.0-yres)+
+        (c10+(c11-c10)*xres)*yres); }
       else {
         psrc=data+y*sizex+x;
         *pdest= (uchar)((psrc[0]+(psrc[1]-psrc[0])*xres)*(1.0-yres)+
@@ -715,6 +908,9 @@ int Decodeblock(t_procdata *pdata,int posx,int posy,t_data *result) {
   // In search-for-the-best-quality mode, I look for the best possible
   // decoding. Helps to estimate the overall quality of the picture.
   bestanswer=17;
+  // If block is unreadable, soft values are taken from the combined grid of
+  // dots of the size that recognized the last good block.
+  softsize=pdata->lastdotsize;
   // Try different dot sizes, starting from 1x1 pixel. If scanner resolution
   // is sufficient, 2x2 dot usually gives best results.
   for (dotsize=1; dotsize<=pdata->maxdotsize; dotsize++) {
@@ -813,19 +1009,66 @@ int Decodeblock(t_procdata *pdata,int posx,int posy,t_data *result) {
         uncorrected=pdata->uncorrected;
         if (answer!=0) answer=17;
       };
+      if (dotsize==softsize)
+        memcpy(softgrid,grid,sizeof(softgrid));
+      ;
     };
     // If data is restored, we don't need different dot size.
-    if (answer<17) break;
+    if (answer<17) {
+      pdata->lastdotsize=dotsize;
+      break;
+    };
   };
   if (pdata->mode & M_BEST) {
     answer=bestanswer;
     *result=bestresult;
     pdata->uncorrected=uncorrected; };
+  // Keep soft values of unreadable block, they may help to read it when page
+  // is scanned again.
+  if (answer>=17 && dotsize>softsize &&
+    Getsoftvalues(pdata,softgrid,pdata->softdot)==0)
+    pdata->softvalid=1;
   return answer;
 };
 
+// Saves correctly decoded block (0<=answer<=16) to the list of blocks on the
+// page or, if block is a superblock, to the page header.
+static void Savegoodblock(t_procdata *pdata,int answer,t_data *result) {
+  int ngroup;
+  if (result->addr==SUPERBLOCK) {
+    // Superblock.
+    pdata->superblock.addr=SUPERBLOCK;
+    pdata->superblock.datasize=((t_superdata *)result)->datasize;
+    pdata->superblock.pagesize=((t_superdata *)result)->pagesize;
+    pdata->superblock.origsize=((t_superdata *)result)->origsize;
+    pdata->superblock.mode=((t_superdata *)result)->mode;
+    pdata->superblock.page=((t_superdata *)result)->page;
+    pdata->superblock.modified=((t_superdata *)result)->modified;
+    pdata->superblock.attributes=((t_superdata *)result)->attributes;
+    pdata->superblock.filecrc=((t_superdata *)result)->filecrc;
+    memcpy(pdata->superblock.name,((t_superdata *)result)->name,64);
+    pdata->nsuper++;
+    pdata->nrestored+=answer; }
+  else if (pdata->ngood<pdata->nposx*pdata->nposy) {
+    // Success, place data block into the intermediate buffer.
+    pdata->blocklist[pdata->ngood].addr=result->addr & 0x0FFFFFFF;
+    ngroup=(result->addr>>28) & 0x0000000F;
+    if (ngroup>0) {                    // Recovery block
+      pdata->blocklist[pdata->ngood].recsize=ngroup*NDATA;
+      pdata->superblock.ngroup=ngroup; }
+    else                               // Data block
+      pdata->blocklist[pdata->ngood].recsize=0;
+    memcpy(pdata->blocklist[pdata->ngood].data,result->data,NDATA);
+    pdata->ngood++;
+    // Number of bytes corrected by ECC may be misleading (block is so good
+    // it can be read with wrong settings), but I have no better indicator
+    // of quality.
+    pdata->nrestored+=answer;
+  };
+};
+
 static void Decodenextblock(t_procdata *pdata) {
-  int answer,ngroup,percent;
+  int answer,percent;
   char s[TEXTLEN];
   t_data result;
   // Display percent of executed data and, if known, data name in progress bar.
@@ -836,51 +1079,41 @@ static void Decodenextblock(t_procdata *pdata) {
     pdata->superblock.name,pdata->superblock.page);
   percent=(pdata->posy*pdata->nposx+pdata->posx)*100/
     (pdata->nposx*pdata->nposy);
-  Message(s,percent);
+  if ((pdata->mode & M_SILENT)==0)
+    Message(s,percent);
   // Decode block.
   answer=Decodeblock(pdata,pdata->posx,pdata->posy,&result);
   // If we are unable to locate block, probably we are outside the raster.
   if (answer<0)
     goto finish;
+  pdata->minposx=min(pdata->minposx,pdata->posx);
+  pdata->minposy=min(pdata->minposy,pdata->posy);
+  pdata->maxposx=max(pdata->maxposx,pdata->posx);
+  pdata->maxposy=max(pdata->maxposy,pdata->posy);
   // If this is the very first block located on the page, show it in the block
   // display window.
-  if (pdata->ngood==0 && pdata->nbad==0 && pdata->nsuper==0)
+  if (pdata->ngood==0 && pdata->nbad==0 && pdata->nsuper==0 &&
+    (pdata->mode & M_SILENT)==0)
     Displayblockimage(pdata,pdata->posx,pdata->posy,answer,&result);
   // Analyze answer.
   if (answer>=17) {
-    // Error, block is unreadable.
-    pdata->nbad++; }
-  else if (result.addr==SUPERBLOCK) {
-    // Superblock.
-    pdata->superblock.addr=SUPERBLOCK;
-    pdata->superblock.datasize=((t_superdata *)&result)->datasize;
-    pdata->superblock.pagesize=((t_superdata *)&result)->pagesize;
-    pdata->superblock.origsize=((t_superdata *)&result)->origsize;
-    pdata->superblock.mode=((t_superdata *)&result)->mode;
-    pdata->superblock.page=((t_superdata *)&result)->page;
-    pdata->superblock.modified=((t_superdata *)&result)->modified;
-    pdata->superblock.attributes=((t_superdata *)&result)->attributes;
-    pdata->superblock.filecrc=((t_superdata *)&result)->filecrc;
-    memcpy(pdata->superblock.name,((t_superdata *)&result)->name,64);
-    pdata->nsuper++;
-    pdata->nrestored+=answer; }
-  else if (pdata->ngood<pdata->nposx*pdata->nposy) {
-    // Success, place data block into the intermediate buffer.
-    pdata->blocklist[pdata->ngood].addr=result.addr & 0x0FFFFFFF;
-    ngroup=(result.addr>>28) & 0x0000000F;
-    if (ngroup>0) {                    // Recovery block
-      pdata->blocklist[pdata->ngood].recsize=ngroup*NDATA;
-      pdata->superblock.ngroup=ngroup; }
-    else                               // Data block
-      pdata->blocklist[pdata->ngood].recsize=0;
-    memcpy(pdata->blocklist[pdata->ngood].data,result.data,NDATA);
-    pdata->ngood++;
-    // Number of bytes corrected by ECC may be misleading (block is so good
-    // it can be read with wrong settings), but I have no better indicator
-    // of quality.
-    pdata->nrestored+=answer; };
+    // Error, block is unreadable. Save its soft values for the file
+    // processor.
+    pdata->nbad++;
+    pdata->celladdr[pdata->posy*pdata->nposx+pdata->posx]=CELL_BAD;
+    if (pdata->softvalid && pdata->nsoft<NSOFT) {
+      pdata->softlist[pdata->nsoft].posx=(short)pdata->posx;
+      pdata->softlist[pdata->nsoft].posy=(short)pdata->posy;
+      pdata->softlist[pdata->nsoft].orientation=pdata->orientation;
+      memcpy(pdata->softlist[pdata->nsoft].dot,pdata->softdot,NDOT*NDOT);
+      pdata->nsoft++;
+    }; }
+  else {
+    pdata->celladdr[pdata->posy*pdata->nposx+pdata->posx]=result.addr;
+    Savegoodblock(pdata,answer,&result); };
   // Add block to quality map.
-  Addblocktomap(pdata->posx,pdata->posy,answer);
+  if ((pdata->mode & M_SILENT)==0)
+    Addblocktomap(pdata->posx,pdata->posy,answer);
   // Block processed, set new coordinates.
 finish:
   pdata->posx++;
@@ -893,23 +1126,191 @@ finish:
   };
 };
 
-// Passes gathered data to file processor and frees resources allocated by call
-// to Preparefordecoding().
-static void Finishdecoding(t_procdata *pdata) {
-  int i,fileindex;
-  // Pass gathered data to file processor.
-  if (pdata->superblock.addr==0)
-    Reporterror("Page label is not readable");
-  else {
-    fileindex=Startnextpage(&pdata->superblock);
-    if (fileindex>=0) {
-      for (i=0; i<pdata->ngood; i++)
-        Addblock(pdata->blocklist+i,fileindex);
-      Finishpage(fileindex,
-        pdata->ngood+pdata->nsuper,pdata->nbad,pdata->nrestored);
+// Predicts address of the block in the cell with given coordinates from the
+// known layout of the page. Returns 0 on success and -1 if cell lies outside
+// the printed raster.
+static int Predictaddr(t_layout *lay,int posx,int posy,ulong *addr) {
+  int x,y,c,r,k,i,j,m,n1,rot;
+  x=posx-lay->x0;
+  y=posy-lay->y0;
+  switch (lay->transform) {
+    case 0: c=x; r=y; break;
+    case 1: c=lay->width-1-x; r=y; break;
+    case 2: c=x; r=lay->height-1-y; break;
+    case 3: c=lay->width-1-x; r=lay->height-1-y; break;
+    case 4: c=y; r=x; break;
+    case 5: c=lay->height-1-y; r=x; break;
+    case 6: c=y; r=lay->width-1-x; break;
+    default: c=lay->height-1-y; r=lay->width-1-x; break; };
+  c-=lay->border;
+  r-=lay->border;
+  if (c<0 || c>=lay->nx || r<0 || r>=lay->ny)
+    return -1;                         // Border or outside the raster
+  // Invert placement of blocks in Printnextpage(). First block in every
+  // string is the superblock, strings are rotated if they are long.
+  k=r*lay->nx+c;
+  n1=lay->nstring+1;
+  if (k>=n1*lay->nchain) {
+    *addr=SUPERBLOCK;                  // Superblocks fill remaining cells
+    return 0; };
+  j=k/n1;
+  m=k%n1;
+  if (n1<lay->nx)
+    rot=0;
+  else
+    rot=(lay->nx/lay->nchain*j-(j*n1)%lay->nx+lay->nx)%lay->nx;
+  if (m==rot) {
+    *addr=SUPERBLOCK;
+    return 0; };
+  i=(m-rot-1+n1)%n1;                   // Index of the group on the page
+  if (j<lay->ngroup)
+    *addr=lay->offset+(i*lay->ngroup+j)*NDATA;
+  else
+    *addr=(lay->offset+(i*lay->ngroup+j-lay->ngroup)*NDATA) ^
+      (lay->ngroup<<28);
+  return 0;
+};
+
+// Page is decoded, but some blocks are bad. If page header and enough blocks
+// are known, I search for the layout of the page that explains all good
+// blocks. This gives expected address of every bad block, so that 4 bytes
+// need no correction and false recognitions are rejected.
+static void Findlayout(t_procdata *pdata) {
+  int t,b,np,npmax,n,nmatch,nmiss,best,posx,posy,nparpages;
+  ulong size,pagesize,addr,u;
+  t_layout lay,bestlay;
+  pdata->layout.valid=0;
+  pdata->posx=pdata->posy=0;           // Prepare for the next step
+  pdata->step++;
+  pagesize=pdata->superblock.pagesize;
+  if (pdata->nbad==0 || pdata->superblock.addr!=SUPERBLOCK ||
+    pdata->superblock.ngroup==0 || pdata->superblock.page==0 ||
+    pagesize==0 || pagesize%NDATA!=0 || pdata->maxposx<pdata->minposx)
+    return;                            // Nothing to do or too little known
+  // Reconstruct size of printed data, including parity pages.
+  size=pdata->superblock.datasize;
+  nparpages=(pdata->superblock.mode & PBM_PARPAGES)>>3;
+  if (nparpages>0) {
+    n=(size+pagesize-1)/pagesize;
+    size=max(size,(n+(n+PARSTRIPE-1)/PARSTRIPE*nparpages)*pagesize); };
+  memset(&lay,0,sizeof(lay));
+  lay.offset=(pdata->superblock.page-1)*pagesize;
+  if (lay.offset>=size)
+    return;
+  n=(min(size-lay.offset,pagesize)+NDATA-1)/NDATA;
+  lay.ngroup=pdata->superblock.ngroup;
+  lay.nstring=(n+lay.ngroup-1)/lay.ngroup;
+  lay.x0=pdata->minposx;
+  lay.y0=pdata->minposy;
+  lay.width=pdata->maxposx-pdata->minposx+1;
+  lay.height=pdata->maxposy-pdata->minposy+1;
+  // In erasure mode, the number of recovery blocks in the group is unknown.
+  npmax=(pdata->superblock.mode & PBM_ERASURE?NPARITYMAX:1);
+  best=0;
+  for (t=0; t<8; t++) {
+    for (b=0; b<=1; b++) {
+      for (np=1; np<=npmax; np++) {
+        lay.transform=t;
+        lay.border=b;
+        lay.nx=(t<4?lay.width:lay.height)-2*b;
+        lay.ny=(t<4?lay.height:lay.width)-2*b;
+        lay.nchain=lay.ngroup+np;
+        if (lay.nx<=0 || lay.ny<=0)
+          continue;
+        // Compare predictions with good blocks. Single false recognition
+        // should not spoil the layout, but more are suspicious.
+        nmatch=nmiss=0;
+        for (posy=lay.y0; posy<lay.y0+lay.height; posy++) {
+          for (posx=lay.x0; posx<lay.x0+lay.width; posx++) {
+            u=pdata->celladdr[posy*pdata->nposx+posx];
+            if (u==CELL_NONE || u==CELL_BAD)
+              continue;
+            if (Predictaddr(&lay,posx,posy,&addr)==0 && addr==u)
+              nmatch++;
+            else
+              nmiss++;
+            ;
+          };
+          if (nmiss>pdata->ngood/32+1) break;
+        };
+        if (nmiss<=pdata->ngood/32+1 && nmatch>best) {
+          best=nmatch;
+          bestlay=lay;
+        };
+      };
+    };
+  };
+  if (best<8)
+    return;                            // Too few blocks to be sure
+  pdata->layout=bestlay;
+  pdata->layout.valid=1;
+};
+
+// Reads bad blocks again, this time with expected addresses. Blocks that are
+// still unreadable get known address in their soft values.
+static void Redecodenextblock(t_procdata *pdata) {
+  int i,k,answer;
+  ulong addr;
+  t_data result;
+  if (pdata->layout.valid==0) {
+    pdata->step++;
+    return; };
+  k=pdata->posy*pdata->nposx+pdata->posx;
+  if (pdata->celladdr[k]==CELL_BAD &&
+    Predictaddr(&pdata->layout,pdata->posx,pdata->posy,&addr)==0
+  ) {
+    pdata->predict=1;
+    pdata->expectaddr=addr;
+    answer=Decodeblock(pdata,pdata->posx,pdata->posy,&result);
+    pdata->predict=0;
+    for (i=0; i<pdata->nsoft; i++) {
+      if (pdata->softlist[i].posx==pdata->posx &&
+        pdata->softlist[i].posy==pdata->posy) break; };
+    if (answer>=0 && answer<17) {
+      // Block is restored, soft values are no longer necessary.
+      pdata->nbad--;
+      pdata->celladdr[k]=result.addr;
+      Savegoodblock(pdata,answer,&result);
+      if (i<pdata->nsoft)
+        pdata->softlist[i]=pdata->softlist[--pdata->nsoft];
+      if ((pdata->mode & M_SILENT)==0)
+        Addblocktomap(pdata->posx,pdata->posy,answer);
+      ; }
+    else if (i<pdata->nsoft) {
+      for (k=0; k<32; k++)
+        pdata->softlist[i].dot[k]=(signed char)((addr>>k) & 1?127:-127);
       ;
     };
   };
+  pdata->posx++;
+  if (pdata->posx>=pdata->nposx) {
+    pdata->posx=0;
+    pdata->posy++;
+    if (pdata->posy>=pdata->nposy) {
+      pdata->step++;                   // All bad blocks processed
+    };
+  };
+};
+
+// Passes gathered data to file processor. Merging is thread-safe, so pages
+// decoded in parallel may belong to the same file. In silent mode, results are
+// reported later by the main thread.
+static void Finishdecoding(t_procdata *pdata) {
+  int i;
+  // Positions of unreadable blocks must not depend on margins of the scan,
+  // so I count them from the first located block.
+  for (i=0; i<pdata->nsoft; i++) {
+    pdata->softlist[i].posx-=(short)pdata->minposx;
+    pdata->softlist[i].posy-=(short)pdata->minposy; };
+  // Pass gathered data to file processor. If page label is not readable,
+  // file processor looks for the file that already has the same blocks.
+  pdata->fileindex=Mergepage(&pdata->superblock,
+    pdata->blocklist,pdata->ngood,pdata->softlist,pdata->nsoft,
+    pdata->ngood+pdata->nsuper,
+    pdata->nbad,pdata->nrestored,&pdata->pagestatus,pdata->error);
+  if ((pdata->mode & M_SILENT)==0)
+    Reportpage(pdata->fileindex,pdata->pagestatus,pdata->error);
+  ;
   // Page processed.
   pdata->step=0;
 };
@@ -923,21 +1324,24 @@ void Nextdataprocessingstep(t_procdata *pdata) {
     case 0:                            // Idle data
       return;
     case 1:                            // Remove previous images
-      SetWindowPos(hwmain,HWND_TOP,0,0,0,0,
-        SWP_NOMOVE|SWP_NOSIZE|SWP_SHOWWINDOW);
-      Initqualitymap(0,0);
-      Displayblockimage(NULL,0,0,0,NULL);
+      if ((pdata->mode & M_SILENT)==0) {
+        SetWindowPos(hwmain,HWND_TOP,0,0,0,0,
+          SWP_NOMOVE|SWP_NOSIZE|SWP_SHOWWINDOW);
+        Initqualitymap(0,0);
+        Displayblockimage(NULL,0,0,0,NULL); };
       pdata->step++;
       break;
     case 2:                            // Determine grid size
-      Message("Searching for raster...",0);
+      if ((pdata->mode & M_SILENT)==0)
+        Message("Searching for raster...",0);
       Getgridposition(pdata);
       break;
     case 3:                            // Determine min and max intensity
       Getgridintensity(pdata);
       break;
     case 4:                            // Determine step and angle in X
-      Message("Searching for grid lines...",0);
+      if ((pdata->mode & M_SILENT)==0)
+        Message("Searching for grid lines...",0);
       Getxangle(pdata);
       break;
     case 5:                            // Determine step and angle in Y
@@ -949,12 +1353,20 @@ void Nextdataprocessingstep(t_procdata *pdata) {
     case 7:                            // Decode next block of data
       Decodenextblock(pdata);
       break;
-    case 8:                            // Finish data decoding
+    case 8:                            // Find layout of the page
+      Findlayout(pdata);
+      break;
+    case 9:                            // Decode bad blocks again
+      Redecodenextblock(pdata);
+      break;
+    case 10:                           // Finish data decoding
       Finishdecoding(pdata);
       break;
     default: break;                    // Internal error
   };
-  if (pdata->step==0) Updatebuttons(); // Right or wrong, decoding finished
+  // Right or wrong, decoding finished.
+  if (pdata->step==0 && (pdata->mode & M_SILENT)==0)
+    Updatebuttons();
 };
 
 // Frees resources allocated by pdata.
@@ -978,13 +1390,25 @@ void Freeprocdata(t_procdata *pdata) {
     pdata->bufy=NULL; };
   if (pdata->blocklist!=NULL) {
     GlobalFree((HGLOBAL)pdata->blocklist);
-    pdata->blocklist=NULL;
+    pdata->blocklist=NULL; };
+  if (pdata->softlist!=NULL) {
+    GlobalFree((HGLOBAL)pdata->softlist);
+    pdata->softlist=NULL; };
+  if (pdata->celladdr!=NULL) {
+    GlobalFree((HGLOBAL)pdata->celladdr);
+    pdata->celladdr=NULL;
   };
 };
 
 // Starts decoding of the new bitmap. If previous decoding is still running,
-// it will be stopped and all intermediate results will be discarded.
-void Startbitmapdecoding(t_procdata *pdata,uchar *data,int sizex,int sizey) {
+// it will be stopped and all intermediate results will be discarded. Bitmap
+// is either 8-bit grayscale (bpp=8) or packed bilevel with DWORD-aligned rows
+// and set bits for black pixels (bpp=1), followed by 4 spare bytes. In both
+// cases rows are placed upside down. Data must be allocated by GlobalAlloc()
+// and will be freed by decoder.
+void Startbitmapdecoding(t_procdata *pdata,uchar *data,int sizex,int sizey,
+  int bpp) {
+  int i;
   // Free resources allocated for the previous bitmap. User may want to
   // browse bitmap while and after it is processed.
   Freeprocdata(pdata);
@@ -992,6 +1416,14 @@ void Startbitmapdecoding(t_procdata *pdata,uchar *data,int sizex,int sizey) {
   pdata->data=data;
   pdata->sizex=sizex;
   pdata->sizey=sizey;
+  pdata->bpp=bpp;
+  if (bpp==1) {
+    pdata->rowbytes=((sizex+31)/32)*4;
+    if (bitcount[255]==0) {
+      for (i=1; i<256; i++) bitcount[i]=(uchar)((i & 1)+bitcount[i>>1]);
+    }; }
+  else
+    pdata->rowbytes=sizex;
   pdata->blockborder=0.0;              // Autoselect
   pdata->step=1;
   if (bestquality)
@@ -0,0 +1,260 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+// MRPODS -- Machine-Readable Printed Optical Data Sheets                     //
+// https://github.com/sheafdynamics/mrpods                                    //
+//                                                                            //
+// Copyright (c) 2024 Ray Doll                                                //
+// Copyright (c) 2007 Oleh Yuschuk                                            //
+//                                                                            //
+// This file is part of MRPODS, which is built off                            //
+// Oleh Yuschuk's PaperBack https://ollydbg.de/Paperbak/                      //
+// MRPODS is cumulative work of passionate programmers,                       //
+// both named and unnamed, including freelancers and private contractors.     //
+// Without them, this would not be possible.                                  //
+// This software contains Oleh Yuschuk's original comments and                //
+// comments from other maintainers.                                           //
+//                                                                            //
+// MRPODS is free software; you can redistribute it and/or modify it under    //
+// the terms of the GNU General Public License as published by the Free       //
+// Software Foundation; either version 3 of the License, or (at your option)  //
+// any later version.                                                         //
+//                                                                            //
+// MRPODS is distributed in the hope that it will be useful, but WITHOUT      //
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or      //
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for   //
+// more details.                                                              //
+//                                                                            //
+// You should have received a copy of the GNU General Public License along    //
+// with this program. If not, see <http://www.gnu.org/licenses/>.             //
+//                                                                            //
+//                              bzip2 license                                 //
+// -------------------------------------------------------------------------- //
+// "bzip2", the associated library "libbzip2" copyright(C) 1996 - 2010        //
+// Julian R Seward. All rights reserved.                                      //
+// Julian Seward, jseward@acm.org                                             //
+// bzip2 / libbzip2 version 1.0.6 of 6 September 2010                         //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include <windows.h>
+#include <commctrl.h>
+#include <stdio.h>
+#include <direct.h>
+#include <math.h>
+#include <emmintrin.h>
+#include "twain.h"
+#pragma hdrstop
+
+#include "mrpods.h"
+#include "resource.h"
+
+// Raw images of disks and sparse database files contain long runs of zeros
+// and many repeating blocks. If data is printed uncompressed, such blocks of
+// NDATA bytes are not printed, but described by runs (t_elision): count
+// blocks that are zero, or count blocks that repeat the same number of
+// consecutive blocks earlier in the data. Payload starts with header
+// t_elidehead and runs sorted by block, followed by the remaining blocks in
+// their original order, including the incomplete last block, which is never
+// elided. Decoder restores data from the beginning, so every referenced
+// block is already in place.
+
+#define NHASHMIN       1024            // Min size of block hash table, 2**n
+#define ELIDENONE      0xFFFFFFFE      // Block is not elided
+
+// Checks whether block of NDATA bytes is all zeros. Block is tested with
+// SSE2 in pieces of 16 bytes, the last piece overlaps the previous one.
+static int Iszeroblock(uchar *p) {
+  __m128i u;
+  u=_mm_or_si128(_mm_loadu_si128((__m128i *)p),
+    _mm_loadu_si128((__m128i *)(p+16)));
+  u=_mm_or_si128(u,_mm_loadu_si128((__m128i *)(p+32)));
+  u=_mm_or_si128(u,_mm_loadu_si128((__m128i *)(p+48)));
+  u=_mm_or_si128(u,_mm_loadu_si128((__m128i *)(p+64)));
+  u=_mm_or_si128(u,_mm_loadu_si128((__m128i *)(p+NDATA-16)));
+  return (_mm_movemask_epi8(_mm_cmpeq_epi8(u,_mm_setzero_si128()))==0xFFFF);
+};
+
+// Calculates FNV-1a hash of block of NDATA bytes.
+static ulong Hashblock(uchar *p) {
+  int i;
+  ulong h;
+  h=2166136261U;
+  for (i=0; i<NDATA; i++)
+    h=(h^p[i])*16777619U;
+  return h;
+};
+
+// Adds run to the list, growing list if necessary. Returns 0 on success and
+// -1 on low memory.
+static int Addrun(t_elision **run,int *nrun,int *nrunmax,
+  ulong block,ulong source) {
+  t_elision *pr;
+  if (*nrun>=*nrunmax) {
+    pr=(t_elision *)GlobalAlloc(GMEM_FIXED,2*(*nrunmax)*sizeof(t_elision));
+    if (pr==NULL)
+      return -1;
+    memcpy(pr,*run,(*nrun)*sizeof(t_elision));
+    GlobalFree((HGLOBAL)*run);
+    *run=pr;
+    *nrunmax*=2; };
+  pr=*run+*nrun;
+  pr->block=block;
+  pr->count=1;
+  pr->source=source;
+  (*nrun)++;
+  return 0;
+};
+
+// Replaces zero and repeating blocks of data by runs. Blocks that are seen
+// for the first time are kept in the hash table. On success, sets pbuf to
+// the new payload allocated with GlobalAlloc, psize to its size and returns
+// 0. Returns 1 if payload would be not shorter than data and -1 on low
+// memory.
+int Elidedata(uchar *data,ulong size,uchar **pbuf,ulong *psize) {
+  int k,nrun,nrunmax,*hash;
+  ulong i,h,nhash,nblock,source,nelided,headsize,pos;
+  uchar *p,*buf;
+  t_elision *run,*pr;
+  t_elidehead *ph;
+  nblock=size/NDATA;
+  if (nblock<2)
+    return 1;
+  for (nhash=NHASHMIN; nhash<2*nblock; nhash*=2) ;
+  hash=(int *)GlobalAlloc(GMEM_FIXED,nhash*sizeof(int));
+  nrunmax=256;
+  run=(t_elision *)GlobalAlloc(GMEM_FIXED,nrunmax*sizeof(t_elision));
+  if (hash==NULL || run==NULL) {
+    if (hash!=NULL) GlobalFree((HGLOBAL)hash);
+    if (run!=NULL) GlobalFree((HGLOBAL)run);
+    return -1; };
+  memset(hash,0xFF,nhash*sizeof(int));
+  nrun=0;
+  nelided=0;
+  for (i=0; i<nblock; i++) {
+    p=data+i*NDATA;
+    pr=(nrun>0 && run[nrun-1].block+run[nrun-1].count==i?run+nrun-1:NULL);
+    if (Iszeroblock(p))
+      source=ELIDEZERO;
+    else if (pr!=NULL && pr->source!=ELIDEZERO &&
+      memcmp(p,data+(pr->source+pr->count)*NDATA,NDATA)==0)
+      source=pr->source+pr->count;     // Repeated sequence continues
+    else {
+      // Look for the first occurrence of the block. Open addressing with
+      // linear probing, table is at most half full.
+      h=Hashblock(p) & (nhash-1);
+      source=ELIDENONE;
+      while (hash[h]>=0) {
+        if (memcmp(data+hash[h]*NDATA,p,NDATA)==0) {
+          source=hash[h];
+          break; };
+        h=(h+1) & (nhash-1); };
+      if (source==ELIDENONE) {
+        hash[h]=i;                     // New block is printed
+        continue;
+      };
+    };
+    nelided++;
+    // Extend previous run or start the new one.
+    if (pr!=NULL && (source==ELIDEZERO?pr->source==ELIDEZERO:
+      pr->source!=ELIDEZERO && pr->source+pr->count==source))
+      pr->count++;
+    else if (Addrun(&run,&nrun,&nrunmax,i,source)!=0) {
+      GlobalFree((HGLOBAL)hash);
+      GlobalFree((HGLOBAL)run);
+      return -1;
+    };
+  };
+  GlobalFree((HGLOBAL)hash);
+  headsize=sizeof(t_elidehead)+nrun*sizeof(t_elision);
+  if (nrun==0 || headsize+size-nelided*NDATA>=size) {
+    GlobalFree((HGLOBAL)run);
+    return 1; };
+  *psize=headsize+size-nelided*NDATA;
+  buf=(uchar *)GlobalAlloc(GPTR,(*psize+15) & 0xFFFFFFF0);
+  if (buf==NULL) {
+    GlobalFree((HGLOBAL)run);
+    return -1; };
+  ph=(t_elidehead *)buf;
+  ph->magic=ELIDEMAGIC;
+  ph->nrun=nrun;
+  ph->headsize=headsize;
+  ph->reserved=0;
+  memcpy(buf+sizeof(t_elidehead),run,nrun*sizeof(t_elision));
+  // Copy blocks between the runs and the incomplete last block.
+  pos=headsize;
+  for (i=0,k=0; k<=nrun; k++) {
+    h=(k<nrun?run[k].block:nblock);
+    memcpy(buf+pos,data+i*NDATA,(h-i)*NDATA);
+    pos+=(h-i)*NDATA;
+    if (k<nrun)
+      i=run[k].block+run[k].count;
+    ;
+  };
+  memcpy(buf+pos,data+nblock*NDATA,size-nblock*NDATA);
+  GlobalFree((HGLOBAL)run);
+  *pbuf=buf;
+  return 0;
+};
+
+// Restores origsize bytes of original data from the payload of datasize
+// bytes. Returns buffer allocated with GlobalAlloc that caller must free, or
+// NULL if payload is invalid or on low memory.
+uchar *Expanddata(uchar *data,ulong datasize,ulong origsize) {
+  int valid;
+  ulong i,j,k,n,nblock,pos;
+  uchar *out;
+  t_elidehead head;
+  t_elision r;
+  if (datasize<sizeof(head))
+    return NULL;
+  memcpy(&head,data,sizeof(head));
+  nblock=origsize/NDATA;
+  // Number of runs is limited before I calculate the size of the header, so
+  // that calculation can't overflow.
+  if (head.magic!=ELIDEMAGIC || head.nrun==0 || head.nrun>nblock ||
+    head.nrun>(datasize-sizeof(head))/sizeof(t_elision) ||
+    head.headsize!=sizeof(head)+head.nrun*sizeof(t_elision) ||
+    head.headsize>datasize)
+    return NULL;
+  out=(uchar *)GlobalAlloc(GMEM_FIXED,origsize);
+  if (out==NULL)
+    return NULL;
+  pos=head.headsize;
+  valid=0;
+  for (i=0,k=0; k<=head.nrun; k++) {
+    // Runs must follow each other, stay within the data and refer to the
+    // preceding blocks only. Then no offset below exceeds origsize.
+    if (k<head.nrun) {
+      memcpy(&r,data+sizeof(head)+k*sizeof(t_elision),sizeof(r));
+      if (r.block<i || r.block>nblock || r.count==0 ||
+        r.count>nblock-r.block ||
+        (r.source!=ELIDEZERO && r.source>=r.block))
+        break;
+      n=r.block; }
+    else
+      n=nblock;
+    if ((n-i)*NDATA>datasize-pos)
+      break;
+    memcpy(out+i*NDATA,data+pos,(n-i)*NDATA);
+    pos+=(n-i)*NDATA;
+    if (k==head.nrun) {
+      valid=1;
+      break; };
+    if (r.source==ELIDEZERO)
+      memset(out+r.block*NDATA,0,r.count*NDATA);
+    else {
+      for (j=0; j<r.count; j++)
+        memcpy(out+(r.block+j)*NDATA,out+(r.source+j)*NDATA,NDATA);
+      ;
+    };
+    i=r.block+r.count;
+  };
+  n=origsize-nblock*NDATA;
+  if (valid==0 || n>datasize-pos) {
+    GlobalFree((HGLOBAL)out);
+    return NULL; };
+  memcpy(out+nblock*NDATA,data+pos,n);
+  return out;
+};
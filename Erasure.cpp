@@ -0,0 +1,239 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+// MRPODS -- Machine-Readable Printed Optical Data Sheets                     //
+// https://github.com/sheafdynamics/mrpods                                    //
+//                                                                            //
+// Copyright (c) 2024 Ray Doll                                                //
+// Copyright (c) 2007 Oleh Yuschuk                                            //
+//                                                                            //
+// This file is part of MRPODS, which is built off                            //
+// Oleh Yuschuk's PaperBack https://ollydbg.de/Paperbak/                      //
+// MRPODS is cumulative work of passionate programmers,                       //
+// both named and unnamed, including freelancers and private contractors.     //
+// Without them, this would not be possible.                                  //
+// This software contains Oleh Yuschuk's original comments and                //
+// comments from other maintainers.                                           //
+//                                                                            //
+// MRPODS is free software; you can redistribute it and/or modify it under    //
+// the terms of the GNU General Public License as published by the Free       //
+// Software Foundation; either version 3 of the License, or (at your option)  //
+// any later version.                                                         //
+//                                                                            //
+// MRPODS is distributed in the hope that it will be useful, but WITHOUT      //
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or      //
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for   //
+// more details.                                                              //
+//                                                                            //
+// You should have received a copy of the GNU General Public License along    //
+// with this program. If not, see <http://www.gnu.org/licenses/>.             //
+//                                                                            //
+//                              bzip2 license                                 //
+// -------------------------------------------------------------------------- //
+// "bzip2", the associated library "libbzip2" copyright(C) 1996 - 2010        //
+// Julian R Seward. All rights reserved.                                      //
+// Julian Seward, jseward@acm.org                                             //
+// bzip2 / libbzip2 version 1.0.6 of 6 September 2010                         //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include <windows.h>
+#include <commctrl.h>
+#include <stdio.h>
+#include <direct.h>
+#include <math.h>
+#include "twain.h"
+#pragma hdrstop
+
+#include "mrpods.h"
+#include "resource.h"
+
+// Erasure code over GF(256) protects groups of data blocks. For ngroup data
+// blocks d[i] of the group, parity block j is the sum of coef[j][i]*d[i],
+// inverted on paper. Coefficients are taken from the Cauchy matrix
+// 1/(x[j]+y[i]) with y[i]=i and x[j]=NGROUPEC+j, so that any m parity blocks
+// restore any m missing data blocks. Columns are scaled to make the first
+// row all ones: parity block 0 is then the plain XOR checksum of the classic
+// format, and old decoders can still use it.
+//
+// Parity pages are built the same way across the stripe of up to PARSTRIPE
+// data pages, byte by byte at the same position on the page, with
+// x[j]=PARSTRIPE+j. Single parity page is XOR of all data pages (RAID-5),
+// two pages correspond to RAID-6.
+//
+// Blocks are only NDATA bytes long, so instead of vector shuffles I keep
+// full 256x256 multiplication table. Region operation costs one lookup and
+// one XOR per byte.
+
+#define GFPOLY         0x11D           // Primitive polynomial of GF(256)
+
+static uchar     gfexp[512];           // Powers of primitive element
+static uchar     gflog[256];           // Discrete logarithms
+static uchar     gfinv[256];           // Multiplicative inverses
+static uchar     gfmul[256][256];      // Multiplication table
+static uchar     coef[NPARITYMAX][NGROUPEC]; // Encoding coefficients
+static uchar     pagecoef[NPARPAGES][PARSTRIPE]; // Coefficients of pages
+
+// Initializes tables of erasure code. Call once at startup.
+void Initerasure(void) {
+  int i,j,x;
+  x=1;
+  for (i=0; i<255; i++) {
+    gfexp[i]=gfexp[i+255]=(uchar)x;
+    gflog[x]=(uchar)i;
+    x<<=1;
+    if (x & 0x100) x^=GFPOLY; };
+  for (i=1; i<256; i++) {
+    gfinv[i]=gfexp[255-gflog[i]];
+    for (j=1; j<256; j++)
+      gfmul[i][j]=gfexp[gflog[i]+gflog[j]];
+    ;
+  };
+  // Cauchy coefficient divided by the coefficient of the first row.
+  for (j=0; j<NPARITYMAX; j++) {
+    for (i=0; i<NGROUPEC; i++)
+      coef[j][i]=gfmul[gfinv[(NGROUPEC+j)^i]][NGROUPEC^i];
+    ;
+  };
+  for (j=0; j<NPARPAGES; j++) {
+    for (i=0; i<PARSTRIPE; i++)
+      pagecoef[j][i]=gfmul[gfinv[(PARSTRIPE+j)^i]][PARSTRIPE^i];
+    ;
+  };
+};
+
+// Multiplies n bytes of src by c and adds (XORs) result to dst.
+static void Muladd(uchar *dst,uchar *src,uchar c,int n) {
+  int i;
+  uchar *row;
+  if (c==0)
+    return;
+  if (c==1) {
+    for (i=0; i<n; i++) dst[i]^=src[i];
+    return; };
+  row=gfmul[c];
+  for (i=0; i<n; i++)
+    dst[i]^=row[src[i]];
+  ;
+};
+
+// Selects erasure group for the given redundancy (1 recovery block per
+// redundancy data blocks) so that paper overhead stays roughly the same but
+// several blocks of the group may be lost.
+void Erasurelayout(int redundancy,int *ngroup,int *nparity) {
+  int m;
+  m=max(2,NGROUPEC/max(redundancy,1));
+  m=min(m,NPARITYMAX);
+  *ngroup=min(NGROUPEC,m*redundancy);
+  *nparity=m;
+};
+
+// Adds data block with index i (0-based within the group) to the parity
+// block with index j. Parity blocks must be zeroed before the first call and
+// inverted after the last, as Finishparity() does.
+void Addparity(uchar *parity,int j,int i,uchar *data) {
+  Muladd(parity,data,coef[j][i],NDATA);
+};
+
+// Inverts n bytes of completed parity block or page.
+void Finishparity(uchar *parity,int n) {
+  int k;
+  for (k=0; k<n; k++)
+    parity[k]^=0xFF;
+  ;
+};
+
+// Adds n bytes of data page with index i (0-based within the stripe) to the
+// parity page with index j. Parity must be zeroed before the first call and
+// inverted after the last, as for parity blocks.
+void Addpageparity(uchar *parity,int j,int i,uchar *data,int n) {
+  Muladd(parity,data,pagecoef[j][i],n);
+};
+
+// Restores missing blocks of the ngroup blocks, NDATA bytes each, from the
+// nparity parity blocks with given indices. Coefficient of parity j and data
+// i is cf[j*ncf+i]. See Recovergroup() for details.
+static int Solve(uchar *group,uchar *valid,int ngroup,
+  uchar *parity,int *index,int nparity,uchar *cf,int ncf) {
+  int i,k,r,t,p,nmiss,miss[PARSTRIPE];
+  uchar a[NPARITYMAX][NPARITYMAX],b[NPARITYMAX][NPARITYMAX],c,*row;
+  uchar s[NPARITYMAX][NDATA];
+  nmiss=0;
+  for (i=0; i<ngroup; i++) {
+    if (valid[i]==0) miss[nmiss++]=i; };
+  if (nmiss==0)
+    return 0;                          // Nothing to restore
+  if (nmiss>nparity || nmiss>NPARITYMAX)
+    return -1;                         // Too many lost blocks
+  // Calculate syndromes: subtract known data from the first nmiss parities.
+  for (r=0; r<nmiss; r++) {
+    for (k=0; k<NDATA; k++)
+      s[r][k]=parity[r*NDATA+k]^0xFF;
+    for (i=0; i<ngroup; i++) {
+      if (valid[i]!=0)
+        Muladd(s[r],group+i*NDATA,cf[index[r]*ncf+i],NDATA);
+      ;
+    };
+  };
+  // Invert the square submatrix that maps missing data to syndromes. Cauchy
+  // submatrices are never singular, but indices may come from bad paper.
+  for (r=0; r<nmiss; r++) {
+    for (t=0; t<nmiss; t++) {
+      a[r][t]=cf[index[r]*ncf+miss[t]];
+      b[r][t]=(uchar)(r==t); };
+    ;
+  };
+  for (t=0; t<nmiss; t++) {
+    for (p=t; p<nmiss && a[p][t]==0; p++) ;
+    if (p>=nmiss)
+      return -1;                       // Duplicate parity indices
+    if (p!=t) {
+      for (k=0; k<nmiss; k++) {
+        c=a[p][k]; a[p][k]=a[t][k]; a[t][k]=c;
+        c=b[p][k]; b[p][k]=b[t][k]; b[t][k]=c;
+      };
+    };
+    c=gfinv[a[t][t]];
+    for (k=0; k<nmiss; k++) {
+      a[t][k]=gfmul[c][a[t][k]];
+      b[t][k]=gfmul[c][b[t][k]]; };
+    for (r=0; r<nmiss; r++) {
+      if (r==t || a[r][t]==0) continue;
+      row=gfmul[a[r][t]];
+      for (k=0; k<nmiss; k++) {
+        a[r][k]^=row[a[t][k]];
+        b[r][k]^=row[b[t][k]];
+      };
+    };
+  };
+  // Missing block t is the combination of syndromes with coefficients b[t].
+  for (t=0; t<nmiss; t++) {
+    memset(group+miss[t]*NDATA,0,NDATA);
+    for (r=0; r<nmiss; r++)
+      Muladd(group+miss[t]*NDATA,s[r],b[t][r],NDATA);
+    valid[miss[t]]=1; };
+  return nmiss;
+};
+
+// Restores missing data blocks of the group. Group consists of ngroup blocks
+// of NDATA bytes, valid[i] is nonzero if block i is known. There are nparity
+// parity blocks, as read from paper, with distinct indices in index. Returns
+// number of restored blocks (marked as valid), or -1 if there are more
+// missing blocks than parity blocks.
+int Recovergroup(uchar *group,uchar *valid,int ngroup,
+  uchar *parity,int *index,int nparity) {
+  if (ngroup<1 || ngroup>NGROUPEC)
+    return -1;                         // Invalid group
+  return Solve(group,valid,ngroup,parity,index,nparity,coef[0],NGROUPEC);
+};
+
+// Restores missing blocks at the same position on data pages of the stripe
+// from the blocks at this position on parity pages. Arguments are as in
+// Recovergroup(), with npages data pages instead of ngroup blocks.
+int Recoverstripe(uchar *blocks,uchar *valid,int npages,
+  uchar *parity,int *index,int nparity) {
+  if (npages<1 || npages>PARSTRIPE || nparity>NPARPAGES)
+    return -1;                         // Invalid stripe
+  return Solve(blocks,valid,npages,parity,index,nparity,pagecoef[0],PARSTRIPE);
+};
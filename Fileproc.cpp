@@ -49,31 +49,268 @@
 #include "mrpods.h"
 #include "resource.h"
 
+// Pages may be decoded by several threads at once. Each page is merged into
+// the table of processed files as a whole under this lock. Merging takes few
+// microseconds, decoding of the page - seconds, so one lock for all files is
+// sufficient.
+static CRITICAL_SECTION fproccs;
+
+// Table of processed files grows on demand, so there is no limit on the
+// number of files scanned in one session. Descriptors are found by the hash
+// of file identity, closed descriptors are chained into the free list and
+// reused. Gathered data of incomplete files that were not accessed for a long
+// time is evicted to temporary files when it exceeds memory budget.
+static int       nfprocmax;            // Allocated number of descriptors
+static int       fhash[NFHASH];        // Heads of hash chains, -1 if empty
+static int       firstfree;            // First free descriptor, -1 if none
+static ulong     usecount;             // Counter of accesses to descriptors
+static ulong     resident;             // Size of gathered data in memory
+static ulong     residentlimit;        // Memory budget for gathered data
+
+// Part selection dialog works on the copy of the table of contents, because
+// decoding threads may merge pages while dialog is open.
+static ulong     partorigsize;         // Size of original data
+static uchar     *parttoc;             // Table of contents or NULL
+static ulong     parttocsize;          // Size of table of contents, bytes
+static int       partsel;              // Selected entry of archive or -1
+static ulong     partfrom;             // Selected start of range
+static ulong     partcount;            // Selected size of range
+
+// Releases memory, temporary file and hash chain entry of descriptor with
+// given index and adds descriptor to the list of free descriptors.
+static void Releasefproc(int slot) {
+  int i,*pslot;
+  t_fproc *pf;
+  pf=fproc+slot;
+  if (pf->busy==0)
+    return;                            // Already free
+  if (pf->datavalid!=NULL) {
+    GlobalFree((HGLOBAL)pf->datavalid);
+    GlobalFree((HGLOBAL)pf->data);
+    resident-=pf->ntotal*(NDATA+1); };
+  if (pf->spillname[0]!='\0')
+    DeleteFile(pf->spillname);
+  if (pf->soft!=NULL)
+    GlobalFree((HGLOBAL)pf->soft);
+  // Remove descriptor from the hash chain.
+  pslot=fhash+pf->hash%NFHASH;
+  for (i=*pslot; i>=0 && i!=slot; i=*pslot)
+    pslot=&fproc[i].hashnext;
+  if (i==slot)
+    *pslot=pf->hashnext;
+  memset(pf,0,sizeof(t_fproc));
+  pf->hashnext=firstfree;
+  firstfree=slot;
+};
+
+// Initializes file processor. Call once at startup.
+void Initfileprocessor(void) {
+  int i;
+  MEMORYSTATUSEX ms;
+  InitializeCriticalSection(&fproccs);
+  for (i=0; i<NFHASH; i++)
+    fhash[i]=-1;
+  firstfree=-1;
+  // I keep up to the quarter of physical memory for data of incomplete files.
+  residentlimit=MINRESIDENT;
+  ms.dwLength=sizeof(ms);
+  if (GlobalMemoryStatusEx(&ms)!=0) {
+    if (ms.ullTotalPhys/4>MAXRESIDENT)
+      residentlimit=MAXRESIDENT;
+    else if (ms.ullTotalPhys/4>MINRESIDENT)
+      residentlimit=(ulong)(ms.ullTotalPhys/4);
+    ;
+  };
+};
+
+// Frees resources of file processor. Call once on exit.
+void Freefileprocessor(void) {
+  int slot;
+  for (slot=0; slot<nfproc; slot++)
+    Releasefproc(slot);
+  if (fproc!=NULL)
+    GlobalFree((HGLOBAL)fproc);
+  fproc=NULL;
+  nfproc=nfprocmax=0;
+  DeleteCriticalSection(&fproccs);
+};
 
 // Clears descriptor of processed file with given index.
 void Closefproc(int slot) {
-  if (slot<0 || slot>=NFILE)
-    return;                            // Error in input data
-  if (fproc[slot].datavalid!=NULL)
-    GlobalFree((HGLOBAL)fproc[slot].datavalid);
-  if (fproc[slot].data!=NULL)
-    GlobalFree((HGLOBAL)fproc[slot].data);
+  EnterCriticalSection(&fproccs);
+  if (slot>=0 && slot<nfproc) {
+    Releasefproc(slot);
+    Updatefileinfo(slot,fproc+slot); };
+  LeaveCriticalSection(&fproccs);
+};
+
+// Shows information about processed file with given index. Call from the main
+// thread only.
+void Showfileinfo(int slot) {
+  EnterCriticalSection(&fproccs);
+  if (slot>=0 && slot<nfproc)
+    Updatefileinfo(slot,fproc+slot);
+  LeaveCriticalSection(&fproccs);
+};
+
+// Calculates hash of file identity. Files with the same name (case-
+// insensitive), mode, timestamp and sizes get the same hash.
+static ulong Hashfile(t_superblock *superblock) {
+  int i;
+  uchar c;
+  ulong h;
+  h=2166136261;                        // FNV-1a
+  for (i=0; i<64 && superblock->name[i]!='\0'; i++) {
+    c=superblock->name[i];
+    if (c>='A' && c<='Z') c+='a'-'A';
+    h=(h^c)*16777619; };
+  h=(h^superblock->mode)*16777619;
+  h=(h^superblock->modified.dwLowDateTime)*16777619;
+  h=(h^superblock->modified.dwHighDateTime)*16777619;
+  h=(h^superblock->datasize)*16777619;
+  h=(h^superblock->origsize)*16777619;
+  return h^(h>>16);
+};
+
+// Gets free descriptor, growing the table if necessary. Returns index of
+// zeroed descriptor or -1 on low memory. Pointers to descriptors become
+// invalid!
+static int Newfproc(void) {
+  int slot,n;
+  t_fproc *pnew;
+  if (firstfree>=0) {
+    slot=firstfree;
+    firstfree=fproc[slot].hashnext; }
+  else {
+    if (nfproc>=nfprocmax) {
+      n=max(16,nfprocmax*2);
+      pnew=(t_fproc *)GlobalAlloc(GPTR,n*sizeof(t_fproc));
+      if (pnew==NULL)
+        return -1;                     // Low memory
+      if (fproc!=NULL) {
+        memcpy(pnew,fproc,nfproc*sizeof(t_fproc));
+        GlobalFree((HGLOBAL)fproc); };
+      fproc=pnew;
+      nfprocmax=n; };
+    slot=nfproc++; };
   memset(fproc+slot,0,sizeof(t_fproc));
-  Updatefileinfo(slot,fproc+slot);
+  return slot;
+};
+
+// Writes gathered data of the least recently used file, except for the file
+// with index keep, to temporary file and frees memory. Returns 0 on success
+// and -1 if there is nothing to evict or on error.
+static int Spilloldest(int keep) {
+  int slot,victim;
+  ulong l,m;
+  char path[MAX_PATH];
+  t_fproc *pf;
+  HANDLE hfile;
+  victim=-1;
+  for (slot=0,pf=fproc; slot<nfproc; slot++,pf++) {
+    if (slot==keep || pf->busy==0 || pf->datavalid==NULL || pf->saving)
+      continue;
+    if (victim<0 || pf->lastused<fproc[victim].lastused)
+      victim=slot;
+    ;
+  };
+  if (victim<0)
+    return -1;                         // Nothing to evict
+  pf=fproc+victim;
+  if (GetTempPath(MAX_PATH,path)==0 ||
+    GetTempFileName(path,"mrp",0,pf->spillname)==0
+  ) {
+    pf->spillname[0]='\0';
+    return -1; };
+  hfile=CreateFile(pf->spillname,GENERIC_WRITE,0,NULL,
+    CREATE_ALWAYS,FILE_ATTRIBUTE_TEMPORARY,NULL);
+  l=m=0;
+  if (hfile!=INVALID_HANDLE_VALUE) {
+    WriteFile(hfile,pf->datavalid,pf->ntotal,&l,NULL);
+    WriteFile(hfile,pf->data,pf->ntotal*NDATA,&m,NULL);
+    CloseHandle(hfile); };
+  if (l!=(ulong)pf->ntotal || m!=(ulong)pf->ntotal*NDATA) {
+    DeleteFile(pf->spillname);         // Disk full?
+    pf->spillname[0]='\0';
+    return -1; };
+  GlobalFree((HGLOBAL)pf->datavalid);
+  GlobalFree((HGLOBAL)pf->data);
+  pf->datavalid=NULL;
+  pf->data=NULL;
+  resident-=pf->ntotal*(NDATA+1);
+  // Soft values are only hints, I simply discard them.
+  if (pf->soft!=NULL)
+    GlobalFree((HGLOBAL)pf->soft);
+  pf->soft=NULL;
+  pf->nsoft=pf->nsoftmax=0;
+  return 0;
+};
+
+// Allocates zeroed buffers for gathered data of file with given index,
+// evicting other files if memory budget is exceeded. Returns 0 on success
+// and -1 on low memory.
+static int Allocfproc(int slot) {
+  ulong size;
+  t_fproc *pf;
+  pf=fproc+slot;
+  size=pf->ntotal*(NDATA+1);
+  while (resident+size>residentlimit && Spilloldest(slot)==0) ;
+  while (1) {
+    pf->datavalid=(uchar *)GlobalAlloc(GPTR,pf->ntotal);
+    pf->data=(uchar *)GlobalAlloc(GPTR,pf->ntotal*NDATA);
+    if (pf->datavalid!=NULL && pf->data!=NULL)
+      break;
+    if (pf->datavalid!=NULL) GlobalFree((HGLOBAL)pf->datavalid);
+    if (pf->data!=NULL) GlobalFree((HGLOBAL)pf->data);
+    pf->datavalid=NULL;
+    pf->data=NULL;
+    if (Spilloldest(slot)!=0)
+      return -1;                       // Nothing more to evict
+    ;
+  };
+  resident+=size;
+  return 0;
+};
+
+// Makes sure that gathered data of file with given index is in memory,
+// reading it back from temporary file if it was evicted. Returns 0 on success
+// and -1 on error.
+static int Loadfproc(int slot) {
+  ulong l,m;
+  t_fproc *pf;
+  HANDLE hfile;
+  pf=fproc+slot;
+  if (pf->datavalid!=NULL)
+    return 0;                          // Data already in memory
+  if (Allocfproc(slot)!=0)
+    return -1;
+  hfile=CreateFile(pf->spillname,GENERIC_READ,0,NULL,
+    OPEN_EXISTING,FILE_ATTRIBUTE_TEMPORARY,NULL);
+  l=m=0;
+  if (hfile!=INVALID_HANDLE_VALUE) {
+    ReadFile(hfile,pf->datavalid,pf->ntotal,&l,NULL);
+    ReadFile(hfile,pf->data,pf->ntotal*NDATA,&m,NULL);
+    CloseHandle(hfile); };
+  if (l!=(ulong)pf->ntotal || m!=(ulong)pf->ntotal*NDATA)
+    return -1;                         // Keep file, maybe error is temporary
+  DeleteFile(pf->spillname);
+  pf->spillname[0]='\0';
+  return 0;
 };
 
 // Starts new decoded page. Returns non-negative index to table of processed
-// files on success or -1 on error.
-int Startnextpage(t_superblock *superblock) {
-  int i,slot,freeslot;
+// files on success or -1 on error (reason is in error).
+static int Startnextpage(t_superblock *superblock,char *error) {
+  int i,n,slot;
+  ulong hash;
   t_fproc *pf;
   // Check whether file is already in the list of processed files. If not,
   // initialize new descriptor.
-  freeslot=-1;
-  for (slot=0,pf=fproc; slot<NFILE; slot++,pf++) {
-    if (pf->busy==0) {                 // Empty descriptor
-      if (freeslot<0) freeslot=slot;
-      continue; };
+  hash=Hashfile(superblock);
+  for (slot=fhash[hash%NFHASH]; slot>=0; slot=pf->hashnext) {
+    pf=fproc+slot;
+    if (pf->hash!=hash)
+      continue;                        // Different hash, sure mismatch
     if (_strnicmp(pf->name,superblock->name,64)!=0)
       continue;                        // Different file name
     if (pf->mode!=superblock->mode)
@@ -90,23 +327,49 @@ int Startnextpage(t_superblock *superblock) {
     if (pf->pagesize!=superblock->pagesize)
       pf->pagesize=0;
     break; };
-  if (slot>=NFILE) {
+  if (slot>=0) {
+    // Data of the file that is being saved must not change.
+    if (pf->saving) {
+      sprintf(error,"File is being saved, please scan this page again");
+      return -1; };
+    // Existing file, bring back its data if it was evicted.
+    if (Loadfproc(slot)!=0) {
+      sprintf(error,"Unable to read back data of file evicted to disk");
+      return -1; }; }
+  else {
     // No matching descriptor, create new one.
-    if (freeslot<0) {
-      Reporterror("Maximal number of processed files exceeded");
+    slot=Newfproc();
+    if (slot<0) {
+      sprintf(error,"Low memory");
       return -1; };
-    slot=freeslot;
     pf=fproc+slot;
-    memset(pf,0,sizeof(t_fproc));
-    // Allocate block and recovery tables.
+    // Allocate block and recovery tables. With parity pages, data is followed
+    // by zero padding up to the end of the last data page and by the parity
+    // pages of all stripes.
     pf->nblock=(superblock->datasize+NDATA-1)/NDATA;
-    pf->datavalid=(uchar *)GlobalAlloc(GPTR,pf->nblock);
-    pf->data=(uchar *)GlobalAlloc(GPTR,pf->nblock*NDATA);
-    if (pf->datavalid==NULL || pf->data==NULL) {
-      if (pf->datavalid!=NULL) GlobalFree((HGLOBAL)pf->datavalid);
-      if (pf->data!=NULL) GlobalFree((HGLOBAL)pf->data);
-      Reporterror("Low memory");
+    pf->ntotal=pf->nblock;
+    pf->nparpages=(superblock->mode & PBM_PARPAGES)>>3;
+    n=0;
+    if (pf->nparpages>0 && superblock->pagesize>0 &&
+      superblock->pagesize%NDATA==0
+    ) {
+      n=(superblock->datasize+superblock->pagesize-1)/superblock->pagesize;
+      i=n+(n+PARSTRIPE-1)/PARSTRIPE*pf->nparpages;
+      if ((double)i*superblock->pagesize>MAXSIZE)
+        pf->nparpages=0;               // Invalid superblock
+      else {
+        n*=superblock->pagesize/NDATA;
+        pf->ntotal=i*(superblock->pagesize/NDATA);
+      }; }
+    else
+      pf->nparpages=0;
+    if (Allocfproc(slot)!=0) {
+      pf->hashnext=firstfree;          // Return descriptor to free list
+      firstfree=slot;
+      sprintf(error,"Low memory");
       return -1; };
+    for (i=pf->nblock; i<n; i++)
+      pf->datavalid[i]=1;              // Padding is known to be zero
     // Initialize remaining fields.
     memcpy(pf->name,superblock->name,64);
     pf->modified=superblock->modified;
@@ -123,28 +386,145 @@ int Startnextpage(t_superblock *superblock) {
     pf->ndata=0;
     for (i=0; i<pf->npages && i<8; i++)
       pf->rempages[i]=i+1;
-    // Initialize statistics and declare descriptor as busy.
+    // Initialize statistics.
     pf->goodblocks=0;
     pf->badblocks=0;
     pf->restoredbytes=0;
     pf->recoveredblocks=0;
+    // Add descriptor to the hash chain and declare it as busy.
+    pf->hash=hash;
+    pf->hashnext=fhash[hash%NFHASH];
+    fhash[hash%NFHASH]=slot;
     pf->busy=1; };
   // Invalidate page limits and report success.
   pf=fproc+slot;
+  pf->lastused=++usecount;
   pf->page=superblock->page;
   pf->ngroup=superblock->ngroup;
   pf->minpageaddr=0xFFFFFFFF;
   pf->maxpageaddr=0;
-  Updatefileinfo(slot,pf);
   return slot;
 };
 
+// Compares data blocks of the page with the data gathered so far. Data of
+// evicted file is not loaded back, I read only the necessary blocks from the
+// temporary file. Returns number of identical blocks, or -1 if some block
+// differs or on error.
+static int Matchpage(t_fproc *pf,t_block *blocklist,int nblock) {
+  int i,nmatch;
+  ulong l;
+  LONG high;
+  uchar valid,buf[NDATA];
+  t_block *pb;
+  HANDLE hfile;
+  nmatch=0;
+  if (pf->datavalid!=NULL) {
+    for (i=0,pb=blocklist; i<nblock; i++,pb++) {
+      if (pb->recsize!=0 || pf->datavalid[pb->addr/NDATA]!=1)
+        continue;
+      if (memcmp(pf->data+pb->addr,pb->data,NDATA)!=0)
+        return -1;                     // Different data, wrong file
+      nmatch++; };
+    return nmatch; };
+  hfile=CreateFile(pf->spillname,GENERIC_READ,0,NULL,
+    OPEN_EXISTING,FILE_ATTRIBUTE_TEMPORARY,NULL);
+  if (hfile==INVALID_HANDLE_VALUE)
+    return -1;
+  // Temporary file keeps ntotal validity bytes followed by the data.
+  for (i=0,pb=blocklist; i<nblock; i++,pb++) {
+    if (pb->recsize!=0)
+      continue;
+    high=0;
+    l=0;
+    if (SetFilePointer(hfile,(LONG)(pb->addr/NDATA),&high,FILE_BEGIN)!=
+      pb->addr/NDATA || ReadFile(hfile,&valid,1,&l,NULL)==0 || l!=1)
+      break;
+    if (valid!=1)
+      continue;
+    high=0;
+    l=0;
+    if (SetFilePointer(hfile,(LONG)(pf->ntotal+pb->addr),&high,FILE_BEGIN)!=
+      pf->ntotal+pb->addr || ReadFile(hfile,buf,NDATA,&l,NULL)==0 ||
+      l!=NDATA || memcmp(buf,pb->data,NDATA)!=0)
+      break;
+    nmatch++; };
+  CloseHandle(hfile);
+  return (i<nblock?-1:nmatch);
+};
+
+// Attributes page with unreadable label to one of the files in work by the
+// addresses of recognized blocks. All blocks must lie on the same page of the
+// file, and data blocks that were already gathered must be identical. Page
+// that merely fits the file is not attributed to it: when scanning mixed
+// pages, it may as well belong to the backup that was not seen yet. Only the
+// file that already shares some data with the page is accepted. On success,
+// fills superblock with the properties of the file and returns 0. Returns -1
+// if there is no such file or if the choice is ambiguous (reason is in error).
+static int Attributepage(t_superblock *superblock,t_block *blocklist,
+  int nblock,char *error) {
+  int i,slot,page,nstrong,strong;
+  ulong a;
+  t_block *pb;
+  t_fproc *pf;
+  nstrong=0;
+  strong=-1;
+  for (slot=0,pf=fproc; slot<nfproc; slot++,pf++) {
+    if (pf->busy==0 || pf->pagesize==0 || pf->pagesize%NDATA!=0)
+      continue;                        // Free or page geometry is unknown
+    // Check that all blocks fit the same page.
+    page=0;
+    for (i=0,pb=blocklist; i<nblock; i++,pb++) {
+      if (pb->recsize==0)
+        a=pb->addr;
+      else
+        a=pb->addr/pb->recsize*pb->recsize;
+      if (a%NDATA!=0 || a>=(ulong)pf->ntotal*NDATA)
+        break;                         // Invalid alignment or outside file
+      if (page==0)
+        page=a/pf->pagesize+1;
+      else if (a/pf->pagesize+1!=(ulong)page)
+        break;                         // Blocks from different pages
+      ;
+    };
+    if (i<nblock || page==0)
+      continue;
+    // Compare with gathered data.
+    if (Matchpage(pf,blocklist,nblock)>0) {
+      nstrong++; strong=slot;
+    };
+  };
+  if (nstrong==1)
+    slot=strong;
+  else {
+    if (nstrong==0)
+      sprintf(error,"Page label is not readable");
+    else
+      sprintf(error,"Page label is not readable and page fits several files");
+    return -1; };
+  // Reconstruct superblock. Actual NGROUP is already known from the recovery
+  // blocks on the page.
+  pf=fproc+slot;
+  a=(blocklist[0].recsize==0?blocklist[0].addr:
+    blocklist[0].addr/blocklist[0].recsize*blocklist[0].recsize);
+  superblock->addr=SUPERBLOCK;
+  superblock->datasize=pf->datasize;
+  superblock->pagesize=pf->pagesize;
+  superblock->origsize=pf->origsize;
+  superblock->mode=pf->mode;
+  superblock->page=(ushort)(a/pf->pagesize+1);
+  superblock->modified=pf->modified;
+  superblock->attributes=pf->attributes;
+  superblock->filecrc=pf->filecrc;
+  memcpy(superblock->name,pf->name,64);
+  return 0;
+};
+
 // Adds block recognized by decoder to file described by file descriptor with
 // specified index. Returns 0 on success and -1 on any error.
-int Addblock(t_block *block,int slot) {
+static int Addblock(t_block *block,int slot) {
   int i,j;
   t_fproc *pf;
-  if (slot<0 || slot>=NFILE)
+  if (slot<0 || slot>=nfproc)
     return -1;                         // Invalid index of file descriptor
   pf=fproc+slot;
   if (pf->busy==0)
@@ -155,14 +535,26 @@ int Addblock(t_block *block,int slot) {
     i=block->addr/NDATA;
     if ((ulong)(i*NDATA)!=block->addr)
       return -1;                       // Invalid data alignment
-    if (i>=pf->nblock)
+    if (i>=pf->ntotal)
       return -1;                       // Data outside the data size
     if (pf->datavalid[i]!=1) {
       memcpy(pf->data+block->addr,block->data,NDATA);
       pf->datavalid[i]=1;              // Valid data
-      pf->ndata++; };
+      if (i<pf->nblock) pf->ndata++; };
     pf->minpageaddr=min(pf->minpageaddr,block->addr);
     pf->maxpageaddr=max(pf->maxpageaddr,block->addr+NDATA); }
+  else if (pf->mode & PBM_ERASURE) {
+    // Erasure-coded recovery block, j-th in the group. It is used directly
+    // from the list of blocks when page is finished.
+    if (block->recsize!=(ulong)(pf->ngroup*NDATA))
+      return -1;                       // Invalid recovery scope
+    i=block->addr/block->recsize;
+    if (block->addr%NDATA!=0 || block->addr%block->recsize>=NPARITYMAX*NDATA)
+      return -1;                       // Invalid data alignment
+    if (i*pf->ngroup>=pf->ntotal)
+      return -1;                       // Data outside the data size
+    pf->minpageaddr=min(pf->minpageaddr,i*block->recsize);
+    pf->maxpageaddr=max(pf->maxpageaddr,(i+1)*block->recsize); }
   else {
     // Data recovery block. I write it to all free locations within the group.
     if (block->recsize!=(ulong)(pf->ngroup*NDATA))
@@ -172,7 +564,7 @@ int Addblock(t_block *block,int slot) {
       return -1;                       // Invalid data alignment
     i=block->addr/NDATA;
     for (j=i; j<i+pf->ngroup; j++) {
-      if (j>=pf->nblock)
+      if (j>=pf->ntotal)
         return -1;                     // Data outside the data size
       if (pf->datavalid[j]!=0) continue;
       memcpy(pf->data+j*NDATA,block->data,NDATA);
@@ -184,14 +576,342 @@ int Addblock(t_block *block,int slot) {
   return 0;
 };
 
-// Processes gathered data. Returns -1 on error, 0 if file is complete and
-// number of pages to scan if there is still missing data. In the last case,
-// fills list of several first remaining pages in file descriptor.
-int Finishpage(int slot,int ngood,int nbad,ulong nrestored) {
-  int i,j,r,rmin,rmax,nrec,irec,firstblock,nrempages;
+// Tries to read block from accumulated soft values. Bytes with the lowest
+// confidence are declared erasures, this allows ECC to correct up to twice as
+// many bytes. Returns 0 on success and -1 if block is still unreadable.
+static int Decodesoft(t_softcell *pc,t_data *result) {
+  int i,j,k,n,answer,conf[sizeof(t_data)],order[sizeof(t_data)],eras[32];
+  ushort crc;
+  // Get confidence of each byte as the confidence of its weakest bit.
+  for (i=0; i<(int)sizeof(t_data); i++) {
+    conf[i]=0x7FFFFFFF;
+    for (j=i*8; j<i*8+8; j++) conf[i]=min(conf[i],abs(pc->sum[j])); };
+  // Sort bytes by increasing confidence (insertion sort, there are only 128).
+  for (i=0; i<(int)sizeof(t_data); i++) {
+    for (j=i; j>0 && conf[order[j-1]]>conf[i]; j--)
+      order[j]=order[j-1];
+    order[j]=i; };
+  // Try plain decoding first, then with 8 and 16 erasures. I stop at 16 to
+  // keep ECC redundancy for detection of miscorrected blocks.
+  for (n=0; n<=16; n+=8) {
+    memset(result,0,sizeof(t_data));
+    for (j=0; j<NDOT*NDOT; j++) {
+      if (pc->sum[j]>0) ((ulong *)result)[j/NDOT]|=1<<(j%NDOT); };
+    for (k=0; k<n; k++)
+      eras[k]=order[k]+127;            // Positions in padded codeword
+    answer=Decode8((uchar *)result,eras,n,127);
+    if (answer<0)
+      continue;
+    crc=(ushort)(Crc16((uchar *)result,NDATA+4)^0x55AA);
+    if (crc==result->crc)
+      return 0;
+    ;
+  };
+  return -1;
+};
+
+// Adds soft values of blocks that were unreadable on the current page to
+// the values accumulated from the previous scans of this page and tries to
+// read combined blocks. Blocks that are read are appended to outlist.
+// Returns number of added blocks.
+static int Combinesoft(int slot,t_soft *softlist,int nsoft,t_block *outlist) {
+  int i,j,k,n,v,ngroup;
+  t_data result;
+  t_soft *ps;
+  t_softcell *pc,*pnew;
+  t_fproc *pf;
+  pf=fproc+slot;
+  n=0;
+  for (i=0,ps=softlist; i<nsoft; i++,ps++) {
+    // Find accumulated values of this block, or start new.
+    for (k=0,pc=pf->soft; k<pf->nsoft; k++,pc++) {
+      if (pc->page==pf->page && pc->posx==ps->posx && pc->posy==ps->posy &&
+        pc->orientation==ps->orientation) break;
+      ;
+    };
+    if (k>=pf->nsoft) {
+      if (pf->nsoft>=MAXSOFTCELL)
+        continue;                      // Too many unreadable blocks
+      if (pf->nsoft>=pf->nsoftmax) {
+        j=min(MAXSOFTCELL,max(64,pf->nsoftmax*2));
+        pnew=(t_softcell *)GlobalAlloc(GMEM_FIXED,j*sizeof(t_softcell));
+        if (pnew==NULL)
+          continue;                    // Low memory, not critical
+        if (pf->soft!=NULL) {
+          memcpy(pnew,pf->soft,pf->nsoft*sizeof(t_softcell));
+          GlobalFree((HGLOBAL)pf->soft); };
+        pf->soft=pnew;
+        pf->nsoftmax=j; };
+      pc=pf->soft+pf->nsoft;
+      memset(pc,0,sizeof(t_softcell));
+      pc->page=pf->page;
+      pc->posx=ps->posx;
+      pc->posy=ps->posy;
+      pc->orientation=ps->orientation;
+      pf->nsoft++; };
+    // Voting weighted by confidence is simply the sum of soft values.
+    for (j=0; j<NDOT*NDOT; j++) {
+      v=pc->sum[j]+ps->dot[j];
+      pc->sum[j]=(short)max(-32767,min(v,32767)); };
+    pc->nscan++;
+    if (Decodesoft(pc,&result)!=0)
+      continue;
+    // Block is read. Superblocks are of no interest here, page is already
+    // identified.
+    if (result.addr!=SUPERBLOCK) {
+      outlist[n].addr=result.addr & 0x0FFFFFFF;
+      ngroup=(result.addr>>28) & 0x0000000F;
+      if (ngroup>0 && pf->ngroup==0)
+        pf->ngroup=ngroup;
+      outlist[n].recsize=ngroup*NDATA;
+      memcpy(outlist[n].data,result.data,NDATA);
+      n++; };
+    // Accumulated values are no longer necessary.
+    pf->nsoft--;
+    if (k<pf->nsoft)
+      memcpy(pc,pf->soft+pf->nsoft,sizeof(t_softcell));
+    ;
+  };
+  return n;
+};
+
+// Restores missing data blocks of erasure-coded groups on the current page
+// from the recovery blocks in the blocklist. Recovery blocks are not kept
+// between scans, but restored data is.
+static void Restoreerasures(int slot,t_block *blocklist,int nblock) {
+  int i,j,k,n,r,rmin,rmax,ngroup,npar,index[NPARITYMAX];
+  uchar valid[NGROUPEC],group[NGROUPEC*NDATA],parity[NPARITYMAX*NDATA];
+  t_block *pb;
+  t_fproc *pf;
+  pf=fproc+slot;
+  ngroup=pf->ngroup;
+  if (ngroup<=0 || ngroup>NGROUPEC || pf->maxpageaddr==0)
+    return;                            // No recovery blocks or no data
+  rmin=pf->minpageaddr/(NDATA*ngroup);
+  rmax=(pf->maxpageaddr-1)/(NDATA*ngroup);
+  for (r=rmin; r<=rmax && r*ngroup<pf->ntotal; r++) {
+    // Gather data of the group. Blocks beyond the end of data are zeros.
+    n=0;
+    for (i=0; i<ngroup; i++) {
+      j=r*ngroup+i;
+      if (j>=pf->ntotal) {
+        memset(group+i*NDATA,0,NDATA);
+        valid[i]=1; }
+      else if (pf->datavalid[j]==1) {
+        memcpy(group+i*NDATA,pf->data+j*NDATA,NDATA);
+        valid[i]=1; }
+      else {
+        valid[i]=0;
+        n++;
+      };
+    };
+    if (n==0)
+      continue;                        // Group is complete
+    // Gather as many distinct recovery blocks of the group as necessary.
+    npar=0;
+    for (i=0,pb=blocklist; i<nblock && npar<n; i++,pb++) {
+      if (pb->recsize!=(ulong)(ngroup*NDATA) || pb->addr/pb->recsize!=(ulong)r)
+        continue;                      // Data or foreign recovery block
+      j=(pb->addr%pb->recsize)/NDATA;
+      if (j>=NPARITYMAX)
+        continue;                      // Invalid index
+      for (k=0; k<npar && index[k]!=j; k++) ;
+      if (k<npar)
+        continue;                      // Same block scanned twice
+      index[npar]=j;
+      memcpy(parity+npar*NDATA,pb->data,NDATA);
+      npar++; };
+    if (npar<n)
+      continue;                        // Too many blocks lost
+    if (Recovergroup(group,valid,ngroup,parity,index,npar)<=0)
+      continue;
+    // Copy restored blocks back.
+    for (i=0; i<ngroup; i++) {
+      j=r*ngroup+i;
+      if (j>=pf->ntotal || pf->datavalid[j]==1)
+        continue;
+      memcpy(pf->data+j*NDATA,group+i*NDATA,NDATA);
+      pf->datavalid[j]=1;
+      pf->recoveredblocks++;
+      if (j<pf->nblock) pf->ndata++;
+    };
+  };
+};
+
+// Rebuilds missing blocks of data pages from parity pages. Blocks at the same
+// position on the data pages of the stripe form a group protected by the
+// blocks at this position on the parity pages of the stripe, so whole lost
+// pages can be restored.
+static void Restorepages(int slot) {
+  int i,j,o,s,b,ppb,nstripe,first,nd,nmiss,npar,index[NPARPAGES];
+  uchar valid[PARSTRIPE],blocks[PARSTRIPE*NDATA],parity[NPARPAGES*NDATA];
+  t_fproc *pf;
+  pf=fproc+slot;
+  if (pf->nparpages==0 || pf->pagesize==0 || pf->ndata==pf->nblock)
+    return;                            // No parity pages or nothing to do
+  ppb=pf->pagesize/NDATA;
+  nstripe=(pf->npages+PARSTRIPE-1)/PARSTRIPE;
+  for (s=0; s<nstripe; s++) {
+    first=s*PARSTRIPE;
+    nd=min(PARSTRIPE,pf->npages-first);
+    for (o=0; o<ppb; o++) {
+      // Count missing blocks at this position.
+      nmiss=0;
+      for (i=0; i<nd; i++) {
+        if (pf->datavalid[(first+i)*ppb+o]!=1) nmiss++; };
+      if (nmiss==0)
+        continue;
+      // Gather parity blocks at this position.
+      npar=0;
+      for (j=0; j<pf->nparpages && npar<nmiss; j++) {
+        b=(pf->npages+s*pf->nparpages+j)*ppb+o;
+        if (pf->datavalid[b]!=1)
+          continue;
+        index[npar]=j;
+        memcpy(parity+npar*NDATA,pf->data+b*NDATA,NDATA);
+        npar++; };
+      if (npar<nmiss)
+        continue;                      // Not enough parity pages scanned
+      for (i=0; i<nd; i++) {
+        b=(first+i)*ppb+o;
+        valid[i]=(uchar)(pf->datavalid[b]==1);
+        if (valid[i]) memcpy(blocks+i*NDATA,pf->data+b*NDATA,NDATA); };
+      if (Recoverstripe(blocks,valid,nd,parity,index,npar)<=0)
+        continue;
+      // Copy restored blocks back.
+      for (i=0; i<nd; i++) {
+        b=(first+i)*ppb+o;
+        if (pf->datavalid[b]==1)
+          continue;
+        memcpy(pf->data+b*NDATA,blocks+i*NDATA,NDATA);
+        pf->datavalid[b]=1;
+        pf->recoveredblocks++;
+        if (b<pf->nblock) pf->ndata++;
+      };
+    };
+  };
+};
+
+// User may restore one file of the archive or a range of bytes without
+// scanning the whole backup. Uncompressed data lies on paper at the same
+// offsets as in the original. Compressed data is preceded by the index of
+// frames (PBM_FRAMED) that says where each bzip2 block starts in the stream
+// and in the original data, so only the pages with the index and with the
+// blocks that cover the part are necessary.
+
+// Checks whether blocks first..last of gathered data are all valid.
+static int Blocksvalid(t_fproc *pf,int first,int last) {
+  int j;
+  if (last>=pf->nblock)
+    return 0;
+  for (j=first; j<=last; j++) {
+    if (pf->datavalid[j]!=1) return 0; };
+  return 1;
+};
+
+// Checks whether bytes start..end-1 of gathered data are all valid.
+static int Rangevalid(t_fproc *pf,ulong start,ulong end) {
+  if (end<=start)
+    return 1;
+  if (end>pf->datasize)
+    return 0;
+  return Blocksvalid(pf,start/NDATA,(end-1)/NDATA);
+};
+
+// Returns pointer to the frame index in the gathered data and sets nframe to
+// the number of frames, or returns NULL if data has no index, if index is
+// not yet restored or is invalid.
+static t_frame *Getindex(t_fproc *pf,int *nframe) {
+  int i,n;
+  t_framehead *ph;
+  t_frame *pr;
+  if ((pf->mode & PBM_COMPRESSED)==0 || (pf->mode & PBM_FRAMED)==0 ||
+    Rangevalid(pf,0,sizeof(t_framehead))==0)
+    return NULL;
+  ph=(t_framehead *)pf->data;
+  if (ph->magic!=FRAMEMAGIC || ph->nframe==0 ||
+    ph->nframe>pf->datasize/sizeof(t_frame) ||
+    ph->indexsize!=sizeof(t_framehead)+(ph->nframe+1)*sizeof(t_frame) ||
+    ph->indexsize+4>pf->datasize || Rangevalid(pf,0,ph->indexsize)==0)
+    return NULL;
+  // Frames must follow each other and cover all data.
+  n=ph->nframe;
+  pr=(t_frame *)(pf->data+sizeof(t_framehead));
+  if (pr[0].origoffset!=0 || pr[0].bitoffset!=32 ||
+    pr[n].origoffset!=pf->origsize ||
+    pr[n].bitoffset/8>=pf->datasize-ph->indexsize)
+    return NULL;
+  for (i=0; i<n; i++) {
+    if (pr[i+1].origoffset<=pr[i].origoffset ||
+      pr[i+1].bitoffset<=pr[i].bitoffset)
+      return NULL;
+    ;
+  };
+  *nframe=n;
+  return pr;
+};
+
+// Finds blocks of gathered data that are necessary to restore selected part.
+// Returns 0 on success and -1 if index of compressed data is not available.
+static int Findpartblocks(t_fproc *pf) {
+  int k0,k1,nframe;
+  ulong first,end,indexsize;
+  t_frame *pr;
+  if ((pf->mode & PBM_COMPRESSED)==0) {
+    pf->partindex=-1;
+    first=pf->partstart;
+    end=pf->partstart+pf->partsize; }
+  else {
+    pr=Getindex(pf,&nframe);
+    if (pr==NULL)
+      return -1;
+    // Index and bzip2 header precede the frames.
+    indexsize=((t_framehead *)pf->data)->indexsize;
+    pf->partindex=(indexsize+4-1)/NDATA;
+    for (k0=0; k0+1<nframe && pr[k0+1].origoffset<=pf->partstart; k0++) ;
+    for (k1=k0+1;
+      k1<nframe && pr[k1].origoffset<pf->partstart+pf->partsize; k1++) ;
+    first=indexsize+pr[k0].bitoffset/8;
+    end=indexsize+(pr[k1].bitoffset+7)/8; };
+  pf->partfirst=first/NDATA;
+  pf->partlast=(end-1)/NDATA;
+  return 0;
+};
+
+// Fills list of several first remaining pages in file descriptor. If part is
+// selected, only pages that hold the part are listed.
+static void Listremainingpages(t_fproc *pf) {
+  int i,j,firstblock,nrempages;
+  nrempages=0;
+  if (pf->pagesize>0) {
+    for (i=0; i<pf->npages && nrempages<8; i++) {
+      firstblock=i*(pf->pagesize/NDATA);
+      for (j=firstblock; j<firstblock+(int)(pf->pagesize/NDATA) && j<pf->nblock; j++) {
+        if (pf->datavalid[j]==1)
+          continue;
+        if (pf->partsize>0 && j>pf->partindex &&
+          (j<pf->partfirst || j>pf->partlast))
+          continue;                    // Not needed for the part
+        // Page incomplete.
+        pf->rempages[nrempages++]=i+1;
+        break;
+      };
+    };
+  };
+  if (nrempages<8)
+    pf->rempages[nrempages]=0;
+  pf->partready=(pf->partsize>0 && Blocksvalid(pf,0,pf->partindex) &&
+    Blocksvalid(pf,pf->partfirst,pf->partlast));
+};
+
+// Processes gathered data and fills list of several first remaining pages in
+// file descriptor. Returns status of the page (one of PS_xxx) or -1 on error.
+static int Finishpage(int slot,int ngood,int nbad,ulong nrestored) {
+  int status;
+  int i,j,r,rmin,rmax,nrec,irec,firstblock;
   uchar *pr,*pd;
   t_fproc *pf;
-  if (slot<0 || slot>=NFILE)
+  if (slot<0 || slot>=nfproc)
     return -1;                         // Invalid index of file descriptor
   pf=fproc+slot;
   if (pf->busy==0)
@@ -202,13 +922,13 @@ int Finishpage(int slot,int ngood,int nbad,ulong nrestored) {
   pf->badblocks+=nbad;
   pf->restoredbytes+=nrestored;
   // Restore bad blocks if corresponding recovery blocks are available (max. 1
-  // per group).
-  if (pf->ngroup>0) {
+  // per group). Erasure-coded groups are already restored.
+  if (pf->ngroup>0 && (pf->mode & PBM_ERASURE)==0) {
     rmin=(pf->minpageaddr/(NDATA*pf->ngroup))*pf->ngroup;
     rmax=(pf->maxpageaddr/(NDATA*pf->ngroup))*pf->ngroup;
     // Walk groups of data on current page, one by one.
     for (r=rmin; r<=rmax; r+=pf->ngroup) {
-      if (r+pf->ngroup>pf->nblock)
+      if (r+pf->ngroup>pf->ntotal)
         break;                         // Inconsistent data
       // Count blocks with recovery data in the group.
       nrec=0;
@@ -234,38 +954,88 @@ int Finishpage(int slot,int ngood,int nbad,ulong nrestored) {
         };
         pf->datavalid[irec]=1;
         pf->recoveredblocks++;
-        pf->ndata++;
+        if (irec<pf->nblock) pf->ndata++;
       };
     };
   };
+  // Rebuild lost data from parity pages.
+  Restorepages(slot);
   // Check whether there are still bad blocks on the page.
   firstblock=(pf->page-1)*(pf->pagesize/NDATA);
-  for (j=firstblock; j<firstblock+(int)(pf->pagesize/NDATA) && j<pf->nblock; j++) {
+  for (j=firstblock; j<firstblock+(int)(pf->pagesize/NDATA) && j<pf->ntotal; j++) {
     if (pf->datavalid[j]!=1) break; };
-  if (j<firstblock+(int)(pf->pagesize/NDATA) && j<pf->nblock)
-    Message("Unrecoverable errors on page, please scan it again",0);
+  if (j<firstblock+(int)(pf->pagesize/NDATA) && j<pf->ntotal)
+    status=PS_BAD;
   else if (nbad>0)
+    status=PS_RESTORED;
+  else
+    status=PS_GOOD;
+  ;
+  // Calculate list of (partially) incomplete pages.
+  Listremainingpages(pf);
+  return status;
+};
+
+// Merges page recognized by decoder into the file it belongs to. Blocks are
+// in blocklist, soft values of unreadable blocks in softlist, ngood, nbad and
+// nrestored are page statistics. Blocklist must have space for nsoft more
+// blocks. If page label was not read (superblock->addr is not SUPERBLOCK),
+// page is attributed to the file in work and superblock is reconstructed.
+// Can be called from any thread and does not touch UI, call Reportpage()
+// from the main thread to show the results. Returns index of file descriptor
+// and sets status to one of PS_xxx on success, or returns -1 on error (reason
+// is in error).
+int Mergepage(t_superblock *superblock,t_block *blocklist,int nblock,
+  t_soft *softlist,int nsoft,int ngood,int nbad,ulong nrestored,
+  int *status,char *error) {
+  int i,slot;
+  EnterCriticalSection(&fproccs);
+  if (superblock->addr!=SUPERBLOCK &&
+    Attributepage(superblock,blocklist,nblock,error)!=0)
+    slot=-1;
+  else
+    slot=Startnextpage(superblock,error);
+  if (slot>=0) {
+    // Blocks read by combining rescans are processed as if they were read
+    // from this scan.
+    nblock+=Combinesoft(slot,softlist,nsoft,blocklist+nblock);
+    for (i=0; i<nblock; i++)
+      Addblock(blocklist+i,slot);
+    if (fproc[slot].mode & PBM_ERASURE)
+      Restoreerasures(slot,blocklist,nblock);
+    *status=Finishpage(slot,ngood,nbad,nrestored); };
+  LeaveCriticalSection(&fproccs);
+  return slot;
+};
+
+// Shows results of Mergepage() and, if file is complete, saves it or asks
+// user to do so. Call from the main thread only.
+void Reportpage(int slot,int status,char *error) {
+  int complete,part;
+  if (slot<0) {
+    if (error[0]!='\0') Reporterror(error);
+    return; };
+  if (status==PS_BAD)
+    Message("Unrecoverable errors on page, please scan it again",0);
+  else if (status==PS_RESTORED)
     Message("Page processed, all bad blocks successfully restored",0);
   else
     Message("Page processed",0);
-  // Calculate list of (partially) incomplete pages.
-  nrempages=0;
-  if (pf->pagesize>0) {
-    for (i=0; i<pf->npages && nrempages<8; i++) {
-      firstblock=i*(pf->pagesize/NDATA);
-      for (j=firstblock; j<firstblock+(int)(pf->pagesize/NDATA) && j<pf->nblock; j++) {
-        if (pf->datavalid[j]==1)
-          continue;
-        // Page incomplete.
-        pf->rempages[nrempages++]=i+1;
-        break;
-      };
-    };
-  };
-  if (nrempages<8)
-    pf->rempages[nrempages]=0;
-  Updatefileinfo(slot,pf);
-  if (pf->ndata==pf->nblock) {
+  EnterCriticalSection(&fproccs);
+  complete=part=0;
+  if (slot<nfproc) {
+    Updatefileinfo(slot,fproc+slot);
+    complete=(fproc[slot].busy && fproc[slot].ndata==fproc[slot].nblock);
+    part=(fproc[slot].busy && fproc[slot].partready); };
+  LeaveCriticalSection(&fproccs);
+  if (part) {
+    if (autosave==0)
+      Message("Part restored. Press \"Save\" to save it to disk",0);
+    else {
+      Message("Part complete",0);
+      Saverestoredfile(slot,0);
+    }; }
+  else if (complete) {
     if (autosave==0)
       Message("File restored. Press \"Save\" to save it to disk",0);
     else {
@@ -273,26 +1043,281 @@ int Finishpage(int slot,int ngood,int nbad,ulong nrestored) {
       Saverestoredfile(slot,0);
     };
   };
-  return 0; ////////////////////////////////////////////////////////////////////
 };
 
-// Saves file with specified index and closes file descriptor (if force is 1,
-// attempts to save data even if file is not yet complete). Returns 0 on
-// success and -1 on error.
-int Saverestoredfile(int slot,int force) {
-  int n,success;
-  ushort filecrc;
-  ulong l,length;
-  uchar* bufout, * data;
+// Returns size of the frame index that precedes compressed data or 0 if data
+// has no index.
+static ulong Indexsize(t_fproc *pf) {
+  int nframe;
+  if (Getindex(pf,&nframe)==NULL)
+    return 0;
+  return ((t_framehead *)pf->data)->indexsize;
+};
+
+// Copies size bytes of the original data starting at offset start to the
+// memory out or, if out is NULL, writes them to the file hfile. Compressed
+// data is unpacked frame by frame. Returns 0 on success and -1 if necessary
+// blocks are not yet restored or on error.
+static int Copyoriginal(t_fproc *pf,ulong start,ulong size,uchar *out,
+  HANDLE hfile) {
+  int k,nframe;
+  ulong end,indexsize,n,from,l,w,done;
+  uchar *buf;
+  t_frame *pr;
+  end=start+size;
+  if (end<start || end>pf->origsize)
+    return -1;
+  if ((pf->mode & PBM_COMPRESSED)==0) {
+    if (Rangevalid(pf,start,end)==0)
+      return -1;
+    if (out!=NULL)
+      memcpy(out,pf->data+start,size);
+    else if (WriteFile(hfile,pf->data+start,size,&l,NULL)==0 || l!=size)
+      return -1;
+    return 0; };
+  pr=Getindex(pf,&nframe);
+  if (pr==NULL)
+    return -1;
+  indexsize=((t_framehead *)pf->data)->indexsize;
+  if (Rangevalid(pf,indexsize,indexsize+4)==0)
+    return -1;                         // Header of bzip2 stream
+  done=0;
+  for (k=0; k<nframe && start<end; k++) {
+    if (pr[k+1].origoffset<=start)
+      continue;
+    if (Rangevalid(pf,indexsize+pr[k].bitoffset/8,
+      indexsize+(pr[k+1].bitoffset+7)/8)==0)
+      return -1;
+    buf=Unpackframe(pf->data+indexsize,pf->datasize-indexsize,
+      pr[k].bitoffset,pr[k+1].bitoffset,&n);
+    if (buf==NULL)
+      return -1;
+    if (n!=pr[k+1].origoffset-pr[k].origoffset) {
+      GlobalFree((HGLOBAL)buf);
+      return -1; };
+    from=start-pr[k].origoffset;
+    l=min(n-from,end-start);
+    if (out!=NULL)
+      memcpy(out+done,buf+from,l);
+    else if (WriteFile(hfile,buf+from,l,&w,NULL)==0 || w!=l) {
+      GlobalFree((HGLOBAL)buf);
+      return -1; };
+    GlobalFree((HGLOBAL)buf);
+    start+=l;
+    done+=l;
+    if (out==NULL)
+      Message("Unpacking data",(int)(done*100.0/size));
+    ;
+  };
+  return (start<end?-1:0);
+};
+
+// Reads table of contents of the archive. Returns buffer that caller must
+// free and sets tocsize, or returns NULL if table is not yet restored.
+static uchar *Readtoc(t_fproc *pf,ulong *tocsize) {
+  uchar *toc;
+  t_archead head;
+  if (Copyoriginal(pf,0,sizeof(head),(uchar *)&head,NULL)!=0 ||
+    head.magic!=ARCMAGIC || head.nfile==0 || head.nfile>NARCFILE ||
+    head.tocsize<sizeof(head) || head.tocsize>pf->origsize)
+    return NULL;
+  toc=(uchar *)GlobalAlloc(GMEM_FIXED,head.tocsize);
+  if (toc==NULL)
+    return NULL;
+  if (Copyoriginal(pf,0,head.tocsize,toc,NULL)!=0) {
+    GlobalFree((HGLOBAL)toc);
+    return NULL; };
+  *tocsize=head.tocsize;
+  return toc;
+};
+
+// Selects part of the file with given index. Table of processed files must be
+// locked. Returns 0 on success and -1 on error (reason, if any, is in error).
+static int Setpart(int slot,int entry,ulong start,ulong size,char *error) {
+  int i;
+  ulong pos,tocsize;
+  uchar *toc;
+  char name[MAX_PATH];
+  t_arcentry ae;
   t_fproc *pf;
-  HANDLE hfile;
-  if (slot<0 || slot>=NFILE)
+  error[0]='\0';
+  if (slot<0 || slot>=nfproc)
     return -1;                         // Invalid index of file descriptor
   pf=fproc+slot;
-  if (pf->busy==0 || pf->nblock==0)
-    return -1;                         // Index points to unused descriptor
-  if (pf->ndata!=pf->nblock && force==0)
-    return -1;                         // Still incomplete data
+  if (pf->busy==0 || pf->nblock==0 || pf->saving)
+    return -1;                         // Unused descriptor or being saved
+  if (Loadfproc(slot)!=0) {
+    strcpy(error,"Unable to read back data of file evicted to disk");
+    return -1; };
+  pf->partsize=0;
+  pf->partentry=0;
+  if (((pf->mode & PBM_COMPRESSED)!=0 && (pf->mode & PBM_FRAMED)==0) ||
+    (pf->mode & PBM_ELIDED)!=0) {
+    Listremainingpages(pf);
+    strcpy(error,"Backup has no index, all pages are necessary to restore it");
+    return -1; };
+  if ((pf->mode & PBM_COMPRESSED)!=0 && Getindex(pf,&i)==NULL) {
+    Listremainingpages(pf);
+    strcpy(error,"Index is not yet restored, please scan page 1 first");
+    return -1; };
+  // Entry of the archive is located by the table of contents.
+  if (entry>=0) {
+    toc=NULL;
+    if (pf->mode & PBM_ARCHIVE)
+      toc=Readtoc(pf,&tocsize);
+    if (toc==NULL) {
+      Listremainingpages(pf);
+      strcpy(error,"Table of contents is not yet restored");
+      return -1; };
+    pos=sizeof(t_archead);
+    for (i=0; i<=entry; i++) {
+      if (i>=(int)((t_archead *)toc)->nfile ||
+        Nextarcentry(toc,tocsize,&pos,&ae,name)!=0)
+        break;
+      ;
+    };
+    GlobalFree((HGLOBAL)toc);
+    if (i<=entry || (ae.attributes & FILE_ATTRIBUTE_DIRECTORY)!=0 ||
+      ae.offset<tocsize) {
+      Listremainingpages(pf);
+      strcpy(error,"Invalid entry of archive");
+      return -1; };
+    start=ae.offset;
+    size=ae.size;
+    pf->partentry=1;
+    strcpy(pf->partname,name);
+    pf->partmodified=ae.modified;
+    pf->partattributes=ae.attributes; };
+  if (size==0 || start>=pf->origsize || size>pf->origsize-start) {
+    pf->partentry=0;
+    Listremainingpages(pf);
+    strcpy(error,entry>=0?"File is empty":"Invalid range of data");
+    return -1; };
+  pf->partstart=start;
+  pf->partsize=size;
+  Findpartblocks(pf);
+  Listremainingpages(pf);
+  return 0;
+};
+
+// Selects part of the file with given index that user wants to restore: the
+// entry of the archive if entry is non-negative, or size bytes of the original
+// data starting at start. Only pages that hold the part remain in the list,
+// and file can be saved as soon as they are scanned. Returns 0 on success and
+// -1 on error.
+int Setrestorepart(int slot,int entry,ulong start,ulong size) {
+  int result;
+  char error[TEXTLEN];
+  EnterCriticalSection(&fproccs);
+  result=Setpart(slot,entry,start,size,error);
+  if (slot>=0 && slot<nfproc)
+    Updatefileinfo(slot,fproc+slot);
+  LeaveCriticalSection(&fproccs);
+  if (error[0]!='\0')
+    Reporterror(error);
+  return result;
+};
+
+// Saves selected part of the file taken out of the table of processed files.
+// Returns 0 on success and -1 on error.
+static int Savepart(t_fproc *pf) {
+  int success;
+  char *pc;
+  HANDLE hfile;
+  pc=pf->name;
+  if (pf->partentry) {
+    pc=strrchr(pf->partname,'\\');
+    if (pc==NULL) pc=pf->partname;
+    else pc++; };
+  if (Selectoutfile(pc)!=0)            // Cancelled by user
+    return -1;
+  hfile=CreateFile(outfile,GENERIC_WRITE,0,NULL,
+    CREATE_ALWAYS,FILE_ATTRIBUTE_NORMAL,NULL);
+  if (hfile==INVALID_HANDLE_VALUE) {
+    Reporterror("Unable to create file");
+    return -1; };
+  success=Copyoriginal(pf,pf->partstart,pf->partsize,NULL,hfile);
+  if (pf->partentry)
+    SetFileTime(hfile,&pf->partmodified,&pf->partmodified,&pf->partmodified);
+  CloseHandle(hfile);
+  Message("",0);
+  if (success!=0) {
+    DeleteFile(outfile);               // Partial file is useless
+    Reporterror("Unable to restore part of data");
+    return -1; };
+  if (pf->partentry)
+    SetFileAttributes(outfile,pf->partattributes &
+      (FILE_ATTRIBUTE_READONLY|FILE_ATTRIBUTE_HIDDEN|
+      FILE_ATTRIBUTE_SYSTEM|FILE_ATTRIBUTE_ARCHIVE|
+      FILE_ATTRIBUTE_NORMAL));
+  Message("Part saved",0);
+  return 0;
+};
+
+// Writes restored data of the file to hfile opened for overlapped I/O. Packed
+// data is unpacked on the fly, frame index is not a part of the stream, so
+// memory requirements don't depend on the size of the file. Elided blocks
+// are restored in memory first. Returns 0 on success and -1 on error.
+static int Writefproc(t_fproc *pf,HANDLE hfile) {
+  int result;
+  ulong skip;
+  uchar *data;
+  if (pf->mode & PBM_ELIDED) {
+    data=Expanddata(pf->data,pf->datasize,pf->origsize);
+    if (data==NULL) {
+      Reporterror("Unable to restore elided blocks");
+      return -1; };
+    result=Writerestored(hfile,data,pf->origsize,pf->origsize,0);
+    GlobalFree((HGLOBAL)data);
+    return result; };
+  skip=Indexsize(pf);
+  return Writerestored(hfile,pf->data+skip,pf->datasize-skip,pf->origsize,
+    pf->mode & PBM_COMPRESSED);
+};
+
+// Restores archive into the temporary file next to the selected output
+// (outfile) and extracts files from it into the folder outfile. Returns 0 on
+// success and -1 on error.
+static int Savearchive(t_fproc *pf) {
+  int n;
+  char drv[_MAX_DRIVE+1],dir[_MAX_DIR],path[MAX_PATH],tmp[MAX_PATH];
+  char s[TEXTLEN];
+  HANDLE hfile;
+  fnsplit(outfile,drv,dir,NULL,NULL);
+  fnmerge(path,drv,dir,NULL,NULL);
+  if (path[0]=='\0')
+    strcpy(path,".");
+  if (GetTempFileName(path,"mrp",0,tmp)==0) {
+    Reporterror("Unable to create temporary file");
+    return -1; };
+  hfile=CreateFile(tmp,GENERIC_WRITE,0,NULL,CREATE_ALWAYS,
+    FILE_ATTRIBUTE_TEMPORARY|FILE_FLAG_OVERLAPPED,NULL);
+  if (hfile==INVALID_HANDLE_VALUE) {
+    DeleteFile(tmp);
+    Reporterror("Unable to create temporary file");
+    return -1; };
+  n=Writefproc(pf,hfile);
+  CloseHandle(hfile);
+  if (n==0)
+    n=Extractarchive(tmp,outfile);
+  else
+    n=-1;
+  DeleteFile(tmp);
+  if (n<0)
+    return -1;
+  sprintf(s,"%i files saved",n);
+  Message(s,0);
+  return 0;
+};
+
+// Saves file or its selected part taken out of the table of processed files.
+// Returns 0 on success and -1 on error.
+static int Savefproc(t_fproc *pf) {
+  int success;
+  HANDLE hfile;
+  // Selected part is saved alone.
+  if (pf->partready)
+    return Savepart(pf);
   Message("",0);
   // Check if data is encrypted, if so, show AES not supported message.
   // Built in encryption has been deprecated in favor of 7zip and rar options.
@@ -300,53 +1325,207 @@ int Saverestoredfile(int slot,int force) {
       Reporterror("AES decryption is no longer supported");
       return -1;
   }
-  // If data is compressed, unpack it to temporary buffer.
-  if ((pf->mode & PBM_COMPRESSED)==0) {
-    // Data is not compressed.
-    data=pf->data; length=pf->origsize;
-    bufout=NULL; }
-  else {
-    // Data is compressed. Create temporary buffer.
-    if (pf->origsize==0)
-      pf->origsize=pf->datasize*4;     // Weak attempt to recover
-    bufout=(uchar *)GlobalAlloc(GMEM_FIXED,pf->origsize);
-    if (bufout==NULL) {
-      Reporterror("Low memory");
-      return -1; };
-    // Unpack data.
-    length=pf->origsize;
-    success=BZ2_bzBuffToBuffDecompress((char *)bufout,(uint *)&length,
-      (char*)pf->data,pf->datasize,0,0);
-    if (success!=BZ_OK) {
-      GlobalFree((HGLOBAL)bufout);
-      Reporterror("Unable to unpack data");
-      return -1; };
-    data=bufout; 
-  };
-  // Ask user for file name.
-  if (Selectoutfile(pf->name)!=0) {    // Cancelled by user
-    if (bufout!=NULL) GlobalFree((HGLOBAL)bufout);
-    return -1; };
-  // Open file and save data.
+  // Ask user for file name. Archive is extracted into the folder with this
+  // name.
+  if (Selectoutfile(pf->name)!=0)      // Cancelled by user
+    return -1;
+  if (pf->mode & PBM_ARCHIVE)
+    return Savearchive(pf);
   hfile=CreateFile(outfile,GENERIC_WRITE,0,NULL,
-    CREATE_ALWAYS,FILE_ATTRIBUTE_NORMAL,NULL);
+    CREATE_ALWAYS,FILE_ATTRIBUTE_NORMAL|FILE_FLAG_OVERLAPPED,NULL);
   if (hfile==INVALID_HANDLE_VALUE) {
-    if (bufout!=NULL) GlobalFree((HGLOBAL)bufout);
     Reporterror("Unable to create file");
     return -1; };
-  WriteFile(hfile,data,length,&l,NULL);
+  // Write data, unpacking or expanding it if necessary.
+  success=Writefproc(pf,hfile);
   // Restore old modification date and time.
   SetFileTime(hfile,&pf->modified,&pf->modified,&pf->modified);
   // Close file and restore old basic attributes.
   CloseHandle(hfile);
-  SetFileAttributes(outfile,pf->attributes);
-  if (bufout!=NULL) GlobalFree((HGLOBAL)bufout);
-  if (l!=length) {
-    Reporterror("I/O error");
+  if (success!=0) {
+    DeleteFile(outfile);               // Partial file is useless
     return -1; };
-  // Close file descriptor and report success.
-  Closefproc(slot);
+  SetFileAttributes(outfile,pf->attributes);
   Message("File saved",0);
   return 0;
 };
 
+
+// Saves file with specified index and closes file descriptor (if force is 1,
+// attempts to save data even if file is not yet complete). If only part of
+// the file is selected, saves the part and keeps descriptor open. Returns 0
+// on success and -1 on error.
+int Saverestoredfile(int slot,int force) {
+  int result;
+  char error[TEXTLEN];
+  t_fproc *pf,copy;
+  // Under the lock, I only mark descriptor as being saved and take its copy.
+  // Decoding threads don't merge pages into such file and don't evict its
+  // data, so buffers remain valid while dialogs are open and data is written,
+  // even if the table of processed files grows.
+  result=-1;
+  error[0]='\0';
+  EnterCriticalSection(&fproccs);
+  if (slot>=0 && slot<nfproc) {
+    pf=fproc+slot;
+    if (pf->busy==0 || pf->nblock==0 || pf->saving)
+      ;                                // Unused descriptor or being saved
+    else if (pf->partready==0 && pf->ndata!=pf->nblock && force==0)
+      ;                                // Still incomplete data
+    else if (Loadfproc(slot)!=0)
+      strcpy(error,"Unable to read back data of file evicted to disk");
+    else {
+      pf->saving=1;
+      copy=*pf;
+      result=0;
+    };
+  };
+  LeaveCriticalSection(&fproccs);
+  if (result!=0) {
+    if (error[0]!='\0')
+      Reporterror(error);
+    return -1; };
+  result=Savefproc(&copy);
+  EnterCriticalSection(&fproccs);
+  pf=fproc+slot;
+  pf->saving=0;
+  if (result==0 && copy.partready) {
+    // Return to the whole file, descriptor remains open, so that other parts
+    // can be restored from the same pages.
+    pf->partsize=0;
+    pf->partentry=0;
+    Listremainingpages(pf); }
+  else if (result==0)
+    Releasefproc(slot);
+  Updatefileinfo(slot,pf);
+  LeaveCriticalSection(&fproccs);
+  return result;
+};
+
+// Dialog procedure of the part selection dialog. If backup is archive, lists
+// its files, otherwise asks for the range of bytes.
+static int CALLBACK Partdlgproc(HWND hw,UINT msg,WPARAM wp,LPARAM lp) {
+  int i,n;
+  ulong pos;
+  char name[MAX_PATH],s[MAX_PATH+TEXTLEN];
+  t_arcentry ae;
+  HWND hlist;
+  switch (msg) {
+    case WM_INITDIALOG:
+      hlist=GetDlgItem(hw,PART_LIST);
+      if (parttoc!=NULL) {
+        // Directories have no data and are not listed.
+        pos=sizeof(t_archead);
+        for (i=0; i<(int)((t_archead *)parttoc)->nfile; i++) {
+          if (Nextarcentry(parttoc,parttocsize,&pos,&ae,name)!=0)
+            break;
+          if (ae.attributes & FILE_ATTRIBUTE_DIRECTORY)
+            continue;
+          sprintf(s,"%s (%lu bytes)",name,ae.size);
+          n=SendMessage(hlist,LB_ADDSTRING,0,(LPARAM)s);
+          SendMessage(hlist,LB_SETITEMDATA,n,i); };
+        SendMessage(hlist,LB_SETCURSEL,0,0);
+        EnableWindow(GetDlgItem(hw,PART_FROM),FALSE);
+        EnableWindow(GetDlgItem(hw,PART_SIZE),FALSE); }
+      else {
+        EnableWindow(hlist,FALSE);
+        SetDlgItemText(hw,PART_FROM,"0");
+        sprintf(s,"%lu",partorigsize);
+        SetDlgItemText(hw,PART_SIZE,s); };
+      return TRUE;
+    case WM_COMMAND:
+      if (LOWORD(wp)==PART_OK) {
+        if (parttoc!=NULL) {
+          n=SendDlgItemMessage(hw,PART_LIST,LB_GETCURSEL,0,0);
+          if (n==LB_ERR) {
+            MessageBeep(MB_ICONEXCLAMATION);
+            break; };
+          partsel=SendDlgItemMessage(hw,PART_LIST,LB_GETITEMDATA,n,0); }
+        else {
+          // Range may be given as decimal or hexadecimal (0x...) number.
+          partsel=-1;
+          GetDlgItemText(hw,PART_FROM,s,TEXTLEN);
+          partfrom=strtoul(s,NULL,0);
+          GetDlgItemText(hw,PART_SIZE,s,TEXTLEN);
+          partcount=strtoul(s,NULL,0); };
+        EndDialog(hw,1); }
+      else if (LOWORD(wp)==PART_LIST && HIWORD(wp)==LBN_DBLCLK)
+        PostMessage(hw,WM_COMMAND,PART_OK,0);
+      else if (LOWORD(wp)==PART_CANCEL)
+        EndDialog(hw,0);
+      break;
+    case WM_SYSCOMMAND:
+      if ((wp & 0xFFF0)==SC_CLOSE)
+        EndDialog(hw,0);
+      break;
+    default: break;
+  };
+  return FALSE;
+};
+
+// Asks user which part of the file with given index to restore and selects
+// it. If pages that hold the part are already scanned, saves it immediately.
+// Returns 0 on success and -1 on error or if user pressed Cancel.
+int Selectpart(int slot) {
+  int result,ready;
+  ulong hash;
+  char error[TEXTLEN];
+  t_fproc *pf;
+  // Dialog and message boxes are shown outside the lock.
+  result=-1;
+  error[0]='\0';
+  hash=0;
+  parttoc=NULL;
+  parttocsize=0;
+  EnterCriticalSection(&fproccs);
+  if (slot>=0 && slot<nfproc && fproc[slot].busy &&
+    fproc[slot].nblock!=0 && fproc[slot].saving==0) {
+    pf=fproc+slot;
+    if (Loadfproc(slot)!=0)
+      strcpy(error,"Unable to read back data of file evicted to disk");
+    else if (((pf->mode & PBM_COMPRESSED)!=0 && (pf->mode & PBM_FRAMED)==0) ||
+      (pf->mode & PBM_ELIDED)!=0)
+      strcpy(error,
+        "Backup has no index, all pages are necessary to restore it");
+    else {
+      hash=pf->hash;
+      partorigsize=pf->origsize;
+      if (pf->mode & PBM_ARCHIVE)
+        parttoc=Readtoc(pf,&parttocsize);
+      if ((pf->mode & PBM_ARCHIVE)!=0 && parttoc==NULL)
+        strcpy(error,
+          "Table of contents is not yet restored, please scan page 1 first");
+      else
+        result=0;
+      ;
+    };
+  };
+  LeaveCriticalSection(&fproccs);
+  if (result!=0) {
+    if (error[0]!='\0')
+      Reporterror(error);
+    return -1; };
+  result=DialogBox(hinst,"DIALOG_PART",hwmain,(DLGPROC)Partdlgproc);
+  if (parttoc!=NULL)
+    GlobalFree((HGLOBAL)parttoc);
+  parttoc=NULL;
+  if (result!=1)
+    return -1;
+  // File may be closed while dialog was open.
+  EnterCriticalSection(&fproccs);
+  result=-1;
+  error[0]='\0';
+  if (slot<nfproc && fproc[slot].busy && fproc[slot].hash==hash) {
+    result=Setpart(slot,partsel,partfrom,partcount,error);
+    Updatefileinfo(slot,fproc+slot); };
+  ready=(result==0 && fproc[slot].partready);
+  LeaveCriticalSection(&fproccs);
+  if (result!=0) {
+    if (error[0]!='\0')
+      Reporterror(error);
+    return -1; };
+  if (ready)
+    return Saverestoredfile(slot,0);
+  Message("Scan remaining pages to restore the part",0);
+  return 0;
+};
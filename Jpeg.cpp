@@ -0,0 +1,709 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+// MRPODS -- Machine-Readable Printed Optical Data Sheets                     //
+// https://github.com/sheafdynamics/mrpods                                    //
+//                                                                            //
+// Copyright (c) 2024 Ray Doll                                                //
+// Copyright (c) 2007 Oleh Yuschuk                                            //
+//                                                                            //
+// This file is part of MRPODS, which is built off                            //
+// Oleh Yuschuk's PaperBack https://ollydbg.de/Paperbak/                      //
+// MRPODS is cumulative work of passionate programmers,                       //
+// both named and unnamed, including freelancers and private contractors.     //
+// Without them, this would not be possible.                                  //
+// This software contains Oleh Yuschuk's original comments and                //
+// comments from other maintainers.                                           //
+//                                                                            //
+// MRPODS is free software; you can redistribute it and/or modify it under    //
+// the terms of the GNU General Public License as published by the Free       //
+// Software Foundation; either version 3 of the License, or (at your option)  //
+// any later version.                                                         //
+//                                                                            //
+// MRPODS is distributed in the hope that it will be useful, but WITHOUT      //
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or      //
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for   //
+// more details.                                                              //
+//                                                                            //
+// You should have received a copy of the GNU General Public License along    //
+// with this program. If not, see <http://www.gnu.org/licenses/>.             //
+//                                                                            //
+//                              bzip2 license                                 //
+// -------------------------------------------------------------------------- //
+// "bzip2", the associated library "libbzip2" copyright(C) 1996 - 2010        //
+// Julian R Seward. All rights reserved.                                      //
+// Julian Seward, jseward@acm.org                                             //
+// bzip2 / libbzip2 version 1.0.6 of 6 September 2010                         //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include <windows.h>
+#include <commctrl.h>
+#include <stdio.h>
+#include <direct.h>
+#include <math.h>
+#include "twain.h"
+#pragma hdrstop
+
+#include "mrpods.h"
+#include "resource.h"
+
+// JPEG markers that I understand. Other markers are skipped, and frames of
+// unsupported types are rejected.
+#define M_SOF0         0xC0            // Baseline DCT
+#define M_SOF1         0xC1            // Extended sequential DCT, Huffman
+#define M_SOF2         0xC2            // Progressive DCT, Huffman
+#define M_DHT          0xC4            // Define Huffman tables
+#define M_RST0         0xD0            // First of restart markers RST0..RST7
+#define M_RST7         0xD7            // Last of restart markers
+#define M_SOI          0xD8            // Start of image
+#define M_EOI          0xD9            // End of image
+#define M_SOS          0xDA            // Start of scan
+#define M_DQT          0xDB            // Define quantization tables
+#define M_DRI          0xDD            // Define restart interval
+#define M_APP0         0xE0            // JFIF header
+
+#define HUFFBITS       9               // Length of fast Huffman lookup, bits
+#define MAXJCOMP       4               // Max number of components in frame
+
+typedef struct t_jhuff {               // Huffman decoding table
+  ushort         fast[1<<HUFFBITS];    // (symbol<<4)|length, 0 if longer
+  int            maxcode[18];          // Largest code of given length or -1
+  int            mincode[17];          // Smallest code of given length
+  int            valptr[17];           // Index of first symbol of length
+  uchar          value[256];           // Symbols sorted by code length
+} t_jhuff;
+
+typedef struct t_jcomp {               // Component of the frame
+  int            id;                   // Component identifier
+  int            h,v;                  // Horizontal and vertical sampling
+  int            tq;                   // Quantization table
+  int            td,ta;                // DC and AC Huffman tables in scan
+  int            dcpred;               // DC predictor
+} t_jcomp;
+
+typedef struct t_jbits {               // Reader of entropy-coded segment
+  uchar          *data;                // Next byte of data
+  uchar          *end;                 // End of file
+  ulong          buf;                  // Bit buffer, MSB first
+  int            nbits;                // Number of valid bits in buf
+  int            marker;               // Marker or end of file reached
+} t_jbits;
+
+typedef struct t_jpeg {                // JPEG decoder
+  int            sizex,sizey;          // Size of image, pixels
+  int            progressive;          // Progressive (SOF2) frame
+  int            ncomp;                // Number of components in frame
+  t_jcomp        comp[MAXJCOMP];       // Components, first is luminance
+  int            hmax,vmax;            // Maximal sampling factors
+  int            mcux,mcuy;            // Number of MCUs in interleaved scan
+  int            nbx,nby;              // Luminance blocks per row and column
+  int            restart;              // Restart interval, MCUs, or 0
+  int            density;              // Scan resolution, ppi, or 0
+  int            ss,se,ah,al;          // Spectral and approximation limits
+  int            eobrun;               // Remaining run of empty blocks
+  ushort         qt[4][64];            // Quantization tables, natural order
+  float          yq[64];               // Luminance quantizers, natural order
+  int            yqvalid;              // yq is already latched
+  t_jhuff        dc[4],ac[4];          // Huffman tables
+  short          *coef;                // Luminance coefficients, 64 per block
+} t_jpeg;
+
+// Natural (row by row) index of coefficients in the zigzag order.
+static int       zigzag[64] = {
+   0, 1, 8,16, 9, 2, 3,10,17,24,32,25,18,11, 4, 5,
+  12,19,26,33,40,48,41,34,27,20,13, 6, 7,14,21,28,
+  35,42,49,56,57,50,43,36,29,22,15,23,30,37,44,51,
+  58,59,52,45,38,31,39,46,53,60,61,54,47,55,62,63 };
+
+static float     idcttab[3][64];       // IDCT kernels for 8, 4 and 2 points
+static int       idctready;            // idcttab is initialized
+
+// Builds Huffman decoding table from the list of code counts (16 items) and
+// symbols. Returns 0 on success and -1 if table is invalid.
+static int Buildhufftable(t_jhuff *ph,uchar *counts,uchar *symbols) {
+  int i,j,k,l,code;
+  memset(ph->fast,0,sizeof(ph->fast));
+  for (l=1,k=0,code=0; l<=16; l++) {
+    ph->valptr[l]=k;
+    ph->mincode[l]=code;
+    for (i=0; i<counts[l-1]; i++,k++,code++) {
+      if (k>=256) return -1;
+      if (code>=(1<<l)) return -1;     // Overfull code
+      ph->value[k]=symbols[k];
+      if (l<=HUFFBITS) {
+        for (j=0; j<(1<<(HUFFBITS-l)); j++)
+          ph->fast[(code<<(HUFFBITS-l))+j]=(ushort)((symbols[k]<<4)|l);
+        ;
+      };
+    };
+    ph->maxcode[l]=(counts[l-1]==0?-1:code-1);
+    code<<=1; };
+  ph->maxcode[17]=0x7FFFFFFF;
+  return 0;
+};
+
+// Marks Huffman table as empty, so that any attempt to use it fails.
+static void Clearhufftable(t_jhuff *ph) {
+  int l;
+  memset(ph->fast,0,sizeof(ph->fast));
+  for (l=0; l<18; l++) ph->maxcode[l]=-1;
+};
+
+// Loads bit buffer so that it contains at least 25 valid bits. Stuffed zero
+// after 0xFF is removed. Marker terminates segment, and the missing bits are
+// read as zeros.
+static void Fillbits(t_jbits *pb) {
+  ulong c;
+  while (pb->nbits<=24) {
+    if (pb->marker || pb->data>=pb->end) {
+      pb->marker=1; c=0; }
+    else if (pb->data[0]!=0xFF)
+      c=*pb->data++;
+    else if (pb->data+1<pb->end && pb->data[1]==0x00) {
+      c=0xFF; pb->data+=2; }
+    else {
+      pb->marker=1; c=0; };
+    pb->buf|=c<<(24-pb->nbits);
+    pb->nbits+=8;
+  };
+};
+
+// Reads n (0..16) bits as unsigned number.
+static int Getbits(t_jbits *pb,int n) {
+  int v;
+  if (n==0) return 0;
+  if (pb->nbits<n) Fillbits(pb);
+  v=(int)(pb->buf>>(32-n));
+  pb->buf<<=n;
+  pb->nbits-=n;
+  return v;
+};
+
+// Reads s-bit magnitude category value and converts it to signed number.
+static int Getsigned(t_jbits *pb,int s) {
+  int v;
+  if (s==0) return 0;
+  v=Getbits(pb,s);
+  if (v<(1<<(s-1))) v-=(1<<s)-1;
+  return v;
+};
+
+// Decodes next Huffman symbol. Returns symbol or -1 on invalid code.
+static int Gethuffsymbol(t_jbits *pb,t_jhuff *ph) {
+  int k,l,code;
+  if (pb->nbits<16) Fillbits(pb);
+  k=ph->fast[pb->buf>>(32-HUFFBITS)];
+  if (k!=0) {
+    pb->buf<<=(k & 15);
+    pb->nbits-=(k & 15);
+    return k>>4; };
+  for (l=HUFFBITS+1; l<=16; l++) {
+    code=(int)(pb->buf>>(32-l));
+    if (code<=ph->maxcode[l]) {
+      pb->buf<<=l;
+      pb->nbits-=l;
+      return ph->value[ph->valptr[l]+code-ph->mincode[l]];
+    };
+  };
+  return -1;
+};
+
+// Decodes block of sequential (baseline) scan. If blk is NULL, I only parse
+// the data. Returns 0 on success and -1 on error.
+static int Decodesequential(t_jpeg *pj,t_jbits *pb,t_jcomp *pc,short *blk) {
+  int k,r,s;
+  s=Gethuffsymbol(pb,pj->dc+pc->td);
+  if (s<0 || s>15) return -1;
+  pc->dcpred+=Getsigned(pb,s);
+  if (blk!=NULL) blk[0]=(short)pc->dcpred;
+  for (k=1; k<64; k++) {
+    s=Gethuffsymbol(pb,pj->ac+pc->ta);
+    if (s<0) return -1;
+    r=s>>4; s&=15;
+    if (s==0) {
+      if (r!=15) break;                // End of block
+      k+=15; continue; };              // Run of 16 zeros
+    k+=r;
+    if (k>63) return -1;
+    r=Getsigned(pb,s);
+    if (blk!=NULL) blk[zigzag[k]]=(short)r;
+  };
+  return 0;
+};
+
+// Decodes DC coefficient in the progressive scan, either the first pass or
+// the refinement. If blk is NULL, I only parse the data.
+static int Decodedc(t_jpeg *pj,t_jbits *pb,t_jcomp *pc,short *blk) {
+  int s;
+  if (pj->ah==0) {
+    s=Gethuffsymbol(pb,pj->dc+pc->td);
+    if (s<0 || s>15) return -1;
+    pc->dcpred+=Getsigned(pb,s);
+    if (blk!=NULL) blk[0]=(short)(pc->dcpred*(1<<pj->al)); }
+  else {
+    if (Getbits(pb,1) && blk!=NULL) blk[0]|=(short)(1<<pj->al); };
+  return 0;
+};
+
+// Decodes first pass of AC coefficients ss..se in the progressive scan.
+static int Decodeacfirst(t_jpeg *pj,t_jbits *pb,t_jcomp *pc,short *blk) {
+  int k,r,s;
+  if (pj->eobrun>0) {
+    pj->eobrun--; return 0; };
+  for (k=pj->ss; k<=pj->se; k++) {
+    s=Gethuffsymbol(pb,pj->ac+pc->ta);
+    if (s<0) return -1;
+    r=s>>4; s&=15;
+    if (s==0) {
+      if (r<15) {                      // Run of empty blocks
+        pj->eobrun=(1<<r)-1+Getbits(pb,r);
+        break; };
+      k+=15; continue; };
+    k+=r;
+    if (k>63) return -1;
+    blk[zigzag[k]]=(short)(Getsigned(pb,s)*(1<<pj->al));
+  };
+  return 0;
+};
+
+// Adds correction bit to the coefficient that is already nonzero.
+static void Refinecoef(t_jbits *pb,short *c,int p1) {
+  if (Getbits(pb,1)==0 || (*c & p1)!=0) return;
+  if (*c>=0) *c=(short)(*c+p1);
+  else *c=(short)(*c-p1);
+};
+
+// Decodes refinement pass of AC coefficients ss..se in the progressive scan.
+// Each new coefficient is preceded by the run of zero-history coefficients,
+// and every nonzero coefficient skipped on the way gets its correction bit.
+static int Decodeacrefine(t_jpeg *pj,t_jbits *pb,t_jcomp *pc,short *blk) {
+  int k,r,s,p1;
+  short *c;
+  p1=1<<pj->al;
+  k=pj->ss;
+  if (pj->eobrun==0) {
+    for ( ; k<=pj->se; k++) {
+      s=Gethuffsymbol(pb,pj->ac+pc->ta);
+      if (s<0) return -1;
+      r=s>>4; s&=15;
+      if (s!=0) {
+        s=(Getbits(pb,1)?p1:-p1); }
+      else if (r!=15) {
+        pj->eobrun=(1<<r)+Getbits(pb,r);
+        break; };
+      for ( ; k<=pj->se; k++) {
+        c=blk+zigzag[k];
+        if (*c!=0)
+          Refinecoef(pb,c,p1);
+        else if (--r<0)
+          break;
+        ;
+      };
+      if (s!=0 && k<=pj->se) blk[zigzag[k]]=(short)s;
+    };
+  };
+  if (pj->eobrun>0) {
+    for ( ; k<=pj->se; k++) {
+      c=blk+zigzag[k];
+      if (*c!=0) Refinecoef(pb,c,p1); };
+    pj->eobrun--; };
+  return 0;
+};
+
+// Skips entropy-coded data up to the next marker other than RSTn. Returns
+// pointer to 0xFF that starts the marker, or end of data.
+static uchar *Skiptomarker(uchar *p,uchar *end) {
+  while (p+1<end) {
+    if (p[0]==0xFF && p[1]!=0x00 && p[1]!=0xFF &&
+      (p[1]<M_RST0 || p[1]>M_RST7)) break;
+    p++; };
+  return (p+1<end?p:end);
+};
+
+// Resynchronizes bit reader on the restart marker and resets predictors.
+static void Restartscan(t_jpeg *pj,t_jbits *pb) {
+  int i;
+  uchar *p;
+  for (p=pb->data; p+1<pb->end; p++) {
+    if (p[0]!=0xFF || p[1]==0x00 || p[1]==0xFF) continue;
+    if (p[1]>=M_RST0 && p[1]<=M_RST7) p+=2;
+    break; };
+  pb->data=p;
+  pb->buf=0;
+  pb->nbits=0;
+  pb->marker=0;
+  for (i=0; i<pj->ncomp; i++) pj->comp[i].dcpred=0;
+  pj->eobrun=0;
+};
+
+// Decodes entropy-coded data of the scan that starts at p. I keep only
+// luminance coefficients; chrominance is parsed only when it is interleaved
+// with luminance. Returns pointer to the marker that follows the scan.
+static uchar *Decodescan(t_jpeg *pj,uchar *p,uchar *end,int *list,int ns) {
+  int i,j,n,x,y,bx,by,nx,ny,mcu,bad;
+  short *blk;
+  t_jcomp *pc;
+  t_jbits bits;
+  bits.data=p; bits.end=end; bits.buf=0; bits.nbits=0; bits.marker=0;
+  for (i=0; i<pj->ncomp; i++) pj->comp[i].dcpred=0;
+  pj->eobrun=0;
+  bad=0;
+  if (ns==1) {
+    // Non-interleaved scan contains only blocks that overlap the image.
+    pc=pj->comp+list[0];
+    nx=((pj->sizex*pc->h+pj->hmax-1)/pj->hmax+7)/8;
+    ny=((pj->sizey*pc->v+pj->vmax-1)/pj->vmax+7)/8; }
+  else {
+    nx=pj->mcux; ny=pj->mcuy; };
+  for (y=0,mcu=0; y<ny && bad==0; y++) {
+    for (x=0; x<nx && bad==0; x++,mcu++) {
+      if (pj->restart!=0 && mcu>0 && mcu%pj->restart==0)
+        Restartscan(pj,&bits);
+      for (i=0; i<ns && bad==0; i++) {
+        pc=pj->comp+list[i];
+        n=(ns==1?1:pc->h*pc->v);
+        for (j=0; j<n && bad==0; j++) {
+          if (ns==1) {
+            bx=x; by=y; }
+          else {
+            bx=x*pc->h+j%pc->h; by=y*pc->v+j/pc->h; };
+          if (list[i]==0)
+            blk=pj->coef+(by*pj->nbx+bx)*64;
+          else
+            blk=NULL;
+          if (pj->progressive==0)
+            bad=Decodesequential(pj,&bits,pc,blk);
+          else if (pj->ss==0)
+            bad=Decodedc(pj,&bits,pc,blk);
+          else if (pj->ah==0)
+            bad=Decodeacfirst(pj,&bits,pc,blk);
+          else
+            bad=Decodeacrefine(pj,&bits,pc,blk);
+          ;
+        };
+      };
+    };
+  };
+  // Corrupt scan is not fatal: what is decoded so far remains, and damaged
+  // blocks will be restored by ECC or recovery blocks. Remaining data bytes
+  // of the scan (if any) are skipped.
+  return Skiptomarker(bits.data,end);
+};
+
+// Estimates dot pitch, in pixels, from the spectrum of luminance. Random dots
+// concentrate their energy at frequencies below 1/dotsize, and the ratio of
+// mean energies in the second and first rings of DCT coefficients falls
+// approximately as (2.4/dotsize)^2. I subtract noise, estimated from the
+// highest frequencies, and convert dot size to pitch using current dot size
+// setting. Returns 0 if image is too flat to tell.
+static float Getdotpitch(t_jpeg *pj) {
+  int i,j,k,r,n;
+  float c;
+  double e[8],ratio;
+  short *blk;
+  for (r=0; r<8; r++) e[r]=0.0;
+  n=pj->nbx*pj->nby;
+  for (i=0,blk=pj->coef; i<n; i++,blk+=64) {
+    for (j=0; j<8; j++) {
+      for (k=0; k<8; k++) {
+        r=max(j,k);
+        if (r!=1 && r!=2 && r!=7) continue;
+        c=blk[j*8+k]*pj->yq[j*8+k];
+        e[r]+=c*c;
+      };
+    };
+  };
+  // Ring r contains 2*r+1 coefficients.
+  e[1]=e[1]/3.0-e[7]/15.0;
+  e[2]=e[2]/5.0-e[7]/15.0;
+  if (e[1]<=0.0) return 0.0;
+  ratio=max(e[2]/e[1],1.0e-4);
+  return (float)(2.4/sqrt(ratio)*100.0/max(dotpercent,10));
+};
+
+// Calculates inverse DCT of the block and writes n*n pixels to the bitmap at
+// dest, n is 8, 4 or 2 (shift 0, 1 or 2). Kernels of reduced size give block
+// downscaled in the DCT domain, whole 2x2 or 4x4 groups of pixels at once.
+// Rows of bitmap are upside down. Only nx*ny pixels that fall into the bitmap
+// are written.
+static void Idctblock(short *blk,float *q,int shift,uchar *dest,int rowbytes,
+  int nx,int ny) {
+  int i,j,k,n,ac,v,row[8];
+  float f[64],t[64],s,*tab;
+  n=8>>shift;
+  tab=idcttab[shift];
+  for (j=0,ac=0; j<8; j++) {
+    for (i=0,row[j]=0; i<8; i++) {
+      f[j*8+i]=blk[j*8+i]*q[j*8+i];
+      if (blk[j*8+i]!=0) row[j]=1;
+    };
+    if (j>0) ac|=row[j]; };
+  for (i=1; i<8; i++) ac|=(blk[i]!=0);
+  // Flat blocks (margins, large black areas) are very frequent.
+  if (ac==0) {
+    v=(int)(f[0]/8.0f+128.5f);
+    v=max(0,min(255,v));
+    for (j=0; j<ny; j++,dest-=rowbytes) memset(dest,v,nx);
+    return; };
+  for (j=0; j<8; j++) {                // Rows
+    for (i=0; i<n; i++) {
+      if (row[j]==0) { t[j*8+i]=0.0f; continue; };
+      for (k=0,s=0.0f; k<8; k++) s+=f[j*8+k]*tab[i*8+k];
+      t[j*8+i]=s;
+    };
+  };
+  for (j=0; j<ny; j++,dest-=rowbytes) { // Columns
+    for (i=0; i<nx; i++) {
+      for (k=0,s=128.5f; k<8; k++) s+=t[k*8+i]*tab[j*8+k];
+      v=(int)s;
+      dest[i]=(uchar)max(0,min(255,v));
+    };
+  };
+};
+
+// Prepares IDCT kernels. Each output point of the reduced kernel is the mean
+// of 1<<shift neighbouring points of the 8-point IDCT, so downscaled block is
+// exactly the box-filtered original.
+static void Initidct(void) {
+  int i,j,k,n,shift;
+  double c;
+  for (shift=0; shift<3; shift++) {
+    n=8>>shift;
+    for (i=0; i<n; i++) {
+      for (k=0; k<8; k++) {
+        for (j=i<<shift,c=0.0; j<(i+1)<<shift; j++)
+          c+=cos((2*j+1)*k*3.14159265358979/16.0);
+        idcttab[shift][i*8+k]=(float)(0.5*(k==0?sqrt(0.5):1.0)*c/(1<<shift));
+      };
+    };
+  };
+  idctready=1;
+};
+
+// Reads JPEG file and decodes its luminance. Supported are baseline, extended
+// sequential and progressive Huffman-coded frames with 8-bit precision.
+// Chrominance is never reconstructed. If the estimated dot pitch is large, I
+// downscale the image in the DCT domain by 2 or 4, so that oversampled scans
+// are never fully decompressed. Does not touch UI and can be called from any
+// thread. Returns 0 on success and -1 on error (reason is in error).
+int Readjpegfile(char *path,t_scanpage *page,char *error) {
+  int i,j,k,m,n,length,ns,list[MAXJCOMP],shift,outx,outy,nx,ny;
+  float pitch;
+  char fil[_MAX_FNAME],ext[_MAX_EXT];
+  uchar *file,*data,*p,*q,*end;
+  ulong size,l;
+  HANDLE hfile;
+  t_jpeg *pj;
+  t_jcomp *pc;
+  fnsplit(path,NULL,NULL,fil,ext);
+  // Read whole file into memory.
+  hfile=CreateFile(path,GENERIC_READ,FILE_SHARE_READ,NULL,
+    OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,NULL);
+  if (hfile==INVALID_HANDLE_VALUE) {
+    sprintf(error,"Unable to open %s%s",fil,ext);
+    return -1; };
+  size=GetFileSize(hfile,&l);
+  if (size<4 || size==INVALID_FILE_SIZE || l!=0) {
+    sprintf(error,"Unable to read %s%s",fil,ext);
+    CloseHandle(hfile); return -1; };
+  file=(uchar *)GlobalAlloc(GMEM_FIXED,size);
+  pj=(t_jpeg *)GlobalAlloc(GPTR,sizeof(t_jpeg));
+  if (file==NULL || pj==NULL) {
+    if (file!=NULL) GlobalFree((HGLOBAL)file);
+    if (pj!=NULL) GlobalFree((HGLOBAL)pj);
+    sprintf(error,"Low memory");
+    CloseHandle(hfile); return -1; };
+  if (ReadFile(hfile,file,size,&l,NULL)==0 || l!=size) {
+    sprintf(error,"Unable to read %s%s",fil,ext);
+    GlobalFree((HGLOBAL)file);
+    GlobalFree((HGLOBAL)pj);
+    CloseHandle(hfile); return -1; };
+  CloseHandle(hfile);
+  for (i=0; i<4; i++) {
+    Clearhufftable(pj->dc+i);
+    Clearhufftable(pj->ac+i); };
+  // Walk through markers. Any error sets m to 0.
+  end=file+size;
+  m=(file[0]==0xFF && file[1]==M_SOI);
+  p=file+2;
+  while (m!=0) {
+    while (p<end && *p!=0xFF) p++;     // Garbage between segments
+    while (p<end && *p==0xFF) p++;     // Fill bytes
+    if (p>=end) break;                 // Missing EOI, decode what we have
+    m=*p++;
+    if (m==M_EOI) break;
+    if (m==M_SOI || (m>=M_RST0 && m<=M_RST7) || m==0x01) continue;
+    if (p+2>end) { m=0; break; };
+    length=(p[0]<<8)|p[1];
+    if (length<2 || p+length>end) { m=0; break; };
+    q=p+2; p+=length; length-=2;
+    if (m==M_SOF0 || m==M_SOF1 || m==M_SOF2) {
+      if (pj->coef!=NULL || length<6 || q[0]!=8) { m=0; break; };
+      pj->progressive=(m==M_SOF2);
+      pj->sizey=(q[1]<<8)|q[2];
+      pj->sizex=(q[3]<<8)|q[4];
+      pj->ncomp=q[5];
+      if (pj->ncomp<1 || pj->ncomp>MAXJCOMP || length<6+3*pj->ncomp ||
+        pj->sizex<128 || pj->sizey<128
+      ) {
+        m=0; break; };
+      pj->hmax=pj->vmax=1;
+      for (i=0,pc=pj->comp; i<pj->ncomp; i++,pc++) {
+        pc->id=q[6+i*3];
+        pc->h=q[7+i*3]>>4;
+        pc->v=q[7+i*3] & 15;
+        pc->tq=q[8+i*3] & 3;
+        if (pc->h<1 || pc->h>4 || pc->v<1 || pc->v>4) break;
+        pj->hmax=max(pj->hmax,pc->h);
+        pj->vmax=max(pj->vmax,pc->v); };
+      // Luminance must have full resolution. This is always so unless
+      // somebody is joking.
+      if (i<pj->ncomp || pj->comp[0].h!=pj->hmax || pj->comp[0].v!=pj->vmax) {
+        m=0; break; };
+      pj->mcux=(pj->sizex+8*pj->hmax-1)/(8*pj->hmax);
+      pj->mcuy=(pj->sizey+8*pj->vmax-1)/(8*pj->vmax);
+      pj->nbx=pj->mcux*pj->hmax;
+      pj->nby=pj->mcuy*pj->vmax;
+      if ((double)pj->nbx*pj->nby*64.0*sizeof(short)<2147483648.0)
+        pj->coef=(short *)GlobalAlloc(GPTR,
+        (SIZE_T)pj->nbx*pj->nby*64*sizeof(short));
+      if (pj->coef==NULL) {
+        sprintf(error,"Low memory");
+        GlobalFree((HGLOBAL)file);
+        GlobalFree((HGLOBAL)pj);
+        return -1; };
+      ; }
+    else if (m==M_DHT) {
+      while (length>=17) {
+        for (i=0,n=0; i<16; i++) n+=q[1+i];
+        if ((q[0] & 0x0F)>3 || length<17+n) { m=0; break; };
+        if (Buildhufftable((q[0]>>4?pj->ac:pj->dc)+(q[0] & 3),q+1,q+17)!=0) {
+          m=0; break; };
+        q+=17+n; length-=17+n;
+      }; }
+    else if (m==M_DQT) {
+      while (length>=65) {
+        n=(q[0]>>4?129:65);            // 16- or 8-bit precision
+        if ((q[0] & 0x0F)>3 || length<n) { m=0; break; };
+        for (i=0; i<64; i++) {
+          if (n==65) k=q[1+i];
+          else k=(q[1+2*i]<<8)|q[2+2*i];
+          pj->qt[q[0] & 3][zigzag[i]]=(ushort)k; };
+        q+=n; length-=n;
+      }; }
+    else if (m==M_DRI) {
+      if (length>=2) pj->restart=(q[0]<<8)|q[1]; }
+    else if (m==M_APP0) {
+      // JFIF header keeps density in dots per inch or per centimeter.
+      if (length>=12 && memcmp(q,"JFIF",5)==0) {
+        k=(q[8]<<8)|q[9];
+        if (q[7]==1) pj->density=k;
+        else if (q[7]==2) pj->density=(k*254+50)/100;
+        ;
+      }; }
+    else if (m==M_SOS) {
+      if (pj->coef==NULL || length<1) { m=0; break; };
+      ns=q[0];
+      if (ns<1 || ns>pj->ncomp || length<4+2*ns) { m=0; break; };
+      for (i=0,k=0; i<ns; i++) {
+        for (j=0; j<pj->ncomp; j++) {
+          if (pj->comp[j].id==q[1+i*2]) break; };
+        if (j>=pj->ncomp) break;
+        list[i]=j;
+        pj->comp[j].td=(q[2+i*2]>>4) & 3;
+        pj->comp[j].ta=q[2+i*2] & 3;
+        if (j==0) k=1; };
+      if (i<ns) { m=0; break; };
+      pj->ss=q[1+ns*2];
+      pj->se=q[2+ns*2];
+      pj->ah=q[3+ns*2]>>4;
+      pj->al=q[3+ns*2] & 15;
+      if (pj->progressive==0) {
+        pj->ss=0; pj->se=63; pj->ah=pj->al=0; }
+      else if (pj->ss>pj->se || pj->se>63 || pj->al>13 ||
+        (pj->ss==0 && pj->se!=0) || (pj->ss!=0 && ns!=1)) {
+        m=0; break; };
+      // Scans without luminance are skipped unparsed. Quantization table may
+      // change between scans, I use one that was valid when luminance first
+      // appeared.
+      if (k==0)
+        p=Skiptomarker(p,end);
+      else {
+        if (pj->yqvalid==0) {
+          for (i=0; i<64; i++) pj->yq[i]=pj->qt[pj->comp[0].tq][i];
+          pj->yqvalid=1; };
+        p=Decodescan(pj,p,end,list,ns);
+      };
+    };
+  };
+  GlobalFree((HGLOBAL)file);
+  if (m==0 || pj->yqvalid==0) {
+    if (pj->coef!=NULL) GlobalFree((HGLOBAL)pj->coef);
+    GlobalFree((HGLOBAL)pj);
+    sprintf(error,"Unsupported or invalid JPEG file %s%s",fil,ext);
+    return -1; };
+  // Select scale. After downscaling, dots must remain at least 3 pixels apart
+  // (decoder is able to work down to 2.25) and bitmap must not get too small.
+  // Resolution from the JFIF header, if present, limits the estimated pitch
+  // from above.
+  pitch=Getdotpitch(pj);
+  if (pj->density>0 && dpi>0)
+    pitch=min(pitch,(float)pj->density/dpi);
+  for (shift=2; shift>0; shift--) {
+    if (pitch>=3.0f*(1<<shift) &&
+      (pj->sizex>>shift)>=512 && (pj->sizey>>shift)>=512) break;
+    ;
+  };
+  outx=(pj->sizex+(1<<shift)-1)>>shift;
+  outy=(pj->sizey+(1<<shift)-1)>>shift;
+  if (outx>32768 || outy>32768) {
+    GlobalFree((HGLOBAL)pj->coef);
+    GlobalFree((HGLOBAL)pj);
+    sprintf(error,"JPEG image %s%s is too large",fil,ext);
+    return -1; };
+  data=(uchar *)GlobalAlloc(GMEM_FIXED,outx*outy+4);
+  if (data==NULL) {
+    GlobalFree((HGLOBAL)pj->coef);
+    GlobalFree((HGLOBAL)pj);
+    sprintf(error,"Low memory");
+    return -1; };
+  if (idctready==0)
+    Initidct();
+  // Reconstruct luminance. Bitmaps in memory are placed upside down.
+  n=8>>shift;
+  for (j=0; j<pj->nby && j*n<outy; j++) {
+    ny=min(n,outy-j*n);
+    for (i=0; i<pj->nbx && i*n<outx; i++) {
+      nx=min(n,outx-i*n);
+      Idctblock(pj->coef+(j*pj->nbx+i)*64,pj->yq,shift,
+        data+(outy-1-j*n)*outx+i*n,outx,nx,ny);
+      ;
+    };
+  };
+  GlobalFree((HGLOBAL)pj->coef);
+  GlobalFree((HGLOBAL)pj);
+  page->data=data;
+  page->sizex=outx;
+  page->sizey=outy;
+  page->bpp=8;
+  page->index=1;
+  return 0;
+};
+
+// Opens JPEG file and passes its luminance to the decoder. Returns 0 on
+// success and -1 on error.
+int Decodejpeg(char *path) {
+  char s[TEXTLEN+MAX_PATH];
+  HCURSOR prevcursor;
+  t_scanpage page;
+  prevcursor=SetCursor(LoadCursor(NULL,IDC_WAIT));
+  if (Readjpegfile(path,&page,s)!=0) {
+    SetCursor(prevcursor);
+    Reporterror(s);
+    return -1; };
+  SetCursor(prevcursor);
+  Startbitmapdecoding(&procdata,page.data,page.sizex,page.sizey,8);
+  return 0;
+};
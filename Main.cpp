@@ -79,6 +79,34 @@
 // different rows and columns, thus increasing the probability of data recovery,
 // even if some parts are completely missing. Redundancy blocks contain ngroup
 // in the most significant 4 bits.
+//
+// In erasure mode (PBM_ERASURE), groups are larger and have several recovery
+// blocks. Recovery block j has the address of the j-th block of the group and
+// contains Cauchy Reed-Solomon parity over GF(256), inverted. Any m recovery
+// blocks restore any m lost data blocks of the group. Parity 0 is the plain
+// XOR checksum described above, so that old decoders still can use it.
+//
+// Optionally, each stripe of up to PARSTRIPE data pages is followed by 1..3
+// parity pages (number is kept in PBM_PARPAGES bits of mode). Parity pages
+// are printed after all data pages as if they were the continuation of the
+// data, and are erasure-coded across the data pages of the stripe position by
+// position, so that as many completely lost pages can be rebuilt.
+//
+// Folder is printed as archive (PBM_ARCHIVE). Its files are packed into one
+// payload that starts with the table of contents (t_archead and t_arcentry
+// with relative paths) and is compressed and printed like a single file.
+// Decoder extracts all files into the folder selected by user.
+//
+// Compressed data may be preceded by the index of frames (PBM_FRAMED), pairs
+// of offsets in the original data and in the bzip2 stream where blocks start
+// (t_framehead and t_frame). Each bzip2 block unpacks alone, so one file of
+// the archive or a range of bytes can be restored from the pages that hold
+// the index and the covering blocks, without scanning the whole backup.
+//
+// Uncompressed data may have zero and repeating blocks elided (PBM_ELIDED).
+// Payload starts with the list of runs (t_elidehead and t_elision) that
+// replace such blocks, followed by the remaining blocks. Decoder expands the
+// payload into the original data before saving.
 
 // TODO: manual restoration of damaged blocks.
 
@@ -189,10 +217,26 @@ int CALLBACK Optionsdlgproc(HWND hw,UINT msg,WPARAM wp,LPARAM lp) {
       CheckDlgButton(hw,OPT_HEADER,(printheader?BST_CHECKED:BST_UNCHECKED));
       // Initialize border checkbox.
       CheckDlgButton(hw,OPT_BORDER,(printborder?BST_CHECKED:BST_UNCHECKED));
+      // Initialize layout planner checkbox.
+      CheckDlgButton(hw,OPT_FITLAYOUT,(fitlayout?BST_CHECKED:BST_UNCHECKED));
+      // Initialize frame index checkbox.
+      CheckDlgButton(hw,OPT_RANDOM,(randomaccess?BST_CHECKED:BST_UNCHECKED));
+      // Initialize block elision checkbox.
+      CheckDlgButton(hw,OPT_ELIDE,(elision?BST_CHECKED:BST_UNCHECKED));
       // Initialize autosave checkbox.
       CheckDlgButton(hw,OPT_AUTOSAVE,(autosave?BST_CHECKED:BST_UNCHECKED));
       // Initialize best quality checkbox.
       CheckDlgButton(hw,OPT_HIQ,(bestquality?BST_CHECKED:BST_UNCHECKED));
+      // Initialize erasure coding checkbox.
+      CheckDlgButton(hw,OPT_ERASURE,(erasure?BST_CHECKED:BST_UNCHECKED));
+      // Initialize list of parity pages.
+      SendMessage(GetDlgItem(hw,OPT_PARPAGES),CB_SETEXTENDEDUI,1,0);
+      for (i=0; i<=NPARPAGES; i++) {
+        if (i==0) strcpy(s,"None");
+        else sprintf(s,"%i : %i",i,PARSTRIPE);
+        SendMessage(GetDlgItem(hw,OPT_PARPAGES),CB_ADDSTRING,0,(LPARAM)s); };
+      parpages=max(0,min(parpages,NPARPAGES));
+      SendMessage(GetDlgItem(hw,OPT_PARPAGES),CB_SETCURSEL,parpages,0);
       return TRUE;
     case WM_COMMAND:
       if (LOWORD(wp)==OPT_OK) {
@@ -213,10 +257,20 @@ int CALLBACK Optionsdlgproc(HWND hw,UINT msg,WPARAM wp,LPARAM lp) {
         printheader=(IsDlgButtonChecked(hw,OPT_HEADER)==BST_CHECKED);
         // Get border option.
         printborder=(IsDlgButtonChecked(hw,OPT_BORDER)==BST_CHECKED);
+        // Get layout planner option.
+        fitlayout=(IsDlgButtonChecked(hw,OPT_FITLAYOUT)==BST_CHECKED);
+        // Get frame index option.
+        randomaccess=(IsDlgButtonChecked(hw,OPT_RANDOM)==BST_CHECKED);
+        // Get block elision option.
+        elision=(IsDlgButtonChecked(hw,OPT_ELIDE)==BST_CHECKED);
         // Get autosave option.
         autosave=(IsDlgButtonChecked(hw,OPT_AUTOSAVE)==BST_CHECKED);
         // Get best quality option.
         bestquality=(IsDlgButtonChecked(hw,OPT_HIQ)==BST_CHECKED);
+        // Get erasure coding option.
+        erasure=(IsDlgButtonChecked(hw,OPT_ERASURE)==BST_CHECKED);
+        // Get number of parity pages.
+        parpages=SendMessage(GetDlgItem(hw,OPT_PARPAGES),CB_GETCURSEL,0,0);
         EndDialog(hw,0); }
       else if (LOWORD(wp)==OPT_CANCEL)
         EndDialog(hw,0);
@@ -235,10 +289,28 @@ void Options(void) {
   DialogBox(hinst,"DIALOG_OPTIONS",hwmain,(DLGPROC)Optionsdlgproc);
 };
 
+// Adds dropped or command-line file to the queue. Bitmaps, scans and "-"
+// (PNM pages on the standard input) are decoded, all other files printed.
+static void Queuefile(char *path) {
+  char ext[_MAX_EXT];
+  fnsplit(path,NULL,NULL,NULL,ext);
+  if (strcmp(path,"-")==0 || _stricmp(ext,".bmp")==0 ||
+    _stricmp(ext,".tif")==0 || _stricmp(ext,".tiff")==0 ||
+    _stricmp(ext,".jpg")==0 || _stricmp(ext,".jpeg")==0 ||
+    _stricmp(ext,".pnm")==0 || _stricmp(ext,".pbm")==0 ||
+    _stricmp(ext,".pgm")==0 || _stricmp(ext,".ppm")==0)
+    // Default action by bitmaps: decode.
+    Addfiletoqueue(path,1);
+  else
+    // Default action by all other files: print.
+    Addfiletoqueue(path,0);
+  ;
+};
+
 // Windows function of main MRPODS window.
 LRESULT CALLBACK Mainwp(HWND hw,UINT msg,WPARAM wp,LPARAM lp) {
   int i,n;
-  char path[MAX_PATH],ext[_MAX_EXT];
+  char path[MAX_PATH];
   HDC dc;
   PAINTSTRUCT ps;
   switch (msg) {
@@ -268,7 +340,7 @@ LRESULT CALLBACK Mainwp(HWND hw,UINT msg,WPARAM wp,LPARAM lp) {
             SelectTWAINsource();
             break;
           case M_FILE_ACQUIRE:         // Scan
-            OpenTWAINinterface();
+            Acquirepages();
             Updatebuttons();
             break;
           case M_FILE_PAGE:            // Page setup
@@ -292,14 +364,7 @@ LRESULT CALLBACK Mainwp(HWND hw,UINT msg,WPARAM wp,LPARAM lp) {
       n=DragQueryFile((HDROP)wp,0xFFFFFFFF,path,MAX_PATH);
       for (i=0; i<n; i++) {
         if (DragQueryFile((HDROP)wp,i,path,MAX_PATH)>0) {
-          fnsplit(path,NULL,NULL,NULL,ext);
-          if (_stricmp(ext,".bmp")==0)
-            // Default action by bitmaps: decode.
-            Addfiletoqueue(path,1);
-          else
-            // Default action by all other files: print.
-            Addfiletoqueue(path,0);
-          ;
+          Queuefile(path);
         };
       };
       DragFinish((HDROP)wp);
@@ -316,7 +381,7 @@ LRESULT CALLBACK Mainwp(HWND hw,UINT msg,WPARAM wp,LPARAM lp) {
 
 // Main MRPODS program.
 int PASCAL WinMain(HINSTANCE hi,HINSTANCE hprev,LPSTR cmdline,int show) {
-  int dx,dy,isbitmap;
+  int n,dx,dy,isbitmap;
   char path[MAX_PATH],drv[_MAX_DRIVE+1],dir[_MAX_DIR],fil[_MAX_FNAME];
   char s[TEXTLEN],inifile[MAX_PATH];
   WNDCLASS wc;
@@ -345,12 +410,21 @@ int PASCAL WinMain(HINSTANCE hi,HINSTANCE hprev,LPSTR cmdline,int show) {
   printborder=GetPrivateProfileInt("Settings","Border",0,inifile);
   autosave=GetPrivateProfileInt("Settings","Autosave",1,inifile);
   bestquality=GetPrivateProfileInt("Settings","Best quality",1,inifile);
+  erasure=GetPrivateProfileInt("Settings","Erasure coding",0,inifile);
+  parpages=GetPrivateProfileInt("Settings","Parity pages",0,inifile);
+  fitlayout=GetPrivateProfileInt("Settings","Fit layout",0,inifile);
+  randomaccess=GetPrivateProfileInt("Settings","Random access",0,inifile);
+  elision=GetPrivateProfileInt("Settings","Elide blocks",0,inifile);
   // Get printer's page size.
   marginunits=GetPrivateProfileInt("Settings","Margin units",0,inifile);
   marginleft=GetPrivateProfileInt("Settings","Margin left",1000,inifile);
   marginright=GetPrivateProfileInt("Settings","Margin right",400,inifile);
   margintop=GetPrivateProfileInt("Settings","Margin top",400,inifile);
   marginbottom=GetPrivateProfileInt("Settings","Margin bottom",500,inifile);
+  // Replay source stands in for the scanner. There is no dialog for it.
+  GetPrivateProfileString("Settings","Replay source","",replaysource,MAX_PATH,
+    inifile);
+  replaydelay=GetPrivateProfileInt("Settings","Replay delay",0,inifile);
   // Register class of main window.
   wc.style=CS_OWNDC;
   wc.lpfnWndProc=Mainwp;
@@ -383,10 +457,36 @@ int PASCAL WinMain(HINSTANCE hi,HINSTANCE hprev,LPSTR cmdline,int show) {
   twainstate=1;
   if (LoadTWAINlibrary()==0) {
     EnableMenuItem(hmenu,M_FILE_SELECT,MF_BYCOMMAND|MF_GRAYED);
-    EnableMenuItem(hmenu,M_FILE_ACQUIRE,MF_BYCOMMAND|MF_GRAYED); };
+    if (replaysource[0]=='\0')
+      EnableMenuItem(hmenu,M_FILE_ACQUIRE,MF_BYCOMMAND|MF_GRAYED);
+    ;
+  };
   Updatebuttons();
   // Initialize printer settings.
   Initializeprintsettings();
+  Initfileprocessor();
+  Initerasure();
+  // Files on the command line are processed as if dropped into the window.
+  // Names with spaces must be quoted.
+  while (*cmdline!='\0') {
+    while (*cmdline==' ' || *cmdline=='\t') cmdline++;
+    if (*cmdline=='\0') break;
+    n=0;
+    if (*cmdline=='"') {
+      cmdline++;
+      while (*cmdline!='\0' && *cmdline!='"') {
+        if (n<MAX_PATH-1) path[n++]=*cmdline;
+        cmdline++; };
+      if (*cmdline=='"') cmdline++; }
+    else {
+      while (*cmdline!='\0' && *cmdline!=' ' && *cmdline!='\t') {
+        if (n<MAX_PATH-1) path[n++]=*cmdline;
+        cmdline++;
+      };
+    };
+    path[n]='\0';
+    if (n>0) Queuefile(path);
+  };
   // And now, the main Windows loop.
   while (1) {
     // Check if there are some unprocessed Windows messages and process them at
@@ -414,15 +514,24 @@ int PASCAL WinMain(HINSTANCE hi,HINSTANCE hprev,LPSTR cmdline,int show) {
       Nextdataprocessingstep(&procdata);
     else if (printdata.step!=0)
       Nextdataprintingstep(&printdata);
+    // Pages of the scanner or open multi-page file go before the queued
+    // files. When decoder takes scanned page, scanner may transfer the next.
+    if (procdata.step==0 && printdata.step==0 && Pagestreamactive())
+      Nextstreampage();
+    if (twainpending && Scanpageroom())
+      GetpicturefromTWAIN();
     // Some TWAIN drivers require very frequent calls when scanning, don't
     // sleep.
     if (twainstate>=5)
       continue;
     // Check whether new printing or decoding task can be executed.
     if (procdata.step==0 && printdata.step==0) {
-      isbitmap=Getfilefromqueue(path);
-      if (isbitmap==0) Printfile(path,NULL);
-      else if (isbitmap==1) Decodebitmap(path); };
+      if (Pagestreamactive()==0) {
+        isbitmap=Getfilefromqueue(path);
+        if (isbitmap==0) Printfile(path,NULL);
+        else if (isbitmap==1) Decodebitmap(path);
+      };
+    };
     // If we have nothing to do, be kind to other applications.
     if (twainstate<5 && procdata.step==0 && printdata.step==0 &&
       GetQueueStatus(QS_ALLINPUT)==0
@@ -430,6 +539,8 @@ int PASCAL WinMain(HINSTANCE hi,HINSTANCE hprev,LPSTR cmdline,int show) {
       Sleep(1);                        // Reduces CPU time practically to zero
     };
   };
+  // Stop reader of the multi-page file, if any.
+  Closepagestream();
   // Save settings to the initialization file.
   WritePrivateProfileString("Settings","Infile",infile,inifile);
   WritePrivateProfileString("Settings","Inbmp",inbmp,inifile);
@@ -451,6 +562,16 @@ int PASCAL WinMain(HINSTANCE hi,HINSTANCE hprev,LPSTR cmdline,int show) {
     WritePrivateProfileString("Settings","Autosave",s,inifile);
   sprintf(s,"%i",bestquality);
     WritePrivateProfileString("Settings","Best quality",s,inifile);
+  sprintf(s,"%i",erasure);
+    WritePrivateProfileString("Settings","Erasure coding",s,inifile);
+  sprintf(s,"%i",parpages);
+    WritePrivateProfileString("Settings","Parity pages",s,inifile);
+  sprintf(s,"%i",fitlayout);
+    WritePrivateProfileString("Settings","Fit layout",s,inifile);
+  sprintf(s,"%i",randomaccess);
+    WritePrivateProfileString("Settings","Random access",s,inifile);
+  sprintf(s,"%i",elision);
+    WritePrivateProfileString("Settings","Elide blocks",s,inifile);
   // Save printer's page size.
   if (pagesetup.Flags & PSD_INTHOUSANDTHSOFINCHES) marginunits=1;
   else if (pagesetup.Flags & PSD_INHUNDREDTHSOFMILLIMETERS) marginunits=2;
@@ -468,8 +589,12 @@ int PASCAL WinMain(HINSTANCE hi,HINSTANCE hprev,LPSTR cmdline,int show) {
       WritePrivateProfileString("Settings","Margin bottom",s,inifile);
     ;
   };
+  WritePrivateProfileString("Settings","Replay source",replaysource,inifile);
+  sprintf(s,"%i",replaydelay);
+    WritePrivateProfileString("Settings","Replay delay",s,inifile);
   // Clean up.
   Freeprocdata(&procdata);
+  Freefileprocessor();
   Stopprinting(&printdata);
   CloseTWAINmanager();
   CloseTWAINlibrary();
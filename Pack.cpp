@@ -0,0 +1,469 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+// MRPODS -- Machine-Readable Printed Optical Data Sheets                     //
+// https://github.com/sheafdynamics/mrpods                                    //
+//                                                                            //
+// Copyright (c) 2024 Ray Doll                                                //
+// Copyright (c) 2007 Oleh Yuschuk                                            //
+//                                                                            //
+// This file is part of MRPODS, which is built off                            //
+// Oleh Yuschuk's PaperBack https://ollydbg.de/Paperbak/                      //
+// MRPODS is cumulative work of passionate programmers,                       //
+// both named and unnamed, including freelancers and private contractors.     //
+// Without them, this would not be possible.                                  //
+// This software contains Oleh Yuschuk's original comments and                //
+// comments from other maintainers.                                           //
+//                                                                            //
+// MRPODS is free software; you can redistribute it and/or modify it under    //
+// the terms of the GNU General Public License as published by the Free       //
+// Software Foundation; either version 3 of the License, or (at your option)  //
+// any later version.                                                         //
+//                                                                            //
+// MRPODS is distributed in the hope that it will be useful, but WITHOUT      //
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or      //
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for   //
+// more details.                                                              //
+//                                                                            //
+// You should have received a copy of the GNU General Public License along    //
+// with this program. If not, see <http://www.gnu.org/licenses/>.             //
+//                                                                            //
+//                              bzip2 license                                 //
+// -------------------------------------------------------------------------- //
+// "bzip2", the associated library "libbzip2" copyright(C) 1996 - 2010        //
+// Julian R Seward. All rights reserved.                                      //
+// Julian Seward, jseward@acm.org                                             //
+// bzip2 / libbzip2 version 1.0.6 of 6 September 2010                         //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include <windows.h>
+#include <commctrl.h>
+#include <stdio.h>
+#include <direct.h>
+#include <math.h>
+#include "twain.h"
+#pragma hdrstop
+
+#include "mrpods.h"
+#include "resource.h"
+
+// Input file is cut into chunks of bzip2 block size that are compressed by a
+// pool of threads, one per processor. Threads read chunks directly from the
+// buffer of the caller. Run-length encoding that precedes block
+// sorting may expand data by up to 5/4; if chunk doesn't fit into a single
+// block, thread splits it in two. Each part is compressed into its own bzip2
+// stream. Main thread collects streams in the order of data, strips headers
+// and end-of-stream markers and appends bare blocks, bit by bit, to the
+// single output stream. Combined CRC of the output is calculated from the
+// block CRCs. Result is an ordinary bzip2 stream that any decompressor,
+// including old versions of this program, accepts.
+
+#define PACKWAIT       10              // Max wait for packed chunk, ms
+
+typedef struct t_packthread {          // Packing thread
+  HANDLE         hthread;              // Thread handle
+  HANDLE         hstart;               // Event, chunk is assigned
+  int            state;                // 0: idle, 1: packing, 2: packed
+  int            chunk;                // Index of assigned chunk
+  int            error;                // Chunk can't be packed
+  uchar          *in;                  // Input data (not owned)
+  ulong          insize;               // Size of input data
+  uchar          *out;                 // One or two single-block streams
+  ulong          outsize[2];           // Sizes of streams
+  ulong          partsize[2];          // Sizes of data packed into streams
+  int            nout;                 // Number of streams
+} t_packthread;
+
+static t_packthread packer[NPACK];     // Packing threads
+static int       npacker;              // Number of running packing threads
+static int       packlevel;            // Block size, 100 kB units (1..9)
+static ulong     chunksize;            // Max size of chunk, bytes
+static int       nextchunk;            // Index of next chunk to pack
+static int       nextcollect;          // Index of next chunk to collect
+static uchar     *packbuf;             // Output buffer
+static ulong     packbufsize;          // Size of output buffer, bytes
+static ulong     packmax;              // Max allowed size of packed data
+static ulong     packbits;             // Used size of output buffer, bits
+static ulong     packcrc;              // Combined CRC of collected blocks
+static ulong     packorig;             // Size of data in collected blocks
+static t_frame   *frame;               // Starts of collected blocks
+static int       nframe;               // Number of entries in frame
+static int       nframemax;            // Allocated number of entries
+static int       frameerror;           // Low memory, frame list incomplete
+static CRITICAL_SECTION packcs;        // Protects states of threads
+static HANDLE    hpackdone;            // Event, some chunk is packed
+static int       stoppack;             // Request to stop packing threads
+
+// Returns length of the longest beginning of data that bzip2 packs into a
+// single block. Run-length encoding replaces runs of 4 to 255 equal bytes by
+// 5 bytes. Block is closed when encoded data reaches 100000*level-19 bytes.
+static ulong Fitblock(uchar *data,ulong size) {
+  ulong i,j,n,limit;
+  limit=packlevel*100000-19-5;
+  for (n=0,i=0; i<size; i=j) {
+    for (j=i+1; j<size && j-i<255 && data[j]==data[i]; j++) ;
+    n+=(j-i<4?j-i:5);
+    if (n>limit)
+      return i;
+    ;
+  };
+  return size;
+};
+
+// Packing thread. Packs assigned chunk and waits for the next one.
+static DWORD WINAPI Packthread(LPVOID param) {
+  int result,stop;
+  uint size;
+  ulong pos,done,n;
+  t_packthread *pt;
+  pt=(t_packthread *)param;
+  while (1) {
+    WaitForSingleObject(pt->hstart,INFINITE);
+    EnterCriticalSection(&packcs);
+    stop=stoppack;
+    LeaveCriticalSection(&packcs);
+    if (stop) break;
+    // Chunk is never longer than encoded block, so second part, if any, is
+    // short and always fits.
+    result=BZ_OK;
+    pt->nout=0;
+    for (pos=done=0; pos<pt->insize && result==BZ_OK; pos+=n) {
+      n=Fitblock(pt->in+pos,pt->insize-pos);
+      size=chunksize+chunksize/100+1200-done;
+      result=BZ2_bzBuffToBuffCompress((char *)pt->out+done,&size,
+        (char *)pt->in+pos,n,packlevel,0,0);
+      pt->outsize[pt->nout]=size;
+      pt->partsize[pt->nout++]=n;
+      done+=size; };
+    EnterCriticalSection(&packcs);
+    pt->error=(result!=BZ_OK);
+    pt->state=2;
+    LeaveCriticalSection(&packcs);
+    SetEvent(hpackdone);
+  };
+  return 0;
+};
+
+// Stops packing threads and frees their resources.
+void Stoppacker(void) {
+  int i;
+  if (npacker==0)
+    return;
+  EnterCriticalSection(&packcs);
+  stoppack=1;
+  LeaveCriticalSection(&packcs);
+  for (i=0; i<npacker; i++) {
+    SetEvent(packer[i].hstart);
+    WaitForSingleObject(packer[i].hthread,INFINITE);
+    CloseHandle(packer[i].hthread);
+    CloseHandle(packer[i].hstart);
+    GlobalFree((HGLOBAL)packer[i].out);
+    memset(packer+i,0,sizeof(t_packthread)); };
+  npacker=0;
+  if (packbuf!=NULL) {
+    GlobalFree((HGLOBAL)packbuf);
+    packbuf=NULL; };
+  if (frame!=NULL) {
+    GlobalFree((HGLOBAL)frame);
+    frame=NULL; };
+  nframe=nframemax=0;
+  CloseHandle(hpackdone);
+  hpackdone=NULL;
+  DeleteCriticalSection(&packcs);
+};
+
+// Starts one packing thread per processor. Level is the block size in 100 kB
+// units, 1..9. Packing fails if packed data gets longer than maxsize bytes.
+// Returns 0 on success and -1 on error.
+int Startpacker(int level,ulong maxsize) {
+  int i,n;
+  DWORD threadid;
+  SYSTEM_INFO si;
+  t_packthread *pt;
+  Stoppacker();
+  if (level<1 || level>9 || maxsize<4)
+    return -1;
+  packlevel=level;
+  chunksize=level*100000-19-5;
+  // Output buffer grows as necessary. Reserve 16 bytes for alignment.
+  packmax=maxsize;
+  packbufsize=min(maxsize,0x00100000)+16;
+  packbuf=(uchar *)GlobalAlloc(GMEM_FIXED,packbufsize);
+  if (packbuf==NULL)
+    return -1;
+  packbuf[0]='B'; packbuf[1]='Z'; packbuf[2]='h'; packbuf[3]=(uchar)('0'+level);
+  packbits=32;
+  packcrc=0;
+  packorig=0;
+  nframe=0;
+  frameerror=0;
+  nextchunk=nextcollect=0;
+  stoppack=0;
+  hpackdone=CreateEvent(NULL,FALSE,FALSE,NULL);
+  if (hpackdone==NULL) {
+    GlobalFree((HGLOBAL)packbuf);
+    packbuf=NULL;
+    return -1; };
+  InitializeCriticalSection(&packcs);
+  GetSystemInfo(&si);
+  n=max(1,min((int)si.dwNumberOfProcessors,NPACK));
+  for (i=0; i<n; i++) {
+    pt=packer+npacker;
+    memset(pt,0,sizeof(t_packthread));
+    pt->out=(uchar *)GlobalAlloc(GMEM_FIXED,chunksize+chunksize/100+1200);
+    pt->hstart=CreateEvent(NULL,FALSE,FALSE,NULL);
+    if (pt->out!=NULL && pt->hstart!=NULL)
+      pt->hthread=CreateThread(NULL,0,Packthread,pt,0,&threadid);
+    if (pt->hthread==NULL) {
+      if (pt->out!=NULL) GlobalFree((HGLOBAL)pt->out);
+      if (pt->hstart!=NULL) CloseHandle(pt->hstart);
+      memset(pt,0,sizeof(t_packthread));
+      break; };
+    npacker++; };
+  if (npacker==0) {
+    CloseHandle(hpackdone);
+    hpackdone=NULL;
+    DeleteCriticalSection(&packcs);
+    GlobalFree((HGLOBAL)packbuf);
+    packbuf=NULL;
+    return -1; };
+  return 0;
+};
+
+// Passes next chunk of data to the idle packing thread. Data must remain in
+// place until packer is stopped. Chunk shorter than the block is passed only
+// if last is set. Returns number of bytes taken or 0 if all threads are busy.
+ulong Packdata(uchar *data,ulong size,int last) {
+  int i;
+  t_packthread *pt;
+  if (size==0 || (size<chunksize && last==0))
+    return 0;
+  pt=NULL;
+  EnterCriticalSection(&packcs);
+  for (i=0; i<npacker; i++) {
+    if (packer[i].state==0) {
+      pt=packer+i;
+      pt->in=data;
+      pt->insize=min(size,chunksize);
+      pt->chunk=nextchunk++;
+      pt->state=1;
+      break;
+    };
+  };
+  LeaveCriticalSection(&packcs);
+  if (pt==NULL)
+    return 0;
+  SetEvent(pt->hstart);
+  return pt->insize;
+};
+
+// Appends nbits of src, starting from bit start, to the output. Returns 0 on
+// success and -1 if output buffer is too small.
+static int Appendbits(uchar *src,ulong start,ulong nbits) {
+  int s,d,n;
+  ulong i,o,b,size;
+  uchar *pb;
+  size=(packbits+nbits+7)/8;
+  if (size>packmax)
+    return -1;
+  if (size+16>packbufsize) {
+    // Enlarge output buffer.
+    size=min(max(size+16,2*packbufsize),packmax+16);
+    pb=(uchar *)GlobalAlloc(GMEM_FIXED,size);
+    if (pb==NULL)
+      return -1;
+    memcpy(pb,packbuf,(packbits+7)/8);
+    GlobalFree((HGLOBAL)packbuf);
+    packbuf=pb;
+    packbufsize=size; };
+  s=start & 7;
+  src+=start/8;
+  for (i=0; i<nbits; i+=8) {
+    b=src[i/8]<<s;
+    if (s!=0 && i+8-s<nbits)
+      b|=src[i/8+1]>>(8-s);
+    n=(int)min(8,nbits-i);
+    b&=(0xFF00>>n) & 0xFF;
+    o=packbits/8;
+    d=packbits & 7;
+    if (d==0)
+      packbuf[o]=(uchar)b;
+    else {
+      packbuf[o]=(uchar)(packbuf[o]|(b>>d));
+      if (d+n>8) packbuf[o+1]=(uchar)(b<<(8-d));
+    };
+    packbits+=n;
+  };
+  return 0;
+};
+
+// Adds start of the next block to the list of frames, growing the list if
+// necessary. On low memory, list is discarded, but packing continues.
+static void Addframe(void) {
+  int n;
+  t_frame *pf;
+  if (frameerror)
+    return;
+  if (nframe>=nframemax) {
+    n=max(64,nframemax*2);
+    pf=(t_frame *)GlobalAlloc(GMEM_FIXED,n*sizeof(t_frame));
+    if (pf==NULL) {
+      frameerror=1;
+      return; };
+    if (frame!=NULL) {
+      memcpy(pf,frame,nframe*sizeof(t_frame));
+      GlobalFree((HGLOBAL)frame); };
+    frame=pf;
+    nframemax=n; };
+  frame[nframe].origoffset=packorig;
+  frame[nframe].bitoffset=packbits;
+  nframe++;
+};
+
+// Returns n bits (n<=24) of data starting at given bit position.
+static ulong Getbits(uchar *data,ulong size,ulong pos,int n) {
+  int k;
+  ulong i,u;
+  i=pos/8;
+  for (u=0,k=0; k<4; k++)
+    u=(u<<8)|(i+k<size?data[i+k]:0);
+  return (u>>(32-(pos & 7)-n)) & ((1<<n)-1);
+};
+
+// Appends block from single-block bzip2 stream to the output. Returns 0 on
+// success, -1 if output buffer is too small and -2 if stream is invalid.
+static int Appendstream(uchar *data,ulong size) {
+  int pad;
+  ulong pos,crc,endcrc;
+  if (size<14 || data[0]!='B' || data[1]!='Z' || data[2]!='h')
+    return -2;
+  // Stream ends with 48-bit magic and 32-bit CRC, padded to byte border.
+  for (pad=0; pad<8; pad++) {
+    pos=size*8-pad-80;
+    if (Getbits(data,size,pos,24)==0x177245 &&
+      Getbits(data,size,pos+24,24)==0x385090)
+      break;
+    ;
+  };
+  if (pad>=8 || pos<=32+80)
+    return -2;
+  // Single-block stream has the same CRC as its only block.
+  crc=(Getbits(data,size,80,16)<<16)|Getbits(data,size,96,16);
+  endcrc=(Getbits(data,size,pos+48,16)<<16)|Getbits(data,size,pos+64,16);
+  if (crc!=endcrc)
+    return -2;
+  if (Appendbits(data,32,pos-32)!=0)
+    return -1;
+  packcrc=((packcrc<<1)|(packcrc>>31)) & 0xFFFFFFFF;
+  packcrc^=crc;
+  return 0;
+};
+
+// Appends packed chunks to the output in the order of data. If wait is set
+// and next chunk is not yet ready, waits for it for a short time. Returns
+// number of chunks that are still being packed, -1 if output buffer is too
+// small and -2 on error.
+int Collectpacked(int wait) {
+  int i,found,result;
+  ulong done;
+  while (nextcollect<nextchunk) {
+    found=-1;
+    EnterCriticalSection(&packcs);
+    for (i=0; i<npacker; i++) {
+      if (packer[i].state==2 && packer[i].chunk==nextcollect) {
+        found=i;
+        break;
+      };
+    };
+    LeaveCriticalSection(&packcs);
+    if (found<0) {
+      if (wait==0) break;
+      WaitForSingleObject(hpackdone,PACKWAIT);
+      wait=0;
+      continue; };
+    if (packer[found].error)
+      return -2;
+    for (i=0,done=0; i<packer[found].nout; i++) {
+      Addframe();
+      result=Appendstream(packer[found].out+done,packer[found].outsize[i]);
+      if (result!=0)
+        return result;
+      packorig+=packer[found].partsize[i];
+      done+=packer[found].outsize[i]; };
+    EnterCriticalSection(&packcs);
+    packer[found].state=0;
+    LeaveCriticalSection(&packcs);
+    nextcollect++;
+  };
+  return nextchunk-nextcollect;
+};
+
+// Closes output stream after all chunks are collected. On success, returns
+// packed data and its size in datasize. Caller must free returned buffer,
+// which has at least 16 spare bytes at the end. Returns NULL if packed data
+// is longer than allowed.
+uchar *Finishpacker(ulong *datasize) {
+  uchar tail[10],*pb;
+  tail[0]=0x17; tail[1]=0x72; tail[2]=0x45;
+  tail[3]=0x38; tail[4]=0x50; tail[5]=0x90;
+  tail[6]=(uchar)(packcrc>>24); tail[7]=(uchar)(packcrc>>16);
+  tail[8]=(uchar)(packcrc>>8); tail[9]=(uchar)packcrc;
+  if (packbuf==NULL)
+    return NULL;
+  Addframe();                          // End of the last block
+  if (Appendbits(tail,0,80)!=0)
+    return NULL;
+  *datasize=(packbits+7)/8;
+  pb=packbuf;
+  packbuf=NULL;
+  return pb;
+};
+
+// Returns list of blocks of the stream closed by Finishpacker(), each of them
+// can be unpacked alone, and sets nframe to their number. List has nframe+1
+// entries, the last marks the end of the last block. Caller must free the
+// list. Returns NULL on error.
+t_frame *Getframes(int *n) {
+  t_frame *pf;
+  if (frame==NULL || frameerror || nframe<2)
+    return NULL;
+  pf=frame;
+  *n=nframe-1;
+  frame=NULL;
+  nframe=nframemax=0;
+  return pf;
+};
+
+// Checks whether data at the beginning of the file is worth compressing. Text
+// and most binary formats have skewed byte statistics. If statistics is nearly
+// flat, as for zip, jpeg or 7z files, data may still contain long repeating
+// strings, so I compress it with the fastest settings. Returns 1 if data seems
+// compressible and 0 otherwise.
+int Checkcompressible(uchar *data,ulong size) {
+  int i,result;
+  uint n;
+  ulong count[256];
+  double p,entropy;
+  uchar *buf;
+  if (size==0)
+    return 0;
+  memset(count,0,sizeof(count));
+  for (i=0; i<(int)size; i++)
+    count[data[i]]++;
+  entropy=0.0;
+  for (i=0; i<256; i++) {
+    if (count[i]==0) continue;
+    p=(double)count[i]/size;
+    entropy-=p*log(p)/log(2.0); };
+  if (entropy<7.0)                     // Bits per byte
+    return 1;
+  n=size+size/100+600;
+  buf=(uchar *)GlobalAlloc(GMEM_FIXED,n);
+  if (buf==NULL)
+    return 1;
+  result=BZ2_bzBuffToBuffCompress((char *)buf,&n,(char *)data,size,1,0,0);
+  GlobalFree((HGLOBAL)buf);
+  return (result==BZ_OK && n<size-size/64);
+};
@@ -0,0 +1,289 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+// MRPODS -- Machine-Readable Printed Optical Data Sheets                     //
+// https://github.com/sheafdynamics/mrpods                                    //
+//                                                                            //
+// Copyright (c) 2024 Ray Doll                                                //
+// Copyright (c) 2007 Oleh Yuschuk                                            //
+//                                                                            //
+// This file is part of MRPODS, which is built off                            //
+// Oleh Yuschuk's PaperBack https://ollydbg.de/Paperbak/                      //
+// MRPODS is cumulative work of passionate programmers,                       //
+// both named and unnamed, including freelancers and private contractors.     //
+// Without them, this would not be possible.                                  //
+// This software contains Oleh Yuschuk's original comments and                //
+// comments from other maintainers.                                           //
+//                                                                            //
+// MRPODS is free software; you can redistribute it and/or modify it under    //
+// the terms of the GNU General Public License as published by the Free       //
+// Software Foundation; either version 3 of the License, or (at your option)  //
+// any later version.                                                         //
+//                                                                            //
+// MRPODS is distributed in the hope that it will be useful, but WITHOUT      //
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or      //
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for   //
+// more details.                                                              //
+//                                                                            //
+// You should have received a copy of the GNU General Public License along    //
+// with this program. If not, see <http://www.gnu.org/licenses/>.             //
+//                                                                            //
+//                              bzip2 license                                 //
+// -------------------------------------------------------------------------- //
+// "bzip2", the associated library "libbzip2" copyright(C) 1996 - 2010        //
+// Julian R Seward. All rights reserved.                                      //
+// Julian Seward, jseward@acm.org                                             //
+// bzip2 / libbzip2 version 1.0.6 of 6 September 2010                         //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include <windows.h>
+#include <commctrl.h>
+#include <stdio.h>
+#include <direct.h>
+#include <math.h>
+#include "twain.h"
+#pragma hdrstop
+
+#include "mrpods.h"
+#include "resource.h"
+
+// PNG writer. Pages are saved as 1-bit grayscale images, compressed with my
+// own minimal deflate: single block with fixed Huffman codes, where matches
+// are either runs of the same byte or repetitions of the row above. Printed
+// pages consist of rows of dots, each repeated several times, and of white
+// space between them, so nothing more elaborate is necessary.
+
+#define PNGCHUNK       65536           // Max size of IDAT chunk
+#define MAXMATCH       258             // Longest match of deflate
+#define MAXDIST        32768           // Longest distance of deflate
+
+typedef struct t_deflater {            // Minimal deflate compressor
+  uchar          *data;                // Output buffer
+  ulong          n;                    // Number of complete bytes in data
+  ulong          acc;                  // Pending bits, LSB first
+  int            nbits;                // Number of pending bits (0..7)
+} t_deflater;
+
+// Base match lengths and numbers of extra bits of length codes 257..285.
+static int lenbase[29] = {
+  3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,
+  131,163,195,227,258 };
+static int lenextra[29] = {
+  0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0 };
+
+// Base distances and numbers of extra bits of distance codes 0..29.
+static int distbase[30] = {
+  1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,
+  2049,3073,4097,6145,8193,12289,16385,24577 };
+static int distextra[30] = {
+  0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+
+static ushort    litcode[288];         // Fixed literal/length codes, reversed
+static uchar     litbits[288];         // Lengths of literal/length codes
+static uchar     lenindex[MAXMATCH+1]; // Index of length code by match length
+static ulong     crctable[256];        // CRC-32 table, polynomial 0xEDB88320
+static int       pngready;             // Tables are initialized
+
+// Returns n lower bits of code in the reversed order. Huffman codes of deflate
+// are stored starting from the most significant bit.
+static ulong Reversebits(ulong code,int n) {
+  ulong r;
+  for (r=0; n>0; n--,code>>=1)
+    r=(r<<1)|(code & 1);
+  return r;
+};
+
+// Builds tables used by the PNG writer. Called once.
+static void Initpngtables(void) {
+  int i,j,n;
+  ulong c;
+  for (i=0; i<288; i++) {
+    if (i<144) { c=0x30+i; n=8; }
+    else if (i<256) { c=0x190+i-144; n=9; }
+    else if (i<280) { c=i-256; n=7; }
+    else { c=0xC0+i-280; n=8; };
+    litcode[i]=(ushort)Reversebits(c,n);
+    litbits[i]=(uchar)n; };
+  for (i=3,j=0; i<=MAXMATCH; i++) {
+    while (j<28 && lenbase[j+1]<=i) j++;
+    lenindex[i]=(uchar)j; };
+  for (i=0; i<256; i++) {
+    for (j=0,c=i; j<8; j++)
+      c=(c & 1?0xEDB88320^(c>>1):c>>1);
+    crctable[i]=c; };
+  pngready=1;
+};
+
+// Updates CRC-32 of the data.
+static ulong Crc32(ulong crc,uchar *p,ulong n) {
+  for ( ; n>0; n--,p++)
+    crc=crctable[(crc^*p) & 0xFF]^(crc>>8);
+  return crc;
+};
+
+// Updates Adler-32 of the data. Sums are reduced often enough to never
+// overflow.
+static ulong Adler32(ulong adler,uchar *p,ulong n) {
+  ulong s1,s2,k;
+  s1=adler & 0xFFFF;
+  s2=adler>>16;
+  while (n>0) {
+    k=min(n,5552); n-=k;
+    for ( ; k>0; k--,p++) {
+      s1+=*p; s2+=s1; };
+    s1%=65521; s2%=65521; };
+  return (s2<<16)|s1;
+};
+
+// Writes 32-bit value in Motorola byte order.
+static void Putbig32(uchar *p,ulong u) {
+  p[0]=(uchar)(u>>24); p[1]=(uchar)(u>>16); p[2]=(uchar)(u>>8); p[3]=(uchar)u;
+};
+
+// Adds code of given length to the deflate stream, least significant bit
+// first.
+static void Putbits(t_deflater *df,ulong code,int length) {
+  df->acc|=code<<df->nbits;
+  df->nbits+=length;
+  while (df->nbits>=8) {
+    df->data[df->n++]=(uchar)df->acc;
+    df->acc>>=8;
+    df->nbits-=8; };
+  ;
+};
+
+// Adds match of given length and distance to the deflate stream.
+static void Putmatch(t_deflater *df,int length,int dist) {
+  int i;
+  i=lenindex[length];
+  Putbits(df,litcode[257+i],litbits[257+i]);
+  if (lenextra[i]>0) Putbits(df,length-lenbase[i],lenextra[i]);
+  for (i=29; distbase[i]>dist; i--);
+  Putbits(df,Reversebits(i,5),5);
+  if (distextra[i]>0) Putbits(df,dist-distbase[i],distextra[i]);
+};
+
+// Compresses row of n bytes. prev is the previous row (immediately preceding
+// in the stream) or NULL if this is the first row. Matches are greedy.
+static void Deflaterow(t_deflater *df,uchar *prev,uchar *cur,int n) {
+  int i,lim,m1,m2;
+  for (i=0; i<n; ) {
+    lim=min(n-i,MAXMATCH);
+    m1=m2=0;
+    if (prev!=NULL) {
+      while (m1<lim && cur[i+m1]==prev[i+m1]) m1++; };
+    if (i>0) {
+      while (m2<lim && cur[i+m2]==cur[i-1]) m2++; };
+    if (m1>=3 && m1>=m2) {
+      Putmatch(df,m1,n); i+=m1; }
+    else if (m2>=3) {
+      Putmatch(df,m2,1); i+=m2; }
+    else {
+      Putbits(df,litcode[cur[i]],litbits[cur[i]]); i++;
+    };
+  };
+};
+
+// Writes PNG chunk of given type. Returns 0 on success and -1 on error.
+static int Writechunk(HANDLE hfile,char *type,uchar *data,ulong n) {
+  uchar hdr[8],tail[4];
+  ulong u,crc;
+  Putbig32(hdr,n);
+  memcpy(hdr+4,type,4);
+  crc=Crc32(0xFFFFFFFF,hdr+4,4);
+  crc=Crc32(crc,data,n);
+  Putbig32(tail,crc^0xFFFFFFFF);
+  if (WriteFile(hfile,hdr,8,&u,NULL)==0 || u!=8) return -1;
+  if (n>0 && (WriteFile(hfile,data,n,&u,NULL)==0 || u!=n)) return -1;
+  if (WriteFile(hfile,tail,4,&u,NULL)==0 || u!=4) return -1;
+  return 0;
+};
+
+// Saves packed 1-bit bitmap (bottom-up, set bits black) as 1-bit grayscale
+// PNG file. Rows are compressed one by one and written in chunks of PNGCHUNK
+// bytes, so that compressed image never resides in memory. Returns 0 on
+// success and -1 on error.
+int Writepngfile(char *path,uchar *bits,int stride,int sizex,int sizey,
+  int ppix,int ppiy) {
+  int i,r,rowlen,success;
+  uchar hdr[16],*prev,*cur,*t,*src;
+  ulong u,adler;
+  HANDLE hfile;
+  t_deflater df;
+  static uchar signature[8] = { 137,'P','N','G',13,10,26,10 };
+  // Each row is preceded by filter type. Whole row must fit into the window
+  // of deflate.
+  rowlen=1+(sizex+7)/8;
+  if (rowlen>MAXDIST)
+    return -1;
+  if (pngready==0)
+    Initpngtables();
+  prev=(uchar *)GlobalAlloc(GMEM_FIXED,2*rowlen);
+  df.data=(uchar *)GlobalAlloc(GMEM_FIXED,PNGCHUNK+2*rowlen+64);
+  if (prev==NULL || df.data==NULL) {
+    if (prev!=NULL) GlobalFree((HGLOBAL)prev);
+    if (df.data!=NULL) GlobalFree((HGLOBAL)df.data);
+    return -1; };
+  cur=prev+rowlen;
+  hfile=CreateFile(path,GENERIC_WRITE,0,NULL,
+    CREATE_ALWAYS,FILE_ATTRIBUTE_NORMAL,NULL);
+  if (hfile==INVALID_HANDLE_VALUE) {
+    GlobalFree((HGLOBAL)prev);
+    GlobalFree((HGLOBAL)df.data);
+    return -1; };
+  // Write signature, header and physical size of pixels.
+  success=1;
+  if (WriteFile(hfile,signature,8,&u,NULL)==0 || u!=8)
+    success=0;
+  Putbig32(hdr,sizex);
+  Putbig32(hdr+4,sizey);
+  hdr[8]=1;                            // 1 bit per pixel
+  hdr[9]=0;                            // Grayscale
+  hdr[10]=hdr[11]=hdr[12]=0;           // Deflate, no filters, no interlace
+  if (success && Writechunk(hfile,"IHDR",hdr,13)!=0)
+    success=0;
+  Putbig32(hdr,(ppix*10000)/254);
+  Putbig32(hdr+4,(ppiy*10000)/254);
+  hdr[8]=1;                            // Pixels per meter
+  if (success && Writechunk(hfile,"pHYs",hdr,9)!=0)
+    success=0;
+  // Start zlib stream (deflate, 32K window, no dictionary) with single block
+  // of fixed Huffman codes.
+  df.data[0]=0x78;
+  df.data[1]=0x01;
+  df.n=2; df.acc=0; df.nbits=0;
+  Putbits(&df,1,1);                    // Final block
+  Putbits(&df,1,2);                    // Fixed Huffman codes
+  adler=1;
+  // Compress rows from top to bottom. In PNG, zero bit is black.
+  for (r=0; r<sizey && success; r++) {
+    src=bits+(sizey-r-1)*stride;
+    cur[0]=0;                          // Filter type None
+    for (i=1; i<rowlen; i++)
+      cur[i]=(uchar)~src[i-1];
+    Deflaterow(&df,(r==0?NULL:prev),cur,rowlen);
+    adler=Adler32(adler,cur,rowlen);
+    t=prev; prev=cur; cur=t;
+    if (df.n>=PNGCHUNK) {
+      if (Writechunk(hfile,"IDAT",df.data,df.n)!=0) success=0;
+      df.n=0;
+    };
+  };
+  // Finish the block and the stream.
+  if (success) {
+    Putbits(&df,litcode[256],litbits[256]);
+    if (df.nbits>0) Putbits(&df,0,8-df.nbits);
+    Putbig32(df.data+df.n,adler);
+    df.n+=4;
+    if (Writechunk(hfile,"IDAT",df.data,df.n)!=0 ||
+      Writechunk(hfile,"IEND",NULL,0)!=0)
+      success=0;
+    ;
+  };
+  GlobalFree((HGLOBAL)(prev<cur?prev:cur));
+  GlobalFree((HGLOBAL)df.data);
+  CloseHandle(hfile);
+  return (success?0:-1);
+};
@@ -51,6 +51,26 @@
 
 //#pragma comment(lib, "BZLIB/bzip2.lib")
 
+#define RENDERWAIT     10              // Max wait for rendered page, ms
+
+typedef struct t_renderthread {        // Page rendering thread
+  HANDLE         hthread;              // Thread handle
+  HANDLE         hstart;               // Event, page is assigned
+  int            state;                // 0: idle, 1: drawing, 2: drawn
+  int            page;                 // Index of assigned page (0-based)
+  t_printdata    *print;               // Print control structure
+  uchar          *bits;                // Bitmap of the page
+  int            height;               // Height of the drawn bitmap
+} t_renderthread;
+
+static t_renderthread renderer[NRENDER]; // Page rendering threads
+static int       nrenderer;            // Number of running rendering threads
+static CRITICAL_SECTION rendercs;      // Protects states of threads
+static HANDLE    hrenderdone;          // Event, some page is drawn
+static int       stoprender;           // Request to stop rendering threads
+
+static void Stoprenderers(void);
+
 // Initializes printer settings. This operation is done blindly, without
 // displaying any dialogs. Call once during startup.
 void Initializeprintsettings(void) {
@@ -168,18 +188,91 @@ void Setuppage(void) {
   PageSetupDlg(&pagesetup);
 };
 
+// Service function, sets pixels x0..x1-1 on the line of 1-bit raster. Pixels
+// are packed from the most significant bit, set bit is a dot.
+static void Setspan(uchar *line,int x0,int x1) {
+  int i0,i1;
+  if (x0>=x1)
+    return;
+  i0=x0>>3;
+  i1=(x1-1)>>3;
+  if (i0==i1) {
+    line[i0]|=(uchar)((0xFF>>(x0 & 7)) & (0xFF<<(7-((x1-1) & 7))));
+    return; };
+  line[i0]|=(uchar)(0xFF>>(x0 & 7));
+  if (i1>i0+1)
+    memset(line+i0+1,0xFF,i1-i0-1);
+  line[i1]|=(uchar)(0xFF<<(7-((x1-1) & 7)));
+};
+
+// Service function, ORs n pixels of the source line starting at xs into the
+// destination line starting at xd, 8 pixels at once.
+static void Orbits(uchar *dst,int xd,uchar *src,int xs,int n) {
+  int k,sd,ss;
+  ulong b;
+  for (k=0; k<n; k+=8) {
+    ss=(xs+k) & 7;
+    b=((src[(xs+k)>>3]<<8)|src[((xs+k)>>3)+1])>>(8-ss);
+    b&=0xFF;
+    if (n-k<8)
+      b&=0xFF<<(8-(n-k));
+    sd=(xd+k) & 7;
+    dst[(xd+k)>>3]|=(uchar)(b>>sd);
+    dst[((xd+k)>>3)+1]|=(uchar)(b<<(8-sd));
+  };
+};
+
+// Service function, draws one row of dots into the 1-bit raster with given
+// number of bytes per line. Bit i of t is a dot with top left corner at
+// (x+i*dx,y), each dot is px pixels wide and py pixels high. Dots are clipped
+// to the bitmap. If lookup table with bit patterns of 8 dots (see
+// Initializeprinting()) is present and row fits horizontally, I OR lines of
+// the row from the table, 8 pixels at once. Pattern of 8 dots is exactly dx
+// bytes long. Bitmap is bottom-up.
+static void Drawdotrow(uchar *bits,int stride,int width,int height,int x,int y,
+  ulong t,int dx,int px,int py,uchar *lut
+) {
+  int i,k,m,sh,ymin,ymax;
+  uchar *line,*p,*q;
+  ymin=max(y,0);
+  ymax=min(y+py,height);
+  if (t==0 || ymin>=ymax)
+    return;
+  line=bits+(height-ymin-1)*stride;
+  if (lut!=NULL && x>=0 && x+32*dx<width) {
+    sh=x & 7;
+    for (m=ymin, p=line+(x>>3); m<ymax; m++, p-=stride) {
+      for (k=0; k<4; k++) {
+        q=lut+((t>>(8*k)) & 255)*dx;
+        for (i=0; i<dx; i++) {
+          p[k*dx+i]|=(uchar)(q[i]>>sh);
+          p[k*dx+i+1]|=(uchar)(q[i]<<(8-sh));
+        };
+      };
+    };
+    return; };
+  // Otherwise I draw dots one by one, clipping each dot only once.
+  for ( ; t!=0; t>>=1, x+=dx) {
+    if ((t & 1)==0)
+      continue;
+    for (m=ymin, p=line; m<ymax; m++, p-=stride)
+      Setspan(p,max(x,0),min(x+px,width));
+    ;
+  };
+};
+
 // Service function, puts block of data to bitmap as a grid of 32x32 dots in
 // the position with given index. Bitmap is treated as a continuous line of
 // cells, where end of the line is connected to the start of the next line.
-static void Drawblock(int index,t_data *block,uchar *bits,int width,int height,
-  int border,int nx,int ny,int dx,int dy,int px,int py,int black
+static void Drawblock(int index,t_data *block,uchar *bits,int stride,
+  int width,int height,int border,int nx,int ny,int dx,int dy,int px,int py,
+  uchar *lut
 ) {
-  int i,j,x,y,m,n;
+  int j,x,y;
   ulong t;
   // Convert cell index into the X-Y bitmap coordinates.
   x=(index%nx)*(NDOT+3)*dx+2*dx+border;
   y=(index/nx)*(NDOT+3)*dy+2*dy+border;
-  bits+=(height-y-1)*width+x;
   // Add CRC.
   block->crc=(ushort)(Crc16((uchar *)block,NDATA+sizeof(ulong))^0x55AA);
   // Add error correction code.
@@ -192,28 +285,35 @@ static void Drawblock(int index,t_data *block,uchar *bits,int width,int height,
       t^=0x55555555;
     else
       t^=0xAAAAAAAA;
-    x=0;
-    for (i=0; i<32; i++) {
-      if (t & 1) {
-        for (m=0; m<py; m++) {
-          for (n=0; n<px; n++) {
-            bits[x-m*width+n]=(uchar)black;
-          };
-        };
-      };
-      t>>=1;
-      x+=dx;
-    };
-    bits-=dy*width;
+    Drawdotrow(bits,stride,width,height,x,y+j*dy,t,dx,px,py,lut);
   };
 };
 
+// Service function, copies block already drawn in the cell with index source
+// to the empty cell with given index. Page contains many identical
+// superblocks, and copying is much faster than encoding and drawing them
+// again.
+static void Copyblock(int index,int source,uchar *bits,int stride,int height,
+  int border,int nx,int dx,int dy,int px,int py
+) {
+  int j,n,xs,ys,xd,yd;
+  xs=(source%nx)*(NDOT+3)*dx+2*dx+border;
+  ys=(source/nx)*(NDOT+3)*dy+2*dy+border;
+  xd=(index%nx)*(NDOT+3)*dx+2*dx+border;
+  yd=(index/nx)*(NDOT+3)*dy+2*dy+border;
+  n=(NDOT-1)*dx+px;
+  for (j=0; j<(NDOT-1)*dy+py; j++)
+    Orbits(bits+(height-yd-j-1)*stride,xd,bits+(height-ys-j-1)*stride,xs,n);
+  ;
+};
+
 // Service function, clips regular 32x32-dot raster to bitmap in the position
 // with given block coordinates (may be outside the bitmap).
-static void Fillblock(int blockx,int blocky,uchar *bits,int width,int height,
-  int border,int nx,int ny,int dx,int dy,int px,int py,int black
+static void Fillblock(int blockx,int blocky,uchar *bits,int stride,
+  int width,int height,int border,int nx,int ny,int dx,int dy,int px,int py,
+  uchar *lut
 ) {
-  int i,j,x0,y0,x,y,m,n;
+  int j,x0,y0;
   ulong t;
   // Convert cell coordinates into the X-Y bitmap coordinates.
   x0=blockx*(NDOT+3)*dx+2*dx+border;
@@ -228,39 +328,38 @@ static void Fillblock(int blockx,int blocky,uchar *bits,int width,int height,
       else if (blockx<0) t=0xAA000000;
       else if (blockx>=nx) t=0x000000AA;
       else t=0xAAAAAAAA; };
-    for (i=0; i<32; i++) {
-      if (t & 1) {
-        for (m=0; m<py; m++) {
-          for (n=0; n<px; n++) {
-            x=x0+i*dx+n;
-            y=y0+j*dy+m;
-            if (x<0 || x>=width || y<0 || y>=height)
-              continue;
-            bits[(height-y-1)*width+x]=(uchar)black;
-          };
-        };
-      };
-      t>>=1;
-    };
+    Drawdotrow(bits,stride,width,height,x0,y0+j*dy,t,dx,px,py,lut);
   };
 };
 
 // Stops printing and cleans print descriptor.
 void Stopprinting(t_printdata *print) {
-  // Finish compression.
+  // Stop compression threads.
   if (print->compression!=0) {
-    BZ2_bzCompressEnd(&print->bzstream);
+    Stoppacker();
     print->compression=0; };
   // Close input file.
   if (print->hfile!=NULL && print->hfile!=INVALID_HANDLE_VALUE) {
     CloseHandle(print->hfile); print->hfile=NULL; };
+  // Stop rendering threads.
+  Stoprenderers();
   // Deallocate memory.
+  if (print->view!=NULL) {
+    UnmapViewOfFile(print->view); print->view=NULL; };
   if (print->buf!=NULL) {
     GlobalFree((HGLOBAL)print->buf); print->buf=NULL; };
-  if (print->readbuf!=NULL) {
-    GlobalFree((HGLOBAL)print->readbuf); print->readbuf=NULL; };
+  if (print->parbuf!=NULL) {
+    GlobalFree((HGLOBAL)print->parbuf); print->parbuf=NULL; };
+  print->data=NULL;
   if (print->drawbits!=NULL) {
     GlobalFree((HGLOBAL)print->drawbits); print->drawbits=NULL; };
+  if (print->dotlut!=NULL) {
+    GlobalFree((HGLOBAL)print->dotlut); print->dotlut=NULL; };
+  // Close multi-page TIFF and vector file.
+  if (print->htiff!=NULL) {
+    CloseHandle(print->htiff); print->htiff=NULL; };
+  if (print->vector!=0) {
+    Closevectorfile(); print->vector=0; };
   // Free other resources.
   if (print->startdoc!=0) {
     EndDoc(print->dc); print->startdoc=0; };
@@ -278,21 +377,19 @@ void Stopprinting(t_printdata *print) {
   print->step=0;
 };
 
-// Opens input file and allocates memory buffers.
-static void Preparefiletoprint(t_printdata *print) {
+// Opens input file and maps it into memory or, if this is impossible,
+// allocates buffer where it will be read. Returns 0 on success and -1 on
+// error.
+static int Openinputfile(t_printdata *print) {
   ulong l;
+  HANDLE hmap;
   FILETIME created,accessed,modified;
-  // Get file attributes.
-  print->attributes=GetFileAttributes(print->infile);
-  if (print->attributes==0xFFFFFFFF)
-    print->attributes=FILE_ATTRIBUTE_NORMAL;
   // Open input file.
   print->hfile=CreateFile(print->infile,GENERIC_READ,FILE_SHARE_READ,
     NULL,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,NULL);
   if (print->hfile==INVALID_HANDLE_VALUE) {
     Reporterror("Unable to open file");
-    Stopprinting(print);
-    return; };
+    return -1; };
   // Get time of last file modification.
   GetFileTime(print->hfile,&created,&accessed,&modified);
   if (modified.dwHighDateTime==0)
@@ -303,139 +400,240 @@ static void Preparefiletoprint(t_printdata *print) {
   print->origsize=GetFileSize(print->hfile,&l);
   if (print->origsize==0 || print->origsize>MAXSIZE || l!=0) {
     Reporterror("Invalid file size");
-    Stopprinting(print);
-    return; };
+    return -1; };
   print->readsize=0;
-  // Allocate buffer for compressed file. (If compression is off, buffer will
-  // contain uncompressed data). As AES encryption works on 16-byte records,
-  // buffer is aligned to next 16-bit border.
-  print->bufsize=(print->origsize+15) & 0xFFFFFFF0;
-  print->buf=(uchar *)GlobalAlloc(GMEM_FIXED,print->bufsize);
-  if (print->buf==NULL) {
-    Reporterror("Low memory");
-    Stopprinting(print);
-    return; };
-  // Allocate read buffer. Because compression may take significant time, I
-  // pack data in pieces of PACKLEN bytes.
-  print->readbuf=(uchar *)GlobalAlloc(GMEM_FIXED,PACKLEN);
-  if (print->readbuf==NULL) {
-    Reporterror("Low memory");
+  print->packsize=0;
+  // Map file into memory. System reads pages of the file on demand when
+  // compressor or printer accesses them and may discard them afterwards, so
+  // even very large files need neither private copy nor much memory. Mapping
+  // object is not needed once the view is created.
+  hmap=CreateFileMapping(print->hfile,NULL,PAGE_READONLY,0,0,NULL);
+  if (hmap!=NULL) {
+    print->view=(uchar *)MapViewOfFile(hmap,FILE_MAP_READ,0,0,0);
+    CloseHandle(hmap); };
+  if (print->view!=NULL) {
+    print->data=print->view;
+    print->readsize=print->origsize; }
+  else {
+    // Mapping failed, read file into the buffer. If compression succeeds,
+    // buffer is replaced by the compressed data. As AES encryption works on
+    // 16-byte records, buffer is aligned to next 16-bit border.
+    print->bufsize=(print->origsize+15) & 0xFFFFFFF0;
+    print->buf=(uchar *)GlobalAlloc(GMEM_FIXED,print->bufsize);
+    if (print->buf==NULL) {
+      Reporterror("Low memory");
+      return -1; };
+    print->data=print->buf;
+  };
+  return 0;
+};
+
+// Opens input file or packs folder into archive and allocates memory buffers.
+static void Preparefiletoprint(t_printdata *print) {
+  int n;
+  // Get file attributes.
+  print->attributes=GetFileAttributes(print->infile);
+  if (print->attributes==0xFFFFFFFF)
+    print->attributes=FILE_ATTRIBUTE_NORMAL;
+  // Folder is packed, with all its files, into the archive that is printed
+  // like a single file. Archive gets the name of the folder.
+  if (print->attributes & FILE_ATTRIBUTE_DIRECTORY) {
+    n=strlen(print->infile);
+    while (n>1 && print->infile[n-1]=='\\')
+      print->infile[--n]='\0';
+    if (Buildarchive(print->infile,&print->buf,&print->origsize,
+      &print->modified)!=0) {
+      Stopprinting(print);
+      return; };
+    print->archive=1;
+    print->attributes=FILE_ATTRIBUTE_NORMAL;
+    print->bufsize=(print->origsize+15) & 0xFFFFFFF0;
+    print->data=print->buf;
+    print->readsize=print->origsize;
+    print->packsize=0; }
+  else if (Openinputfile(print)!=0) {
     Stopprinting(print);
     return; };
   // Set options.
   print->compression=compression;
+  print->framed=randomaccess;
+  print->elided=elision;
   print->printheader=printheader;
   print->printborder=printborder;
   print->redundancy=redundancy;
+  // In erasure mode, groups are larger and get several recovery blocks each.
+  if (erasure)
+    Erasurelayout(redundancy,&print->ngroup,&print->nparity);
+  else {
+    print->ngroup=redundancy;
+    print->nparity=1; };
+  print->parpages=parpages;
   // Step finished.
   print->step++;
 };
 
-// Initializes bzip2 compression engine.
+// Reads beginning of the file and, if data looks compressible, starts bzip2
+// compression threads.
 static void Preparecompressor(t_printdata *print) {
-  int success;
+  ulong size,l;
   // Check whether compression is requested at all.
   if (print->compression==0) {
     print->step++;
     return; };
-  // Initialize compressor. On error, I silently disable compression.
-  memset(&print->bzstream,0,sizeof(print->bzstream));
-  success=BZ2_bzCompressInit(&print->bzstream,
-    (print->compression==1?1:9),0,0);
-  if (success!=BZ_OK) {
-    print->compression=0;              // Disable compression
-    print->step++;
-    return; };
-  print->bzstream.next_out=(char *)print->buf;
-  print->bzstream.avail_out=print->bufsize;
+  // Already packed data (zip, jpeg, 7z) is not worth compressing again. Check
+  // the beginning of the file. Data read here is used later.
+  size=min(print->origsize,PACKPROBE);
+  if (print->readsize<size) {
+    if (ReadFile(print->hfile,print->buf,size,&l,NULL)==0 || l!=size) {
+      Reporterror("Unable to read file");
+      Stopprinting(print);
+      return; };
+    print->readsize=size; };
+  if (Checkcompressible(print->data,size)==0)
+    print->compression=0;
+  // Start compressor. On error, I silently disable compression.
+  else if (Startpacker((print->compression==1?1:9),print->origsize-1)!=0)
+    print->compression=0;
   // Step finished.
   print->step++;
 };
 
-// Compresses file.
+// Reads next piece of file directly to the buffer. If compression is active,
+// threads pack complete chunks of data in parallel, main thread only reads
+// data and collects results. Mapped file needs no reading.
 static void Readandcompress(t_printdata *print) {
-  int success;
+  int success,n;
   ulong size,l;
   // Read next piece of data.
-  size=print->origsize-print->readsize;
-  if (size>PACKLEN) size=PACKLEN;
-  success=ReadFile(print->hfile,print->readbuf,size,&l,NULL);
-  if (success==0 || l!=size) {
-    Reporterror("Unable to read file");
-    Stopprinting(print);
-    return; };
-  // If compression is active, compress next piece of data. Otherwise, just
-  // copy data to buffer.
-  //print->compression = 0; // TODO: vf
-  if (print->compression) {
-    Message("Compressing file",(print->readsize+size)*100/print->origsize);
-    print->bzstream.next_in=(char *)print->readbuf;
-    print->bzstream.avail_in=size;
-    success=BZ2_bzCompress(&print->bzstream,BZ_RUN);
-    if (print->bzstream.avail_in!=0 || success!=BZ_RUN_OK) {
-      Reporterror("Unable to compress data. Try to disable compression.");
+  if (print->readsize<print->origsize) {
+    size=print->origsize-print->readsize;
+    if (size>PACKLEN) size=PACKLEN;
+    success=ReadFile(print->hfile,print->buf+print->readsize,size,&l,NULL);
+    if (success==0 || l!=size) {
+      Reporterror("Unable to read file");
       Stopprinting(print);
       return; };
     print->readsize+=size;
-    // If compression runs out of memory, probably the data is already packed.
-    // Silently restart without compression.
-    if (print->readsize<print->origsize && print->bzstream.avail_out==0) {
-      BZ2_bzCompressEnd(&print->bzstream);
-      print->compression=0;
-      SetFilePointer(print->hfile,0,NULL,FILE_BEGIN);
-      print->readsize=0;
-      return;
-    }; 
-  }
-  else {
-    Message("Reading file",(print->readsize+size)*100/print->origsize);
-    memcpy(print->buf+print->readsize,print->readbuf,size);
-    print->readsize+=size; };
+    if (print->compression==0)
+      Message("Reading file",(int)(print->readsize*100.0/print->origsize));
+    ;
+  };
+  if (print->compression) {
+    // Pass complete chunks to idle threads and append packed chunks to the
+    // output. When all data is read, wait for the next chunk a bit.
+    while ((l=Packdata(print->data+print->packsize,
+      print->readsize-print->packsize,print->readsize==print->origsize))!=0)
+      print->packsize+=l;
+    Message("Compressing file",(int)(print->packsize*100.0/print->origsize));
+    n=Collectpacked(print->readsize==print->origsize);
+    // If compressed data gets longer than original, probably the rest of the
+    // data is already packed. Silently continue without compression. All
+    // data read so far is in the buffer or in the view.
+    if (n==-1) {
+      Stoppacker();
+      print->compression=0; }
+    else if (n<0) {
+      Reporterror("Unable to compress data. Try to disable compression.");
+      Stopprinting(print);
+      return; }
+    else if (n>0 || print->packsize<print->origsize)
+      return;                          // Still packing
+    ;
+  };
   // If all data is read, finish step.
   if (print->readsize==print->origsize)
     print->step++;
   ;
 };
 
-// Finishes compression (may take significant time) and closes input file.
+// Places index of frames (independently unpackable blocks of the packed
+// stream) before the packed data, so that decoder can restore part of the
+// file from the pages that hold it. Returns 0 on success and -1 on error.
+static int Addframeindex(t_printdata *print,t_frame *frames,int nframe) {
+  ulong indexsize,bufsize;
+  uchar *buf;
+  t_framehead *ph;
+  indexsize=sizeof(t_framehead)+(nframe+1)*sizeof(t_frame);
+  bufsize=(indexsize+print->datasize+15) & 0xFFFFFFF0;
+  buf=(uchar *)GlobalAlloc(GPTR,bufsize);
+  if (buf==NULL)
+    return -1;
+  ph=(t_framehead *)buf;
+  ph->magic=FRAMEMAGIC;
+  ph->nframe=nframe;
+  ph->indexsize=indexsize;
+  ph->reserved=0;
+  memcpy(buf+sizeof(t_framehead),frames,(nframe+1)*sizeof(t_frame));
+  memcpy(buf+indexsize,print->buf,print->datasize);
+  GlobalFree((HGLOBAL)print->buf);
+  print->buf=buf;
+  print->bufsize=bufsize;
+  print->data=buf;
+  print->datasize+=indexsize;
+  return 0;
+};
+
+// Finishes compression and closes input file. View of the file remains open
+// if data is printed uncompressed.
 static void Finishcompression(t_printdata *print) {
-  int success;
-  ulong l;
-  // Finish compression.
+  int nframe;
+  ulong size;
+  uchar *packed,*buf;
+  t_frame *frames;
+  // Finish compression. If compressed data is not shorter than original,
+  // keep original data.
   if (print->compression) {
-    success=BZ2_bzCompress(&print->bzstream,BZ_FINISH);
-    // If compression runs out of memory, probably the data is already packed.
-    // Silently restart without compression.
-    if (success==BZ_FINISH_OK && print->bzstream.avail_out==0) {
-      BZ2_bzCompressEnd(&print->bzstream);
+    packed=Finishpacker(&print->datasize);
+    frames=NULL;
+    if (packed!=NULL && print->framed)
+      frames=Getframes(&nframe);
+    Stoppacker();
+    if (packed==NULL) {
       print->compression=0;
-      SetFilePointer(print->hfile,0,NULL,FILE_BEGIN);
-      print->readsize=0;
-      print->step--;
-      return; };
-    // If compression routine reports other error, stop processing.
-    if (success!=BZ_STREAM_END) {
-      Reporterror("Unable to compress data. Try to disable compression.");
-      Stopprinting(print);
-      return; };
-    // File compressed. Update size of compressed data and finish.
-    print->datasize=print->bzstream.total_out_lo32;
-    BZ2_bzCompressEnd(&print->bzstream); 
-  }
+      print->datasize=print->origsize; }
+    else {
+      if (print->view!=NULL) {
+        UnmapViewOfFile(print->view); print->view=NULL; };
+      if (print->buf!=NULL)
+        GlobalFree((HGLOBAL)print->buf);
+      print->buf=packed;
+      print->bufsize=(print->datasize+15) & 0xFFFFFFF0;
+      print->data=print->buf;
+    };
+    // If index can't be built, data is printed as usual and can be restored
+    // only as a whole.
+    if (frames==NULL || Addframeindex(print,frames,nframe)!=0)
+      print->framed=0;
+    if (frames!=NULL)
+      GlobalFree((HGLOBAL)frames);
+    ; }
   else
     print->datasize=print->origsize;
+  // Uncompressed data needs no index, offset on paper is offset in the file.
+  if (print->compression==0)
+    print->framed=0;
+  // Runs of zeros and repeating blocks of uncompressed data are replaced by
+  // short descriptions. Packed data has neither.
+  if (print->elided==0 || print->compression!=0 ||
+    Elidedata(print->data,print->origsize,&buf,&size)!=0)
+    print->elided=0;
+  else {
+    if (print->view!=NULL) {
+      UnmapViewOfFile(print->view); print->view=NULL; };
+    if (print->buf!=NULL)
+      GlobalFree((HGLOBAL)print->buf);
+    print->buf=buf;
+    print->bufsize=(size+15) & 0xFFFFFFF0;
+    print->data=buf;
+    print->datasize=size;
+  };
   // Align size of (compressed) data to next 16-byte border. Note that bzip2
   // doesn't mind if data passed to decompressor is longer than expected.
+  // Aligning bytes are zero, see Getprintdata().
   print->alignedsize=(print->datasize+15) & 0xFFFFFFF0;
-  // Zero aligning bytes.
-  for (l=print->datasize; l<print->alignedsize; l++)
-    print->buf[l]='\0';
   // Close file.
-  CloseHandle(print->hfile);
-  print->hfile=NULL;
-  // Free read buffer. We no longer need it.
-  GlobalFree((HGLOBAL)print->readbuf);
-  print->readbuf=NULL;
+  if (print->hfile!=NULL) {
+    CloseHandle(print->hfile); print->hfile=NULL; };
   // Step finished.
   print->step++;
 };
@@ -453,9 +651,551 @@ static BOOL WINAPI GenerateRandomData(DWORD dwLen, BYTE *pbBuffer) {
   return result;
 }
 
+// Gets NDATA bytes of data to print at the specified offset. Data pages are
+// taken from the view of the file or from the buffer, parity pages from the
+// separate buffer. Bytes beyond the data are set to 0.
+static void Getprintdata(t_printdata *print,ulong offset,uchar *block) {
+  ulong l,parstart;
+  l=0;
+  parstart=print->ndatapages*print->pagesize;
+  if (print->parbuf!=NULL && offset>=parstart) {
+    l=min(print->printsize-offset,NDATA);
+    memcpy(block,print->parbuf+(offset-parstart),l); }
+  else if (offset<print->datasize) {
+    l=min(print->datasize-offset,NDATA);
+    memcpy(block,print->data+offset,l); };
+  if (l<NDATA)
+    memset(block+l,0,NDATA-l);
+  ;
+};
+
+// Calculates parity pages that follow the data. For each stripe of up to
+// PARSTRIPE data pages, I add parpages pages, each page protecting bytes at
+// the same position on the data pages of the stripe. Data itself is not
+// copied, only the incomplete page. Returns 0 on success and -1 on error.
+static int Addparitypages(t_printdata *print) {
+  int i,j,s,nstripe,first,n,partial;
+  ulong total,offset;
+  uchar *page,*last,*empty,*parity;
+  if (print->parpages<=0) {
+    print->ndatapages=(print->datasize+print->pagesize-1)/print->pagesize;
+    print->printsize=print->datasize;
+    return 0; };
+  // Decoder counts pages of the aligned data.
+  print->ndatapages=(print->alignedsize+print->pagesize-1)/print->pagesize;
+  // Calculate size of data with parity pages.
+  nstripe=(print->ndatapages+PARSTRIPE-1)/PARSTRIPE;
+  n=print->ndatapages+nstripe*print->parpages;
+  if (n>0xFFFF || (double)n*print->pagesize>MAXSIZE) {
+    Reporterror("File is too big for parity pages");
+    return -1; };
+  total=n*print->pagesize;
+  // Allocate buffer for parity pages, a copy of the incomplete data page,
+  // which is padded with zeros, and an empty page. Aligned data may end up to
+  // 15 bytes after the data, so the last counted page may be all padding and
+  // the incomplete page the one before it.
+  print->parbuf=(uchar *)GlobalAlloc(GMEM_FIXED,
+    (nstripe*print->parpages+2)*print->pagesize);
+  if (print->parbuf==NULL) {
+    Reporterror("Low memory");
+    return -1; };
+  memset(print->parbuf,0,(nstripe*print->parpages+2)*print->pagesize);
+  last=print->parbuf+nstripe*print->parpages*print->pagesize;
+  empty=last+print->pagesize;
+  partial=print->datasize/print->pagesize;
+  offset=partial*print->pagesize;
+  if (partial<print->ndatapages && print->datasize>offset)
+    memcpy(last,print->data+offset,print->datasize-offset);
+  // Calculate parity pages. Stripe s consists of data pages starting with
+  // first, followed (after all data pages) by its parity pages.
+  for (s=0; s<nstripe; s++) {
+    first=s*PARSTRIPE;
+    n=min(PARSTRIPE,print->ndatapages-first);
+    for (j=0; j<print->parpages; j++) {
+      parity=print->parbuf+(s*print->parpages+j)*print->pagesize;
+      for (i=0; i<n; i++) {
+        if (first+i<partial)
+          page=print->data+(first+i)*print->pagesize;
+        else if (first+i==partial)
+          page=last;
+        else
+          page=empty;
+        Addpageparity(parity,j,i,page,print->pagesize); };
+      Finishparity(parity,print->pagesize);
+    };
+  };
+  print->printsize=total;
+  print->superdata.mode|=(uchar)(print->parpages<<3);
+  return 0;
+};
+
+// Draws page with given index (0-based) into the bits and returns height of
+// the bitmap, which is smaller on the last page. Page depends only on its
+// index, so several pages can be drawn in parallel. I change only the private
+// copy of superblock and don't modify print.
+static int Renderpage(t_printdata *print,int page,uchar *bits) {
+  int dx,dy,px,py,nx,ny,width,stride,height,border,ngroup,nparity,nchain;
+  int i,j,k,l,n,nstring,rot,super;
+  ulong size,pagesize,offset;
+  uchar *lut;
+  t_data block,cksum[NPARITYMAX];
+  t_superdata superdata;
+  // Get frequently used variables.
+  dx=print->dx;
+  dy=print->dy;
+  px=print->px;
+  py=print->py;
+  nx=print->nx;
+  ny=print->ny;
+  width=print->width;
+  stride=print->stride;
+  border=print->border;
+  size=max(print->alignedsize,print->printsize);
+  pagesize=print->pagesize;
+  ngroup=print->ngroup;
+  nparity=print->nparity;
+  nchain=ngroup+nparity;
+  lut=print->dotlut;
+  superdata=print->superdata;
+  offset=page*pagesize;
+  // Check if we can reduce the vertical size of the table on the last page.
+  // To assure reliable orientation, I request at least 3 rows.
+  l=min(size-offset,pagesize);
+  n=(l+NDATA-1)/NDATA;                 // Number of pure data blocks on page
+  nstring=                             // Number of groups (length of string)
+    (n+ngroup-1)/ngroup;
+  n=(nstring+1)*nchain+1;              // Total number of blocks to print
+  n=max((n+nx-1)/nx,3);                // Number of rows (at least 3)
+  if (ny>n) ny=n;
+  height=ny*(NDOT+3)*dy+py+2*border;
+  // Initialize bitmap to all white.
+  memset(bits,0,height*stride);
+  // Draw vertical grid lines. All lines crossed by them are equal, so I draw
+  // the first line and copy it to the others.
+  if (print->printborder) {
+    j=0; n=ny*(NDOT+3)*dy+py+2*border; }
+  else {
+    j=border; n=ny*(NDOT+3)*dy; };
+  for (i=0; i<=nx; i++)
+    Setspan(bits+j*stride,i*(NDOT+3)*dx+border,i*(NDOT+3)*dx+border+px);
+  for (k=1; k<n; k++)
+    memcpy(bits+(j+k)*stride,bits+j*stride,stride);
+  // Draw horizontal grid lines.
+  for (j=0; j<=ny; j++) {
+    for (k=0; k<py; k++) {
+      if (print->printborder)
+        Setspan(bits+(j*(NDOT+3)*dy+k+border)*stride,0,width);
+      else
+        Setspan(bits+(j*(NDOT+3)*dy+k+border)*stride,border,
+        border+nx*(NDOT+3)*dx+px);
+      ;
+    };
+  };
+  // Fill borders with regular raster.
+  if (print->printborder) {
+    for (j=-1; j<=ny; j++) {
+      Fillblock(-1,j,bits,stride,width,height,border,nx,ny,dx,dy,px,py,lut);
+      Fillblock(nx,j,bits,stride,width,height,border,nx,ny,dx,dy,px,py,lut); };
+    for (i=0; i<nx; i++) {
+      Fillblock(i,-1,bits,stride,width,height,border,nx,ny,dx,dy,px,py,lut);
+      Fillblock(i,ny,bits,stride,width,height,border,nx,ny,dx,dy,px,py,lut);
+    };
+  };
+  // Update superblock.
+  superdata.page=(ushort)(page+1);     // Page number is 1-based
+  // First block in every string (including recovery strings) is a superblock.
+  // To improve redundancy, I avoid placing blocks belonging to the same group
+  // in the same column (consider damaged diode in laser printer).
+  // Superblock is encoded and drawn only once, other copies are blitted.
+  super=-1;
+  for (j=0; j<nchain; j++) {
+    k=j*(nstring+1);
+    if (nstring+1>=nx)
+      k+=(nx/nchain*j-k%nx+nx)%nx;
+    if (super>=0)
+      Copyblock(k,super,bits,stride,height,border,nx,dx,dy,px,py);
+    else {
+      Drawblock(k,(t_data *)&superdata,
+      bits,stride,width,height,border,nx,ny,dx,dy,px,py,lut);
+      super=k;
+    };
+  };
+  // Now the most important part - encode and draw data, group by group!
+  for (i=0; i<nstring; i++) {
+    // Prepare recovery blocks. Block j is addressed at the j-th block of the
+    // group, so that blocks j>0 are rejected by the decoders that know only
+    // single XOR checksum at the beginning of the group.
+    for (j=0; j<nparity; j++) {
+      cksum[j].addr=(offset+j*NDATA) ^ (ngroup<<28);
+      memset(cksum[j].data,0,NDATA); };
+    // Process data group.
+    for (j=0; j<ngroup; j++) {
+      // Fill block with data.
+      block.addr=offset;
+      Getprintdata(print,offset,block.data);
+      // Update recovery blocks.
+      for (l=0; l<nparity; l++) Addparity(cksum[l].data,l,j,block.data);
+      // Find cell where block will be placed on the paper. The first block in
+      // every string is the superblock.
+      k=j*(nstring+1);
+      if (nstring+1<nx)
+        k+=i+1;
+      else {
+        // Optimal shift between the first columns of the strings is
+        // nx/nchain. Next line calculates how I must rotate the j-th string.
+        // Best understandable after two bottles of Weissbier.
+        rot=(nx/nchain*j-k%nx+nx)%nx;
+        k+=(i+1+rot)%(nstring+1); };
+      Drawblock(k,&block,bits,stride,width,height,border,nx,ny,dx,dy,px,py,lut);
+      offset+=NDATA;
+    };
+    // Process recovery blocks in the similar way.
+    for (j=ngroup; j<nchain; j++) {
+      Finishparity(cksum[j-ngroup].data,NDATA);
+      k=j*(nstring+1);
+      if (nstring+1<nx)
+        k+=i+1;
+      else {
+        rot=(nx/nchain*j-k%nx+nx)%nx;
+        k+=(i+1+rot)%(nstring+1); };
+      Drawblock(k,cksum+j-ngroup,bits,stride,width,height,border,nx,ny,
+        dx,dy,px,py,lut);
+    };
+  };
+  // Print superblock in all remaining cells.
+  for (k=(nstring+1)*nchain; k<nx*ny; k++)
+    Copyblock(k,super,bits,stride,height,border,nx,dx,dy,px,py);
+  return height;
+};
+
+// Saves bitmap of the page with given index (0-based) to file. Returns 0 on
+// success and -1 on error. Format depends on the extention of output file.
+// PNG and TIFF are 1-bit and compressed; all pages of TIFF, PDF or PostScript
+// go into the single multi-page file. BMP is an 8-bit grayscale bitmap, as it
+// always was; I convert 1-bit lines in pieces of SAVELINES lines. In BMP, grid
+// lines are black and dots are dark gray. Grid never crosses dots, so I know
+// the colour of set pixel from its position.
+static int Savebitmap(t_printdata *print,int page,uchar *bits,int height) {
+  int i,j,k,n,r,x,npages,width,border,dx,dy,ny,ymin,ymax,grid,success;
+  char drv[_MAX_DRIVE+1],dir[_MAX_DIR],nam[_MAX_FNAME],ext[_MAX_EXT];
+  char path[MAX_PATH+32];
+  uchar expand[2][256][8],*buf,*pb,*line;
+  uchar bmi[sizeof(BITMAPINFO)+256*sizeof(RGBQUAD)];
+  ulong u;
+  HANDLE hbmpfile;
+  BITMAPFILEHEADER bmfh;
+  BITMAPINFO *pbmi;
+  width=print->width;
+  npages=(print->printsize+print->pagesize-1)/print->pagesize;
+  // Get file name.
+  fnsplit(print->outbmp,drv,dir,nam,ext);
+  if (ext[0]=='\0') strcpy(ext,".bmp");
+  if (npages>1 && print->vector==0 &&
+    _stricmp(ext,".tif")!=0 && _stricmp(ext,".tiff")!=0)
+    sprintf(path,"%s%s%s_%04i%s",drv,dir,nam,page+1,ext);
+  else
+    sprintf(path,"%s%s%s%s",drv,dir,nam,ext);
+  // Save compressed and vector formats directly from 1-bit bitmap.
+  if (print->vector!=0) {
+    if (Writevectorpage(print,page,bits,height)!=0) {
+      Reporterror("Unable to save bitmap");
+      return -1; };
+    return 0; };
+  if (_stricmp(ext,".tif")==0 || _stricmp(ext,".tiff")==0) {
+    if (print->htiff==NULL) {
+      print->htiff=Createtifffile(path,&print->tifflink);
+      if (print->htiff==INVALID_HANDLE_VALUE) {
+        print->htiff=NULL;
+        Reporterror("Unable to create bitmap file");
+        return -1;
+      };
+    };
+    if (Writetiffpage(print->htiff,&print->tifflink,bits,print->stride,
+      width,height,print->ppix,print->ppiy,page,npages)!=0) {
+      Reporterror("Unable to save bitmap");
+      return -1; };
+    return 0; };
+  if (_stricmp(ext,".png")==0) {
+    if (Writepngfile(path,bits,print->stride,width,height,
+      print->ppix,print->ppiy)!=0) {
+      Reporterror("Unable to save bitmap");
+      return -1; };
+    return 0; };
+  border=print->border;
+  dx=print->dx;
+  dy=print->dy;
+  // Last page may have less rows, see Renderpage().
+  ny=(height-print->py-2*border)/((NDOT+3)*dy);
+  if (print->printborder) {
+    ymin=0; ymax=height; }
+  else {
+    ymin=border; ymax=border+ny*(NDOT+3)*dy; };
+  // Allocate buffer for converted lines and prepare tables that convert 8
+  // bits into 8 pixels of dots or grid.
+  buf=(uchar *)GlobalAlloc(GMEM_FIXED,SAVELINES*width);
+  if (buf==NULL) {
+    Reporterror("Low memory, can't save bitmap");
+    return -1; };
+  for (i=0; i<256; i++) {
+    for (j=0; j<8; j++) {
+      expand[0][i][j]=(uchar)(i & (0x80>>j)?print->black:255);
+      expand[1][i][j]=(uchar)(i & (0x80>>j)?0:255);
+    };
+  };
+  // Create bitmap file.
+  hbmpfile=CreateFile(path,GENERIC_WRITE,0,NULL,
+    CREATE_ALWAYS,FILE_ATTRIBUTE_NORMAL,NULL);
+  if (hbmpfile==INVALID_HANDLE_VALUE) {
+    GlobalFree((HGLOBAL)buf);
+    Reporterror("Unable to create bitmap file");
+    return -1; };
+  // Create and save bitmap file header.
+  success=1;
+  n=sizeof(BITMAPINFOHEADER)+256*sizeof(RGBQUAD);
+  bmfh.bfType = 0x4d42; // 'BM';
+  bmfh.bfSize=sizeof(bmfh)+n+width*height;
+  bmfh.bfReserved1=bmfh.bfReserved2=0;
+  bmfh.bfOffBits=sizeof(bmfh)+n;
+  if (WriteFile(hbmpfile,&bmfh,sizeof(bmfh),&u,NULL)==0 || u!=sizeof(bmfh))
+    success=0;
+  // Prepare and save bitmap info header and 256-colour grayscale palette.
+  if (success) {
+    pbmi=(BITMAPINFO *)bmi;
+    memset(pbmi,0,sizeof(BITMAPINFOHEADER));
+    pbmi->bmiHeader.biSize=sizeof(BITMAPINFOHEADER);
+    pbmi->bmiHeader.biWidth=width;
+    pbmi->bmiHeader.biHeight=height;
+    pbmi->bmiHeader.biPlanes=1;
+    pbmi->bmiHeader.biBitCount=8;
+    pbmi->bmiHeader.biCompression=BI_RGB;
+    pbmi->bmiHeader.biXPelsPerMeter=(print->ppix*10000)/254;
+    pbmi->bmiHeader.biYPelsPerMeter=(print->ppiy*10000)/254;
+    pbmi->bmiHeader.biClrUsed=256;
+    pbmi->bmiHeader.biClrImportant=256;
+    for (i=0; i<256; i++) {
+      pbmi->bmiColors[i].rgbBlue=(uchar)i;
+      pbmi->bmiColors[i].rgbGreen=(uchar)i;
+      pbmi->bmiColors[i].rgbRed=(uchar)i;
+      pbmi->bmiColors[i].rgbReserved=0; };
+    if (WriteFile(hbmpfile,pbmi,n,&u,NULL)==0 || u!=(ulong)n) success=0; };
+  // Convert and save bitmap data.
+  for (i=0; i<height && success; i+=k) {
+    k=min(SAVELINES,height-i);
+    for (j=0; j<k; j++) {
+      r=i+j;
+      line=bits+r*print->stride;
+      pb=buf+j*width;
+      grid=(r>=border && (r-border)%((NDOT+3)*dy)<print->py &&
+        (r-border)/((NDOT+3)*dy)<=ny);
+      for (n=0; n+8<=width; n+=8)
+        memcpy(pb+n,expand[grid][line[n/8]],8);
+      if (n<width)
+        memcpy(pb+n,expand[grid][line[n/8]],width-n);
+      // Vertical grid lines.
+      if (grid==0 && r>=ymin && r<ymax) {
+        for (x=border; x<=border+print->nx*(NDOT+3)*dx; x+=(NDOT+3)*dx)
+          memset(pb+x,0,print->px);
+        ;
+      };
+    };
+    if (WriteFile(hbmpfile,buf,k*width,&u,NULL)==0 || u!=(ulong)(k*width))
+      success=0;
+    ;
+  };
+  GlobalFree((HGLOBAL)buf);
+  CloseHandle(hbmpfile);
+  if (success==0) {
+    Reporterror("Unable to save bitmap");
+    return -1; };
+  return 0;
+};
+
+// Page rendering thread. Draws assigned page into its own bitmap and waits for
+// the next one.
+static DWORD WINAPI Renderthread(LPVOID param) {
+  int stop,height;
+  t_renderthread *rt;
+  rt=(t_renderthread *)param;
+  while (1) {
+    WaitForSingleObject(rt->hstart,INFINITE);
+    EnterCriticalSection(&rendercs);
+    stop=stoprender;
+    LeaveCriticalSection(&rendercs);
+    if (stop) break;
+    height=Renderpage(rt->print,rt->page,rt->bits);
+    EnterCriticalSection(&rendercs);
+    rt->height=height;
+    rt->state=2;
+    LeaveCriticalSection(&rendercs);
+    SetEvent(hrenderdone);
+  };
+  return 0;
+};
+
+// Stops rendering threads and frees their bitmaps.
+static void Stoprenderers(void) {
+  int i;
+  t_renderthread *rt;
+  if (nrenderer==0)
+    return;
+  EnterCriticalSection(&rendercs);
+  stoprender=1;
+  LeaveCriticalSection(&rendercs);
+  for (i=0; i<nrenderer; i++) {
+    rt=renderer+i;
+    SetEvent(rt->hstart);
+    WaitForSingleObject(rt->hthread,INFINITE);
+    CloseHandle(rt->hthread);
+    CloseHandle(rt->hstart);
+    if (i>0)
+      GlobalFree((HGLOBAL)rt->bits);
+    memset(rt,0,sizeof(t_renderthread)); };
+  nrenderer=0;
+  CloseHandle(hrenderdone);
+  hrenderdone=NULL;
+  DeleteCriticalSection(&rendercs);
+};
+
+// Starts rendering threads, one per processor, but only as many as there are
+// memory for bitmaps. First thread draws into print->drawbits. Returns number
+// of started threads.
+static int Startrenderers(t_printdata *print) {
+  int i,n;
+  DWORD threadid;
+  SYSTEM_INFO si;
+  t_renderthread *rt;
+  GetSystemInfo(&si);
+  n=max(1,min((int)si.dwNumberOfProcessors,NRENDER));
+  if (n<2)
+    return 0;
+  hrenderdone=CreateEvent(NULL,FALSE,FALSE,NULL);
+  if (hrenderdone==NULL)
+    return 0;
+  InitializeCriticalSection(&rendercs);
+  stoprender=0;
+  for (i=0; i<n; i++) {
+    rt=renderer+nrenderer;
+    memset(rt,0,sizeof(t_renderthread));
+    rt->print=print;
+    if (i==0)
+      rt->bits=print->drawbits;
+    else
+      rt->bits=(uchar *)GlobalAlloc(GMEM_FIXED,print->stride*print->height);
+    rt->hstart=CreateEvent(NULL,FALSE,FALSE,NULL);
+    if (rt->bits!=NULL && rt->hstart!=NULL)
+      rt->hthread=CreateThread(NULL,0,Renderthread,rt,0,&threadid);
+    if (rt->hthread==NULL) {
+      if (rt->bits!=NULL && i>0)
+        GlobalFree((HGLOBAL)rt->bits);
+      if (rt->hstart!=NULL) CloseHandle(rt->hstart);
+      memset(rt,0,sizeof(t_renderthread));
+      break; };
+    nrenderer++; };
+  if (nrenderer==0) {
+    CloseHandle(hrenderdone);
+    hrenderdone=NULL;
+    DeleteCriticalSection(&rendercs); };
+  return nrenderer;
+};
+
+// Returns width of the border around the data grid with raster dx.
+static int Borderwidth(t_printdata *print,int printborder,int dx) {
+  if (printborder)
+    return dx*16;
+  else if (print->outbmp[0]!='\0' && print->vector==0)
+    return 25;
+  else
+    return 0;
+  ;
+};
+
+// Calculates how many pages, including parity pages, data takes with the
+// given layout of the printable area width x height. Returns 0 if page can't
+// hold even a single group.
+static int Countpages(t_printdata *print,int width,int height,int density,
+  int printborder,int ngroup,int nparity) {
+  int dx,dy,px,py,nx,ny,nchain,border,n;
+  ulong pagesize;
+  dx=max(print->ppix/density,2);
+  px=max((dx*dotpercent)/100,1);
+  dy=max(print->ppiy/density,2);
+  py=max((dy*dotpercent)/100,1);
+  border=Borderwidth(print,printborder,dx);
+  nchain=ngroup+nparity;
+  nx=(width-px-2*border)/(NDOT*dx+3*dx);
+  ny=(height-py-2*border)/(NDOT*dy+3*dy);
+  if (nx<nchain || ny<3 || nx*ny<2*nchain)
+    return 0;
+  pagesize=((nx*ny-nchain-1)/nchain)*ngroup*NDATA;
+  if (print->parpages<=0)
+    return (print->datasize+pagesize-1)/pagesize;
+  n=(print->alignedsize+pagesize-1)/pagesize;
+  return n+(n+PARSTRIPE-1)/PARSTRIPE*print->parpages;
+};
+
+// Searches for the layout that takes the fewest sheets of paper. Density
+// selected in options is the highest that printer and scanner can handle,
+// and redundancy is the weakest protection the user accepts. I try densities
+// down to one half of it and all stronger redundancies, with and without
+// border around the page. Of layouts with the same number of pages, I prefer
+// stronger redundancy, then larger dots, then border, so that otherwise empty
+// space on the last page makes backup more robust. On success, sets density,
+// changes redundancy and border in print and returns 0. Returns -1 if nothing
+// fits.
+static int Planlayout(t_printdata *print,int width,int height,int *density) {
+  int i,d,r,b,n,ngroup,nparity,dxmin,dxlast,manual;
+  int best,bestd,bestr,bestb;
+  dxmin=max(print->ppix/dpi,2);
+  manual=Countpages(print,width,height,dpi,print->printborder,
+    print->ngroup,print->nparity);
+  best=0; bestd=bestr=bestb=0;
+  dxlast=0;
+  for (i=dxmin; i<=2*dxmin; i++) {
+    d=print->ppix/i;
+    if (d<=0 || max(print->ppix/d,2)==dxlast)
+      continue;                        // Same raster as already checked
+    dxlast=max(print->ppix/d,2);
+    for (r=print->redundancy; r>=NGROUPMIN; r--) {
+      if (erasure)
+        Erasurelayout(r,&ngroup,&nparity);
+      else {
+        ngroup=r;
+        nparity=1; };
+      for (b=0; b<=1; b++) {
+        n=Countpages(print,width,height,d,b,ngroup,nparity);
+        if (n==0)
+          continue;
+        if (best==0 || n<best ||
+          (n==best && (r<bestr || (r==bestr && (d<bestd ||
+          (d==bestd && b>bestb)))))
+        ) {
+          best=n; bestd=d; bestr=r; bestb=b;
+        };
+      };
+    };
+  };
+  if (best==0)
+    return -1;
+  *density=bestd;
+  print->redundancy=bestr;
+  if (erasure)
+    Erasurelayout(bestr,&print->ngroup,&print->nparity);
+  else {
+    print->ngroup=bestr;
+    print->nparity=1; };
+  print->printborder=bestb;
+  if (manual==0 || manual==best)
+    sprintf(print->plan,"%i dpi, 1:%i%s",bestd,bestr,(bestb?", border":""));
+  else
+    sprintf(print->plan,"%i dpi, 1:%i%s, %i of %i pages saved",
+      bestd,bestr,(bestb?", border":""),manual-best,manual);
+  return 0;
+};
+
 // Prepares for printing. Despite its size, this routine is very quick.
 static void Initializeprinting(t_printdata *print) {
-  int i,dx,dy,px,py,nx,ny,width,height,success,rastercaps;
+  int i,j,n,dx,dy,px,py,nx,ny,nchain,width,stride,height,success,rastercaps;
+  int density;
   char fil[MAX_PATH],nam[_MAX_FNAME],ext[_MAX_EXT],jobname[TEXTLEN];
   BITMAPINFO *pbmi;
   SIZE extent;
@@ -468,6 +1208,14 @@ static void Initializeprinting(t_printdata *print) {
   print->superdata.origsize=print->origsize;
   if (print->compression)
     print->superdata.mode|=PBM_COMPRESSED;
+  if (print->nparity>1)
+    print->superdata.mode|=PBM_ERASURE;
+  if (print->archive)
+    print->superdata.mode|=PBM_ARCHIVE;
+  if (print->framed)
+    print->superdata.mode|=PBM_FRAMED;
+  if (print->elided)
+    print->superdata.mode|=PBM_ELIDED;
   print->superdata.attributes=(uchar)(print->attributes &
     (FILE_ATTRIBUTE_READONLY|FILE_ATTRIBUTE_HIDDEN|
     FILE_ATTRIBUTE_SYSTEM|FILE_ATTRIBUTE_ARCHIVE|
@@ -564,8 +1312,8 @@ static void Initializeprinting(t_printdata *print) {
       print->hfont6=NULL;
       print->hfont10=NULL;
       print->extratop=print->extrabottom=0; };
-    // Dots on paper are black (palette index 0 in the memory bitmap that will
-    // be created later in this subroutine).
+    // Dots on paper are black (colour of set bits in the memory bitmap that
+    // will be created later in this subroutine).
     print->black=0; }
   // I treat printing to bitmap as a debugging feature and set some more or
   // less sound defaults.
@@ -589,6 +1337,21 @@ static void Initializeprinting(t_printdata *print) {
     print->hfont6=NULL;
     print->hfont10=NULL;
     print->extratop=print->extrabottom=0;
+    // PDF and PostScript are printed later, so they look like paper, with
+    // real text in the title and info lines.
+    fnsplit(print->outbmp,NULL,NULL,NULL,ext);
+    if (_stricmp(ext,".pdf")==0)
+      print->vector=VEC_PDF;
+    else if (_stricmp(ext,".ps")==0)
+      print->vector=VEC_PS;
+    if (print->vector!=0) {
+      print->paperx=width;
+      print->papery=height;
+      if (print->printheader) {
+        print->extratop=print->ppiy/6+print->ppiy/16;
+        print->extrabottom=print->ppiy/10+print->ppiy/24;
+      };
+    };
     // To simplify recognition of grid on high-contrast bitmap, dots on the
     // bitmap are dark gray.
     print->black=64; };
@@ -613,52 +1376,59 @@ static void Initializeprinting(t_printdata *print) {
     print->borderleft+print->borderright;
   height-=
     print->bordertop+print->borderbottom+print->extratop+print->extrabottom;
+  // If requested, select density, redundancy and border that give the fewest
+  // pages for this file.
+  density=dpi;
+  if (fitlayout && Planlayout(print,width,height,&density)!=0) {
+    Reporterror("Printable area is too small, reduce borders or block size");
+    Stopprinting(print);
+    return; };
   // Calculate data point raster (dx,dy) and size of the point (px,py) in the
   // pixels of printer's resolution. Note that pixels, at least in theory, may
   // be non-rectangular.
-  dx=max(print->ppix/dpi,2);
+  dx=max(print->ppix/density,2);
   px=max((dx*dotpercent)/100,1);
-  dy=max(print->ppiy/dpi,2);
+  dy=max(print->ppiy/density,2);
   py=max((dy*dotpercent)/100,1);
   // Calculate width of the border around the data grid.
-  if (print->printborder)
-    print->border=dx*16;
-  else if (print->outbmp[0]!='\0')
-    print->border=25;
-  else
-    print->border=0;
+  print->border=Borderwidth(print,print->printborder,dx);
   // Calculate the number of data blocks that fit onto the single page. Single
-  // page must contain at least redundancy data blocks plus 1 recovery checksum,
-  // and redundancy+1 superblocks with name and size of the data. Data and
-  // recovery blocks should be placed into different columns.
+  // page must contain at least one group of data blocks plus its recovery
+  // blocks, and one superblock with name and size of the data per each block
+  // of the group. Data and recovery blocks should be placed into different
+  // columns.
+  nchain=print->ngroup+print->nparity;
   nx=(width-px-2*print->border)/(NDOT*dx+3*dx);
   ny=(height-py-2*print->border)/(NDOT*dy+3*dy);
-  if (nx<print->redundancy+1 || ny<3 || nx*ny<2*print->redundancy+2) {
+  if (nx<nchain || ny<3 || nx*ny<2*nchain) {
     Reporterror("Printable area is too small, reduce borders or block size");
     Stopprinting(print);
     return; };
   // Calculate final size of the bitmap where I will draw the image.
   width=(nx*(NDOT+3)*dx+px+2*print->border+3) & 0xFFFFFFFC;
   height=ny*(NDOT+3)*dy+py+2*print->border;
-  // Fill in bitmap header. To simplify processing, I use 256-color bitmap
-  // (1 byte per pixel).
+  // Fill in bitmap header. Image has only two colours, so I draw it into the
+  // 1-bit bitmap: 8 times less memory to clear and walk, and 8 pixels are
+  // processed at once. Lines are aligned to 32 bits. Set bits are dots.
+  stride=((width+31)/32)*4;
   pbmi=(BITMAPINFO *)print->bmi;
   memset(pbmi,0,sizeof(BITMAPINFOHEADER));
   pbmi->bmiHeader.biSize=sizeof(BITMAPINFOHEADER);
   pbmi->bmiHeader.biWidth=width;
   pbmi->bmiHeader.biHeight=height;
   pbmi->bmiHeader.biPlanes=1;
-  pbmi->bmiHeader.biBitCount=8;
+  pbmi->bmiHeader.biBitCount=1;
   pbmi->bmiHeader.biCompression=BI_RGB;
   pbmi->bmiHeader.biSizeImage=0;
   pbmi->bmiHeader.biXPelsPerMeter=0;
   pbmi->bmiHeader.biYPelsPerMeter=0;      
-  pbmi->bmiHeader.biClrUsed=256;
-  pbmi->bmiHeader.biClrImportant=256;
-  for (i=0; i<256; i++) {
-    pbmi->bmiColors[i].rgbBlue=(uchar)i;
-    pbmi->bmiColors[i].rgbGreen=(uchar)i;
-    pbmi->bmiColors[i].rgbRed=(uchar)i;
+  pbmi->bmiHeader.biClrUsed=2;
+  pbmi->bmiHeader.biClrImportant=2;
+  for (i=0; i<2; i++) {
+    n=(i==0?255:print->black);
+    pbmi->bmiColors[i].rgbBlue=(uchar)n;
+    pbmi->bmiColors[i].rgbGreen=(uchar)n;
+    pbmi->bmiColors[i].rgbRed=(uchar)n;
     pbmi->bmiColors[i].rgbReserved=0; };
   // Create bitmap. Direct drawing is faster than tens of thousands of API
   // calls.
@@ -671,21 +1441,38 @@ static void Initializeprinting(t_printdata *print) {
       return;
     }; }
   else {                               // Save to bitmap
-    print->drawbits=(uchar *)GlobalAlloc(GMEM_FIXED,width*height);
+    print->drawbits=(uchar *)GlobalAlloc(GMEM_FIXED,stride*height);
     if (print->drawbits==NULL) {
       Reporterror("Low memory, can't create bitmap");
       return;
     };
   };
+  // Dots are drawn from the table of bit patterns for all 256 combinations
+  // of 8 neighbouring dots, dx bytes each. If there is no memory for the
+  // table, I do without.
+  print->dotlut=(uchar *)GlobalAlloc(GMEM_FIXED,256*dx);
+  if (print->dotlut!=NULL) {
+    memset(print->dotlut,0,256*dx);
+    for (i=0; i<256; i++) {
+      for (j=0; j<8; j++) {
+        if (i & (1<<j))
+          Setspan(print->dotlut+i*dx,j*dx,j*dx+px);
+        ;
+      };
+    };
+  };
   // Calculate the total size of useful data, bytes, that fits onto the page.
-  // For each redundancy blocks, I create one recovery block. For each chain, I
-  // create one superblock that contains file name and size, plus at least one
-  // superblock at the end of the page.
-  print->pagesize=((nx*ny-print->redundancy-2)/(print->redundancy+1))*
-    print->redundancy*NDATA;
+  // For each ngroup data blocks, I create nparity recovery blocks. For each
+  // chain, I create one superblock that contains file name and size, plus at
+  // least one superblock at the end of the page.
+  print->pagesize=((nx*ny-nchain-1)/nchain)*print->ngroup*NDATA;
   print->superdata.pagesize=print->pagesize;
+  if (Addparitypages(print)!=0) {
+    Stopprinting(print);
+    return; };
   // Save calculated parameters.
   print->width=width;
+  print->stride=stride;
   print->height=height;
   print->dx=dx;
   print->dy=dy;
@@ -693,6 +1480,16 @@ static void Initializeprinting(t_printdata *print) {
   print->py=py;
   print->nx=nx;
   print->ny=ny;
+  // Vector file needs raster to define font of dots.
+  if (print->vector!=0 &&
+    Createvectorfile(print->outbmp,print->vector,print)!=0) {
+    Reporterror("Unable to create bitmap file");
+    Stopprinting(print);
+    return; };
+  // When saving bitmaps, start threads that draw several pages at once.
+  if (print->outbmp[0]!='\0') {
+    Startrenderers(print);
+    print->nextrender=print->frompage; };
   // Start printing.
   if (print->outbmp[0]=='\0') {
     if (pagesetup.hDevNames!=NULL)
@@ -720,234 +1517,117 @@ static void Initializeprinting(t_printdata *print) {
   print->step++;
 };
 
-// Prints one complete page or saves one bitmap.
+// Reports page that is being processed and layout chosen by planner.
+static void Reportprintpage(t_printdata *print,int npages) {
+  char s[TEXTLEN];
+  if (print->plan[0]=='\0')
+    sprintf(s,"Processing page %i of %i...",print->frompage+1,npages);
+  else
+    sprintf(s,"Processing page %i of %i (%s)...",
+      print->frompage+1,npages,print->plan);
+  Message(s,0);
+};
+
+// Prints one complete page.
 static void Printnextpage(t_printdata *print) {
-  int dx,dy,px,py,nx,ny,width,height,border,redundancy,black;
-  int i,j,k,l,n,success,basex,nstring,npages,rot;
+  int n,height,npages;
   char s[TEXTLEN],ts[TEXTLEN/2];
-  char drv[_MAX_DRIVE+1],dir[_MAX_DIR],nam[_MAX_FNAME],ext[_MAX_EXT],path[MAX_PATH+32];
-  uchar *bits;
-  ulong u,size,pagesize,offset;
-  t_data block,cksum;
-  HANDLE hbmpfile;
-  BITMAPFILEHEADER bmfh;
-  BITMAPINFO *pbmi;
-  // Calculate offset of this page in data.
-  offset=print->frompage*print->pagesize;
-  if (offset>=print->datasize || print->frompage>print->topage) {
-    // All requested pages are printed, finish this step.
+  // Check whether all requested pages are printed.
+  if (print->frompage*print->pagesize>=print->printsize ||
+    print->frompage>print->topage) {
     print->step++;
     return; };
   // Report page.
-  npages=(print->datasize+print->pagesize-1)/print->pagesize;
-  sprintf(s,"Processing page %i of %i...",print->frompage+1,npages);
-  Message(s,0);
-  // Get frequently used variables.
-  dx=print->dx;
-  dy=print->dy;
-  px=print->px;
-  py=print->py;
-  nx=print->nx;
-  ny=print->ny;
-  width=print->width;
-  border=print->border;
-  size=print->alignedsize;
-  pagesize=print->pagesize;
-  redundancy=print->redundancy;
-  black=print->black;
-  if (print->outbmp[0]=='\0')
-    bits=print->dibbits;
-  else
-    bits=print->drawbits;
+  npages=(print->printsize+print->pagesize-1)/print->pagesize;
+  Reportprintpage(print,npages);
   // Start new page.
-  if (print->outbmp[0]=='\0') {
-    success=StartPage(print->dc);
-    if (success<=0) {
-      Reporterror("Unable to print");
-      Stopprinting(print);
-      return;
-    };
-  };
-  // Check if we can reduce the vertical size of the table on the last page.
-  // To assure reliable orientation, I request at least 3 rows.
-  l=min(size-offset,pagesize);
-  n=(l+NDATA-1)/NDATA;                 // Number of pure data blocks on page
-  nstring=                             // Number of groups (length of string)
-    (n+redundancy-1)/redundancy;
-  n=(nstring+1)*(redundancy+1)+1;      // Total number of blocks to print
-  n=max((n+nx-1)/nx,3);                // Number of rows (at least 3)
-  if (ny>n) ny=n;
-  height=ny*(NDOT+3)*dy+py+2*border;
-  // Initialize bitmap to all white.
-  memset(bits,255,height*width);
-  // Draw vertical grid lines.
-  for (i=0; i<=nx; i++) {
-    if (print->printborder) {
-      basex=i*(NDOT+3)*dx+border;
-      for (j=0; j<ny*(NDOT+3)*dy+py+2*border; j++,basex+=width) {
-        for (k=0; k<px; k++) bits[basex+k]=0;
-      }; }
-    else {
-      basex=i*(NDOT+3)*dx+width*border+border;
-      for (j=0; j<ny*(NDOT+3)*dy; j++,basex+=width) {
-        for (k=0; k<px; k++) bits[basex+k]=0;
-      };
-    };
+  if (StartPage(print->dc)<=0) {
+    Reporterror("Unable to print");
+    Stopprinting(print);
+    return; };
+  height=Renderpage(print,print->frompage,print->dibbits);
+  // Print title at the top of the page and info text at the bottom.
+  if (print->printheader) {
+    // Print title at the top of the page.
+    Filetimetotext(&print->modified,ts,sizeof(ts));
+    n=sprintf(s,"%.64s [%s, %i bytes] - page %i of %i",
+      print->superdata.name,ts,print->origsize,print->frompage+1,npages);
+    SelectObject(print->dc,print->hfont6);
+    TextOut(print->dc,print->borderleft+print->width/2,print->bordertop,s,n);
+    // Print info at the bottom of the page.
+    n=sprintf(s,"Recommended scanner resolution %i dots per inch",
+      max(print->ppix*3/print->dx,print->ppiy*3/print->dy));
+    SelectObject(print->dc,print->hfont10);
+    TextOut(print->dc,
+      print->borderleft+print->width/2,
+      print->bordertop+print->extratop+height+print->ppiy/24,s,n);
+    ;
   };
-  // Draw horizontal grid lines.
-  for (j=0; j<=ny; j++) {
-    if (print->printborder) {
-      for (k=0; k<py; k++) {
-        memset(bits+(j*(NDOT+3)*dy+k+border)*width,0,width);
-      }; }
-    else {
-      for (k=0; k<py; k++) {
-        memset(bits+(j*(NDOT+3)*dy+k+border)*width+border,0,
-        nx*(NDOT+3)*dx+px);
+  // Transfer bitmap to paper and send page to printer.
+  SetDIBitsToDevice(print->dc,
+    print->borderleft,print->bordertop+print->extratop,
+    print->width,height,0,0,0,height,print->dibbits,
+    (BITMAPINFO *)print->bmi,DIB_RGB_COLORS);
+  EndPage(print->dc);
+  // Page printed, proceed with next.
+  print->frompage++;
+};
+
+// Saves next page to bitmap. Pages are independent, so on multiprocessor
+// systems pool of threads draws several pages at once, each into its own
+// bitmap, and main thread saves finished pages in the order of pages.
+static void Savenextpage(t_printdata *print) {
+  int i,n,npages,height;
+  t_renderthread *rt;
+  // Check whether all requested pages are saved.
+  if (print->frompage*print->pagesize>=print->printsize ||
+    print->frompage>print->topage) {
+    Stoprenderers();
+    if (print->vector!=0) {
+      print->vector=0;
+      if (Closevectorfile()!=0) {
+        Reporterror("Unable to save bitmap");
+        Stopprinting(print);
+        return;
       };
     };
-  };
-  // Fill borders with regular raster.
-  if (print->printborder) {
-    for (j=-1; j<=ny; j++) {
-      Fillblock(-1,j,bits,width,height,border,nx,ny,dx,dy,px,py,black);
-      Fillblock(nx,j,bits,width,height,border,nx,ny,dx,dy,px,py,black); };
-    for (i=0; i<nx; i++) {
-      Fillblock(i,-1,bits,width,height,border,nx,ny,dx,dy,px,py,black);
-      Fillblock(i,ny,bits,width,height,border,nx,ny,dx,dy,px,py,black);
-    };
-  };
-  // Update superblock.
-  print->superdata.page=
-    (ushort)(print->frompage+1);       // Page number is 1-based
-  // First block in every string (including redundancy string) is a superblock.
-  // To improve redundancy, I avoid placing blocks belonging to the same group
-  // in the same column (consider damaged diode in laser printer).
-  for (j=0; j<=redundancy; j++) {
-    k=j*(nstring+1);
-    if (nstring+1>=nx)
-      k+=(nx/(redundancy+1)*j-k%nx+nx)%nx;
-    Drawblock(k,(t_data *)&print->superdata,
-    bits,width,height,border,nx,ny,dx,dy,px,py,black); };
-  // Now the most important part - encode and draw data, group by group!
-  for (i=0; i<nstring; i++) {
-    // Prepare redundancy block.
-    cksum.addr=offset ^ (redundancy<<28);
-    memset(cksum.data,0xFF,NDATA);
-    // Process data group.
-    for (j=0; j<redundancy; j++) {
-      // Fill block with data.
-      block.addr=offset;
-      if (offset<size) {
-        l=size-offset;
-        if (l>NDATA) l=NDATA;
-        memcpy(block.data,print->buf+offset,l); }
-      else
-        l=0;
-      // Bytes beyond the data are set to 0.
-      while (l<NDATA)
-        block.data[l++]=0;
-      // Update redundancy block.
-      for (l=0; l<NDATA; l++) cksum.data[l]^=block.data[l];
-      // Find cell where block will be placed on the paper. The first block in
-      // every string is the superblock.
-      k=j*(nstring+1);
-      if (nstring+1<nx)
-        k+=i+1;
-      else {
-        // Optimal shift between the first columns of the strings is
-        // nx/(redundancy+1). Next line calculates how I must rotate the j-th
-        // string. Best understandable after two bottles of Weissbier.
-        rot=(nx/(redundancy+1)*j-k%nx+nx)%nx;
-        k+=(i+1+rot)%(nstring+1); };
-      Drawblock(k,&block,bits,width,height,border,nx,ny,dx,dy,px,py,black);
-      offset+=NDATA;
-    };
-    // Process redundancy block in the similar way.
-    k=redundancy*(nstring+1);
-    if (nstring+1<nx)
-      k+=i+1;
-    else {
-      rot=(nx/(redundancy+1)*redundancy-k%nx+nx)%nx;
-      k+=(i+1+rot)%(nstring+1); };
-    Drawblock(k,&cksum,bits,width,height,border,nx,ny,dx,dy,px,py,black);
-  };
-  // Print superblock in all remaining cells.
-  for (k=(nstring+1)*(redundancy+1); k<nx*ny; k++) {
-    Drawblock(k,(t_data *)&print->superdata,
-    bits,width,height,border,nx,ny,dx,dy,px,py,black); };
-  // When printing to paper, print title at the top of the page and info text
-  // at the bottom.
-  if (print->outbmp[0]=='\0') {
-    if (print->printheader) {
-      // Print title at the top of the page.
-      Filetimetotext(&print->modified,ts,sizeof(ts));
-      n=sprintf(s,"%.64s [%s, %i bytes] - page %i of %i",
-        print->superdata.name,ts,print->origsize,print->frompage+1,npages);
-      SelectObject(print->dc,print->hfont6);
-      TextOut(print->dc,print->borderleft+width/2,print->bordertop,s,n);
-      // Print info at the bottom of the page.
-      n=sprintf(s,"Recommended scanner resolution %i dots per inch",
-        max(print->ppix*3/dx,print->ppiy*3/dy));
-      SelectObject(print->dc,print->hfont10);
-      TextOut(print->dc,
-        print->borderleft+width/2,
-        print->bordertop+print->extratop+height+print->ppiy/24,s,n);
-      ;
-    };
-    // Transfer bitmap to paper and send page to printer.
-    SetDIBitsToDevice(print->dc,
-      print->borderleft,print->bordertop+print->extratop,
-      width,height,0,0,0,height,bits,
-      (BITMAPINFO *)print->bmi,DIB_RGB_COLORS);
-    EndPage(print->dc); }
-  else {
-    // Save bitmap to file. First, get file name.
-    fnsplit(print->outbmp,drv,dir,nam,ext);
-    if (ext[0]=='\0') strcpy(ext,".bmp");
-    if (npages>1)
-      sprintf(path,"%s%s%s_%04i%s",drv,dir,nam,print->frompage+1,ext);
-    else
-      sprintf(path,"%s%s%s%s",drv,dir,nam,ext);
-    // Create bitmap file.
-    hbmpfile=CreateFile(path,GENERIC_WRITE,0,NULL,
-      CREATE_ALWAYS,FILE_ATTRIBUTE_NORMAL,NULL);
-    if (hbmpfile==INVALID_HANDLE_VALUE) {
-      Reporterror("Unable to create bitmap file");
+    print->step++;
+    return; };
+  npages=(print->printsize+print->pagesize-1)/print->pagesize;
+  // Without threads, draw and save pages one by one.
+  if (nrenderer==0) {
+    Reportprintpage(print,npages);
+    height=Renderpage(print,print->frompage,print->drawbits);
+    if (Savebitmap(print,print->frompage,print->drawbits,height)!=0) {
       Stopprinting(print);
       return; };
-    // Create and save bitmap file header.
-    success=1;
-    n=sizeof(BITMAPINFOHEADER)+256*sizeof(RGBQUAD);
-    bmfh.bfType = 0x4d42; // 'BM';
-    bmfh.bfSize=sizeof(bmfh)+n+width*height;
-    bmfh.bfReserved1=bmfh.bfReserved2=0;
-    bmfh.bfOffBits=sizeof(bmfh)+n;
-    if (WriteFile(hbmpfile,&bmfh,sizeof(bmfh),&u,NULL)==0 || u!=sizeof(bmfh))
-      success=0;
-    // Update and save bitmap info header and palette.
-    if (success) {
-      pbmi=(BITMAPINFO *)print->bmi;
-      pbmi->bmiHeader.biWidth=width;
-      pbmi->bmiHeader.biHeight=height;
-      pbmi->bmiHeader.biXPelsPerMeter=(print->ppix*10000)/254;
-      pbmi->bmiHeader.biYPelsPerMeter=(print->ppiy*10000)/254;
-      if (WriteFile(hbmpfile,pbmi,n,&u,NULL)==0 || u!=(ulong)n) success=0; };
-    // Save bitmap data.
-    if (success) {
-      if (WriteFile(hbmpfile,bits,width*height,&u,NULL)==0 ||
-        u!=(ulong)(width*height))
-        success=0;
-      ;  
-    };
-    CloseHandle(hbmpfile);
-    if (success==0) {
-      Reporterror("Unable to save bitmap");
-      Stopprinting(print);
-      return;
-    };
+    print->frompage++;
+    return; };
+  // Assign next pages to idle threads.
+  n=min(npages-1,print->topage);
+  rt=NULL;
+  EnterCriticalSection(&rendercs);
+  for (i=0; i<nrenderer; i++) {
+    if (renderer[i].state==0 && print->nextrender<=n) {
+      renderer[i].page=print->nextrender++;
+      renderer[i].state=1;
+      SetEvent(renderer[i].hstart); }
+    else if (renderer[i].state==2 && renderer[i].page==print->frompage)
+      rt=renderer+i;
+    ;
   };
-  // Page printed, proceed with next.
+  LeaveCriticalSection(&rendercs);
+  // If next page is not yet ready, wait for it a bit.
+  if (rt==NULL) {
+    WaitForSingleObject(hrenderdone,RENDERWAIT);
+    return; };
+  Reportprintpage(print,npages);
+  if (Savebitmap(print,rt->page,rt->bits,rt->height)!=0) {
+    Stopprinting(print);
+    return; };
+  EnterCriticalSection(&rendercs);
+  rt->state=0;
+  LeaveCriticalSection(&rendercs);
   print->frompage++;
 };
 
@@ -971,8 +1651,11 @@ void Nextdataprintingstep(t_printdata *print) {
     case 5:                            // Initialize printing
       Initializeprinting(print);
       break;
-    case 6:                            // Print pages, one at a time
-      Printnextpage(print);
+    case 6:                            // Print or save pages
+      if (print->outbmp[0]=='\0')
+        Printnextpage(print);
+      else
+        Savenextpage(print);
       break;
     case 7:                            // Finish printing.
       Stopprinting(print);
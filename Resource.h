@@ -20,6 +20,17 @@
 #define OPT_BORDER     3107
 #define OPT_AUTOSAVE   3108
 #define OPT_HIQ        3109
+#define OPT_ERASURE    3110
+#define OPT_PARPAGES   3111
+#define OPT_FITLAYOUT  3112
+#define OPT_RANDOM     3113
+#define OPT_ELIDE      3114
 #define OPT_OK         IDOK
 #define OPT_CANCEL     IDCANCEL
 
+#define PART_LIST      3201
+#define PART_FROM      3202
+#define PART_SIZE      3203
+#define PART_OK        IDOK
+#define PART_CANCEL    IDCANCEL
+
@@ -54,141 +54,212 @@ static DSMENTRYPROC dsmentry;          // Address of DSM_Entry()
 static TW_IDENTITY appid;              // Application's identity structure
 static TW_IDENTITY source;             // Opened TWAIN source
 
-// Processes data from the scanner.
-int ProcessDIB(HGLOBAL hdata,int offset) {
-  int i,j,sizex,sizey,ncolor;
+// Converts DIB, either from the scanner or read from the file, into the
+// bitmap in the format of decoder. Offset is the offset of bits from the
+// beginning of DIB, or 0 if bits immediately follow the palette. Returns 0 on
+// success and -1 on error.
+static int Convertdib(BITMAPINFO *pdib,int offset,t_scanpage *page) {
+  int i,j,sizex,sizey,ncolor,rowbytes,invert;
   uchar scale[256],*data,*pdata,*pbits;
-  BITMAPINFO *pdib;
-  pdib=(BITMAPINFO *)GlobalLock(hdata);
-  if (pdib==NULL)
-    return -1;                         // Something is wrong with this DIB
   // Check that bitmap is more or less valid.
   if (pdib->bmiHeader.biSize!=sizeof(BITMAPINFOHEADER) ||
     pdib->bmiHeader.biPlanes!=1 ||
-    (pdib->bmiHeader.biBitCount!=8 && pdib->bmiHeader.biBitCount!=24) ||
+    (pdib->bmiHeader.biBitCount!=1 && pdib->bmiHeader.biBitCount!=8 &&
+    pdib->bmiHeader.biBitCount!=24) ||
+    (pdib->bmiHeader.biBitCount==1 && pdib->bmiHeader.biClrUsed>2) ||
     (pdib->bmiHeader.biBitCount==24 && pdib->bmiHeader.biClrUsed!=0) ||
     pdib->bmiHeader.biCompression!=BI_RGB ||
     pdib->bmiHeader.biWidth<128 || pdib->bmiHeader.biWidth>32768 ||
     pdib->bmiHeader.biHeight<128 || pdib->bmiHeader.biHeight>32768
   ) {
-    GlobalUnlock(hdata);
     return -1; };                      // Not a known bitmap!
   sizex=pdib->bmiHeader.biWidth;
   sizey=pdib->bmiHeader.biHeight;
   ncolor=pdib->bmiHeader.biClrUsed;
-  // Convert bitmap to 8-bit grayscale. Note that scan lines are DWORD-aligned.
-  data=(uchar *)GlobalAlloc(GMEM_FIXED,sizex*sizey);
-  if (data==NULL) {
-    GlobalUnlock(hdata);
-    return -1; };
-  if (pdib->bmiHeader.biBitCount==8) {
-    // 8-bit bitmap with palette.
-    if (ncolor>0) {
-      for (i=0; i<ncolor; i++) {
-        scale[i]=(uchar)((pdib->bmiColors[i].rgbBlue+
-        pdib->bmiColors[i].rgbGreen+pdib->bmiColors[i].rgbRed)/3);
-      }; }
-    else {
-      for (i=0; i<256; i++) scale[i]=(uchar)i; };
+  if (pdib->bmiHeader.biBitCount==1) {
+    // Bilevel bitmap is decoded directly, without expanding to 8 bits per
+    // pixel. Rows of 1-bit DIB are already DWORD-aligned as decoder expects,
+    // I only make sure that set bits are black and padding bits are zero.
+    if (ncolor==0) ncolor=2;
+    invert=(pdib->bmiColors[1].rgbBlue+pdib->bmiColors[1].rgbGreen+
+      pdib->bmiColors[1].rgbRed>pdib->bmiColors[0].rgbBlue+
+      pdib->bmiColors[0].rgbGreen+pdib->bmiColors[0].rgbRed);
+    rowbytes=((sizex+31)/32)*4;
+    data=(uchar *)GlobalAlloc(GMEM_FIXED,rowbytes*sizey+4);
+    if (data==NULL)
+      return -1;
     if (offset==0)
       offset=sizeof(BITMAPINFOHEADER)+ncolor*sizeof(RGBQUAD);
-    pdata=data;
-    for (j=0; j<sizey; j++) {
-      offset=(offset+3) & 0xFFFFFFFC;
-      pbits=((uchar *)(pdib))+offset;
-      for (i=0; i<sizex; i++) {
-        *pdata++=scale[*pbits++]; };
-      offset+=sizex;
-    }; }
+    memcpy(data,((uchar *)(pdib))+offset,rowbytes*sizey);
+    memset(data+rowbytes*sizey,0,4);
+    for (j=0,pdata=data; j<sizey; j++,pdata+=rowbytes) {
+      if (invert) {
+        for (i=0; i<rowbytes; i++) pdata[i]^=0xFF; };
+      if (sizex & 7)
+        pdata[sizex>>3]&=(uchar)(0xFF00>>(sizex & 7));
+      for (i=(sizex+7)/8; i<rowbytes; i++) pdata[i]=0;
+    };
+    page->bpp=1; }
   else {
-    // 24-bit bitmap without palette.
-    if (offset==0)
-      offset=sizeof(BITMAPINFOHEADER)+ncolor*sizeof(RGBQUAD);
-    pdata=data;
-    for (j=0; j<sizey; j++) {
-      offset=(offset+3) & 0xFFFFFFFC;
-      pbits=((uchar *)(pdib))+offset;
-      for (i=0; i<sizex; i++) {
-        *pdata++=(uchar)((pbits[0]+pbits[1]+pbits[2])/3);
-        pbits+=3; };
-      offset+=sizex*3;
+    // Convert bitmap to 8-bit grayscale. Note that scan lines are
+    // DWORD-aligned.
+    data=(uchar *)GlobalAlloc(GMEM_FIXED,sizex*sizey);
+    if (data==NULL)
+      return -1;
+    if (pdib->bmiHeader.biBitCount==8) {
+      // 8-bit bitmap with palette.
+      if (ncolor>0) {
+        for (i=0; i<ncolor; i++) {
+          scale[i]=(uchar)((pdib->bmiColors[i].rgbBlue+
+          pdib->bmiColors[i].rgbGreen+pdib->bmiColors[i].rgbRed)/3);
+        }; }
+      else {
+        for (i=0; i<256; i++) scale[i]=(uchar)i; };
+      if (offset==0)
+        offset=sizeof(BITMAPINFOHEADER)+ncolor*sizeof(RGBQUAD);
+      pdata=data;
+      for (j=0; j<sizey; j++) {
+        offset=(offset+3) & 0xFFFFFFFC;
+        pbits=((uchar *)(pdib))+offset;
+        for (i=0; i<sizex; i++) {
+          *pdata++=scale[*pbits++]; };
+        offset+=sizex;
+      }; }
+    else {
+      // 24-bit bitmap without palette.
+      if (offset==0)
+        offset=sizeof(BITMAPINFOHEADER)+ncolor*sizeof(RGBQUAD);
+      pdata=data;
+      for (j=0; j<sizey; j++) {
+        offset=(offset+3) & 0xFFFFFFFC;
+        pbits=((uchar *)(pdib))+offset;
+        for (i=0; i<sizex; i++) {
+          *pdata++=(uchar)((pbits[0]+pbits[1]+pbits[2])/3);
+          pbits+=3; };
+        offset+=sizex*3;
+      };
     };
+    page->bpp=8;
   };
-  // Decode bitmap. This is what we are for here.
-  Startbitmapdecoding(&procdata,data,sizex,sizey);
-  // Free original bitmap and report success.
-  GlobalUnlock(hdata);
+  page->data=data;
+  page->sizex=sizex;
+  page->sizey=sizey;
+  page->index=1;
   return 0;
 };
 
-// Opens and decodes bitmap. Returns 0 on success and -1 on error.
-int Decodebitmap(char *path) {
+// Reads bitmap file and converts it into the format of decoder. Does not touch
+// UI and can be called from any thread. Returns 0 on success and -1 on error
+// (reason is in error).
+int Readbmpfile(char *path,t_scanpage *page,char *error) {
   int i,size;
-  char s[TEXTLEN+MAX_PATH],fil[_MAX_FNAME],ext[_MAX_EXT];
+  char fil[_MAX_FNAME],ext[_MAX_EXT];
   uchar *data,buf[sizeof(BITMAPFILEHEADER)+sizeof(BITMAPINFOHEADER)];
   FILE *f;
   BITMAPFILEHEADER *pbfh;
   BITMAPINFOHEADER *pbih;
-  HCURSOR prevcursor;
-  // Ask for file name.
-  if (path==NULL || path[0]=='\0') {
-    if (Selectinbmp()!=0) return -1; }
-  else {
-    strncpy(inbmp,path,sizeof(inbmp));
-    inbmp[sizeof(inbmp)-1]='\0'; };
-  fnsplit(inbmp,NULL,NULL,fil,ext);
-  sprintf(s,"Reading %s%s...",fil,ext);
-  Message(s,0);
-  Updatebuttons();
+  fnsplit(path,NULL,NULL,fil,ext);
   // Open file and verify that this is the valid bitmap of known type.
-  f=fopen(inbmp,"rb");
+  f=fopen(path,"rb");
   if (f==NULL) {                       // Unable to open file
-    sprintf(s,"Unable to open %s%s",fil,ext);
-    Reporterror(s);
+    sprintf(error,"Unable to open %s%s",fil,ext);
     return -1; };
-  // Reading 100-MB bitmap may take many seconds. Let's inform user by changing
-  // mouse pointer.
-  prevcursor=SetCursor(LoadCursor(NULL,IDC_WAIT));
   i=fread(buf,1,sizeof(buf),f);
-  SetCursor(prevcursor);
   if (i!=sizeof(buf)) {                // Unable to read file
-    sprintf(s,"Unable to read %s%s",fil,ext);
-    Reporterror(s);
+    sprintf(error,"Unable to read %s%s",fil,ext);
     fclose(f); return -1; };
   pbfh=(BITMAPFILEHEADER *)buf;
   pbih=(BITMAPINFOHEADER *)(buf+sizeof(BITMAPFILEHEADER));
   if (pbfh->bfType!= 0x4d42 || // this fails! 'BM' ||
     pbih->biSize!=sizeof(BITMAPINFOHEADER) || pbih->biPlanes!=1 ||
-    (pbih->biBitCount!=8 && pbih->biBitCount!=24) ||
+    (pbih->biBitCount!=1 && pbih->biBitCount!=8 && pbih->biBitCount!=24) ||
+    (pbih->biBitCount==1 && pbih->biClrUsed>2) ||
     (pbih->biBitCount==24 && pbih->biClrUsed!=0) ||
     pbih->biCompression!=BI_RGB ||
     pbih->biWidth<128 || pbih->biWidth>32768 ||
     pbih->biHeight<128 || pbih->biHeight>32768
   ) {                                  // Invalid bitmap type
-    sprintf(s,"Unsupported bitmap type: %s%s",fil,ext);
-    Reporterror(s);
+    sprintf(error,"Unsupported bitmap type: %s%s",fil,ext);
     fclose(f); return -1; };
   // Allocate buffer and read file.
   fseek(f,0,SEEK_END);
   size=ftell(f)-sizeof(BITMAPFILEHEADER);
   data=(uchar *)GlobalAlloc(GMEM_FIXED,size);
   if (data==NULL) {                    // Unable to allocate memory
-    Reporterror("Low memory");
+    sprintf(error,"Low memory");
     fclose(f); return -1; };
   fseek(f,sizeof(BITMAPFILEHEADER),SEEK_SET);
   i=fread(data,1,size,f);
   fclose(f);
   if (i!=size) {                       // Unable to read bitmap
-    sprintf(s,"Unable to read %s%s",fil,ext);
-    Reporterror(s);
+    sprintf(error,"Unable to read %s%s",fil,ext);
     GlobalFree((HGLOBAL)data);
     return -1; };
-  // Process bitmap.
-  ProcessDIB((HGLOBAL)data,pbfh->bfOffBits-sizeof(BITMAPFILEHEADER));
+  // Convert bitmap.
+  i=Convertdib((BITMAPINFO *)data,pbfh->bfOffBits-sizeof(BITMAPFILEHEADER),
+    page);
   GlobalFree((HGLOBAL)data);
+  if (i!=0) {
+    sprintf(error,"Low memory");
+    return -1; };
   return 0;
 };
 
+// Opens and decodes bitmap. Multi-page files, directories and lists of page
+// files (*.lst) are opened as page streams. Returns 0 on success and -1 on
+// error.
+int Decodebitmap(char *path) {
+  char s[TEXTLEN+MAX_PATH],fil[_MAX_FNAME],ext[_MAX_EXT];
+  DWORD attr;
+  HCURSOR prevcursor;
+  t_scanpage page;
+  // Ask for file name.
+  if (path==NULL || path[0]=='\0') {
+    if (Selectinbmp()!=0) return -1; }
+  else if (strcmp(path,"-")==0)
+    return Openpagestream(path);       // PNM images on standard input
+  else {
+    strncpy(inbmp,path,sizeof(inbmp));
+    inbmp[sizeof(inbmp)-1]='\0'; };
+  fnsplit(inbmp,NULL,NULL,fil,ext);
+  sprintf(s,"Reading %s%s...",fil,ext);
+  Message(s,0);
+  Updatebuttons();
+  // TIFF and JPEG files have their own readers. Multi-page TIFF and PNM
+  // files, as well as replayed directories, are read page by page in the
+  // background.
+  attr=GetFileAttributes(inbmp);
+  if ((attr!=INVALID_FILE_ATTRIBUTES && (attr & FILE_ATTRIBUTE_DIRECTORY)) ||
+    _stricmp(ext,".lst")==0 ||
+    _stricmp(ext,".tif")==0 || _stricmp(ext,".tiff")==0 ||
+    _stricmp(ext,".pnm")==0 || _stricmp(ext,".pbm")==0 ||
+    _stricmp(ext,".pgm")==0 || _stricmp(ext,".ppm")==0)
+    return Openpagestream(inbmp);
+  if (_stricmp(ext,".jpg")==0 || _stricmp(ext,".jpeg")==0)
+    return Decodejpeg(inbmp);
+  // Reading 100-MB bitmap may take many seconds. Let's inform user by changing
+  // mouse pointer.
+  prevcursor=SetCursor(LoadCursor(NULL,IDC_WAIT));
+  if (Readbmpfile(inbmp,&page,s)!=0) {
+    SetCursor(prevcursor);
+    Reporterror(s);
+    return -1; };
+  SetCursor(prevcursor);
+  // Decode bitmap. This is what we are for here.
+  Startbitmapdecoding(&procdata,page.data,page.sizex,page.sizey,page.bpp);
+  return 0;
+};
+
+// Starts acquisition of pages. If replay source is set in the initialization
+// file, pages are replayed from it instead of the scanner, so that batch
+// scanning can be tested without hardware. Returns 0 on success and -1 on
+// error.
+int Acquirepages(void) {
+  if (replaysource[0]!='\0')
+    return Openpagestream(replaysource);
+  return OpenTWAINinterface();
+};
+
 // Opens TWAIN manager. Returns 0 on success and -1 on error.
 int OpenTWAINmanager(void) {
   TW_UINT16 result;
@@ -258,17 +329,26 @@ int OpenTWAINinterface(void) {
   return 0;
 };
 
-// Gets picture(s) from the TWAIN.
+// Gets picture(s) from the TWAIN. Pages are not decoded here but placed into
+// the page queue, so that the page that is being decoded is never discarded.
+// If queue is full, remaining transfers stay pending and main loop calls this
+// function again when decoder takes the next page. Meanwhile, the scanner
+// feeds the next sheet.
 int GetpicturefromTWAIN(void) {
   int nextimage;
   TW_UINT16 result,xferres;
   TW_IMAGEINFO imageinfo;
   TW_PENDINGXFERS pending;
   HGLOBAL hdata;
+  BITMAPINFO *pdib;
+  t_scanpage page;
   if (twainstate!=5)
     return -1;                         // Not a good time to get the picture
   nextimage=1;
   while (nextimage) {
+    if (Scanpageroom()==0) {
+      twainpending=1;                  // Continue when queue has free slot
+      return 0; };
     // Get image information, like resolution and size.
     result=dsmentry(&appid,&source,
       DG_IMAGE,DAT_IMAGEINFO,MSG_GET,(TW_MEMREF)&imageinfo);
@@ -286,7 +366,9 @@ int GetpicturefromTWAIN(void) {
     switch (xferres) {
       case TWRC_XFERDONE:              // Transfer finished, hbmp valid
         if (hdata!=NULL) {
-          ProcessDIB(hdata,0);
+          pdib=(BITMAPINFO *)GlobalLock(hdata);
+          if (pdib!=NULL && Convertdib(pdib,0,&page)==0)
+            Pushscanpage(&page);
           GlobalUnlock(hdata);
           GlobalFree(hdata); };
         break;
@@ -302,14 +384,29 @@ int GetpicturefromTWAIN(void) {
       break;
     };
   };
+  twainpending=0;
   return 0;
 };
 
+// Discards scanner pages that are not yet transferred.
+void CancelTWAINtransfers(void) {
+  TW_PENDINGXFERS pending;
+  if (twainpending==0 || twainstate!=5)
+    return;
+  dsmentry(&appid,&source,
+    DG_CONTROL,DAT_PENDINGXFERS,MSG_RESET,(TW_MEMREF)&pending);
+  twainpending=0;
+};
+
 // Disables and closes TWAIN interface. Returns 0 on success and -1 on error.
 int CloseTWAINinterface(void) {
   TW_UINT16 result;
   TW_USERINTERFACE interf;
   if (twainstate==5) {
+    // Source can't be disabled while transfers are pending. Pages that are
+    // already in the queue will be decoded.
+    CancelTWAINtransfers();
+    Endpushstream();
     // Disable source.
     interf.ShowUI=0;
     interf.ModalUI=0;
@@ -121,7 +121,9 @@ int Selectinbmp(void) {
   ofn.lStructSize=min(OPENFILENAME_SIZE_VERSION_400,sizeof(ofn));
   ofn.hwndOwner=hwmain;
   ofn.hInstance=hinst;
-  ofn.lpstrFilter="Bitmap file (*.bmp)\0*.bmp\0Any file (*.*)\0*.*\0\0";
+  ofn.lpstrFilter="Bitmap file (*.bmp)\0*.bmp\0"
+    "TIFF file (*.tif)\0*.tif;*.tiff\0JPEG file (*.jpg)\0*.jpg;*.jpeg\0"
+    "PNM file (*.pnm)\0*.pnm;*.pbm;*.pgm;*.ppm\0Any file (*.*)\0*.*\0\0";
   ofn.lpstrFile=inbmp;
   ofn.nMaxFile=sizeof(inbmp);
   ofn.lpstrTitle="Decode bitmap";
@@ -146,7 +148,11 @@ int Selectoutbmp(void) {
   ofn.lStructSize=min(OPENFILENAME_SIZE_VERSION_400,sizeof(ofn));
   ofn.hwndOwner=hwmain;
   ofn.hInstance=hinst;
-  ofn.lpstrFilter="Bitmap file (*.bmp)\0*.bmp\0Any file (*.*)\0*.*\0\0";
+  ofn.lpstrFilter="Bitmap file (*.bmp)\0*.bmp\0"
+    "PNG file, 1-bit (*.png)\0*.png\0"
+    "Multi-page TIFF file, G4 (*.tif)\0*.tif;*.tiff\0"
+    "PDF file (*.pdf)\0*.pdf\0PostScript file (*.ps)\0*.ps\0"
+    "Any file (*.*)\0*.*\0\0";
   ofn.lpstrFile=outbmp;
   ofn.nMaxFile=sizeof(outbmp);
   ofn.lpstrTitle="Save bitmap as";
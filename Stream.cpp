@@ -0,0 +1,683 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+// MRPODS -- Machine-Readable Printed Optical Data Sheets                     //
+// https://github.com/sheafdynamics/mrpods                                    //
+//                                                                            //
+// Copyright (c) 2024 Ray Doll                                                //
+// Copyright (c) 2007 Oleh Yuschuk                                            //
+//                                                                            //
+// This file is part of MRPODS, which is built off                            //
+// Oleh Yuschuk's PaperBack https://ollydbg.de/Paperbak/                      //
+// MRPODS is cumulative work of passionate programmers,                       //
+// both named and unnamed, including freelancers and private contractors.     //
+// Without them, this would not be possible.                                  //
+// This software contains Oleh Yuschuk's original comments and                //
+// comments from other maintainers.                                           //
+//                                                                            //
+// MRPODS is free software; you can redistribute it and/or modify it under    //
+// the terms of the GNU General Public License as published by the Free       //
+// Software Foundation; either version 3 of the License, or (at your option)  //
+// any later version.                                                         //
+//                                                                            //
+// MRPODS is distributed in the hope that it will be useful, but WITHOUT      //
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or      //
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for   //
+// more details.                                                              //
+//                                                                            //
+// You should have received a copy of the GNU General Public License along    //
+// with this program. If not, see <http://www.gnu.org/licenses/>.             //
+//                                                                            //
+//                              bzip2 license                                 //
+// -------------------------------------------------------------------------- //
+// "bzip2", the associated library "libbzip2" copyright(C) 1996 - 2010        //
+// Julian R Seward. All rights reserved.                                      //
+// Julian Seward, jseward@acm.org                                             //
+// bzip2 / libbzip2 version 1.0.6 of 6 September 2010                         //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include <windows.h>
+#include <commctrl.h>
+#include <stdio.h>
+#include <direct.h>
+#include <math.h>
+#include "twain.h"
+#pragma hdrstop
+
+#include "mrpods.h"
+#include "resource.h"
+
+static t_pagestream stream;            // Current source of pages
+static int       streamactive;         // Stream is open
+static HANDLE    hstreamthread;        // Thread that reads pages
+static HANDLE    hstreamfree;          // Semaphore, counts free page slots
+static CRITICAL_SECTION streamcs;      // Protects list of ready pages
+static t_scanpage ready[NSTREAMBUF];   // Pages waiting for decoder
+static int       firstready;           // Index of first ready page
+static int       nready;               // Number of ready pages
+static int       streamdone;           // Reader thread finished
+static volatile int stopstream;        // Request to stop reader thread
+
+typedef struct t_decoder {             // Decoding thread
+  t_procdata     pd;                   // Decoder context of this thread
+  HANDLE         hthread;              // Thread handle
+  HANDLE         hstart;               // Event, page is assigned
+  int            busy;                 // Thread decodes page
+  int            hasresult;            // Results are not yet reported
+} t_decoder;
+
+static t_decoder decoder[NDECODER];    // Decoding threads
+static int       ndecoder;             // Number of running decoding threads
+static volatile int stopdecoders;      // Request to terminate threads
+
+// Returns next byte of the sequential input or -1 at the end of data.
+static int Getstreambyte(t_pagestream *ps) {
+  ulong l;
+  if (ps->bufpos>=ps->bufsize) {
+    if (ReadFile(ps->hfile,ps->buf,STREAMBUFSIZE,&l,NULL)==0 || l==0)
+      return -1;
+    ps->bufpos=0;
+    ps->bufsize=l; };
+  return ps->buf[ps->bufpos++];
+};
+
+// Reads n bytes from the sequential input. Pipes may return data in pieces of
+// any size. Returns number of bytes actually read.
+static int Readstream(t_pagestream *ps,uchar *dest,int n) {
+  int k,done;
+  ulong l;
+  done=0;
+  while (done<n) {
+    if (ps->bufpos<ps->bufsize) {
+      k=min(n-done,ps->bufsize-ps->bufpos);
+      memcpy(dest+done,ps->buf+ps->bufpos,k);
+      ps->bufpos+=k;
+      done+=k; }
+    else {
+      if (ReadFile(ps->hfile,ps->buf,STREAMBUFSIZE,&l,NULL)==0 || l==0)
+        break;
+      ps->bufpos=0;
+      ps->bufsize=l;
+    };
+  };
+  return done;
+};
+
+// Reads decimal number from the PNM header, skipping whitespaces and
+// comments before it. Single character that terminates number is consumed.
+// Returns number or -1 on error.
+static int Getpnmnumber(t_pagestream *ps) {
+  int c,n;
+  do {
+    c=Getstreambyte(ps);
+    if (c=='#') {
+      while (c>=0 && c!='\n' && c!='\r') c=Getstreambyte(ps); };
+  } while (c==' ' || c=='\t' || c=='\n' || c=='\r');
+  if (c<'0' || c>'9') return -1;
+  for (n=0; c>='0' && c<='9'; c=Getstreambyte(ps)) {
+    if (n>=0x7FFFFFF) return -1;
+    n=n*10+c-'0'; };
+  return n;
+};
+
+// Reads next image from the sequence of binary PNM images (PBM, PGM or PPM),
+// like the output of scanimage in batch mode. Images with more than 8 bits
+// per sample are reduced to 8 bits, colour images are converted to gray.
+// Bilevel images are passed to the decoder packed. Returns 1 if page is read,
+// 0 at the end of stream and -1 on error (ps->error contains the reason).
+static int Readpnmpage(t_pagestream *ps,t_scanpage *page) {
+  int i,j,c,type,sizex,sizey,maxval,nsample,pnmrowbytes,rowbytes,v;
+  uchar *data,*row,*src,*dest;
+  // Images may be separated by whitespaces. End of data before the next
+  // image is a normal end of stream.
+  do {
+    c=Getstreambyte(ps);
+  } while (c==' ' || c=='\t' || c=='\n' || c=='\r');
+  if (c<0)
+    return 0;
+  type=Getstreambyte(ps);
+  if (c!='P' || type<'1' || type>'7') {
+    sprintf(ps->error,"%s is not a PNM stream",ps->name);
+    return -1; };
+  ps->npage++;
+  sizex=Getpnmnumber(ps);
+  sizey=Getpnmnumber(ps);
+  if (type=='4')
+    maxval=1;
+  else
+    maxval=Getpnmnumber(ps);
+  if ((type!='4' && type!='5' && type!='6') ||
+    sizex<128 || sizex>32768 || sizey<128 || sizey>32768 ||
+    maxval<1 || maxval>65535
+  ) {
+    sprintf(ps->error,"Unsupported PNM type: %s, page %i",
+      ps->name,ps->npage);
+    return -1; };
+  // Bilevel rows are DWORD-aligned, like in 1-bit DIBs, and 4 spare bytes
+  // allow decoder to read words crossing the end of bitmap.
+  nsample=(type=='6'?3:1)*(maxval>255?2:1);
+  if (type=='4') {
+    pnmrowbytes=(sizex+7)/8;
+    rowbytes=((sizex+31)/32)*4; }
+  else {
+    pnmrowbytes=sizex*nsample;
+    rowbytes=sizex; };
+  data=(uchar *)GlobalAlloc(GPTR,rowbytes*sizey+4);
+  row=(uchar *)GlobalAlloc(GMEM_FIXED,pnmrowbytes);
+  if (data==NULL || row==NULL) {
+    if (data!=NULL) GlobalFree((HGLOBAL)data);
+    if (row!=NULL) GlobalFree((HGLOBAL)row);
+    sprintf(ps->error,"Low memory");
+    return -1; };
+  // PNM rows go from top to bottom, whereas bitmaps in memory are placed
+  // upside down. In PBM, set bit is black, exactly as decoder expects.
+  for (j=0; j<sizey; j++) {
+    if (stopstream || Readstream(ps,row,pnmrowbytes)!=pnmrowbytes) break;
+    dest=data+(sizey-1-j)*rowbytes;
+    if (type=='4') {
+      memcpy(dest,row,pnmrowbytes);
+      if ((sizex & 7)!=0)
+        dest[sizex>>3]&=(uchar)(0xFF00>>(sizex & 7));
+      continue; };
+    for (i=0,src=row; i<sizex; i++,src+=nsample) {
+      if (nsample==1)
+        v=src[0];
+      else if (nsample==2)
+        v=(src[0]<<8)|src[1];
+      else if (nsample==3)
+        v=(src[0]+src[1]+src[2])/3;
+      else
+        v=(((src[0]+src[2]+src[4])<<8)+src[1]+src[3]+src[5])/3;
+      if (maxval!=255) v=(v*255+maxval/2)/maxval;
+      dest[i]=(uchar)min(v,255);
+    };
+  };
+  GlobalFree((HGLOBAL)row);
+  if (j<sizey) {
+    sprintf(ps->error,"Unexpected end of %s, page %i",ps->name,ps->npage);
+    GlobalFree((HGLOBAL)data);
+    return -1; };
+  page->data=data;
+  page->sizex=sizex;
+  page->sizey=sizey;
+  page->bpp=(type=='4'?1:8);
+  page->index=ps->npage;
+  return 1;
+};
+
+// Checks whether file is one of page formats that replay source accepts.
+static int Ispagefile(char *path) {
+  char ext[_MAX_EXT];
+  fnsplit(path,NULL,NULL,NULL,ext);
+  return (_stricmp(ext,".bmp")==0 ||
+    _stricmp(ext,".tif")==0 || _stricmp(ext,".tiff")==0 ||
+    _stricmp(ext,".jpg")==0 || _stricmp(ext,".jpeg")==0 ||
+    _stricmp(ext,".pnm")==0 || _stricmp(ext,".pbm")==0 ||
+    _stricmp(ext,".pgm")==0 || _stricmp(ext,".ppm")==0);
+};
+
+// Adds file to the replay list. Returns 0 on success and -1 on error.
+static int Addreplayfile(t_pagestream *ps,char *path) {
+  int n;
+  char *list;
+  if (ps->nlist%256==0) {
+    n=ps->nlist+256;
+    list=(char *)GlobalAlloc(GMEM_FIXED,n*MAX_PATH);
+    if (list==NULL) return -1;
+    if (ps->list!=NULL) {
+      memcpy(list,ps->list,ps->nlist*MAX_PATH);
+      GlobalFree((HGLOBAL)ps->list); };
+    ps->list=list; };
+  strncpy(ps->list+ps->nlist*MAX_PATH,path,MAX_PATH-1);
+  ps->list[ps->nlist*MAX_PATH+MAX_PATH-1]='\0';
+  ps->nlist++;
+  return 0;
+};
+
+// Helper function for qsort(), compares names of replayed files.
+static int Comparenames(const void *a,const void *b) {
+  return _stricmp((const char *)a,(const char *)b);
+};
+
+// Builds list of replayed page files. Directory is replayed in the
+// alphabetical order of names, list file (*.lst) contains one file per line,
+// names are relative to the location of the list. Returns 0 on success and
+// -1 on error.
+static int Openreplay(t_pagestream *ps,char *path,int isdir) {
+  int n;
+  char s[MAX_PATH+16],name[MAX_PATH],drv[_MAX_DRIVE+1],dir[_MAX_DIR];
+  FILE *f;
+  HANDLE hfind;
+  WIN32_FIND_DATA fd;
+  if (isdir) {
+    n=strlen(path);
+    sprintf(s,"%s%s*",path,(n>0 && path[n-1]!='\\' ? "\\" : ""));
+    hfind=FindFirstFile(s,&fd);
+    if (hfind!=INVALID_HANDLE_VALUE) {
+      do {
+        if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
+        sprintf(s,"%s%s%s",path,(n>0 && path[n-1]!='\\' ? "\\" : ""),
+          fd.cFileName);
+        if (strlen(s)>=MAX_PATH || Ispagefile(s)==0) continue;
+        if (Addreplayfile(ps,s)!=0) {
+          FindClose(hfind);
+          sprintf(ps->error,"Low memory");
+          return -1; };
+      } while (FindNextFile(hfind,&fd));
+      FindClose(hfind);
+    };
+    if (ps->nlist>1)
+      qsort(ps->list,ps->nlist,MAX_PATH,Comparenames);
+    ; }
+  else {
+    f=fopen(path,"rt");
+    if (f==NULL) {
+      sprintf(ps->error,"Unable to open %s",ps->name);
+      return -1; };
+    fnsplit(path,drv,dir,NULL,NULL);
+    while (fgets(name,sizeof(name),f)!=NULL) {
+      n=strlen(name);
+      while (n>0 && (name[n-1]=='\n' || name[n-1]=='\r' ||
+        name[n-1]==' ' || name[n-1]=='\t')) name[--n]='\0';
+      if (n==0 || name[0]=='#' || name[0]==';') continue;
+      if (name[0]=='\\' || name[0]=='/' || (n>1 && name[1]==':'))
+        strcpy(s,name);
+      else
+        sprintf(s,"%s%s%s",drv,dir,name);
+      if (strlen(s)>=MAX_PATH) continue;
+      if (Addreplayfile(ps,s)!=0) {
+        fclose(f);
+        sprintf(ps->error,"Low memory");
+        return -1;
+      };
+    };
+    fclose(f);
+  };
+  if (ps->nlist==0) {
+    sprintf(ps->error,"No pages to replay in %s",ps->name);
+    return -1; };
+  return 0;
+};
+
+static int Readreplaypage(t_pagestream *ps,t_scanpage *page);
+static void Closeinput(t_pagestream *ps);
+
+// Opens source of pages: multi-page TIFF, PNM file, standard input ("-"),
+// directory or list of page files. Does not touch UI. Returns 0 on success
+// and -1 on error (reason is in ps->error).
+static int Openinput(t_pagestream *ps,char *path) {
+  char fil[_MAX_FNAME],ext[_MAX_EXT];
+  DWORD attr;
+  memset(ps,0,sizeof(t_pagestream));
+  if (strcmp(path,"-")==0) {
+    strcpy(ps->name,"standard input");
+    ps->type=SRC_PNM;
+    ps->readpage=Readpnmpage;
+    ps->isstdin=1;
+    ps->hfile=GetStdHandle(STD_INPUT_HANDLE); }
+  else {
+    fnsplit(path,NULL,NULL,fil,ext);
+    sprintf(ps->name,"%s%s",fil,ext);
+    attr=GetFileAttributes(path);
+    if ((attr!=INVALID_FILE_ATTRIBUTES && (attr & FILE_ATTRIBUTE_DIRECTORY))
+      || _stricmp(ext,".lst")==0) {
+      // Replay needs no file handle, each page file is opened in turn.
+      ps->type=SRC_REPLAY;
+      ps->readpage=Readreplaypage;
+      if (Openreplay(ps,path,
+        (attr!=INVALID_FILE_ATTRIBUTES && (attr & FILE_ATTRIBUTE_DIRECTORY)))
+        !=0) {
+        Closeinput(ps);
+        return -1; };
+      return 0; };
+    if (_stricmp(ext,".tif")==0 || _stricmp(ext,".tiff")==0) {
+      ps->type=SRC_TIFF;
+      ps->readpage=Readtiffpage; }
+    else {
+      ps->type=SRC_PNM;
+      ps->readpage=Readpnmpage; };
+    ps->hfile=CreateFile(path,GENERIC_READ,FILE_SHARE_READ,NULL,
+      OPEN_EXISTING,(ps->type==SRC_TIFF?FILE_ATTRIBUTE_NORMAL:
+      FILE_FLAG_SEQUENTIAL_SCAN),NULL);
+    ;
+  };
+  if (ps->hfile==NULL || ps->hfile==INVALID_HANDLE_VALUE) {
+    ps->hfile=NULL;
+    sprintf(ps->error,"Unable to open %s",ps->name);
+    return -1; };
+  ps->buf=(uchar *)GlobalAlloc(GMEM_FIXED,STREAMBUFSIZE);
+  if (ps->buf==NULL) {
+    Closeinput(ps);
+    sprintf(ps->error,"Low memory");
+    return -1; };
+  return 0;
+};
+
+// Closes source of pages opened by Openinput() and frees its resources.
+static void Closeinput(t_pagestream *ps) {
+  if (ps->sub!=NULL) {
+    Closeinput(ps->sub);
+    GlobalFree((HGLOBAL)ps->sub);
+    ps->sub=NULL; };
+  if (ps->list!=NULL) {
+    GlobalFree((HGLOBAL)ps->list);
+    ps->list=NULL; };
+  if (ps->buf!=NULL) {
+    GlobalFree((HGLOBAL)ps->buf);
+    ps->buf=NULL; };
+  if (ps->hfile!=NULL && ps->isstdin==0)
+    CloseHandle(ps->hfile);
+  ps->hfile=NULL;
+};
+
+// Reads next page of the replay source. Single-page files are read at once,
+// multi-page files are opened as nested streams. Before each file, I wait
+// replaydelay milliseconds to imitate the speed of real scanner.
+static int Readreplaypage(t_pagestream *ps,t_scanpage *page) {
+  int t,result;
+  char *path,ext[_MAX_EXT];
+  while (1) {
+    if (ps->sub!=NULL) {
+      result=ps->sub->readpage(ps->sub,page);
+      if (result==1) {
+        page->index=++ps->npage;
+        return 1; };
+      if (result<0)
+        strcpy(ps->error,ps->sub->error);
+      Closeinput(ps->sub);
+      GlobalFree((HGLOBAL)ps->sub);
+      ps->sub=NULL;
+      if (result<0) return -1;
+      continue; };
+    if (ps->nextfile>=ps->nlist)
+      return 0;                        // All files replayed
+    path=ps->list+(ps->nextfile++)*MAX_PATH;
+    for (t=0; t<replaydelay && stopstream==0; t+=10)
+      Sleep(10);
+    if (stopstream)
+      return 0;
+    fnsplit(path,NULL,NULL,NULL,ext);
+    if (_stricmp(ext,".bmp")==0)
+      result=Readbmpfile(path,page,ps->error);
+    else if (_stricmp(ext,".jpg")==0 || _stricmp(ext,".jpeg")==0)
+      result=Readjpegfile(path,page,ps->error);
+    else {
+      ps->sub=(t_pagestream *)GlobalAlloc(GPTR,sizeof(t_pagestream));
+      if (ps->sub==NULL) {
+        sprintf(ps->error,"Low memory");
+        return -1; };
+      if (Openinput(ps->sub,path)!=0) {
+        strcpy(ps->error,ps->sub->error);
+        GlobalFree((HGLOBAL)ps->sub);
+        ps->sub=NULL;
+        return -1; };
+      continue;
+    };
+    if (result!=0)
+      return -1;
+    page->index=++ps->npage;
+    return 1;
+  };
+};
+
+// Reader thread. Reads pages while there are free slots and passes them to
+// the main thread, so that the next page is read while the current one is
+// being decoded.
+static DWORD WINAPI Streamthread(LPVOID param) {
+  int result;
+  t_scanpage page;
+  while (1) {
+    WaitForSingleObject(hstreamfree,INFINITE);
+    if (stopstream) break;
+    result=stream.readpage(&stream,&page);
+    if (result!=1) break;
+    if (stopstream) {
+      GlobalFree((HGLOBAL)page.data); break; };
+    EnterCriticalSection(&streamcs);
+    ready[(firstready+nready)%NSTREAMBUF]=page;
+    nready++;
+    LeaveCriticalSection(&streamcs);
+  };
+  EnterCriticalSection(&streamcs);
+  streamdone=1;
+  LeaveCriticalSection(&streamcs);
+  return 0;
+};
+
+// Decoding thread. Decodes assigned pages in silent mode and merges results
+// into the processed files. Main thread reports results and assigns new page.
+static DWORD WINAPI Decoderthread(LPVOID param) {
+  t_decoder *pdec;
+  pdec=(t_decoder *)param;
+  while (1) {
+    WaitForSingleObject(pdec->hstart,INFINITE);
+    if (stopdecoders) break;
+    while (pdec->pd.step!=0 && stopstream==0)
+      Nextdataprocessingstep(&pdec->pd);
+    EnterCriticalSection(&streamcs);
+    pdec->busy=0;
+    LeaveCriticalSection(&streamcs);
+  };
+  return 0;
+};
+
+// Stops decoding threads and frees their resources.
+static void Stopdecoders(void) {
+  int i;
+  stopdecoders=1;
+  for (i=0; i<ndecoder; i++) {
+    SetEvent(decoder[i].hstart);
+    WaitForSingleObject(decoder[i].hthread,INFINITE);
+    CloseHandle(decoder[i].hthread);
+    CloseHandle(decoder[i].hstart);
+    Freeprocdata(&decoder[i].pd);
+    memset(decoder+i,0,sizeof(t_decoder)); };
+  ndecoder=0;
+};
+
+// Starts one decoding thread per processor, so that pages of the stream are
+// decoded in parallel. Returns 0 on success and -1 if not a single thread can
+// be started.
+static int Startdecoders(void) {
+  int i,n;
+  DWORD threadid;
+  SYSTEM_INFO si;
+  GetSystemInfo(&si);
+  n=max(1,min((int)si.dwNumberOfProcessors,NDECODER));
+  stopdecoders=0;
+  ndecoder=0;
+  for (i=0; i<n; i++) {
+    memset(decoder+i,0,sizeof(t_decoder));
+    decoder[i].hstart=CreateEvent(NULL,FALSE,FALSE,NULL);
+    if (decoder[i].hstart==NULL) break;
+    decoder[i].hthread=CreateThread(NULL,0,Decoderthread,decoder+i,0,
+      &threadid);
+    if (decoder[i].hthread==NULL) {
+      CloseHandle(decoder[i].hstart);
+      decoder[i].hstart=NULL;
+      break; };
+    ndecoder++; };
+  return (ndecoder>0?0:-1);
+};
+
+// Opens multi-page TIFF file, sequence of PNM images or replay source and
+// starts reading pages in the background. Path "-" means PNM images on the
+// standard input. Pages are passed to the decoder by Nextstreampage().
+// Returns 0 on success and -1 on error.
+int Openpagestream(char *path) {
+  DWORD threadid;
+  if (streamactive) {
+    Reporterror("Another multi-page file is being processed");
+    return -1; };
+  if (Openinput(&stream,path)!=0) {
+    Reporterror(stream.error);
+    return -1; };
+  hstreamfree=CreateSemaphore(NULL,NSTREAMBUF,NSTREAMBUF,NULL);
+  if (hstreamfree==NULL) {
+    Closeinput(&stream);
+    Reporterror("Low memory");
+    return -1; };
+  if (Startdecoders()!=0) {
+    CloseHandle(hstreamfree);
+    hstreamfree=NULL;
+    Closeinput(&stream);
+    Reporterror("Unable to start decoding threads");
+    return -1; };
+  InitializeCriticalSection(&streamcs);
+  firstready=nready=0;
+  streamdone=0;
+  stopstream=0;
+  hstreamthread=CreateThread(NULL,0,Streamthread,NULL,0,&threadid);
+  if (hstreamthread==NULL) {
+    Stopdecoders();
+    DeleteCriticalSection(&streamcs);
+    CloseHandle(hstreamfree);
+    hstreamfree=NULL;
+    Closeinput(&stream);
+    Reporterror("Unable to start reader thread");
+    return -1; };
+  streamactive=1;
+  Updatebuttons();
+  return 0;
+};
+
+// Checks whether source that pushes pages (scanner) may push the next page
+// now. This is so if no stream is open or if pushed stream has free slot.
+int Scanpageroom(void) {
+  if (streamactive==0)
+    return 1;
+  return (stream.type==SRC_TWAIN && streamdone==0 && nready<NSTREAMBUF);
+};
+
+// Places page acquired by the main thread into the queue, opening pushed
+// stream if necessary. Queue takes ownership of page data. Returns 0 on
+// success and -1 if page is rejected (call Scanpageroom() first!).
+int Pushscanpage(t_scanpage *page) {
+  if (Scanpageroom()==0) {
+    GlobalFree((HGLOBAL)page->data);
+    return -1; };
+  if (streamactive==0) {
+    if (Startdecoders()!=0) {
+      GlobalFree((HGLOBAL)page->data);
+      Reporterror("Unable to start decoding threads");
+      return -1; };
+    memset(&stream,0,sizeof(stream));
+    stream.type=SRC_TWAIN;
+    strcpy(stream.name,"scanner");
+    InitializeCriticalSection(&streamcs);
+    hstreamthread=hstreamfree=NULL;
+    firstready=nready=0;
+    streamdone=0;
+    stopstream=0;
+    streamactive=1;
+    Updatebuttons(); };
+  page->index=++stream.npage;
+  EnterCriticalSection(&streamcs);
+  ready[(firstready+nready)%NSTREAMBUF]=*page;
+  nready++;
+  LeaveCriticalSection(&streamcs);
+  return 0;
+};
+
+// Marks pushed stream as complete. Stream closes when last page is taken.
+void Endpushstream(void) {
+  if (streamactive && stream.type==SRC_TWAIN)
+    streamdone=1;
+  ;
+};
+
+// Returns 1 if multi-page stream is open and 0 otherwise.
+int Pagestreamactive(void) {
+  return streamactive;
+};
+
+// Call this function periodically from the main thread while stream is open.
+// Reports results of decoded pages and passes ready pages to idle decoding
+// threads. Returns 0 if some page was passed to decoder, 1 if decoders are
+// busy or next page is not yet ready and -1 if stream is exhausted and
+// closed. In the last case, reports error, if any.
+int Nextstreampage(void) {
+  int i,got,done,busy,nbusy,started;
+  char s[TEXTLEN+MAX_PATH];
+  t_scanpage page;
+  t_decoder *pdec;
+  if (streamactive==0)
+    return -1;
+  nbusy=started=0;
+  for (i=0,pdec=decoder; i<ndecoder; i++,pdec++) {
+    EnterCriticalSection(&streamcs);
+    busy=pdec->busy;
+    LeaveCriticalSection(&streamcs);
+    if (busy) {
+      nbusy++; continue; };
+    // Report results of the previous page and free its bitmap.
+    if (pdec->hasresult) {
+      Reportpage(pdec->pd.fileindex,pdec->pd.pagestatus,pdec->pd.error);
+      Freeprocdata(&pdec->pd);
+      pdec->hasresult=0; };
+    // Get next page, if any.
+    EnterCriticalSection(&streamcs);
+    got=(nready>0);
+    if (got) {
+      page=ready[firstready];
+      firstready=(firstready+1)%NSTREAMBUF;
+      nready--; };
+    LeaveCriticalSection(&streamcs);
+    if (got==0)
+      continue;
+    if (hstreamfree!=NULL)
+      ReleaseSemaphore(hstreamfree,1,NULL);
+    sprintf(s,"Page %i of %s",page.index,stream.name);
+    Message(s,0);
+    // Context is prepared in the main thread, the rest is done by decoder.
+    Startbitmapdecoding(&pdec->pd,page.data,page.sizex,page.sizey,page.bpp);
+    pdec->pd.mode|=M_SILENT;
+    pdec->pd.fileindex=-1;
+    pdec->hasresult=1;
+    pdec->busy=1;
+    SetEvent(pdec->hstart);
+    nbusy++;
+    started=1;
+  };
+  if (started)
+    return 0;
+  EnterCriticalSection(&streamcs);
+  done=(streamdone && nready==0);
+  LeaveCriticalSection(&streamcs);
+  if (done==0 || nbusy>0)
+    return 1;                          // Pages are still being read or decoded
+  strcpy(s,stream.error);
+  Closepagestream();
+  if (s[0]!='\0')
+    Reporterror(s);
+  Updatebuttons();
+  return -1;
+};
+
+// Stops reader thread, discards pages that are not yet decoded and closes
+// input.
+void Closepagestream(void) {
+  if (streamactive==0)
+    return;
+  stopstream=1;
+  // Wake thread if it waits for free slot, or break the pending read from the
+  // pipe. Both may fail harmlessly if thread is not waiting.
+  if (hstreamthread!=NULL) {
+    ReleaseSemaphore(hstreamfree,1,NULL);
+    CancelSynchronousIo(hstreamthread);
+    WaitForSingleObject(hstreamthread,INFINITE);
+    CloseHandle(hstreamthread);
+    CloseHandle(hstreamfree);
+    hstreamthread=hstreamfree=NULL; };
+  // Pages that are being decoded are discarded, too.
+  Stopdecoders();
+  DeleteCriticalSection(&streamcs);
+  while (nready>0) {
+    GlobalFree((HGLOBAL)ready[firstready].data);
+    firstready=(firstready+1)%NSTREAMBUF;
+    nready--; };
+  Closeinput(&stream);
+  streamactive=0;
+};
@@ -0,0 +1,758 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+// MRPODS -- Machine-Readable Printed Optical Data Sheets                     //
+// https://github.com/sheafdynamics/mrpods                                    //
+//                                                                            //
+// Copyright (c) 2024 Ray Doll                                                //
+// Copyright (c) 2007 Oleh Yuschuk                                            //
+//                                                                            //
+// This file is part of MRPODS, which is built off                            //
+// Oleh Yuschuk's PaperBack https://ollydbg.de/Paperbak/                      //
+// MRPODS is cumulative work of passionate programmers,                       //
+// both named and unnamed, including freelancers and private contractors.     //
+// Without them, this would not be possible.                                  //
+// This software contains Oleh Yuschuk's original comments and                //
+// comments from other maintainers.                                           //
+//                                                                            //
+// MRPODS is free software; you can redistribute it and/or modify it under    //
+// the terms of the GNU General Public License as published by the Free       //
+// Software Foundation; either version 3 of the License, or (at your option)  //
+// any later version.                                                         //
+//                                                                            //
+// MRPODS is distributed in the hope that it will be useful, but WITHOUT      //
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or      //
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for   //
+// more details.                                                              //
+//                                                                            //
+// You should have received a copy of the GNU General Public License along    //
+// with this program. If not, see <http://www.gnu.org/licenses/>.             //
+//                                                                            //
+//                              bzip2 license                                 //
+// -------------------------------------------------------------------------- //
+// "bzip2", the associated library "libbzip2" copyright(C) 1996 - 2010        //
+// Julian R Seward. All rights reserved.                                      //
+// Julian Seward, jseward@acm.org                                             //
+// bzip2 / libbzip2 version 1.0.6 of 6 September 2010                         //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include <windows.h>
+#include <commctrl.h>
+#include <stdio.h>
+#include <direct.h>
+#include <math.h>
+#include "twain.h"
+#pragma hdrstop
+
+#include "mrpods.h"
+#include "resource.h"
+
+// TIFF tags that I understand. All other tags are silently ignored.
+#define TAG_SUBFILE    254             // NewSubfileType
+#define TAG_WIDTH      256             // ImageWidth
+#define TAG_HEIGHT     257             // ImageLength
+#define TAG_BPS        258             // BitsPerSample
+#define TAG_COMPRESS   259             // Compression
+#define TAG_PHOTO      262             // PhotometricInterpretation
+#define TAG_FILLORDER  266             // FillOrder
+#define TAG_STRIPOFS   273             // StripOffsets
+#define TAG_SPP        277             // SamplesPerPixel
+#define TAG_ROWSSTRIP  278             // RowsPerStrip
+#define TAG_STRIPCNT   279             // StripByteCounts
+
+// Additional tags that I write into the saved pages.
+#define TAG_XRES       282             // XResolution
+#define TAG_YRES       283             // YResolution
+#define TAG_T6OPT      293             // T6Options
+#define TAG_RESUNIT    296             // ResolutionUnit
+#define TAG_PAGENUM    297             // PageNumber
+
+#define TIFFWRITEBUF   65536           // Compressed data written at once
+
+#define COMP_NONE      1               // No compression
+#define COMP_G4        4               // CCITT T.6 (Group 4 fax)
+
+// 2D coding modes of CCITT T.6. Vertical modes are MODE_V0+(a1-b1).
+#define MODE_PASS      1               // Pass mode
+#define MODE_HORZ      2               // Horizontal mode
+#define MODE_V0        6               // Vertical mode, a1 just below b1
+
+typedef struct t_faxcode {             // CCITT run length code
+  uchar          length;               // Code length, bits
+  ushort         code;                 // Code, right-aligned
+  ushort         run;                  // Run length, pixels
+} t_faxcode;
+
+typedef struct t_bitwriter {           // Writer of MSB-first bit stream
+  uchar          *data;                // Output buffer
+  ulong          n;                    // Number of complete bytes in data
+  ulong          acc;                  // Pending bits, right-aligned
+  int            nbits;                // Number of pending bits (0..7)
+} t_bitwriter;
+
+typedef struct t_bitreader {           // Reader of MSB-first bit stream
+  uchar          *data;                // Compressed data
+  ulong          size;                 // Size of data, bits
+  ulong          pos;                  // Current position, bits
+} t_bitreader;
+
+// Terminating, makeup and extended makeup codes for white runs.
+static t_faxcode whitecode[] = {
+  { 8,0x0035,   0},{ 6,0x0007,   1},{ 4,0x0007,   2},{ 4,0x0008,   3},
+  { 4,0x000B,   4},{ 4,0x000C,   5},{ 4,0x000E,   6},{ 4,0x000F,   7},
+  { 5,0x0013,   8},{ 5,0x0014,   9},{ 5,0x0007,  10},{ 5,0x0008,  11},
+  { 6,0x0008,  12},{ 6,0x0003,  13},{ 6,0x0034,  14},{ 6,0x0035,  15},
+  { 6,0x002A,  16},{ 6,0x002B,  17},{ 7,0x0027,  18},{ 7,0x000C,  19},
+  { 7,0x0008,  20},{ 7,0x0017,  21},{ 7,0x0003,  22},{ 7,0x0004,  23},
+  { 7,0x0028,  24},{ 7,0x002B,  25},{ 7,0x0013,  26},{ 7,0x0024,  27},
+  { 7,0x0018,  28},{ 8,0x0002,  29},{ 8,0x0003,  30},{ 8,0x001A,  31},
+  { 8,0x001B,  32},{ 8,0x0012,  33},{ 8,0x0013,  34},{ 8,0x0014,  35},
+  { 8,0x0015,  36},{ 8,0x0016,  37},{ 8,0x0017,  38},{ 8,0x0028,  39},
+  { 8,0x0029,  40},{ 8,0x002A,  41},{ 8,0x002B,  42},{ 8,0x002C,  43},
+  { 8,0x002D,  44},{ 8,0x0004,  45},{ 8,0x0005,  46},{ 8,0x000A,  47},
+  { 8,0x000B,  48},{ 8,0x0052,  49},{ 8,0x0053,  50},{ 8,0x0054,  51},
+  { 8,0x0055,  52},{ 8,0x0024,  53},{ 8,0x0025,  54},{ 8,0x0058,  55},
+  { 8,0x0059,  56},{ 8,0x005A,  57},{ 8,0x005B,  58},{ 8,0x004A,  59},
+  { 8,0x004B,  60},{ 8,0x0032,  61},{ 8,0x0033,  62},{ 8,0x0034,  63},
+  { 5,0x001B,  64},{ 5,0x0012, 128},{ 6,0x0017, 192},{ 7,0x0037, 256},
+  { 8,0x0036, 320},{ 8,0x0037, 384},{ 8,0x0064, 448},{ 8,0x0065, 512},
+  { 8,0x0068, 576},{ 8,0x0067, 640},{ 9,0x00CC, 704},{ 9,0x00CD, 768},
+  { 9,0x00D2, 832},{ 9,0x00D3, 896},{ 9,0x00D4, 960},{ 9,0x00D5,1024},
+  { 9,0x00D6,1088},{ 9,0x00D7,1152},{ 9,0x00D8,1216},{ 9,0x00D9,1280},
+  { 9,0x00DA,1344},{ 9,0x00DB,1408},{ 9,0x0098,1472},{ 9,0x0099,1536},
+  { 9,0x009A,1600},{ 6,0x0018,1664},{ 9,0x009B,1728},{11,0x0008,1792},
+  {11,0x000C,1856},{11,0x000D,1920},{12,0x0012,1984},{12,0x0013,2048},
+  {12,0x0014,2112},{12,0x0015,2176},{12,0x0016,2240},{12,0x0017,2304},
+  {12,0x001C,2368},{12,0x001D,2432},{12,0x001E,2496},{12,0x001F,2560}
+};
+
+// Terminating, makeup and extended makeup codes for black runs.
+static t_faxcode blackcode[] = {
+  {10,0x0037,   0},{ 3,0x0002,   1},{ 2,0x0003,   2},{ 2,0x0002,   3},
+  { 3,0x0003,   4},{ 4,0x0003,   5},{ 4,0x0002,   6},{ 5,0x0003,   7},
+  { 6,0x0005,   8},{ 6,0x0004,   9},{ 7,0x0004,  10},{ 7,0x0005,  11},
+  { 7,0x0007,  12},{ 8,0x0004,  13},{ 8,0x0007,  14},{ 9,0x0018,  15},
+  {10,0x0017,  16},{10,0x0018,  17},{10,0x0008,  18},{11,0x0067,  19},
+  {11,0x0068,  20},{11,0x006C,  21},{11,0x0037,  22},{11,0x0028,  23},
+  {11,0x0017,  24},{11,0x0018,  25},{12,0x00CA,  26},{12,0x00CB,  27},
+  {12,0x00CC,  28},{12,0x00CD,  29},{12,0x0068,  30},{12,0x0069,  31},
+  {12,0x006A,  32},{12,0x006B,  33},{12,0x00D2,  34},{12,0x00D3,  35},
+  {12,0x00D4,  36},{12,0x00D5,  37},{12,0x00D6,  38},{12,0x00D7,  39},
+  {12,0x006C,  40},{12,0x006D,  41},{12,0x00DA,  42},{12,0x00DB,  43},
+  {12,0x0054,  44},{12,0x0055,  45},{12,0x0056,  46},{12,0x0057,  47},
+  {12,0x0064,  48},{12,0x0065,  49},{12,0x0052,  50},{12,0x0053,  51},
+  {12,0x0024,  52},{12,0x0037,  53},{12,0x0038,  54},{12,0x0027,  55},
+  {12,0x0028,  56},{12,0x0058,  57},{12,0x0059,  58},{12,0x002B,  59},
+  {12,0x002C,  60},{12,0x005A,  61},{12,0x0066,  62},{12,0x0067,  63},
+  {10,0x000F,  64},{12,0x00C8, 128},{12,0x00C9, 192},{12,0x005B, 256},
+  {12,0x0033, 320},{12,0x0034, 384},{12,0x0035, 448},{13,0x006C, 512},
+  {13,0x006D, 576},{13,0x004A, 640},{13,0x004B, 704},{13,0x004C, 768},
+  {13,0x004D, 832},{13,0x0072, 896},{13,0x0073, 960},{13,0x0074,1024},
+  {13,0x0075,1088},{13,0x0076,1152},{13,0x0077,1216},{13,0x0052,1280},
+  {13,0x0053,1344},{13,0x0054,1408},{13,0x0055,1472},{13,0x005A,1536},
+  {13,0x005B,1600},{13,0x0064,1664},{13,0x0065,1728},{11,0x0008,1792},
+  {11,0x000C,1856},{11,0x000D,1920},{12,0x0012,1984},{12,0x0013,2048},
+  {12,0x0014,2112},{12,0x0015,2176},{12,0x0016,2240},{12,0x0017,2304},
+  {12,0x001C,2368},{12,0x001D,2432},{12,0x001E,2496},{12,0x001F,2560}
+};
+
+// Codes of 2D modes, indexed by mode (MODE_PASS..MODE_V0+3).
+static t_faxcode modecode[] = {
+  { 0,0x00,0           },{ 4,0x01,MODE_PASS   },{ 3,0x01,MODE_HORZ   },
+  { 7,0x02,MODE_V0-3   },{ 6,0x02,MODE_V0-2   },{ 3,0x02,MODE_V0-1   },
+  { 1,0x01,MODE_V0     },{ 3,0x03,MODE_V0+1   },{ 6,0x03,MODE_V0+2   },
+  { 7,0x03,MODE_V0+3   }
+};
+
+static ushort    whitelut[8192];       // 13-bit white lookup, (run<<4)|length
+static ushort    blacklut[8192];       // 13-bit black lookup, (run<<4)|length
+static uchar     modelut[128];         // 7-bit mode lookup, (mode<<3)|length
+static uchar     reversed[256];        // Bit-reversed bytes for FillOrder 2
+static uchar     leading[256];         // Number of leading zero bits in byte
+static int       faxready;             // Lookup tables are initialized
+
+// Places code into the lookup table with index length nbits. Code of length n
+// occupies 2^(nbits-n) consecutive entries.
+static void Addcode(ushort *lut,int nbits,int length,int code,int value) {
+  int i,n;
+  n=1<<(nbits-length);
+  for (i=0; i<n; i++)
+    lut[(code<<(nbits-length))+i]=(ushort)value;
+  ;
+};
+
+// Builds lookup tables used by the G4 decoder. Called once.
+static void Initfaxtables(void) {
+  int i,j,b;
+  ushort modes[128];
+  memset(whitelut,0,sizeof(whitelut));
+  memset(blacklut,0,sizeof(blacklut));
+  for (i=0; i<sizeof(whitecode)/sizeof(t_faxcode); i++)
+    Addcode(whitelut,13,whitecode[i].length,whitecode[i].code,
+    (whitecode[i].run<<4)|whitecode[i].length);
+  for (i=0; i<sizeof(blackcode)/sizeof(t_faxcode); i++)
+    Addcode(blacklut,13,blackcode[i].length,blackcode[i].code,
+    (blackcode[i].run<<4)|blackcode[i].length);
+  // Codes not listed here (extensions, EOL and EOFB) remain zero.
+  memset(modes,0,sizeof(modes));
+  for (i=1; i<sizeof(modecode)/sizeof(t_faxcode); i++)
+    Addcode(modes,7,modecode[i].length,modecode[i].code,
+    (modecode[i].run<<3)|modecode[i].length);
+  for (i=0; i<128; i++)
+    modelut[i]=(uchar)modes[i];
+  for (i=0; i<256; i++) {
+    for (j=0,b=0; j<8; j++) {
+      if (i & (1<<j)) b|=0x80>>j; };
+    reversed[i]=(uchar)b;
+    for (j=0; j<8 && (i & (0x80>>j))==0; j++) ;
+    leading[i]=(uchar)j; };
+  faxready=1;
+};
+
+// Returns next n (n<=13) bits from the stream without advancing position.
+// Bits beyond the end of data are read as zeros.
+static int Peekbits(t_bitreader *br,int n) {
+  ulong i,w;
+  i=br->pos>>3;
+  w=0;
+  if (i<(br->size>>3)) w|=(ulong)br->data[i]<<16;
+  if (i+1<(br->size>>3)) w|=(ulong)br->data[i+1]<<8;
+  if (i+2<(br->size>>3)) w|=(ulong)br->data[i+2];
+  return (int)((w>>(24-(br->pos & 7)-n)) & ((1<<n)-1));
+};
+
+// Reads run of white (black=0) or black (black=1) pixels, including makeup
+// codes. Returns length of the run or -1 if code is invalid.
+static int Getrun(t_bitreader *br,int black) {
+  int entry,run,total;
+  ushort *lut;
+  lut=(black?blacklut:whitelut);
+  total=0;
+  do {
+    entry=lut[Peekbits(br,13)];
+    if (entry==0)
+      return -1;                       // Invalid or unsupported code
+    br->pos+=entry & 15;
+    run=entry>>4;
+    total+=run;
+  } while (run>=64);                   // Makeup code is followed by more
+  return total;
+};
+
+// Sets bits x0..x1-1 in the packed row (MSB is the leftmost pixel).
+static void Setbits(uchar *row,int x0,int x1) {
+  int i0,i1;
+  if (x0>=x1) return;
+  i0=x0>>3; i1=(x1-1)>>3;
+  if (i0==i1) {
+    row[i0]|=(uchar)((0xFF>>(x0 & 7)) & (0xFF00>>(((x1-1) & 7)+1)));
+    return; };
+  row[i0]|=(uchar)(0xFF>>(x0 & 7));
+  if (i1>i0+1) memset(row+i0+1,0xFF,i1-i0-1);
+  row[i1]|=(uchar)(0xFF00>>(((x1-1) & 7)+1));
+};
+
+// Decodes strip of nrow rows compressed with CCITT T.6 into packed 1-bit rows
+// where bit set means black. Rows go to dest, dest+stride and so on (stride
+// may be negative) and must be zeroed. ref and cur are work arrays of at least
+// sizex+8 items. Returns 0 on success and -1 on error.
+static int Decodeg4(uchar *src,ulong srcsize,uchar *dest,int stride,
+  int sizex,int nrow,int *ref,int *cur) {
+  int row,a0,a1,a2,b1,b2,ib,ncur,color,entry,mode,run1,run2,*t;
+  t_bitreader br;
+  br.data=src;
+  br.size=srcsize*8;
+  br.pos=0;
+  // Imaginary reference line above the first row is white.
+  ref[0]=ref[1]=ref[2]=sizex;
+  for (row=0; row<nrow; row++,dest+=stride) {
+    a0=-1; color=0; ncur=0; ib=0;
+    while (a0<sizex) {
+      entry=modelut[Peekbits(&br,7)];
+      if (entry==0) {
+        // EOFB at the start of row terminates the image, the rest is white.
+        // Anything else is either corruption or unsupported extension.
+        if (a0<0 && ncur==0) return 0;
+        return -1; };
+      br.pos+=entry & 7;
+      mode=entry>>3;
+      if (br.pos>br.size)
+        return -1;                     // Unexpected end of data
+      // Find b1, first changing element on the reference line to the right
+      // of a0 with colour opposite to a0, and b2 next to it. Changes with
+      // even index switch from white to black.
+      while (ib>0 && ref[ib-1]>a0) ib--;
+      while (ref[ib]<=a0) ib++;
+      if ((ib & 1)!=color) ib++;
+      b1=ref[ib];
+      b2=ref[ib+1];
+      if (ncur>sizex+2)
+        return -1;                     // Too many changes, corrupt data
+      if (mode==MODE_PASS) {
+        if (color) Setbits(dest,max(a0,0),b2);
+        a0=b2; }
+      else if (mode==MODE_HORZ) {
+        run1=Getrun(&br,color);
+        run2=Getrun(&br,color^1);
+        if (run1<0 || run2<0)
+          return -1;
+        a1=min(max(a0,0)+run1,sizex);
+        a2=min(a1+run2,sizex);
+        if (color) Setbits(dest,max(a0,0),a1);
+        else Setbits(dest,a1,a2);
+        cur[ncur++]=a1;
+        cur[ncur++]=a2;
+        a0=a2; }
+      else {
+        a1=b1+mode-MODE_V0;
+        if (a1<0 || a1>sizex)
+          return -1;                   // Change outside the row
+        if (color) Setbits(dest,max(a0,0),a1);
+        cur[ncur++]=a1;
+        a0=a1;
+        color^=1;
+      };
+    };
+    // Terminate list of changes and make it the new reference line.
+    cur[ncur]=cur[ncur+1]=cur[ncur+2]=sizex;
+    t=ref; ref=cur; cur=t;
+  };
+  return 0;
+};
+
+// Reads 16-bit value in the byte order of the TIFF file.
+static ulong Get16(uchar *p,int motorola) {
+  if (motorola) return ((ulong)p[0]<<8)|p[1];
+  return ((ulong)p[1]<<8)|p[0];
+};
+
+// Reads 32-bit value in the byte order of the TIFF file.
+static ulong Get32(uchar *p,int motorola) {
+  if (motorola)
+    return ((ulong)p[0]<<24)|((ulong)p[1]<<16)|((ulong)p[2]<<8)|p[3];
+  return ((ulong)p[3]<<24)|((ulong)p[2]<<16)|((ulong)p[1]<<8)|p[0];
+};
+
+// Reads n bytes at the given offset of the TIFF file. Returns 0 on success
+// and -1 on error.
+static int Readtiffdata(t_pagestream *ps,ulong offset,void *buf,ulong n) {
+  LONG high;
+  ulong l;
+  high=0;
+  if (SetFilePointer(ps->hfile,(LONG)offset,&high,FILE_BEGIN)==
+    INVALID_SET_FILE_POINTER && GetLastError()!=NO_ERROR) return -1;
+  if (ReadFile(ps->hfile,buf,n,&l,NULL)==0 || l!=n) return -1;
+  return 0;
+};
+
+// Returns single value of the IFD entry at p (SHORT or LONG), or 0 if entry
+// is malformed or keeps several values.
+static ulong Gettagvalue(uchar *p,int motorola) {
+  ulong type,count;
+  type=Get16(p+2,motorola);
+  count=Get32(p+4,motorola);
+  if (type==3 && count>=1 && count<=2) return Get16(p+8,motorola);
+  if (type==4 && count==1) return Get32(p+8,motorola);
+  return 0;
+};
+
+// Reads n values of the IFD entry at p (SHORT or LONG) into array. Values
+// that do not fit into the entry are read from the file. Returns 0 on success
+// and -1 on error.
+static int Gettagarray(t_pagestream *ps,uchar *p,ulong *values,int n) {
+  int i;
+  ulong type,count,size;
+  uchar *buf;
+  type=Get16(p+2,ps->motorola);
+  count=Get32(p+4,ps->motorola);
+  if ((type!=3 && type!=4) || count<(ulong)n) return -1;
+  size=(type==3?2:4);
+  if (count*size<=4)
+    buf=p+8;
+  else {
+    buf=(uchar *)GlobalAlloc(GMEM_FIXED,n*size);
+    if (buf==NULL) return -1;
+    if (Readtiffdata(ps,Get32(p+8,ps->motorola),buf,n*size)!=0) {
+      GlobalFree((HGLOBAL)buf); return -1;
+    };
+  };
+  for (i=0; i<n; i++) {
+    if (type==3) values[i]=Get16(buf+i*2,ps->motorola);
+    else values[i]=Get32(buf+i*4,ps->motorola); };
+  if (buf!=p+8) GlobalFree((HGLOBAL)buf);
+  return 0;
+};
+
+// Reads next page of the multi-page TIFF file. Supported are bilevel images,
+// either uncompressed or CCITT G4, and uncompressed 8-bit grayscale. Reduced
+// resolution images (thumbnails) are skipped. Bilevel images are passed to the
+// decoder packed. Strips are read only when needed, so that large files never
+// reside in memory. Returns 1 if page is read, 0 if there are no more pages
+// and -1 on error (ps->error contains the reason).
+int Readtiffpage(t_pagestream *ps,t_scanpage *page) {
+  int i,j,k,n,sizex,sizey,bps,spp,compression,photo,fillorder,subfile;
+  int rowsperstrip,nstrip,rowbytes,tifrowbytes,r0,nrow,*ref,*cur;
+  uchar hdr[8],*dir,*p,*pstrips,*pcounts,*data,*strip,*prow;
+  ulong ifd,nextifd,*offsets,*counts,maxcount;
+  // On the first call, verify header and find the first IFD.
+  if (ps->npage==0 && ps->ifd==0) {
+    if (Readtiffdata(ps,0,hdr,8)!=0 ||
+      (hdr[0]!='I' || hdr[1]!='I') && (hdr[0]!='M' || hdr[1]!='M')
+    ) {
+      sprintf(ps->error,"%s is not a TIFF file",ps->name);
+      return -1; };
+    ps->motorola=(hdr[0]=='M');
+    if (Get16(hdr+2,ps->motorola)!=42) {
+      sprintf(ps->error,"%s is not a TIFF file",ps->name);
+      return -1; };
+    ps->ifd=Get32(hdr+4,ps->motorola);
+    if (ps->ifd==0) {
+      sprintf(ps->error,"%s contains no images",ps->name);
+      return -1;
+    };
+  };
+  // Read next IFD, skipping thumbnails.
+  do {
+    ifd=ps->ifd;
+    if (ifd==0)
+      return 0;                        // No more pages
+    if (Readtiffdata(ps,ifd,hdr,2)!=0) {
+      sprintf(ps->error,"Unable to read %s",ps->name);
+      return -1; };
+    n=Get16(hdr,ps->motorola);
+    dir=(uchar *)GlobalAlloc(GMEM_FIXED,n*12+4);
+    if (dir==NULL) {
+      sprintf(ps->error,"Low memory");
+      return -1; };
+    if (Readtiffdata(ps,ifd+2,dir,n*12+4)!=0) {
+      GlobalFree((HGLOBAL)dir);
+      sprintf(ps->error,"Unable to read %s",ps->name);
+      return -1; };
+    sizex=sizey=0; bps=1; spp=1; compression=COMP_NONE; photo=0;
+    fillorder=1; subfile=0; rowsperstrip=0x7FFFFFFF; pstrips=pcounts=NULL;
+    for (i=0; i<n; i++) {
+      p=dir+i*12;
+      switch (Get16(p,ps->motorola)) {
+        case TAG_SUBFILE: subfile=Gettagvalue(p,ps->motorola); break;
+        case TAG_WIDTH: sizex=Gettagvalue(p,ps->motorola); break;
+        case TAG_HEIGHT: sizey=Gettagvalue(p,ps->motorola); break;
+        case TAG_BPS: bps=Gettagvalue(p,ps->motorola); break;
+        case TAG_SPP: spp=Gettagvalue(p,ps->motorola); break;
+        case TAG_COMPRESS: compression=Gettagvalue(p,ps->motorola); break;
+        case TAG_PHOTO: photo=Gettagvalue(p,ps->motorola); break;
+        case TAG_FILLORDER: fillorder=Gettagvalue(p,ps->motorola); break;
+        case TAG_ROWSSTRIP: rowsperstrip=Gettagvalue(p,ps->motorola); break;
+        case TAG_STRIPOFS: pstrips=p; break;
+        case TAG_STRIPCNT: pcounts=p; break;
+        default: break;
+      };
+    };
+    nextifd=Get32(dir+n*12,ps->motorola);
+    ps->ifd=(nextifd==ifd?0:nextifd); // Primitive protection against loops
+    if (subfile & 1) GlobalFree((HGLOBAL)dir);
+  } while (subfile & 1);
+  ps->npage++;
+  if (rowsperstrip<=0 || rowsperstrip>sizey) rowsperstrip=sizey;
+  if (n==0 || spp!=1 || (bps!=1 && bps!=8) ||
+    (compression!=COMP_NONE && (compression!=COMP_G4 || bps!=1)) ||
+    photo>1 || pstrips==NULL || pcounts==NULL ||
+    sizex<128 || sizex>32768 || sizey<128 || sizey>32768
+  ) {
+    GlobalFree((HGLOBAL)dir);
+    sprintf(ps->error,"Unsupported TIFF type: %s, page %i",
+      ps->name,ps->npage);
+    return -1; };
+  // Get list of strips.
+  nstrip=(sizey+rowsperstrip-1)/rowsperstrip;
+  offsets=(ulong *)GlobalAlloc(GMEM_FIXED,2*nstrip*sizeof(ulong));
+  if (offsets==NULL) {
+    GlobalFree((HGLOBAL)dir);
+    sprintf(ps->error,"Low memory");
+    return -1; };
+  counts=offsets+nstrip;
+  if (Gettagarray(ps,pstrips,offsets,nstrip)!=0 ||
+    Gettagarray(ps,pcounts,counts,nstrip)!=0
+  ) {
+    GlobalFree((HGLOBAL)dir);
+    GlobalFree((HGLOBAL)offsets);
+    sprintf(ps->error,"Unable to read %s, page %i",ps->name,ps->npage);
+    return -1; };
+  GlobalFree((HGLOBAL)dir);
+  for (i=0,maxcount=1; i<nstrip; i++) maxcount=max(maxcount,counts[i]);
+  // Allocate bitmap. Bilevel rows are DWORD-aligned, like in 1-bit DIBs, and
+  // 4 spare bytes allow decoder to read words crossing the end of bitmap.
+  if (bps==1)
+    rowbytes=((sizex+31)/32)*4;
+  else
+    rowbytes=sizex;
+  tifrowbytes=(sizex*bps+7)/8;
+  data=(uchar *)GlobalAlloc(GPTR,rowbytes*sizey+4);
+  strip=(uchar *)GlobalAlloc(GMEM_FIXED,maxcount);
+  ref=(int *)GlobalAlloc(GMEM_FIXED,(sizex+8)*sizeof(int));
+  cur=(int *)GlobalAlloc(GMEM_FIXED,(sizex+8)*sizeof(int));
+  if (data==NULL || strip==NULL || ref==NULL || cur==NULL) {
+    if (data!=NULL) GlobalFree((HGLOBAL)data);
+    if (strip!=NULL) GlobalFree((HGLOBAL)strip);
+    if (ref!=NULL) GlobalFree((HGLOBAL)ref);
+    if (cur!=NULL) GlobalFree((HGLOBAL)cur);
+    GlobalFree((HGLOBAL)offsets);
+    sprintf(ps->error,"Low memory");
+    return -1; };
+  if (faxready==0)
+    Initfaxtables();
+  // Read and decode strips. TIFF rows go from top to bottom, whereas bitmaps
+  // in memory are placed upside down.
+  for (i=0,r0=0; r0<sizey; i++,r0+=rowsperstrip) {
+    nrow=min(rowsperstrip,sizey-r0);
+    if (counts[i]==0 || Readtiffdata(ps,offsets[i],strip,counts[i])!=0)
+      break;
+    if (fillorder==2) {
+      for (k=0; k<(int)counts[i]; k++) strip[k]=reversed[strip[k]]; };
+    prow=data+(sizey-r0-1)*rowbytes;
+    if (compression==COMP_G4) {
+      if (Decodeg4(strip,counts[i],prow,-rowbytes,sizex,nrow,ref,cur)!=0)
+        break;
+      ; }
+    else {
+      if (counts[i]<(ulong)(nrow*tifrowbytes)) break;
+      for (j=0; j<nrow; j++,prow-=rowbytes)
+        memcpy(prow,strip+j*tifrowbytes,tifrowbytes);
+      ;
+    };
+  };
+  GlobalFree((HGLOBAL)offsets);
+  GlobalFree((HGLOBAL)strip);
+  GlobalFree((HGLOBAL)ref);
+  GlobalFree((HGLOBAL)cur);
+  if (r0<sizey) {
+    sprintf(ps->error,"Unable to decode %s, page %i",ps->name,ps->npage);
+    GlobalFree((HGLOBAL)data); return -1; };
+  // Decoder expects set bits (or low intensity) to be black. Padding bits at
+  // the end of bilevel rows must be zero.
+  for (j=0,prow=data; j<sizey; j++,prow+=rowbytes) {
+    if ((bps==1 && photo==1) || (bps==8 && photo==0)) {
+      for (k=0; k<tifrowbytes; k++) prow[k]^=0xFF; };
+    if (bps==1 && (sizex & 7)!=0)
+      prow[sizex>>3]&=(uchar)(0xFF00>>(sizex & 7));
+    ;
+  };
+  page->data=data;
+  page->sizex=sizex;
+  page->sizey=sizey;
+  page->bpp=bps;
+  page->index=ps->npage;
+  return 1;
+};
+
+// Adds code of given length (at most 24 bits) to the bit stream.
+static void Putbits(t_bitwriter *bw,ulong code,int length) {
+  bw->acc=(bw->acc<<length)|code;
+  bw->nbits+=length;
+  while (bw->nbits>=8) {
+    bw->nbits-=8;
+    bw->data[bw->n++]=(uchar)(bw->acc>>bw->nbits); };
+  ;
+};
+
+// Writes run of white (black=0) or black (black=1) pixels, preceded by the
+// makeup codes if necessary.
+static void Putrun(t_bitwriter *bw,int black,int run) {
+  t_faxcode *codes,*c;
+  codes=(black?blackcode:whitecode);
+  while (run>=2560) {
+    c=codes+63+2560/64;
+    Putbits(bw,c->code,c->length);
+    run-=2560; };
+  if (run>=64) {
+    c=codes+63+run/64;
+    Putbits(bw,c->code,c->length);
+    run%=64; };
+  Putbits(bw,codes[run].code,codes[run].length);
+};
+
+// Finds changing elements of the packed 1-bit row, in the format used by
+// Decodeg4(): positions where colour changes, white to black first, followed
+// by three terminators sizex. Returns number of changes.
+static int Findchanges(uchar *row,int sizex,int *list) {
+  int x,n,b,color;
+  n=0; color=0;
+  for (x=0; x<sizex; ) {
+    // Set bits in b mark pixels of opposite colour at or after x.
+    b=(row[x>>3]^(color?0xFF:0x00)) & (0xFF>>(x & 7));
+    if (b==0) {
+      x=(x|7)+1; continue; };
+    x=(x & ~7)+leading[b];
+    if (x>=sizex) break;
+    list[n++]=x;
+    color^=1;
+  };
+  list[n]=list[n+1]=list[n+2]=sizex;
+  return n;
+};
+
+// Encodes single row with CCITT T.6, given the changing elements of this row
+// (cur) and of the row above (ref). This is the exact mirror of Decodeg4().
+static void Encodeg4row(t_bitwriter *bw,int *ref,int *cur,int sizex) {
+  int a0,a1,a2,b1,b2,ia,ib,color;
+  t_faxcode *c;
+  a0=-1; color=0; ia=0; ib=0;
+  while (a0<sizex) {
+    while (cur[ia]<=a0) ia++;
+    a1=cur[ia];
+    a2=cur[ia+1];
+    while (ib>0 && ref[ib-1]>a0) ib--;
+    while (ref[ib]<=a0) ib++;
+    if ((ib & 1)!=color) ib++;
+    b1=ref[ib];
+    b2=ref[ib+1];
+    if (b2<a1) {
+      c=modecode+MODE_PASS;
+      Putbits(bw,c->code,c->length);
+      a0=b2; }
+    else if (a1-b1>=-3 && a1-b1<=3) {
+      c=modecode+MODE_V0+(a1-b1);
+      Putbits(bw,c->code,c->length);
+      a0=a1;
+      color^=1; }
+    else {
+      c=modecode+MODE_HORZ;
+      Putbits(bw,c->code,c->length);
+      Putrun(bw,color,a1-max(a0,0));
+      Putrun(bw,color^1,a2-a1);
+      a0=a2;
+    };
+  };
+};
+
+// Writes 16-bit value in Intel byte order.
+static void Put16(uchar *p,ulong u) {
+  p[0]=(uchar)u; p[1]=(uchar)(u>>8);
+};
+
+// Writes 32-bit value in Intel byte order.
+static void Put32(uchar *p,ulong u) {
+  p[0]=(uchar)u; p[1]=(uchar)(u>>8); p[2]=(uchar)(u>>16); p[3]=(uchar)(u>>24);
+};
+
+// Fills IFD entry. SHORT entries keep up to two values, low word first.
+static void Puttag(uchar *p,int tag,int type,ulong count,ulong value) {
+  Put16(p,tag);
+  Put16(p+2,type);
+  Put32(p+4,count);
+  if (type==3) {
+    Put16(p+8,value & 0xFFFF); Put16(p+10,value>>16); }
+  else
+    Put32(p+8,value);
+  ;
+};
+
+// Creates new multi-page TIFF file and writes its header. On success, returns
+// handle of the file and sets link to the offset of the pointer to the first
+// IFD. On error, returns INVALID_HANDLE_VALUE.
+HANDLE Createtifffile(char *path,ulong *link) {
+  uchar hdr[8];
+  ulong u;
+  HANDLE hfile;
+  hfile=CreateFile(path,GENERIC_READ|GENERIC_WRITE,0,NULL,
+    CREATE_ALWAYS,FILE_ATTRIBUTE_NORMAL,NULL);
+  if (hfile==INVALID_HANDLE_VALUE)
+    return INVALID_HANDLE_VALUE;
+  hdr[0]=hdr[1]='I';
+  Put16(hdr+2,42);
+  Put32(hdr+4,0);                      // No pages yet
+  if (WriteFile(hfile,hdr,8,&u,NULL)==0 || u!=8) {
+    CloseHandle(hfile);
+    return INVALID_HANDLE_VALUE; };
+  *link=4;
+  return hfile;
+};
+
+// Appends page (0-based index page of npages) to the TIFF file created by
+// Createtifffile(). Bitmap is packed 1-bit, bottom-up, with set bits black.
+// It is compressed with CCITT G4 row by row and written as a single strip, so
+// that compressed page never resides in memory. IFD follows the strip, and
+// link is updated to point to its next IFD field. Returns 0 on success and -1
+// on error.
+int Writetiffpage(HANDLE hfile,ulong *link,uchar *bits,int stride,
+  int sizex,int sizey,int ppix,int ppiy,int page,int npages) {
+  int r,n,*ref,*cur,*t;
+  uchar ifd[1+2+15*12+4+16],*p;
+  ulong u,stripofs,stripsize,ifdofs;
+  t_bitwriter bw;
+  // Allocate buffers. Single row never takes more than 7 bytes per pixel.
+  bw.data=(uchar *)GlobalAlloc(GMEM_FIXED,TIFFWRITEBUF+8*sizex+64);
+  ref=(int *)GlobalAlloc(GMEM_FIXED,(sizex+8)*sizeof(int));
+  cur=(int *)GlobalAlloc(GMEM_FIXED,(sizex+8)*sizeof(int));
+  if (bw.data==NULL || ref==NULL || cur==NULL) {
+    if (bw.data!=NULL) GlobalFree((HGLOBAL)bw.data);
+    if (ref!=NULL) GlobalFree((HGLOBAL)ref);
+    if (cur!=NULL) GlobalFree((HGLOBAL)cur);
+    return -1; };
+  bw.n=0; bw.acc=0; bw.nbits=0;
+  if (faxready==0)
+    Initfaxtables();
+  // Strip starts at the end of file.
+  stripofs=SetFilePointer(hfile,0,NULL,FILE_END);
+  stripsize=0;
+  // Imaginary reference line above the first row is white. TIFF rows go from
+  // top to bottom.
+  ref[0]=ref[1]=ref[2]=sizex;
+  for (r=0; r<sizey; r++) {
+    Findchanges(bits+(sizey-r-1)*stride,sizex,cur);
+    Encodeg4row(&bw,ref,cur,sizex);
+    t=ref; ref=cur; cur=t;
+    if (bw.n>=TIFFWRITEBUF || r==sizey-1) {
+      if (r==sizey-1) {
+        // Terminate image with EOFB and pad to the full byte.
+        Putbits(&bw,0x001,12);
+        Putbits(&bw,0x001,12);
+        if (bw.nbits>0) Putbits(&bw,0,8-bw.nbits); };
+      if (WriteFile(hfile,bw.data,bw.n,&u,NULL)==0 || u!=bw.n)
+        break;
+      stripsize+=bw.n;
+      bw.n=0;
+    };
+  };
+  GlobalFree((HGLOBAL)bw.data);
+  GlobalFree((HGLOBAL)ref);
+  GlobalFree((HGLOBAL)cur);
+  if (r<sizey)
+    return -1;
+  // Prepare IFD, followed by resolutions, and write it after the strip. IFD
+  // must begin on the word boundary.
+  ifdofs=stripofs+stripsize;
+  p=ifd;
+  if (ifdofs & 1) {
+    *p++=0; ifdofs++; };
+  Put16(p,15); p+=2;
+  Puttag(p,TAG_SUBFILE,4,1,2); p+=12;  // Single page of multi-page image
+  Puttag(p,TAG_WIDTH,4,1,sizex); p+=12;
+  Puttag(p,TAG_HEIGHT,4,1,sizey); p+=12;
+  Puttag(p,TAG_BPS,3,1,1); p+=12;
+  Puttag(p,TAG_COMPRESS,3,1,COMP_G4); p+=12;
+  Puttag(p,TAG_PHOTO,3,1,0); p+=12;    // WhiteIsZero
+  Puttag(p,TAG_STRIPOFS,4,1,stripofs); p+=12;
+  Puttag(p,TAG_SPP,3,1,1); p+=12;
+  Puttag(p,TAG_ROWSSTRIP,4,1,sizey); p+=12;
+  Puttag(p,TAG_STRIPCNT,4,1,stripsize); p+=12;
+  Puttag(p,TAG_XRES,5,1,ifdofs+2+15*12+4); p+=12;
+  Puttag(p,TAG_YRES,5,1,ifdofs+2+15*12+4+8); p+=12;
+  Puttag(p,TAG_T6OPT,4,1,0); p+=12;
+  Puttag(p,TAG_RESUNIT,3,1,2); p+=12;  // Inches
+  Puttag(p,TAG_PAGENUM,3,2,(page & 0xFFFF)|((ulong)npages<<16)); p+=12;
+  Put32(p,0); p+=4;                    // Last page so far
+  Put32(p,ppix); Put32(p+4,1); p+=8;
+  Put32(p,ppiy); Put32(p+4,1); p+=8;
+  n=p-ifd;
+  if (WriteFile(hfile,ifd,n,&u,NULL)==0 || u!=(ulong)n)
+    return -1;
+  // Link new IFD to the previous one.
+  Put32(ifd,ifdofs);
+  if (SetFilePointer(hfile,*link,NULL,FILE_BEGIN)!=*link ||
+    WriteFile(hfile,ifd,4,&u,NULL)==0 || u!=4)
+    return -1;
+  *link=ifdofs+2+15*12;
+  return 0;
+};
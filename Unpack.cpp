@@ -0,0 +1,505 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+// MRPODS -- Machine-Readable Printed Optical Data Sheets                     //
+// https://github.com/sheafdynamics/mrpods                                    //
+//                                                                            //
+// Copyright (c) 2024 Ray Doll                                                //
+// Copyright (c) 2007 Oleh Yuschuk                                            //
+//                                                                            //
+// This file is part of MRPODS, which is built off                            //
+// Oleh Yuschuk's PaperBack https://ollydbg.de/Paperbak/                      //
+// MRPODS is cumulative work of passionate programmers,                       //
+// both named and unnamed, including freelancers and private contractors.     //
+// Without them, this would not be possible.                                  //
+// This software contains Oleh Yuschuk's original comments and                //
+// comments from other maintainers.                                           //
+//                                                                            //
+// MRPODS is free software; you can redistribute it and/or modify it under    //
+// the terms of the GNU General Public License as published by the Free       //
+// Software Foundation; either version 3 of the License, or (at your option)  //
+// any later version.                                                         //
+//                                                                            //
+// MRPODS is distributed in the hope that it will be useful, but WITHOUT      //
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or      //
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for   //
+// more details.                                                              //
+//                                                                            //
+// You should have received a copy of the GNU General Public License along    //
+// with this program. If not, see <http://www.gnu.org/licenses/>.             //
+//                                                                            //
+//                              bzip2 license                                 //
+// -------------------------------------------------------------------------- //
+// "bzip2", the associated library "libbzip2" copyright(C) 1996 - 2010        //
+// Julian R Seward. All rights reserved.                                      //
+// Julian Seward, jseward@acm.org                                             //
+// bzip2 / libbzip2 version 1.0.6 of 6 September 2010                         //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include <windows.h>
+#include <commctrl.h>
+#include <stdio.h>
+#include <direct.h>
+#include <math.h>
+#include "twain.h"
+#pragma hdrstop
+
+#include "mrpods.h"
+#include "resource.h"
+
+// Bzip2 stream consists of the header "BZh" followed by the block size digit,
+// blocks of compressed data and the end-of-stream marker. Each block starts
+// with the 48-bit magic 0x314159265359 and the 32-bit CRC of its data and
+// does not depend on other blocks. Blocks are not aligned on byte boundary,
+// so I search for magic at all bit positions. To unpack block alone, I copy
+// it to a separate single-block stream, where combined CRC equals to the CRC
+// of the block. Magic may also occur by chance inside compressed data; this
+// is detected by checking the combined CRC of the original stream.
+
+#define BZBLOCKHI      0x314159        // Block magic, bits 47..24
+#define BZBLOCKLO      0x265359        // Block magic, bits 23..0
+#define BZENDHI        0x177245        // End-of-stream magic, bits 47..24
+#define BZENDLO        0x385090        // End-of-stream magic, bits 23..0
+
+typedef struct t_unpackjob {           // Single block of bzip2 stream
+  ulong          bitstart;             // Position of block magic, bits
+  ulong          bitend;               // End of block, bits
+  ulong          crc;                  // CRC of unpacked block
+  uchar          *out;                 // Unpacked data or NULL
+  ulong          outsize;              // Size of unpacked data
+  int            done;                 // 0: pending, 1: unpacked, -1: error
+} t_unpackjob;
+
+static uchar     *packed;              // Compressed data
+static ulong     packedsize;           // Size of compressed data, bytes
+static int       blocklevel;           // Block size digit, '1'..'9'
+static t_unpackjob *job;               // Blocks in the order of data
+static int       njob;                 // Number of blocks
+static int       nextjob;              // Next block to be unpacked
+static CRITICAL_SECTION unpackcs;      // Protects job states
+static HANDLE    hunpackslot;          // Semaphore, limits unpacked blocks
+static HANDLE    hunpackdone;          // Event, some block is unpacked
+static int       stopunpack;           // Request to stop unpacking threads
+
+// Starts asynchronous write of size bytes to the restored file at given
+// offset. Returns 0 on success and -1 on error.
+static int Startwrite(HANDLE hfile,OVERLAPPED *ov,uchar *data,ulong size,
+  ulong offset) {
+  ov->Offset=offset;
+  ov->OffsetHigh=0;
+  if (WriteFile(hfile,data,size,NULL,ov)==0 &&
+    GetLastError()!=ERROR_IO_PENDING)
+    return -1;
+  return 0;
+};
+
+// Waits until asynchronous write started by Startwrite() is finished. Returns
+// 0 if all size bytes are written and -1 on error.
+static int Finishwrite(HANDLE hfile,OVERLAPPED *ov,ulong size) {
+  ulong l;
+  if (GetOverlappedResult(hfile,ov,&l,TRUE)==0 || l!=size)
+    return -1;
+  return 0;
+};
+
+// Unpacks bzip2 stream on the calling thread in pieces of fixed size. One
+// piece is unpacked while another is written asynchronously. Returns 1 on
+// success, 0 on I/O error and -1 if data is corrupt.
+static int Unpackserial(HANDLE hfile,OVERLAPPED *ov) {
+  int success,result,cur;
+  ulong offset,size,pending;
+  uchar *buf;
+  bz_stream bz;
+  buf=(uchar *)GlobalAlloc(GMEM_FIXED,2*UNPACKBUF);
+  if (buf==NULL)
+    return -1;
+  memset(&bz,0,sizeof(bz));
+  if (BZ2_bzDecompressInit(&bz,0,0)!=BZ_OK) {
+    GlobalFree((HGLOBAL)buf);
+    return -1; };
+  bz.next_in=(char *)packed;
+  bz.avail_in=packedsize;
+  success=1;
+  offset=0;
+  pending=0;
+  cur=0;
+  do {
+    // Unpack next piece of data into the free buffer.
+    bz.next_out=(char *)buf+cur*UNPACKBUF;
+    bz.avail_out=UNPACKBUF;
+    result=BZ2_bzDecompress(&bz);
+    size=UNPACKBUF-bz.avail_out;
+    if (result!=BZ_OK && result!=BZ_STREAM_END)
+      success=-1;                      // Corrupt data
+    else if (result==BZ_OK && size==0)
+      success=-1;                      // Truncated data
+    // Wait until previous piece is written and start writing this one.
+    if (pending>0 && Finishwrite(hfile,ov,pending)!=0 && success>0)
+      success=0;
+    pending=0;
+    if (success>0 && size>0) {
+      if (Startwrite(hfile,ov,buf+cur*UNPACKBUF,size,offset)!=0)
+        success=0;
+      else {
+        pending=size;
+        offset+=size;
+        cur^=1;
+      };
+    };
+    Message("Unpacking data",
+      (int)(((uchar *)bz.next_in-packed)*100.0/packedsize));
+  } while (success>0 && result!=BZ_STREAM_END);
+  if (pending>0 && Finishwrite(hfile,ov,pending)!=0 && success>0)
+    success=0;
+  BZ2_bzDecompressEnd(&bz);
+  GlobalFree((HGLOBAL)buf);
+  return success;
+};
+
+// Returns n bits (n<=24) of compressed data starting at given bit position.
+// Bits beyond the end of data are zeros.
+static ulong Getbits(ulong pos,int n) {
+  int k;
+  ulong i,u;
+  i=pos/8;
+  for (u=0,k=0; k<4; k++)
+    u=(u<<8)|(i+k<packedsize?packed[i+k]:0);
+  return (u>>(32-(pos & 7)-n)) & ((1<<n)-1);
+};
+
+// Returns 32-bit value at given bit position of compressed data.
+static ulong Getlong(ulong pos) {
+  return ((Getbits(pos,16)<<16)|Getbits(pos+16,16)) & 0xFFFFFFFF;
+};
+
+// Adds block to the list of jobs, growing list if necessary. Returns 0 on
+// success and -1 on error.
+static int Addjob(ulong bitstart,ulong bitend,int *njobmax) {
+  t_unpackjob *pj;
+  if (njob>=*njobmax) {
+    pj=(t_unpackjob *)GlobalAlloc(GMEM_FIXED,
+      2*(*njobmax)*sizeof(t_unpackjob));
+    if (pj==NULL)
+      return -1;
+    memcpy(pj,job,njob*sizeof(t_unpackjob));
+    GlobalFree((HGLOBAL)job);
+    job=pj;
+    *njobmax*=2; };
+  pj=job+njob;
+  memset(pj,0,sizeof(t_unpackjob));
+  pj->bitstart=bitstart;
+  pj->bitend=bitend;
+  pj->crc=Getlong(bitstart+48);
+  njob++;
+  return 0;
+};
+
+// Splits first bzip2 stream in compressed data into blocks and verifies the
+// combined CRC of the stream, so that false block magic inside the data is
+// detected. Returns 0 on success and -1 if data can't be split.
+static int Splitstream(void) {
+  int k,s,njobmax,isblock;
+  ulong i,pos,start,crc,hi,lo;
+  uchar pairs[8192];
+  njob=0;
+  if (packedsize<14 || packed[0]!='B' || packed[1]!='Z' || packed[2]!='h' ||
+    packed[3]<'1' || packed[3]>'9')
+    return -1;
+  blocklevel=packed[3];
+  if (packedsize>=0x1FFFFFFF)
+    return -1;                         // Bit positions would overflow
+  njobmax=256;
+  job=(t_unpackjob *)GlobalAlloc(GMEM_FIXED,njobmax*sizeof(t_unpackjob));
+  if (job==NULL)
+    return -1;
+  // Magic that starts s bits before the byte boundary always contains two
+  // whole bytes taken from bits s..s+15 of the magic. I mark such pairs in
+  // the bitmap and compare all 48 bits only where bitmap says so.
+  memset(pairs,0,sizeof(pairs));
+  for (s=0; s<8; s++) {
+    k=(BZBLOCKHI>>(8-s)) & 0xFFFF;
+    pairs[k>>3]|=(uchar)(1<<(k & 7));
+    k=(BZENDHI>>(8-s)) & 0xFFFF;
+    pairs[k>>3]|=(uchar)(1<<(k & 7)); };
+  // Block ends where the next magic starts.
+  start=0;                             // 0: no block yet
+  crc=0;
+  for (i=4; i+1<packedsize; i++) {
+    k=(packed[i]<<8)|packed[i+1];
+    if ((pairs[k>>3] & (1<<(k & 7)))==0) continue;
+    for (s=7; s>=0; s--) {
+      pos=i*8-s;
+      if (pos<32) continue;            // Magic can't precede first block
+      hi=Getbits(pos,24);
+      lo=Getbits(pos+24,24);
+      if (hi==BZBLOCKHI && lo==BZBLOCKLO) isblock=1;
+      else if (hi==BZENDHI && lo==BZENDLO) isblock=0;
+      else continue;
+      if (start==0 && pos!=32)
+        return -1;                     // First block must follow header
+      if (start!=0 && pos<start+80)
+        continue;                      // Inside block header
+      if (start!=0) {
+        if (Addjob(start,pos,&njobmax)!=0)
+          return -1;
+        crc=((crc<<1)|(crc>>31)) & 0xFFFFFFFF;
+        crc^=job[njob-1].crc; };
+      if (isblock) {
+        start=pos;
+        continue; };
+      // End of stream, check combined CRC. Data that may follow is ignored.
+      if (pos+80>packedsize*8 || Getlong(pos+48)!=crc)
+        return -1;
+      return 0;
+    };
+  };
+  return -1;                           // Truncated stream
+};
+
+// Copies block to separate single-block stream and unpacks it. Returns 0 on
+// success and -1 on error.
+static int Unpackblock(t_unpackjob *pj) {
+  int shift,result;
+  ulong i,j,bit,nbits,nbytes,size,pos,outmax;
+  uchar *buf,*src,*out,*pu;
+  bz_stream bz;
+  // Build stream: header, block and end-of-stream marker with CRC.
+  nbits=pj->bitend-pj->bitstart;
+  size=4+(nbits+80+7)/8;
+  buf=(uchar *)GlobalAlloc(GPTR,size);
+  if (buf==NULL)
+    return -1;
+  buf[0]='B'; buf[1]='Z'; buf[2]='h'; buf[3]=(uchar)blocklevel;
+  src=packed+pj->bitstart/8;
+  shift=pj->bitstart & 7;
+  nbytes=(nbits+7)/8;
+  for (j=0; j<nbytes; j++) {
+    i=pj->bitstart/8+j;
+    buf[4+j]=(uchar)((src[j]<<shift)|
+      (shift!=0 && i+1<packedsize?src[j+1]>>(8-shift):0)); };
+  if (nbits & 7)
+    buf[4+nbytes-1]&=(uchar)(0xFF00>>(nbits & 7));
+  pos=32+nbits;
+  for (j=0; j<80; j++,pos++) {
+    if (j<24)
+      bit=(BZENDHI>>(23-j)) & 1;
+    else if (j<48)
+      bit=(BZENDLO>>(47-j)) & 1;
+    else
+      bit=(pj->crc>>(79-j)) & 1;
+    if (bit)
+      buf[pos/8]|=(uchar)(0x80>>(pos & 7));
+    ;
+  };
+  // Unpack stream. Runs of repeating bytes may expand block well beyond its
+  // nominal size, in this case I enlarge the output buffer.
+  outmax=(blocklevel-'0')*100000;
+  out=(uchar *)GlobalAlloc(GMEM_FIXED,outmax);
+  memset(&bz,0,sizeof(bz));
+  if (out==NULL || BZ2_bzDecompressInit(&bz,0,0)!=BZ_OK) {
+    if (out!=NULL) GlobalFree((HGLOBAL)out);
+    GlobalFree((HGLOBAL)buf);
+    return -1; };
+  bz.next_in=(char *)buf;
+  bz.avail_in=size;
+  bz.next_out=(char *)out;
+  bz.avail_out=outmax;
+  while (1) {
+    result=BZ2_bzDecompress(&bz);
+    if (result==BZ_STREAM_END)
+      break;
+    if (result!=BZ_OK || bz.avail_out!=0) {
+      GlobalFree((HGLOBAL)out);
+      out=NULL;
+      break; };
+    pu=(uchar *)GlobalAlloc(GMEM_FIXED,2*outmax);
+    if (pu==NULL) {
+      GlobalFree((HGLOBAL)out);
+      out=NULL;
+      break; };
+    memcpy(pu,out,outmax);
+    GlobalFree((HGLOBAL)out);
+    out=pu;
+    bz.next_out=(char *)out+outmax;
+    bz.avail_out=outmax;
+    outmax*=2;
+  };
+  pj->outsize=outmax-bz.avail_out;
+  BZ2_bzDecompressEnd(&bz);
+  GlobalFree((HGLOBAL)buf);
+  pj->out=out;
+  return (out==NULL?-1:0);
+};
+
+// Unpacking thread. Takes blocks in the order of data as long as there are
+// free slots and unpacks them. Main thread writes unpacked blocks and frees
+// slots.
+static DWORD WINAPI Unpackthread(LPVOID param) {
+  int j,result;
+  while (1) {
+    WaitForSingleObject(hunpackslot,INFINITE);
+    EnterCriticalSection(&unpackcs);
+    j=nextjob;
+    if (stopunpack==0 && j<njob) nextjob++;
+    else j=njob;
+    LeaveCriticalSection(&unpackcs);
+    if (j>=njob) {
+      ReleaseSemaphore(hunpackslot,1,NULL);      // Wake up other threads
+      break; };
+    result=Unpackblock(job+j);
+    EnterCriticalSection(&unpackcs);
+    job[j].done=(result==0?1:-1);
+    LeaveCriticalSection(&unpackcs);
+    SetEvent(hunpackdone);
+  };
+  return 0;
+};
+
+// Unpacks blocks of bzip2 stream in parallel on nthread threads and writes
+// them to the file in the order of data. At most two blocks per thread are
+// kept in memory. Returns 1 on success, 0 on I/O error and -1 if data is
+// corrupt.
+static int Unpackparallel(HANDLE hfile,OVERLAPPED *ov,int nthread) {
+  int i,n,w,done,pending,success;
+  ulong offset;
+  DWORD threadid;
+  HANDLE hthread[NUNPACK];
+  InitializeCriticalSection(&unpackcs);
+  hunpackslot=CreateSemaphore(NULL,2*nthread,2*nthread,NULL);
+  hunpackdone=CreateEvent(NULL,FALSE,FALSE,NULL);
+  nextjob=0;
+  stopunpack=0;
+  n=0;
+  if (hunpackslot!=NULL && hunpackdone!=NULL) {
+    for (n=0; n<nthread; n++) {
+      hthread[n]=CreateThread(NULL,0,Unpackthread,NULL,0,&threadid);
+      if (hthread[n]==NULL) break;
+    };
+  };
+  success=1;
+  offset=0;
+  pending=-1;                          // Block being written
+  for (w=0; n>0 && w<njob && success>0; w++) {
+    // Wait until next block in order is unpacked.
+    while (1) {
+      EnterCriticalSection(&unpackcs);
+      done=job[w].done;
+      LeaveCriticalSection(&unpackcs);
+      if (done!=0) break;
+      WaitForSingleObject(hunpackdone,INFINITE); };
+    if (done<0) {
+      success=-1;
+      break; };
+    // Wait until previous block is written and free its slot.
+    if (pending>=0) {
+      if (Finishwrite(hfile,ov,job[pending].outsize)!=0)
+        success=0;
+      GlobalFree((HGLOBAL)job[pending].out);
+      job[pending].out=NULL;
+      ReleaseSemaphore(hunpackslot,1,NULL);
+      pending=-1; };
+    if (success<=0)
+      break;
+    if (Startwrite(hfile,ov,job[w].out,job[w].outsize,offset)!=0)
+      success=0;
+    else {
+      pending=w;
+      offset+=job[w].outsize; };
+    Message("Unpacking data",(w+1)*100/njob);
+  };
+  if (pending>=0 && Finishwrite(hfile,ov,job[pending].outsize)!=0 &&
+    success>0)
+    success=0;
+  // Stop threads and discard blocks that are not written.
+  EnterCriticalSection(&unpackcs);
+  stopunpack=1;
+  LeaveCriticalSection(&unpackcs);
+  if (hunpackslot!=NULL)
+    ReleaseSemaphore(hunpackslot,1,NULL);
+  for (i=0; i<n; i++) {
+    WaitForSingleObject(hthread[i],INFINITE);
+    CloseHandle(hthread[i]); };
+  for (i=0; i<njob; i++) {
+    if (job[i].out!=NULL) GlobalFree((HGLOBAL)job[i].out); };
+  if (hunpackslot!=NULL) CloseHandle(hunpackslot);
+  if (hunpackdone!=NULL) CloseHandle(hunpackdone);
+  hunpackslot=hunpackdone=NULL;
+  DeleteCriticalSection(&unpackcs);
+  if (n==0)                            // Unable to start threads
+    return Unpackserial(hfile,ov);
+  return success;
+};
+
+// Writes restored data to the file opened for overlapped I/O. If data is
+// compressed, unpacks it on the fly, using all processors if stream has more
+// than one block. Returns 0 on success and -1 on error.
+int Writerestored(HANDLE hfile,uchar *data,ulong datasize,ulong origsize,
+  int compressed) {
+  int n,success;
+  OVERLAPPED ov;
+  SYSTEM_INFO si;
+  memset(&ov,0,sizeof(ov));
+  ov.hEvent=CreateEvent(NULL,TRUE,FALSE,NULL);
+  if (ov.hEvent==NULL) {
+    Reporterror("Low memory");
+    return -1; };
+  if (compressed==0) {
+    // Data is not compressed and is already in memory.
+    success=1;
+    if (Startwrite(hfile,&ov,data,origsize,0)!=0 ||
+      Finishwrite(hfile,&ov,origsize)!=0)
+      success=0;
+    ; }
+  else {
+    packed=data;
+    packedsize=datasize;
+    job=NULL;
+    njob=0;
+    GetSystemInfo(&si);
+    n=max(1,min((int)si.dwNumberOfProcessors,NUNPACK));
+    if (n>1 && Splitstream()==0 && njob>1)
+      success=Unpackparallel(hfile,&ov,min(n,njob));
+    else
+      success=Unpackserial(hfile,&ov);
+    if (job!=NULL) GlobalFree((HGLOBAL)job);
+    job=NULL;
+    njob=0;
+  };
+  CloseHandle(ov.hEvent);
+  if (success<0) {
+    Message("",0);
+    Reporterror("Unable to unpack data");
+    return -1; };
+  if (success==0) {
+    Reporterror("I/O error");
+    return -1; };
+  return 0;
+};
+
+// Unpacks single block of bzip2 stream that occupies bits bitstart..bitend-1
+// of data, as listed in the frame index. Other parts of data need not be
+// valid. Returns unpacked block that caller must free and sets size to its
+// length, or returns NULL on error.
+uchar *Unpackframe(uchar *data,ulong datasize,ulong bitstart,ulong bitend,
+  ulong *size) {
+  t_unpackjob pj;
+  if (datasize<14 || data[0]!='B' || data[1]!='Z' || data[2]!='h' ||
+    data[3]<'1' || data[3]>'9' || datasize>=0x1FFFFFFF)
+    return NULL;
+  packed=data;
+  packedsize=datasize;
+  blocklevel=data[3];
+  if (bitstart<32 || bitend<bitstart+80 || bitend>datasize*8 ||
+    Getbits(bitstart,24)!=BZBLOCKHI || Getbits(bitstart+24,24)!=BZBLOCKLO)
+    return NULL;
+  memset(&pj,0,sizeof(pj));
+  pj.bitstart=bitstart;
+  pj.bitend=bitend;
+  pj.crc=Getlong(bitstart+48);
+  if (Unpackblock(&pj)!=0)
+    return NULL;
+  *size=pj.outsize;
+  return pj.out;
+};
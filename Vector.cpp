@@ -0,0 +1,433 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+// MRPODS -- Machine-Readable Printed Optical Data Sheets                     //
+// https://github.com/sheafdynamics/mrpods                                    //
+//                                                                            //
+// Copyright (c) 2024 Ray Doll                                                //
+// Copyright (c) 2007 Oleh Yuschuk                                            //
+//                                                                            //
+// This file is part of MRPODS, which is built off                            //
+// Oleh Yuschuk's PaperBack https://ollydbg.de/Paperbak/                      //
+// MRPODS is cumulative work of passionate programmers,                       //
+// both named and unnamed, including freelancers and private contractors.     //
+// Without them, this would not be possible.                                  //
+// This software contains Oleh Yuschuk's original comments and                //
+// comments from other maintainers.                                           //
+//                                                                            //
+// MRPODS is free software; you can redistribute it and/or modify it under    //
+// the terms of the GNU General Public License as published by the Free       //
+// Software Foundation; either version 3 of the License, or (at your option)  //
+// any later version.                                                         //
+//                                                                            //
+// MRPODS is distributed in the hope that it will be useful, but WITHOUT      //
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or      //
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for   //
+// more details.                                                              //
+//                                                                            //
+// You should have received a copy of the GNU General Public License along    //
+// with this program. If not, see <http://www.gnu.org/licenses/>.             //
+//                                                                            //
+//                              bzip2 license                                 //
+// -------------------------------------------------------------------------- //
+// "bzip2", the associated library "libbzip2" copyright(C) 1996 - 2010        //
+// Julian R Seward. All rights reserved.                                      //
+// Julian Seward, jseward@acm.org                                             //
+// bzip2 / libbzip2 version 1.0.6 of 6 September 2010                         //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include <windows.h>
+#include <commctrl.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <direct.h>
+#include <math.h>
+#include "twain.h"
+#pragma hdrstop
+
+#include "mrpods.h"
+#include "resource.h"
+
+// Vector output (PDF or PostScript). Pages are drawn into the 1-bit bitmap as
+// usual, then I read back the dots and write them as text in the special
+// Type 3 font. Each of its 256 glyphs is the pattern of 8 dots, where dots
+// that touch each other are merged into one filled rectangle, so that row of
+// 32 dots in the cell takes exactly 4 characters. Grid lines are filled
+// rectangles, and title and info lines are real text in Helvetica. Printer
+// caches glyphs, therefore files are small and print fast at any resolution.
+
+#define VECBUF         65536           // Output buffered before writing
+#define NFIXOBJ        261             // PDF objects preceding the first page
+
+static HANDLE    hvec;                 // Open vector file or NULL
+static int       vectype;              // Type of open file, VEC_xxx
+static char      *vbuf;                // Output buffer, VECBUF+4*TEXTLEN bytes
+static int       nvbuf;                // Number of bytes in vbuf
+static ulong     vpos;                 // File offset of vbuf
+static int       verror;               // Write error occured
+static ulong     *objofs;              // File offsets of PDF objects
+static int       maxobj;               // Number of items in objofs
+static int       nvpage;               // Number of pages written so far
+static float     vpagew,vpageh;        // Size of paper, points
+
+// Widths of Helvetica characters 32..126 in WinAnsiEncoding, 1/1000 of size.
+static short helvwidth[95] = {
+  278,278,355,556,556,889,667,191,333,333,389,584,278,333,278,278,
+  556,556,556,556,556,556,556,556,556,556,278,278,584,584,584,556,
+  1015,667,667,722,722,667,611,778,722,278,500,667,556,833,722,778,
+  667,778,722,667,611,722,667,944,667,667,611,278,278,278,469,556,
+  333,556,556,500,556,556,278,556,556,222,222,500,222,833,556,556,
+  556,556,333,500,278,556,500,722,500,500,500,334,260,334,584 };
+
+// Writes buffered output to the file. Errors are sticky and reported by
+// Closevectorfile().
+static void Flushvector(void) {
+  ulong u;
+  if (nvbuf==0)
+    return;
+  if (verror==0 &&
+    (WriteFile(hvec,vbuf,nvbuf,&u,NULL)==0 || u!=(ulong)nvbuf))
+    verror=1;
+  vpos+=nvbuf;
+  nvbuf=0;
+};
+
+// Adds formatted text to the output. Single call must produce less than
+// 4*TEXTLEN characters.
+static void Vprintf(char *format,...) {
+  va_list ap;
+  va_start(ap,format);
+  nvbuf+=vsprintf(vbuf+nvbuf,format,ap);
+  va_end(ap);
+  if (nvbuf>=VECBUF)
+    Flushvector();
+  ;
+};
+
+// Starts PDF object with given number and remembers its offset.
+static void Startobject(int n) {
+  if (n<maxobj)
+    objofs[n]=vpos+nvbuf;
+  Vprintf("%i 0 obj\n",n);
+};
+
+// Converts string to the string literal of PDF or PostScript, including
+// parentheses. Output must have place for 4*strlen(s)+3 characters.
+static void Quotestring(char *s,char *out) {
+  int c;
+  *out++='(';
+  for ( ; *s!='\0'; s++) {
+    c=*s & 0xFF;
+    if (c=='(' || c==')' || c=='\\')
+      out+=sprintf(out,"\\%c",c);
+    else if (c<32 || c>=127)
+      out+=sprintf(out,"\\%03o",c);
+    else
+      *out++=(char)c;
+    ;
+  };
+  *out++=')';
+  *out='\0';
+};
+
+// Formats rectangles of the glyph with 8 dots coded as bits of b (bit 0 is
+// the leftmost dot), one operator op per rectangle, and returns length of the
+// text. Adjacent dots touch only if they are as wide as the raster.
+static int Glyphrects(char *s,int b,int dx,int px,int py,char *op) {
+  int i,j,n;
+  n=0;
+  s[0]='\0';
+  for (i=0; i<8; i=j+1) {
+    j=i;
+    if ((b & (1<<i))==0)
+      continue;
+    if (px==dx) {
+      while (j<7 && (b & (2<<j))!=0) j++; };
+    n+=sprintf(s+n,"%i 0 %i %i %s\n",i*dx,(j-i)*dx+px,py,op);
+  };
+  return n;
+};
+
+// Writes centered line of text with baseline at (x,y) and font size in pixels.
+static void Centeredtext(char *s,int x,int y,int size) {
+  int c,w;
+  char q[4*TEXTLEN+3];
+  Quotestring(s,q);
+  if (vectype==VEC_PS) {
+    Vprintf("/MRPhelv %i selectfont %i %i %s T\n",size,x,y,q);
+    return; };
+  for (w=0; *s!='\0'; s++) {
+    c=*s & 0xFF;
+    w+=(c>=32 && c<127?helvwidth[c-32]:556); };
+  Vprintf("BT /F1 %i Tf %i %i Td %s Tj ET\n",size,x-w*size/2000,y,q);
+};
+
+// Creates PDF (type VEC_PDF) or PostScript (VEC_PS) file and writes prologue
+// with dot font that fits raster of print. Returns 0 on success and -1 on
+// error.
+int Createvectorfile(char *path,int type,t_printdata *print) {
+  int i,n,dx,npages;
+  float w,h;
+  char q[4*32+3],g[TEXTLEN];
+  Closevectorfile();
+  dx=print->dx;
+  npages=(print->printsize+print->pagesize-1)/print->pagesize;
+  vbuf=(char *)GlobalAlloc(GMEM_FIXED,VECBUF+4*TEXTLEN);
+  maxobj=NFIXOBJ+3*npages;
+  objofs=(ulong *)GlobalAlloc(GPTR,maxobj*sizeof(ulong));
+  if (vbuf==NULL || objofs==NULL) {
+    Closevectorfile();
+    return -1; };
+  hvec=CreateFile(path,GENERIC_WRITE,0,NULL,
+    CREATE_ALWAYS,FILE_ATTRIBUTE_NORMAL,NULL);
+  if (hvec==INVALID_HANDLE_VALUE) {
+    hvec=NULL;
+    Closevectorfile();
+    return -1; };
+  vectype=type;
+  nvbuf=0; vpos=0; verror=0; nvpage=0;
+  vpagew=w=print->paperx*72.0f/print->ppix;
+  vpageh=h=print->papery*72.0f/print->ppiy;
+  Quotestring(print->superdata.name,q);
+  if (type==VEC_PS) {
+    Vprintf("%%!PS-Adobe-3.0\n%%%%Creator: MRPODS\n%%%%Title: %s\n",q);
+    Vprintf("%%%%Pages: (atend)\n%%%%BoundingBox: 0 0 %i %i\n",
+      (int)ceil(w),(int)ceil(h));
+    Vprintf("%%%%LanguageLevel: 2\n%%%%EndComments\n%%%%BeginProlog\n");
+    Vprintf("/M { moveto } bind def\n");
+    // S shows string of dots, 4 characters per cell, and skips the gap
+    // between the cells.
+    Vprintf("/S { 0 4 2 index length 1 sub { 1 index exch 4 getinterval "
+      "show %i 0 rmoveto } for pop } bind def\n",3*dx);
+    Vprintf("/T { moveto dup stringwidth pop 2 div neg 0 rmoveto show } "
+      "bind def\n");
+    Vprintf("/Helvetica findfont dup length dict begin\n"
+      "{ 1 index /FID ne { def } { pop pop } ifelse } forall\n"
+      "/Encoding ISOLatin1Encoding def currentdict end\n"
+      "/MRPhelv exch definefont pop\n");
+    Vprintf("/MRPdots 8 dict dup begin\n/FontType 3 def\n"
+      "/FontMatrix [1 0 0 1 0 0] def\n/FontBBox [0 0 %i %i] def\n",
+      8*dx,print->py);
+    Vprintf("/Encoding [");
+    for (i=0; i<256; i++)
+      Vprintf("%s/c%i",(i%16==0?"\n":" "),i);
+    Vprintf(" ] def\n");
+    Vprintf("/Glyphs 256 array def\nGlyphs\n");
+    for (i=0; i<256; i++) {
+      Glyphrects(g,i,dx,print->px,print->py,"rectfill");
+      Vprintf("dup %i {\n%s} put\n",i,g); };
+    Vprintf("pop\n/BuildChar { %i 0 0 0 %i %i setcachedevice "
+      "exch /Glyphs get exch get exec } bind def\n",
+      8*dx,8*dx,print->py);
+    Vprintf("end /MRPdots exch definefont pop\n%%%%EndProlog\n"); }
+  else {
+    Vprintf("%%PDF-1.4\n%%\xE2\xE3\xCF\xD3\n");
+    Startobject(1);
+    Vprintf("<< /Type /Catalog /Pages 2 0 R >>\nendobj\n");
+    // Object 2 (page tree) is written last, when all pages are known.
+    Startobject(3);
+    Vprintf("<< /Type /Font /Subtype /Type1 /BaseFont /Helvetica "
+      "/Encoding /WinAnsiEncoding >>\nendobj\n");
+    Startobject(4);
+    // Font is used with size 1000, so that gaps between the cells in TJ are
+    // in pixels, too.
+    Vprintf("<< /Type /Font /Subtype /Type3 /FontBBox [0 0 %i %i]\n"
+      "/FontMatrix [0.001 0 0 0.001 0 0] /FirstChar 0 /LastChar 255\n"
+      "/Resources << >>\n/CharProcs <<",8*dx,print->py);
+    for (i=0; i<256; i++)
+      Vprintf("%s/c%i %i 0 R",(i%8==0?"\n":" "),i,5+i);
+    Vprintf(" >>\n/Encoding << /Type /Encoding /Differences [0");
+    for (i=0; i<256; i++)
+      Vprintf("%s/c%i",(i%16==0?"\n":" "),i);
+    Vprintf(" ] >>\n/Widths [");
+    for (i=0; i<256; i++)
+      Vprintf("%s%i",(i%16==0?"\n":" "),8*dx);
+    Vprintf(" ] >>\nendobj\n");
+    // Glyphs are filled with the colour of text, black.
+    for (i=0; i<256; i++) {
+      n=sprintf(g,"%i 0 0 0 %i %i d1\n",8*dx,8*dx,print->py);
+      n+=Glyphrects(g+n,i,dx,print->px,print->py,"re");
+      if (i!=0) n+=sprintf(g+n,"f\n");
+      Startobject(5+i);
+      Vprintf("<< /Length %i >>\nstream\n%sendstream\nendobj\n",n,g);
+    };
+  };
+  return 0;
+};
+
+
+// Reads 32 dots of the cell row starting at (x,y) back from the 1-bit bitmap
+// (see Drawdotrow()). Dots partially clipped by the bitmap are recognized by
+// their visible part.
+static ulong Readdotrow(uchar *line,int width,int x,int dx,int px) {
+  int i,xs;
+  ulong t;
+  for (i=0,t=0; i<32; i++,x+=dx) {
+    xs=min(x+px-1,width-1);
+    if (xs<0 || xs<x)
+      continue;
+    if (line[xs>>3] & (0x80>>(xs & 7)))
+      t|=1<<i;
+    ;
+  };
+  return t;
+};
+
+// Appends page with given index (0-based), drawn into the bitmap of given
+// height, to the vector file. Returns 0 on success and -1 on error.
+int Writevectorpage(t_printdata *print,int page,uchar *bits,int height) {
+  int i,j,k,n,x,y,ya,yb,x0,y0,ny,bmin,bmax,width,border,dx,dy,px,py;
+  int npages,ox,oy,cmin,cmax;
+  ulong t,streamofs;
+  char s[TEXTLEN],ts[TEXTLEN/2];
+  uchar *line;
+  if (hvec==NULL)
+    return -1;
+  width=print->width;
+  border=print->border;
+  dx=print->dx; dy=print->dy;
+  px=print->px; py=print->py;
+  // Last page may have less rows, see Renderpage().
+  ny=(height-py-2*border)/((NDOT+3)*dy);
+  npages=(print->printsize+print->pagesize-1)/print->pagesize;
+  // Bitmap is placed on paper like on the printed page. Vector coordinates
+  // are in pixels and go from the bottom left corner of the paper.
+  ox=print->borderleft;
+  oy=print->papery-print->bordertop-print->extratop-height;
+  if (vectype==VEC_PS) {
+    Vprintf("%%%%Page: %i %i\nsave\n%g %g scale\n",page+1,nvpage+1,
+      72.0/print->ppix,72.0/print->ppiy); }
+  else {
+    n=NFIXOBJ+3*nvpage;
+    Startobject(n);
+    Vprintf("<< /Type /Page /Parent 2 0 R /Contents %i 0 R\n"
+      "/Resources << /Font << /F1 3 0 R /F2 4 0 R >> >> >>\nendobj\n",n+1);
+    Startobject(n+1);
+    Vprintf("<< /Length %i 0 R >>\nstream\n",n+2);
+    streamofs=vpos+nvbuf;
+    Vprintf("q %g 0 0 %g 0 0 cm\n",72.0/print->ppix,72.0/print->ppiy); };
+  // Print title at the top of the page and info text at the bottom, in gray.
+  if (print->printheader) {
+    Vprintf(vectype==VEC_PS?"0.5 setgray\n":"0.5 g\n");
+    Filetimetotext(&print->modified,ts,sizeof(ts));
+    sprintf(s,"%.64s [%s, %i bytes] - page %i of %i",
+      print->superdata.name,ts,print->origsize,page+1,npages);
+    Centeredtext(s,ox+width/2,
+      print->papery-print->bordertop-print->ppiy*8/10/6,print->ppiy/6);
+    sprintf(s,"Recommended scanner resolution %i dots per inch",
+      max(print->ppix*3/dx,print->ppiy*3/dy));
+    Centeredtext(s,ox+width/2,
+      oy-print->ppiy/24-print->ppiy*8/10/10,print->ppiy/10);
+    Vprintf(vectype==VEC_PS?"0 setgray\n":"0 g\n"); };
+  // Clip everything else to the bitmap, exactly as it would be printed.
+  if (vectype==VEC_PS)
+    Vprintf("%i %i translate\n0 0 %i %i rectclip\n",ox,oy,width,height);
+  else
+    Vprintf("1 0 0 1 %i %i cm\n0 0 %i %i re W n\n",ox,oy,width,height);
+  // Vertical and horizontal grid lines, see Renderpage(). Bitmap is
+  // bottom-up, so rows of bitmap are vector coordinates.
+  if (print->printborder) {
+    j=0; n=ny*(NDOT+3)*dy+py+2*border; }
+  else {
+    j=border; n=ny*(NDOT+3)*dy; };
+  for (i=0; i<=print->nx; i++)
+    Vprintf(vectype==VEC_PS?"%i %i %i %i rectfill\n":"%i %i %i %i re\n",
+    i*(NDOT+3)*dx+border,j,px,n);
+  for (j=0; j<=ny; j++) {
+    if (print->printborder)
+      Vprintf(vectype==VEC_PS?"%i %i %i %i rectfill\n":"%i %i %i %i re\n",
+      0,j*(NDOT+3)*dy+border,width,py);
+    else
+      Vprintf(vectype==VEC_PS?"%i %i %i %i rectfill\n":"%i %i %i %i re\n",
+      border,j*(NDOT+3)*dy+border,print->nx*(NDOT+3)*dx+px,py);
+    ;
+  };
+  if (vectype==VEC_PDF)
+    Vprintf("f\n");
+  // Rows of dots, including regular raster in the border, as strings of the
+  // dot font.
+  if (print->printborder) {
+    bmin=-1; bmax=ny; cmin=-1; cmax=print->nx; }
+  else {
+    bmin=0; bmax=ny-1; cmin=0; cmax=print->nx-1; };
+  Vprintf(vectype==VEC_PS?"/MRPdots 1 selectfont\n":"BT /F2 1000 Tf\n");
+  for (j=bmin; j<=bmax; j++) {
+    for (k=0; k<NDOT; k++) {
+      y0=j*(NDOT+3)*dy+2*dy+border+k*dy;
+      ya=max(y0,0);
+      yb=min(y0+py,height);
+      if (ya>=yb)
+        continue;
+      line=bits+(height-ya-1)*print->stride;
+      y=height-y0-py;                  // Bottom of the row of dots
+      x0=cmin*(NDOT+3)*dx+2*dx+border;
+      n=0;
+      for (i=cmin,x=x0; i<=cmax; i++,x+=(NDOT+3)*dx) {
+        t=Readdotrow(line,width,x,dx,px);
+        if (t==0 && n==0) {
+          x0+=(NDOT+3)*dx; continue; };
+        if (n==0)
+          Vprintf(vectype==VEC_PS?"%i %i M <":"1 0 0 1 %i %i Tm [<",x0,y);
+        else if (vectype==VEC_PDF)
+          Vprintf("-%i<",3*dx);
+        else if (n%16==0)
+          Vprintf("\n");                 // Keep lines of PostScript short
+        Vprintf(vectype==VEC_PS?"%02X%02X%02X%02X":"%02X%02X%02X%02X>",
+          t & 255,(t>>8) & 255,(t>>16) & 255,t>>24);
+        n++;
+      };
+      if (n>0)
+        Vprintf(vectype==VEC_PS?"> S\n":"] TJ\n");
+      ;
+    };
+  };
+  // Finish page.
+  if (vectype==VEC_PS)
+    Vprintf("restore\nshowpage\n");
+  else {
+    Vprintf("ET\nQ\n");
+    n=vpos+nvbuf-streamofs;
+    Vprintf("endstream\nendobj\n");
+    Startobject(NFIXOBJ+3*nvpage+2);
+    Vprintf("%i\nendobj\n",n); };
+  nvpage++;
+  Flushvector();
+  return (verror?-1:0);
+};
+
+// Finishes and closes vector file, if any. Returns 0 on success and -1 on
+// error.
+int Closevectorfile(void) {
+  int i,n,success;
+  ulong xref;
+  success=1;
+  if (hvec!=NULL) {
+    if (vectype==VEC_PS)
+      Vprintf("%%%%Trailer\n%%%%Pages: %i\n%%%%EOF\n",nvpage);
+    else {
+      Startobject(2);
+      Vprintf("<< /Type /Pages /Count %i /MediaBox [0 0 %g %g]\n/Kids [",
+        nvpage,vpagew,vpageh);
+      for (i=0; i<nvpage; i++)
+        Vprintf("%s%i 0 R",(i%8==0?"\n":" "),NFIXOBJ+3*i);
+      Vprintf(" ] >>\nendobj\n");
+      xref=vpos+nvbuf;
+      n=NFIXOBJ+3*nvpage;
+      Vprintf("xref\n0 %i\n0000000000 65535 f \n",n);
+      for (i=1; i<n; i++)
+        Vprintf("%010lu 00000 n \n",objofs[i]);
+      Vprintf("trailer\n<< /Size %i /Root 1 0 R >>\nstartxref\n%lu\n"
+        "%%%%EOF\n",n,xref);
+    };
+    Flushvector();
+    if (verror) success=0;
+    CloseHandle(hvec);
+    hvec=NULL; };
+  if (vbuf!=NULL) {
+    GlobalFree((HGLOBAL)vbuf); vbuf=NULL; };
+  if (objofs!=NULL) {
+    GlobalFree((HGLOBAL)objofs); objofs=NULL; };
+  return (success?0:-1);
+};
@@ -93,6 +93,11 @@ static_assert(sizeof(t_data) == 128, "Invalid data alignment");
 
 #define PBM_COMPRESSED 0x01            // Paper backup is compressed
 #define PBM_ENCRYPTED  0x02            // Paper backup is encrypted
+#define PBM_ERASURE    0x04            // Groups have several parity blocks
+#define PBM_PARPAGES   0x18            // Parity pages per stripe, bits 3..4
+#define PBM_ARCHIVE    0x20            // Data is archive of several files
+#define PBM_FRAMED     0x40            // Packed data is preceded by frame index
+#define PBM_ELIDED     0x80            // Zero and repeating blocks are elided
 
 typedef struct t_superdata {           // Identification block on paper
   ulong          addr;                 // Expecting SUPERBLOCK
@@ -117,6 +122,12 @@ typedef struct t_block {               // Block in memory
   uchar          data[NDATA];          // Useful data
 } t_block;
 
+typedef struct t_soft {                // Soft values of unreadable block
+  short          posx,posy;            // Position relative to data raster
+  int            orientation;          // Data orientation on the scan
+  signed char    dot[NDOT*NDOT];       // Confidence that bit is set, +-127
+} t_soft;
+
 typedef struct t_superblock {          // Identification block in memory
   ulong          addr;                 // Expecting SUPERBLOCK
   ulong          datasize;             // Size of (compressed) data
@@ -145,10 +156,62 @@ void   Encode8(uchar *data,uchar *parity,int pad);
 int    Decode8(uchar *data, int *eras_pos, int no_eras,int pad);
 
 
+////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////// ERASURE CODING ////////////////////////////////
+
+#define NGROUPEC       15              // Max data blocks in erasure group
+#define NPARITYMAX     8               // Max parity blocks in erasure group
+#define PARSTRIPE      64              // Max data pages per parity stripe
+#define NPARPAGES      3               // Max parity pages per stripe
+
+void   Initerasure(void);
+void   Erasurelayout(int redundancy,int *ngroup,int *nparity);
+void   Addparity(uchar *parity,int j,int i,uchar *data);
+void   Finishparity(uchar *parity,int n);
+void   Addpageparity(uchar *parity,int j,int i,uchar *data,int n);
+int    Recovergroup(uchar *group,uchar *valid,int ngroup,
+         uchar *parity,int *index,int nparity);
+int    Recoverstripe(uchar *blocks,uchar *valid,int npages,
+         uchar *parity,int *index,int nparity);
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////// PACKER /////////////////////////////////////
+
+#define NPACK          16              // Max number of packing threads
+#define PACKPROBE      0x00040000      // Data checked for compressibility
+#define FRAMEMAGIC     0x4650524D      // Frame index signature, "MRPF"
+
+typedef struct t_frame {               // Block of packed stream
+  ulong          origoffset;           // Offset of unpacked block in data
+  ulong          bitoffset;            // Offset of block in stream, bits
+} t_frame;
+
+typedef struct t_framehead {           // Header of frame index
+  ulong          magic;                // Expecting FRAMEMAGIC
+  ulong          nframe;               // Number of frames
+  ulong          indexsize;            // Size of header and nframe+1 frames
+  ulong          reserved;             // Reserved, must be 0
+} t_framehead;
+
+int    Startpacker(int level,ulong maxsize);
+void   Stoppacker(void);
+ulong  Packdata(uchar *data,ulong size,int last);
+int    Collectpacked(int wait);
+uchar  *Finishpacker(ulong *datasize);
+t_frame *Getframes(int *n);
+int    Checkcompressible(uchar *data,ulong size);
+
+
 ////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////// PRINTER ////////////////////////////////////
 
-#define PACKLEN        65536           // Length of data read buffer 64 K
+#define PACKLEN        65536           // Length of data read at once 64 K
+#define NRENDER        16              // Max number of page rendering threads
+#define SAVELINES      64              // Bitmap lines converted at once
+
+#define VEC_PDF        1               // Vector output is PDF
+#define VEC_PS         2               // Vector output is PostScript
 
 typedef struct t_printdata {           // Print control structure
   int            step;                 // Next data printing step (0 - idle)
@@ -159,6 +222,7 @@ typedef struct t_printdata {           // Print control structure
   ulong          attributes;           // File attributes
   ulong          origsize;             // Original file size, bytes
   ulong          readsize;             // Amount of data read from file so far
+  ulong          packsize;             // Amount of data passed to compressor
   ulong          datasize;             // Size of (compressed) data
   ulong          alignedsize;          // Data size aligned to next 16 bytes
   ulong          pagesize;             // Size of (compressed) data on page
@@ -166,10 +230,20 @@ typedef struct t_printdata {           // Print control structure
   int            printheader;          // Print header and footer
   int            printborder;          // Print border around bitmap
   int            redundancy;           // Redundancy
-  uchar          *buf;                 // Buffer for compressed file
+  int            ngroup;               // Data blocks per group
+  int            nparity;              // Recovery blocks per group
+  int            parpages;             // Parity pages per stripe
+  int            archive;              // Input is folder packed as archive
+  int            framed;               // Packed data is preceded by index
+  int            elided;               // Zero and repeating blocks elided
+  char           plan[TEXTLEN];        // Layout chosen by planner or empty
+  int            ndatapages;           // Number of pages with data
+  ulong          printsize;            // Size of data and parity pages
+  uchar          *parbuf;              // Parity pages following data or NULL
+  uchar          *view;                // Mapped view of input file or NULL
+  uchar          *data;                // Data to print (view or buf)
+  uchar          *buf;                 // Buffer for file or compressed data
   ulong          bufsize;              // Size of buf, bytes
-  uchar          *readbuf;             // Read buffer, PACKLEN bytes long
-  bz_stream      bzstream;             // Compression control structure
   int            bufcrc;               // 16-bit CRC of (packed) data in buf
   t_superdata    superdata;            // Identification block on paper
   HDC            dc;                   // Printer device context
@@ -178,6 +252,7 @@ typedef struct t_printdata {           // Print control structure
   int            ppix;                 // Printer X resolution, pixels per inch
   int            ppiy;                 // Printer Y resolution, pixels per inch
   int            width;                // Page width, pixels
+  int            stride;               // Bytes per line of 1-bit bitmap
   int            height;               // Page height, pixels
   HFONT          hfont6;               // Font 1/6 inch high
   HFONT          hfont10;              // Font 1/10 inch high
@@ -195,6 +270,13 @@ typedef struct t_printdata {           // Print control structure
   HBITMAP        hbmp;                 // Handle of memory bitmap
   uchar          *dibbits;             // Pointer to DIB bits
   uchar          *drawbits;            // Pointer to file bitmap bits
+  uchar          *dotlut;              // Bit patterns of 8 dots or NULL
+  int            nextrender;           // Next page to assign for rendering
+  HANDLE         htiff;                // Multi-page TIFF being saved or NULL
+  ulong          tifflink;             // Offset of the link to next TIFF page
+  int            vector;               // Vector output, one of VEC_xxx, or 0
+  int            paperx;               // Paper width (vector only), pixels
+  int            papery;               // Paper height (vector only), pixels
   uchar          bmi[sizeof(BITMAPINFO)+256*sizeof(RGBQUAD)]; // Bitmap info
   int            startdoc;             // Print job started
 } t_printdata;
@@ -211,11 +293,39 @@ void   Stopprinting(t_printdata *print);
 void   Nextdataprintingstep(t_printdata *print);
 void   Printfile(char *path,char *bmp);
 
+HANDLE Createtifffile(char *path,ulong *link);
+int    Writetiffpage(HANDLE hfile,ulong *link,uchar *bits,int stride,
+         int sizex,int sizey,int ppix,int ppiy,int page,int npages);
+int    Writepngfile(char *path,uchar *bits,int stride,int sizex,int sizey,
+         int ppix,int ppiy);
+int    Createvectorfile(char *path,int type,t_printdata *print);
+int    Writevectorpage(t_printdata *print,int page,uchar *bits,int height);
+int    Closevectorfile(void);
+
 
 ////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////// DECODER ////////////////////////////////////
 
 #define M_BEST         0x00000001      // Search for best possible quality
+#define M_SILENT       0x00000002      // Background decoding, no UI calls
+
+#define NSOFT          256             // Max unreadable blocks kept per page
+
+#define CELL_NONE      0xFFFFFFFD      // Cell address: block not located
+#define CELL_BAD       0xFFFFFFFE      // Cell address: block unreadable
+
+typedef struct t_layout {              // Placement of blocks on the page
+  int            valid;                // Layout is known
+  int            transform;            // Rotation/mirroring of cells, 0..7
+  int            border;               // Width of border raster, cells
+  int            x0,y0;                // First located cell
+  int            width,height;         // Located cells in X and Y
+  int            nx,ny;                // Printed cells in X and Y
+  int            nstring;              // Number of groups on the page
+  int            ngroup;               // Data blocks in group
+  int            nchain;               // Data and recovery blocks in group
+  ulong          offset;               // Offset of the page in data
+} t_layout;
 
 typedef struct t_procdata {            // Descriptor of processed data
   int            step;                 // Next data processing step (0 - idle)
@@ -223,6 +333,8 @@ typedef struct t_procdata {            // Descriptor of processed data
   uchar          *data;                // Pointer to bitmap
   int            sizex;                // X bitmap size, pixels
   int            sizey;                // Y bitmap size, pixels
+  int            bpp;                  // Bits per pixel, 8 or 1 (packed)
+  int            rowbytes;             // Length of bitmap row, bytes
   int            gridxmin,gridxmax;    // Rought X grid limits, pixels
   int            gridymin,gridymax;    // Rought Y grid limits, pixels
   int            searchx0,searchx1;    // X grid search limits, pixels
@@ -247,15 +359,30 @@ typedef struct t_procdata {            // Descriptor of processed data
   int            nposx;                // Number of blocks to scan in X
   int            nposy;                // Number of blocks to scan in X
   int            posx,posy;            // Next block to scan
+  int            minposx,minposy;      // First located block on the page
+  int            maxposx,maxposy;      // Last located block on the page
+  ulong          *celladdr;            // Address of block in each cell
+  t_layout       layout;               // Placement of blocks, if known
+  int            predict;              // Block address is expected
+  ulong          expectaddr;           // Expected address of the block
   t_data         uncorrected;          // Data before ECC for block display
+  int            softvalid;            // Soft values of last block are valid
+  signed char    softdot[NDOT*NDOT];   // Soft values of last unreadable block
   t_block        *blocklist;           // List of blocks recognized on page
+  t_soft         *softlist;            // Soft values of unreadable blocks
+  int            nsoft;                // Number of entries in softlist
   t_superblock   superblock;           // Page header
   int            maxdotsize;           // Maximal size of the data dot, pixels
   int            orientation;          // Data orientation (-1: unknown)
+  int            lastgood;             // Last successful recognition mode
+  int            lastdotsize;          // Dot size of the last good block
   int            ngood;                // Page statistics: good blocks
   int            nbad;                 // Page statistics: bad blocks
   int            nsuper;               // Page statistics: good superblocks
   int            nrestored;            // Page statistics: restored bytes
+  int            fileindex;            // File that got page, -1 on error
+  int            pagestatus;           // Page status after merge, PS_xxx
+  char           error[TEXTLEN];       // Error in silent mode, empty if none
 } t_procdata;
 
 unique int       orientation;          // Orientation of bitmap (-1: unknown)
@@ -263,7 +390,8 @@ unique t_procdata procdata;            // Descriptor of processed data
 
 void   Nextdataprocessingstep(t_procdata *pdata);
 void   Freeprocdata(t_procdata *pdata);
-void   Startbitmapdecoding(t_procdata *pdata,uchar *data,int sizex,int sizey);
+void   Startbitmapdecoding(t_procdata *pdata,uchar *data,int sizex,int sizey,
+         int bpp);
 void   Stopbitmapdecoding(t_procdata *pdata);
 int    Decodeblock(t_procdata *pdata,int posx,int posy,t_data *result);
 
@@ -271,7 +399,22 @@ int    Decodeblock(t_procdata *pdata,int posx,int posy,t_data *result);
 ////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////// FILE PROCESSOR ////////////////////////////////
 
-#define NFILE          5               // Max number of simultaneous files
+#define NFHASH         1024            // Size of file hash table, 2**n
+#define MINRESIDENT    0x04000000      // Min memory for incomplete files
+#define MAXRESIDENT    0x40000000      // Max memory for incomplete files
+#define MAXSOFTCELL    2048            // Max accumulated soft blocks per file
+
+#define PS_BAD         1               // Page has unrecoverable errors
+#define PS_RESTORED    2               // All bad blocks restored
+#define PS_GOOD        3               // Page has no bad blocks
+
+typedef struct t_softcell {            // Soft values accumulated over scans
+  int            page;                 // Page (1-based)
+  short          posx,posy;            // Position relative to data raster
+  int            orientation;          // Data orientation on the scans
+  int            nscan;                // Number of accumulated scans
+  short          sum[NDOT*NDOT];       // Sum of confidences that bit is set
+} t_softcell;
 
 typedef struct t_fproc {               // Descriptor of processed file
   int            busy;                 // In work
@@ -292,6 +435,8 @@ typedef struct t_fproc {               // Descriptor of processed file
   ulong          maxpageaddr;          // Maximal address of block on page
   // Gathered data.
   int            nblock;               // Total number of data blocks
+  int            ntotal;               // Blocks incl. parity pages
+  int            nparpages;            // Parity pages per stripe
   int            ndata;                // Number of decoded blocks so far
   uchar          *datavalid;           // 0:data invalid, 1:valid, 2:recovery
   uchar          *data;                // Gathered data
@@ -301,15 +446,106 @@ typedef struct t_fproc {               // Descriptor of processed file
   ulong          restoredbytes;        // Total number of bytes restored by ECC
   int            recoveredblocks;      // Total number of recovered blocks
   int            rempages[8];          // 1-based list of remaining pages
+  // Part selected for random-access restore.
+  ulong          partstart;            // Start of part in original data
+  ulong          partsize;             // Size of part, 0: whole file
+  int            partindex;            // Last block of frame index or -1
+  int            partfirst;            // First block that holds the part
+  int            partlast;             // Last block that holds the part
+  int            partready;            // All blocks of the part are valid
+  int            partentry;            // Part is archive entry
+  char           partname[MAX_PATH];   // Relative path of the entry
+  FILETIME       partmodified;         // Time of last entry modification
+  ulong          partattributes;       // Entry attributes
+  // Registry.
+  ulong          hash;                 // Hash of file identity
+  int            hashnext;             // Next in hash chain or free list
+  ulong          lastused;             // Order of last access, for eviction
+  char           spillname[MAX_PATH];  // Temporary file with evicted data
+  int            saving;               // Being saved, pages are not merged
+  // Soft values of unreadable blocks, accumulated over rescans.
+  t_softcell     *soft;                // Accumulated soft values
+  int            nsoft;                // Number of entries in soft
+  int            nsoftmax;             // Allocated number of entries
 } t_fproc;
 
-unique t_fproc   fproc[NFILE];         // Processed files
+unique t_fproc   *fproc;               // Processed files, nfproc entries
+unique int       nfproc;               // Used entries in fproc, incl. free
 
+void   Initfileprocessor(void);
+void   Freefileprocessor(void);
 void   Closefproc(int slot);
-int    Startnextpage(t_superblock *superblock);
-int    Addblock(t_block *block,int slot);
-int    Finishpage(int slot,int ngood,int nbad,ulong nrestored);
+void   Showfileinfo(int slot);
+int    Mergepage(t_superblock *superblock,t_block *blocklist,int nblock,
+         t_soft *softlist,int nsoft,int ngood,int nbad,ulong nrestored,
+         int *status,char *error);
+void   Reportpage(int slot,int status,char *error);
 int    Saverestoredfile(int slot,int force);
+int    Setrestorepart(int slot,int entry,ulong start,ulong size);
+int    Selectpart(int slot);
+
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////// UNPACKER ////////////////////////////////////
+
+#define UNPACKBUF      0x00100000      // Piece of data unpacked at once
+#define NUNPACK        16              // Max number of unpacking threads
+
+int    Writerestored(HANDLE hfile,uchar *data,ulong datasize,ulong origsize,
+         int compressed);
+uchar  *Unpackframe(uchar *data,ulong datasize,ulong bitstart,ulong bitend,
+         ulong *size);
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////// ARCHIVE ////////////////////////////////////
+
+#define ARCMAGIC       0x4150524D      // Archive signature, "MRPA"
+#define NARCFILE       65535           // Max number of files in archive
+
+typedef struct t_archead {             // Header of archive
+  ulong          magic;                // Expecting ARCMAGIC
+  ulong          nfile;                // Number of entries
+  ulong          tocsize;              // Size of header and entries, bytes
+  ulong          reserved;             // Reserved, must be 0
+} t_archead;
+
+typedef struct t_arcentry {            // Entry of archive table of contents
+  ulong          offset;               // Offset of file data in archive
+  ulong          size;                 // Size of file, bytes
+  FILETIME       modified;             // Time of last file modification
+  ulong          attributes;           // File attributes
+  ushort         crc;                  // CRC of file data
+  ushort         namelen;              // Length of relative path that follows
+} t_arcentry;
+
+int    Buildarchive(char *folder,uchar **pbuf,ulong *psize,FILETIME *modified);
+int    Nextarcentry(uchar *toc,ulong tocsize,ulong *pos,t_arcentry *entry,
+         char *name);
+int    Extractarchive(char *path,char *folder);
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////// ELISION ////////////////////////////////////
+
+#define ELIDEMAGIC     0x4550524D      // Elision header signature, "MRPE"
+#define ELIDEZERO      0xFFFFFFFF      // Source of the run of zero blocks
+
+typedef struct t_elidehead {           // Header of elided data
+  ulong          magic;                // Expecting ELIDEMAGIC
+  ulong          nrun;                 // Number of runs
+  ulong          headsize;             // Size of header and runs, bytes
+  ulong          reserved;             // Reserved, must be 0
+} t_elidehead;
+
+typedef struct t_elision {             // Run of elided blocks
+  ulong          block;                // First elided block
+  ulong          count;                // Number of elided blocks
+  ulong          source;               // First repeated block or ELIDEZERO
+} t_elision;
+
+int    Elidedata(uchar *data,ulong size,uchar **pbuf,ulong *psize);
+uchar  *Expanddata(uchar *data,ulong datasize,ulong origsize);
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -317,16 +553,81 @@ int    Saverestoredfile(int slot,int force);
 
 unique int       twainstate;           // According to TWAIN specifications
 
+unique int       twainpending;         // Scanner has untransferred pages
+
 int    Decodebitmap(char *path);
+int    Decodejpeg(char *path);
+int    Acquirepages(void);
 int    SelectTWAINsource(void);
 int    OpenTWAINmanager(void);
 int    OpenTWAINinterface(void);
+int    GetpicturefromTWAIN(void);
+void   CancelTWAINtransfers(void);
 int    CloseTWAINmanager(void);
 int    PassmessagetoTWAIN(MSG *msg);
 int    LoadTWAINlibrary(void);
 void   CloseTWAINlibrary(void);
 
 
+////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////// PAGE STREAM //////////////////////////////////
+
+#define NSTREAMBUF     2               // Max pages read ahead of the decoder
+#define NDECODER       16              // Max number of decoding threads
+#define STREAMBUFSIZE  65536           // Size of sequential input buffer
+
+#define SRC_TIFF       1               // Multi-page TIFF file
+#define SRC_PNM        2               // Sequence of PNM images
+#define SRC_REPLAY     3               // Directory or list of page files
+#define SRC_TWAIN      4               // Scanner, pages pushed by TWAIN
+
+typedef struct t_scanpage {            // Page prepared for decoding
+  uchar          *data;                // Bitmap in the format of decoder
+  int            sizex;                // Width of bitmap, pixels
+  int            sizey;                // Height of bitmap, pixels
+  int            bpp;                  // Bits per pixel, 8 or 1 (packed)
+  int            index;                // 1-based index of page in stream
+} t_scanpage;
+
+typedef struct t_pagestream {          // Source of scanned pages
+  int            type;                 // One of SRC_xxx
+  // Reads next page. Returns 1 if page is read, 0 at the end of stream and
+  // -1 on error. Called by the reader thread, must not touch UI. NULL if
+  // pages are pushed into the queue by Pushscanpage().
+  int            (*readpage)(struct t_pagestream *ps,t_scanpage *page);
+  HANDLE         hfile;                // Input file or pipe
+  int            isstdin;              // Input is standard input
+  char           name[MAX_PATH];       // Name of source for messages
+  int            npage;                // Number of pages read so far
+  char           error[TEXTLEN+MAX_PATH]; // Error message, empty if none
+  // TIFF only.
+  int            motorola;             // Byte order is big endian
+  ulong          ifd;                  // Offset of next IFD, 0 if none
+  // Sequential input (PNM) only.
+  uchar          *buf;                 // Input buffer
+  int            bufpos;               // Next unread byte in buf
+  int            bufsize;              // Number of valid bytes in buf
+  // Replay only.
+  char           *list;                // Page files, MAX_PATH chars each
+  int            nlist;                // Number of files in list
+  int            nextfile;             // Index of next file in list
+  struct t_pagestream *sub;            // Open multi-page file or NULL
+} t_pagestream;
+
+unique char      replaysource[MAX_PATH]; // Replaces scanner if not empty
+unique int       replaydelay;          // Delay before each replayed page, ms
+
+int    Readtiffpage(t_pagestream *ps,t_scanpage *page);
+int    Readbmpfile(char *path,t_scanpage *page,char *error);
+int    Readjpegfile(char *path,t_scanpage *page,char *error);
+int    Openpagestream(char *path);
+int    Pushscanpage(t_scanpage *page);
+int    Scanpageroom(void);
+void   Endpushstream(void);
+int    Nextstreampage(void);
+int    Pagestreamactive(void);
+void   Closepagestream(void);
+
 ////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////// CONTROLS ///////////////////////////////////
 
@@ -390,6 +691,11 @@ unique int       dpi;                  // Dot raster, dots per inch
 unique int       dotpercent;           // Dot size, percent of dpi
 unique int       compression;          // 0: none, 1: fast, 2: maximal
 unique int       redundancy;           // Redundancy (NGROUPMIN..NGROUPMAX)
+unique int       erasure;              // Several recovery blocks per group
+unique int       parpages;             // Parity pages per stripe (0..3)
+unique int       fitlayout;            // Choose layout with fewest pages
+unique int       randomaccess;         // Index packed data for partial restore
+unique int       elision;              // Don't print zero and repeating blocks
 unique int       printheader;          // Print header and footer
 unique int       printborder;          // Border around bitmap
 unique int       autosave;             // Autosave completed files